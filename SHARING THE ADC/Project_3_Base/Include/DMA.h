@@ -2,10 +2,44 @@
 #define DMA_H
 
 #include <stdint.h>
+#include "timers.h"
+
+/*
+ DMA channel service. The four KL25Z channels (and their DMAMUX slots,
+ which map one to one) are handed out at init. A subsystem that needs a
+ particular channel, e.g. for PIT periodic triggering (DMA channel n is
+ gated by PIT channel n), reserves it; others allocate by priority. The
+ KL25Z arbitrates channels in fixed order, channel 0 first, so high
+ priority takes the lowest free channel and low priority the highest.
+
+ One ISR per channel reads and clears the channel's status (DONE and the
+ error bits), then calls the owner's callback with the status it read.
+*/
+#define DMA_NUM_CH (4)
+
+typedef enum {DMA_PRIO_LOW, DMA_PRIO_HIGH} DMA_PRIO_E;
+typedef void (* DMA_CALLBACK_T)(uint8_t ch, uint32_t dsr); // ISR context
+
+extern const char * volatile DMA_Owner[DMA_NUM_CH]; // NULL if free, for the debugger
+
+int DMA_Reserve(uint8_t ch, const char * owner, DMA_CALLBACK_T cb, uint8_t irq_prio); // 0, or -1 if taken
+int DMA_Alloc(DMA_PRIO_E prio, const char * owner, DMA_CALLBACK_T cb, uint8_t irq_prio); // Channel, or -1
+void DMA_Free(uint8_t ch);
+
+// Hold every channel's requests and callbacks, e.g. while flash can't be read (ftfa.h)
+uint32_t DMA_Park(void);            // Returns the channels that were taking requests
+void DMA_Unpark(uint32_t parked);
+
+#define DMA_PLAYBACK_FOREVER (0) // num_playbacks value for continuous audio
+
+// Double buffering: a buffer is full from refill until DMA has finished playing it
+extern volatile uint8_t DMA_Buffer_Full[2];
+extern volatile uint32_t DMA_Underrun_Count; // Buffers of silence played because the next one wasn't refilled
 
 void DMA_Init(void);
 void Configure_DMA_For_Playback(uint16_t * source1, uint16_t * source2, uint32_t count, uint32_t num_playbacks);
 void Start_DMA_Playback(void);
+void DMA_Set_Playback_Timer(TMR_E t); // TPM whose overflow paces playback
 
 #endif
 // *******************************ARM University Program Copyright  ARM Ltd 2013*************************************   
@@ -1,4 +1,8 @@
+#ifndef I2C_H
+#define I2C_H
+
 #include <stdint.h>
+#include <cmsis_os2.h>
 
 #define I2C_M_START 	I2C0->C1 |= I2C_C1_MST_MASK
 #define I2C_M_STOP  	I2C0->C1 &= ~I2C_C1_MST_MASK
@@ -16,6 +20,47 @@
 #define NACK 	        I2C0->C1 |= I2C_C1_TXAK_MASK
 #define ACK           I2C0->C1 &= ~I2C_C1_TXAK_MASK
 
+/*
+ Interrupt-driven register bursts. A descriptor names the device, its
+ first register and a buffer. I2C_Start_Xfer sends the START and device
+ address; after that, the I2C0 ISR runs the whole transaction, one IICIF
+ per byte. It sends the register address, then either writes Len bytes,
+ or sends a repeated START and reads Len bytes, ACKing all but the last.
+ It ends with STOP, then sets Flag on TID. The calling thread sleeps
+ meanwhile, so a burst read costs two short ISR visits per byte.
+
+ One transaction at a time. A NACK or lost arbitration ends it early
+ with an error status; a transaction that hasn't finished after
+ I2C_TIMEOUT_MS is aborted and the bus is recovered with i2c_busy().
+
+ The polled functions below are for use before the kernel starts (e.g.
+ init_mma), and must not overlap a transaction.
+*/
+
+#define I2C_FLAG_DONE (0x1000)
+#define I2C_TIMEOUT_MS (10)
+
+typedef enum {I2C_OK, I2C_IN_PROGRESS, I2C_ERR_NACK, I2C_ERR_ARB, I2C_ERR_TIMEOUT} I2C_STATUS_E;
+
+typedef struct {
+	uint8_t Dev;              // Write address, as MMA_ADDR
+	uint8_t Reg;              // First register
+	uint8_t Read;             // 1: read Len bytes into Data, 0: write them from Data
+	uint8_t * Data;
+	uint16_t Len;
+	osThreadId_t TID;         // Thread to signal
+	uint32_t Flag;            // Thread flag to set on completion
+	volatile uint8_t Status;  // I2C_STATUS_E, I2C_IN_PROGRESS until the flag is set
+} I2C_XFER_T;
+
+extern volatile uint32_t I2C_Errors, I2C_Timeouts;
+
+int I2C_Start_Xfer(I2C_XFER_T * x); // Thread or ISR. 0, or -1 if a transaction is running
+void I2C_Abort_Xfer(void);          // Ends the running transaction with I2C_ERR_TIMEOUT, no flag
+// Thread context, block until done. 0 or -1
+int i2c_read_burst(uint8_t dev, uint8_t reg, uint8_t * data, uint16_t len);
+int i2c_write_burst(uint8_t dev, uint8_t reg, uint8_t * data, uint16_t len);
+
 void i2c_init(void);
 
 void i2c_start(void);
@@ -24,3 +69,5 @@ uint8_t i2c_repeated_read(uint8_t);
 	
 uint8_t i2c_read_byte(uint8_t dev, uint8_t address);
 void i2c_write_byte(uint8_t dev, uint8_t address, uint8_t data);
+
+#endif // I2C_H
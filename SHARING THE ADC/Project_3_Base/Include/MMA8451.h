@@ -11,21 +11,89 @@
 #define REG_ZHI	0x05
 #define REG_ZLO 0x06
 
+#define REG_F_STATUS 0x00 // FIFO status when the FIFO is on
+#define REG_F_SETUP 0x09
 #define REG_WHOAMI 0x0D
 #define REG_CTRL1  0x2A
 #define REG_CTRL4  0x2D
+#define REG_CTRL5  0x2E
 
 #define WHOAMI 0x1A
 
 #define COUNTS_PER_G (16384.0)
+
+/*
+ FIFO acquisition. With MMA_USE_FIFO the sensor samples at MMA_FIFO_DR
+ into its 32-sample FIFO (circular, so the newest are kept) and pulls
+ INT2 (PTA15) low when MMA_FIFO_WATERMARK samples are waiting.
+ read_fifo_xyz sleeps until then and drains the FIFO in one burst, so
+ the thread gets every sample for one I2C transaction and one wakeup
+ per watermark. If the edge is missed (e.g. the pin was already low),
+ the wait times out after twice the watermark time and drains anyway.
+*/
+#define MMA_USE_FIFO (0)
+#define MMA_FIFO_SIZE (32)
+#define MMA_INT2_PIN (15)         // PTA15
+#define MMA_FLAG_FIFO (0x2000)
+
+/*
+ Decimation. With MMA_USE_DECIMATOR (needs MMA_USE_FIFO) the sensor runs
+ at 400 Hz and each burst goes through an integer CIC filter of order
+ MMA_CIC_ORDER that keeps one output per 2^MMA_CIC_LOG2_DECIM samples.
+ Outputs land in the MMA_Filtered ring and the newest in acc_X/Y/Z; the
+ thread does the roll/pitch math only for those, at about the UI rate.
+*/
+#define MMA_USE_DECIMATOR (0)
+#define MMA_CIC_ORDER (2)
+#define MMA_CIC_LOG2_DECIM (5)    // 32: 400 Hz in, 12.5 Hz out
+#define MMA_FILT_RING_LEN (8)
+
+#if MMA_USE_DECIMATOR
+#if !MMA_USE_FIFO
+#error "MMA_USE_DECIMATOR needs MMA_USE_FIFO"
+#endif
+#define MMA_FIFO_WATERMARK (20)   // 50 ms per burst
+#define MMA_FIFO_DR (1)           // CTRL_REG1 DR code: 1 is 400 Hz
+#define MMA_FIFO_RATE_HZ (400)    // Matches MMA_FIFO_DR
+#else
+#define MMA_FIFO_WATERMARK (10)   // Samples per burst, 1..MMA_FIFO_SIZE
+#define MMA_FIFO_DR (3)           // CTRL_REG1 DR code: 3 is 100 Hz
+#define MMA_FIFO_RATE_HZ (100)    // Matches MMA_FIFO_DR
+#endif
+
+typedef struct {
+	int16_t X, Y, Z;
+} MMA_SAMPLE_T;
+
+extern MMA_SAMPLE_T MMA_Fifo[MMA_FIFO_SIZE]; // Last burst, oldest first
+extern volatile uint32_t MMA_Fifo_Overflows, MMA_Int_Timeouts;
+extern MMA_SAMPLE_T MMA_Filtered[MMA_FILT_RING_LEN];
+extern volatile uint32_t MMA_Filt_Count;     // Outputs so far, newest at (count-1) % MMA_FILT_RING_LEN
+
 #define M_PI (3.14159265)
 
+/*
+ Angles. roll_fx and pitch_fx are degrees in Q ANGLE_FX_FRAC_BITS, for
+ integer-only users like the paddle. With MMA_FIXED_ANGLES they come
+ from a 16-step CORDIC atan2 and an integer sqrt (about 0.01 degree
+ error) and the float roll/pitch aren't updated; otherwise from the float
+ approximations, converted.
+*/
+#define MMA_FIXED_ANGLES (1)
+#define ANGLE_FX_FRAC_BITS (8)
+#define ANGLE_FX_ONE (1L << ANGLE_FX_FRAC_BITS) // One degree
+
 int init_mma(void);
 void read_full_xyz(void);
+int read_fifo_xyz(void); // Thread context, blocks. Samples read into MMA_Fifo, -1 on bus error
+int mma_decimate(const MMA_SAMPLE_T * s, uint32_t n); // Filtered outputs produced from n samples
 void read_xyz(void);
 void convert_xyz_to_roll_pitch(void);
+uint32_t isqrt32(uint32_t v);
+int32_t atan2_fx(int32_t y, int32_t x); // Degrees, Q ANGLE_FX_FRAC_BITS, -180..180
 
 extern float roll, pitch;
+extern int32_t roll_fx, pitch_fx;
 extern int16_t acc_X, acc_Y, acc_Z;
 
 #endif
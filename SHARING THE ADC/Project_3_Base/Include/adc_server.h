@@ -0,0 +1,86 @@
+#ifndef ADC_SERVER_H
+#define ADC_SERVER_H
+
+#include <stdint.h>
+#include <cmsis_os2.h>
+
+/*
+ ADC conversion server. The TPM-triggered current sense sample for the
+ HBLED controller always owns the ADC. Between control samples the ADC
+ ISR runs queued software conversions, one after another, as long as
+ each ends before the next trigger (see ADC_GUARD_COUNTS), then re-arms
+ the hardware trigger, so the control loop never loses a sample.
+
+ Clients take a descriptor from the pool, fill it in and submit it. The
+ ISR writes the result into the descriptor and sets the descriptor's
+ thread flag on its thread.
+
+ A request may instead carry a sequence of steps, each with its own
+ channel and an optional Setup function (e.g. touchscreen pin muxing)
+ that the ISR calls before the step's conversion. A step can wait Settle
+ control samples after its Setup; a step with Settle 0 runs back-to-back
+ with the previous one. The descriptor's flag is set once, after the
+ last step.
+
+ Resolution, sample time and hardware averaging are kept per channel.
+ The ISR rewrites CFG1/CFG2/SC3 only when the next conversion's channel
+ uses different settings than the ADC currently holds. Channels with no
+ settings of their own use 16 bit, short sample, no averaging.
+
+ Each channel's settings give its conversion time in TPM0 counts. The ISR
+ starts a software conversion only if, from the current TPM0 count, it
+ ends ADC_GUARD_COUNTS before the next overflow triggers the control
+ sample; otherwise it waits for the next slot. Settings that cannot fit
+ in any slot are refused, so software conversions cannot cost a control
+ sample.
+
+ Requires USE_ADC_HW_TRIGGER and USE_ADC_INTERRUPT (see control.h).
+*/
+
+#define ADC_POOL_SIZE (8)       // Descriptors shared by all clients
+#define ADC_FLAG_DONE (0x0100)  // Default thread flag for completion
+#define ADC_GUARD_COUNTS (192)  // TPM0 counts (4 us) kept free before each trigger
+
+// Software request classes, highest priority first
+typedef enum {
+	ADC_PRIO_FAST,        // Latency-sensitive clients (touchscreen)
+	ADC_PRIO_BACKGROUND,  // Anything that can wait
+	ADC_NUM_PRIO
+} ADC_PRIO_E;
+
+// Per-channel settings, values are the register field codes
+typedef enum {ADC_RES_8=0, ADC_RES_12=1, ADC_RES_10=2, ADC_RES_16=3} ADC_RES_E;               // CFG1 MODE
+typedef enum {ADC_SAMPLE_SHORT, ADC_SAMPLE_LONG_20, ADC_SAMPLE_LONG_12,
+	ADC_SAMPLE_LONG_6, ADC_SAMPLE_LONG_2} ADC_SAMPLE_E;  // Extra ADCK cycles, CFG1 ADLSMP + CFG2 ADLSTS
+typedef enum {ADC_AVG_NONE, ADC_AVG_4, ADC_AVG_8, ADC_AVG_16, ADC_AVG_32} ADC_AVG_E; // SC3 AVGE + AVGS
+
+typedef struct {
+	uint8_t Channel;          // ADCH code
+	uint8_t Settle;           // Control samples to wait after Setup
+	void (*Setup)(void);      // Called from ADC ISR, may be NULL
+	volatile uint16_t Result;
+} ADC_STEP_T;
+
+typedef struct ADC_REQ_S {
+	struct ADC_REQ_S * Next;
+	uint8_t Channel;          // ADCH code, single conversion requests
+	uint8_t Prio;             // ADC_PRIO_E
+	volatile uint16_t Result; // Written by ADC ISR before flag is set
+	ADC_STEP_T * Steps;       // NULL for a single conversion on Channel
+	uint8_t Num_Steps;
+	uint8_t Step, Wait;       // Used by the ISR
+	osThreadId_t TID;         // Thread to signal
+	uint32_t Flag;            // Thread flag to set on completion
+} ADC_REQ_T;
+
+extern volatile uint32_t ADC_Deferred;   // Conversions pushed to a later slot
+extern osThreadId_t volatile ADC_SW_Owner; // Thread of the latest software conversion
+
+void ADC_Server_Init(void);
+int ADC_Set_Channel_Config(uint8_t channel, ADC_RES_E res, ADC_SAMPLE_E sample, ADC_AVG_E avg); // 0, or -1 if too slow
+ADC_REQ_T * ADC_Req_Alloc(void);         // NULL if pool is exhausted
+void ADC_Req_Free(ADC_REQ_T * req);
+void ADC_Submit(ADC_REQ_T * req);        // Thread or ISR context
+int ADC_Convert_Seq(ADC_STEP_T * steps, uint8_t num_steps, ADC_PRIO_E prio); // Blocks, 0 or -1
+
+#endif // ADC_SERVER_H
@@ -0,0 +1,71 @@
+#ifndef BLK_POOL_H
+#define BLK_POOL_H
+
+#include <stdint.h>
+#include "sound.h"
+#include "sd_audio.h"
+#include "sd_log.h"
+
+/*
+ Pool of 512 byte blocks (one SD sector) for the large data buffers, in
+ section BlkPool, which the scatter file places in its own region
+ (RW_BLKPOOL) so the map file shows the whole footprint at once. The pool
+ is sized from the subsystems that are switched on, so a buffer costs RAM
+ only in builds that use it:
+  - sound: both Waveform buffers and the mix buffer, held for good
+  - SD audio: the readahead ring. The reader reads each sector straight
+    into a block and hands it to the mixer, which releases it when used up.
+  - SD log: two batches of sectors, filled from the telemetry ring and
+    written by SD_Write_Multi in place.
+
+ Each block has a reference count: Blk_Alloc gives a block with count 1,
+ Blk_Retain adds a holder and Blk_Release drops one, freeing the block at
+ 0, so a block can be passed on without copying it. A run of adjacent
+ blocks suits DMA and multi-block SD transfers. Blk_Claim is for buffers
+ that are never freed; if the pool can't supply them BLK_POOL_BLOCKS is
+ wrong, so it lights the red LED and stops with the owner in
+ Blk_Pool_Stats.Fail_Owner, like a timer conflict (timers.h).
+
+ Thread and ISR safe, allocation scans the counts with interrupts masked.
+*/
+
+#define BLK_SIZE (512)
+#define BLK_COUNT(bytes) (((bytes) + BLK_SIZE-1)/BLK_SIZE)
+
+// Blocks each subsystem takes
+#if USE_SOUND
+#define BLK_POOL_SOUND (2*BLK_COUNT(NUM_WAVEFORM_SAMPLES*2) + BLK_COUNT(NUM_WAVEFORM_SAMPLES*4))
+#else
+#define BLK_POOL_SOUND (0)
+#endif
+#if USE_SD_AUDIO
+#define BLK_POOL_SD_AUDIO (SD_AUDIO_RING_SECTORS)
+#else
+#define BLK_POOL_SD_AUDIO (0)
+#endif
+#if USE_SD_LOG
+#define BLK_POOL_SD_LOG (2*SD_LOG_BATCH)
+#else
+#define BLK_POOL_SD_LOG (0)
+#endif
+#define BLK_POOL_SPARE (0)  // For blocks passed between subsystems and held a while
+
+#define BLK_POOL_BLOCKS (BLK_POOL_SOUND + BLK_POOL_SD_AUDIO + BLK_POOL_SD_LOG + BLK_POOL_SPARE)
+
+typedef struct {
+	uint32_t Free;       // Blocks
+	uint32_t Min_Free;   // Low-water mark
+	uint32_t Alloc_Fails;
+	const char * Fail_Owner; // Blk_Claim that stopped
+} BLK_POOL_STATS_T;
+
+extern volatile BLK_POOL_STATS_T Blk_Pool_Stats;
+
+void * Blk_Alloc(void);                  // One block, or NULL if the pool is empty
+void * Blk_Alloc_Run(uint32_t n);        // n adjacent blocks, each with count 1, or NULL
+void * Blk_Claim(uint32_t n, const char * owner); // Blk_Alloc_Run for good, stops on failure
+void Blk_Retain(void * blk);
+void Blk_Release(void * blk);
+void Blk_Release_Run(void * blk, uint32_t n);
+
+#endif // BLK_POOL_H
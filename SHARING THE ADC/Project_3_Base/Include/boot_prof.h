@@ -0,0 +1,36 @@
+#ifndef BOOT_PROF_H
+#define BOOT_PROF_H
+
+#include <stdint.h>
+
+/*
+ Boot timeline. Boot_Mark records the time since reset at the end of
+ each init stage in Boot_Prof, a table for the debugger's watch window:
+ Name and microseconds since Boot_Prof_Init, in the order the stages
+ finished.
+
+ Before osKernelStart the time comes from SysTick counting down freely
+ from 2^24 at the core clock, so marks there must come within 349 ms
+ (48 MHz) of Boot_Prof_Init; Boot_Prof_Wrapped is set if one didn't.
+ The kernel takes SysTick over at start, so from then on a mark is the
+ pre-kernel time at osKernelStart plus osKernelGetSysTimerCount.
+ Boot_Mark may be called from threads and ISRs alike.
+*/
+
+#define USE_BOOT_PROF (1)
+#define BOOT_PROF_MAX_MARKS (16)
+
+typedef struct {
+	const char * Name;
+	uint32_t us; // Since Boot_Prof_Init
+} BOOT_MARK_T;
+
+extern BOOT_MARK_T Boot_Prof[BOOT_PROF_MAX_MARKS];
+extern volatile uint32_t Boot_Prof_Count;
+extern volatile uint8_t Boot_Prof_Wrapped;
+
+void Boot_Prof_Init(void);            // First thing in main
+void Boot_Mark(const char * name);    // Marks past BOOT_PROF_MAX_MARKS are dropped
+void Boot_Kernel_Start(void);         // Last thing before osKernelStart
+
+#endif // BOOT_PROF_H
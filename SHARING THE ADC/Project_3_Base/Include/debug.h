@@ -26,6 +26,7 @@
 #define DBG_IRQTPM_POS			DBG_3
 
 #define DBG_TUPDATESCR_POS	DBG_4
+#define DBG_TDISPLAY_POS		DBG_4
 
 #define DBG_TSNDMGR_POS 		DBG_5
 #define DBG_IRQ_ADC_POS			DBG_5
@@ -35,9 +36,72 @@
 
 #define DBG_TIDLE						DBG_7
 
+/*
+ Software event trace. With DBG_TRACE_MODE set, DEBUG_START/STOP/TOGGLE
+ also (1) or only (2) write a (time, channel, edge) record into Dbg_Trace,
+ a ring that keeps the last DBG_TRACE_LEN events. Time is the RTX system
+ timer (osKernelGetSysTimerCount, Dbg_Trace.Freq Hz). A record is written
+ with interrupts masked for a few stores, so any thread or ISR can trace
+ and nothing waits. Head counts every event; the oldest record is at
+ Head - DBG_TRACE_LEN once the ring has wrapped.
+
+ Halt, save Dbg_Trace from the debugger (e.g. uVision:
+ SAVE trace.hex &Dbg_Trace, &Dbg_Trace + sizeof(Dbg_Trace)) and run
+ Scripts/trace_decode.py on it for a timeline or a VCD file.
+*/
+#define DBG_TRACE_MODE (0) // 0: pins only, 1: pins and trace, 2: trace only
+#define DBG_TRACE_LEN (128) // Records, power of two
+
+#define DBG_EDGE_STOP (0)
+#define DBG_EDGE_START (1)
+#define DBG_EDGE_TOGGLE (2)
+
+#if DBG_TRACE_MODE
+#include <MKL25Z4.H>
+#include <cmsis_os2.h>
+
+typedef struct {
+	uint32_t Time;       // System timer count
+	uint8_t Channel;     // DBG_n, the PTB bit
+	uint8_t Edge;        // DBG_EDGE_*
+	uint16_t Reserved;
+} DBG_TRACE_REC_T;
+
+typedef struct {
+	volatile uint32_t Head; // Events so far, next record is Rec[Head % DBG_TRACE_LEN]
+	uint32_t Freq;          // Time counts per second
+	DBG_TRACE_REC_T Rec[DBG_TRACE_LEN];
+} DBG_TRACE_T;
+
+extern DBG_TRACE_T Dbg_Trace;
+
+static __inline void Dbg_Trace_Event(uint8_t channel, uint8_t edge) {
+	DBG_TRACE_REC_T * r;
+	uint32_t m;
+
+	m = __get_PRIMASK();
+	__disable_irq();
+	r = &Dbg_Trace.Rec[Dbg_Trace.Head++ & (DBG_TRACE_LEN-1)];
+	r->Time = osKernelGetSysTimerCount();
+	r->Channel = channel;
+	r->Edge = edge;
+	__set_PRIMASK(m);
+}
+#endif
+
+#if DBG_TRACE_MODE == 2
+#define DEBUG_START(channel) { Dbg_Trace_Event(channel, DBG_EDGE_START); }
+#define DEBUG_STOP(channel) { Dbg_Trace_Event(channel, DBG_EDGE_STOP); }
+#define DEBUG_TOGGLE(channel) { Dbg_Trace_Event(channel, DBG_EDGE_TOGGLE); }
+#elif DBG_TRACE_MODE == 1
+#define DEBUG_START(channel) { PTB->PSOR = MASK(channel); Dbg_Trace_Event(channel, DBG_EDGE_START); }
+#define DEBUG_STOP(channel) { PTB->PCOR = MASK(channel); Dbg_Trace_Event(channel, DBG_EDGE_STOP); }
+#define DEBUG_TOGGLE(channel) { PTB->PTOR = MASK(channel); Dbg_Trace_Event(channel, DBG_EDGE_TOGGLE); }
+#else
 #define DEBUG_START(channel) { PTB->PSOR = MASK(channel); } 
 #define DEBUG_STOP(channel) { PTB->PCOR = MASK(channel); }
 #define DEBUG_TOGGLE(channel) { PTB->PTOR = MASK(channel); }
+#endif
 	
 void Init_Debug_Signals(void);
 
@@ -2,7 +2,18 @@
 #define DELAY_H
 #include <stdint.h>
 
-extern void Delay(uint32_t dlyTicks);
-extern void ShortDelay(uint32_t dlyTicks);
+/*
+ Delays timed with SysTick at the core clock. Before the kernel runs,
+ and in ISRs or with interrupts masked, they spin on SysTick (set
+ running freely if nothing has started it). In a thread with the kernel
+ running, whole ticks of the wait are slept with osDelay, and the rest
+ spins on osKernelGetSysTimerCount, yielding to threads of the same
+ priority while more than DELAY_YIELD_US remain.
+*/
+
+#define DELAY_YIELD_US (50)  // Shorter remainders spin, a yield could overshoot them
+
+extern void Delay_us(uint32_t us);
+extern void Delay(uint32_t ms);
+extern void Wait_ms(uint32_t ms); // Same as Delay
 #endif
-// *******************************ARM University Program Copyright  ARM Ltd 2013*************************************   
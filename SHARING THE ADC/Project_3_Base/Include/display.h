@@ -0,0 +1,60 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <stdint.h>
+#include <cmsis_os2.h>
+#include "LCD.h"
+
+/*
+ Display server. Thread_Display owns the LCD; other threads send it small
+ draw commands through Disp_MsgQ and never wait on the display. A full
+ queue drops the command and counts it in Disp_Dropped.
+
+ Every DISP_FRAME_MS the server takes what has queued up (at most
+ DISP_MSGQ_LEN commands) and draws it in order. Within a frame, text for
+ the same row and column replaces the earlier text if nothing was drawn
+ in between and it is at least as long, and a later compositor move or
+ colour for an object replaces the earlier one. The compositor renders
+ once at the end of a frame in which it changed.
+
+ Compositor objects are set up (LCD_Comp_Init, LCD_Comp_Add_Rect) before
+ sending the first command about them; after that only Disp_Comp_* change
+ them. Code running before the kernel starts draws directly.
+*/
+
+#define DISP_FRAME_MS (20)
+#define DISP_MSGQ_LEN (10)
+#define DISP_TEXT_LEN (24) // Including the NUL, longer strings are cut
+
+typedef enum {DISP_TEXT_RC, DISP_RECT, DISP_LINE, DISP_CIRCLE, DISP_COMP_MOVE, DISP_COMP_COLOR} DISP_CMD_E;
+
+typedef struct {
+	uint8_t Cmd;         // DISP_CMD_E
+	uint8_t Arg;         // Text: row. Circle: filled. Compositor: object id
+	COLOR_T Color;       // Text: foreground
+	union {
+		struct {
+			uint16_t X0, Y0, X1, Y1; // Circle: centre, radius in X1
+		} Pts;
+		struct {
+			uint8_t Col;
+			COLOR_T Bg;
+			char Str[DISP_TEXT_LEN];
+		} Text;
+	} U;
+} DISP_MSG_T;
+
+extern osMessageQueueId_t Disp_MsgQ;
+extern volatile uint32_t Disp_Dropped, Disp_Coalesced, Disp_Frames_Late;
+
+// Any thread, never block. 0, or -1 if the queue is full
+int Disp_Text_RC(uint8_t row, uint8_t col, const char * str, COLOR_T * fg, COLOR_T * bg); // NULL colours: yellow on black
+int Disp_Fill_Rect(PT_T * p1, PT_T * p2, COLOR_T * color);
+int Disp_Line(PT_T * p1, PT_T * p2, COLOR_T * color);
+int Disp_Circle(PT_T * center, int radius, COLOR_T * color, int filled);
+int Disp_Comp_Move_Rect(int id, PT_T * p1, PT_T * p2);
+int Disp_Comp_Set_Color(int id, COLOR_T * color);
+
+void Thread_Display(void * arg);
+
+#endif // DISPLAY_H
@@ -0,0 +1,49 @@
+#ifndef FLASH_PROFILE_H
+#define FLASH_PROFILE_H
+
+#include <stdint.h>
+
+/*
+ Flash current profiles played by DMA. A table of (duration, mA) points is
+ converted once to DAC codes. PIT channel 1 paces DMA channel
+ PROFILE_DMA_CH (DMAMUX periodic trigger), which writes the next code into
+ DAC0. Each of those transfers links to a second channel, which writes the
+ following point's duration into PIT1 LDVAL, so points can have different
+ lengths. The table repeats; the CPU only steps in once per cycle (DMA
+ ISR) to rewind the two channels. PROFILE_DMA_CH is reserved from the
+ DMA service for its PIT pairing; the linked channel is allocated.
+
+ Control_HBLED sets g_set_current from the DMA source address, so the
+ controller setpoint follows the DAC with no per-step work.
+
+ PIT1 reloads LDVAL at expiry, before that expiry's DMA transfers run. The
+ duration written with point i's code therefore belongs to point i+1.
+*/
+
+#define USE_FLASH_PROFILE (1)     // 1: flashing comes from the profile engine, not Update_Set_Current
+
+#define PROFILE_MAX_POINTS (16)
+#define PROFILE_DMA_CH (1)        // DAC writes, must be 0-3 for PIT triggering (uses PIT ch 1)
+#define PROFILE_PIT_CH (PROFILE_DMA_CH)
+#define PROFILE_PIT_TICKS_PER_MS (24000) // Bus clock
+
+// Default two-level flash, same shape as the thread-driven sequence
+#define PROFILE_PEAK_MS (10)
+#define PROFILE_TAIL_MS (10)      // At a quarter of the peak
+#define PROFILE_OFF_MS ((FLASH_PERIOD-41)*10)
+
+typedef struct {
+	uint16_t Duration_ms;     // At least 1
+	uint16_t mA;
+} PROFILE_POINT_T;
+
+extern volatile uint8_t Flash_Profile_Active;
+
+int Flash_Profile_Init(void);                   // 0, or -1 if DMA channels are taken
+int Flash_Profile_Load(const PROFILE_POINT_T * points, unsigned num_points); // 0 or -1, stops playback
+void Flash_Profile_Start(void);
+void Flash_Profile_Stop(void);                  // DAC keeps the last code
+int Flash_Profile_Two_Level(int peak_mA);       // Load and start the default flash
+int Flash_Profile_Current_mA(void);             // Point now in the DAC, ISR safe
+
+#endif // FLASH_PROFILE_H
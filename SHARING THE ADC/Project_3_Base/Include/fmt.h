@@ -0,0 +1,25 @@
+#ifndef FMT_H
+#define FMT_H
+
+#include <stdint.h>
+
+/*
+ Small number formatting for the display, in place of sprintf. Each
+ function writes at buf, NUL-terminates, and returns the end so calls
+ chain: Fmt_Int(Fmt_Str(buf, "Peak: "), n, 4).
+
+ Numbers are right-aligned in width characters, space padded (wider if
+ they don't fit). With a fixed width, each digit keeps its cell from one
+ update to the next, so LCD_Text_PrintStr_RC's text shadow redraws only
+ the digits that changed, and the display server can let a newer string
+ replace an older one for the same cell.
+*/
+
+#define FMT_MAX_DECIMALS (4)
+
+char * Fmt_Str(char * buf, const char * s);
+char * Fmt_Int(char * buf, int32_t v, unsigned width);
+// v has frac_bits fractional bits, shown rounded to decimals places (at most FMT_MAX_DECIMALS)
+char * Fmt_Q(char * buf, int32_t v, unsigned frac_bits, unsigned decimals, unsigned width);
+
+#endif // FMT_H
@@ -0,0 +1,32 @@
+#ifndef FTFA_H
+#define FTFA_H
+
+#include <stdint.h>
+
+/*
+ Erase and program the KL25Z's own flash through the FTFA controller,
+ for small records kept across resets (e.g. touchscreen calibration).
+
+ The flash is a single block, so it can't be read while a command runs.
+ The launch-and-wait loop runs from RAM with interrupts masked; vectors,
+ ISRs and the RTX tick all live in flash. A sector erase masks interrupts
+ for a few ms (14 ms worst case), a longword about 150 us worst case, so
+ call these only when the control loop can miss samples, and with no
+ DMA channel reading from flash. FTFA_Write_Record arranges that: it
+ parks the control loop (LED off) and every DMA channel around the
+ erase and program, then restarts them.
+
+ The last sector, FTFA_NV_SECTOR, is kept out of the link (IROM1 ends
+ before it in the project) for such records.
+*/
+
+#define FTFA_SECTOR_SIZE (1024)
+#define FTFA_FLASH_SIZE (0x20000)
+#define FTFA_NV_SECTOR (FTFA_FLASH_SIZE - FTFA_SECTOR_SIZE)
+
+// 0, or -1 on an access or protection error
+int FTFA_Erase_Sector(uint32_t addr);  // Any address in the sector
+int FTFA_Program(uint32_t addr, const uint32_t * data, uint32_t num_words); // addr word aligned, erased
+int FTFA_Write_Record(uint32_t addr, const uint32_t * data, uint32_t num_words); // Erase addr's sector, program from addr
+
+#endif // FTFA_H
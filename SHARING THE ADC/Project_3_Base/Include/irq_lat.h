@@ -0,0 +1,54 @@
+#ifndef IRQ_LAT_H
+#define IRQ_LAT_H
+
+#include <stdint.h>
+
+/*
+ Interrupt latency harness. Each measured ISR calls IRQ_Lat_Enter first
+ thing, with the core clock cycles since its hardware trigger as read
+ from the trigger source's own counter, and IRQ_Lat_Exit on the way out:
+  - ADC0, control samples: CTL_TRIGGER_TPM count since its overflow.
+    Includes the conversion time, so Min is the floor, not zero
+  - PIT channels 0 and 1: LDVAL - CVAL since the reload, bus clock
+  - DMA sound channel done: playback TPM count since its overflow, which
+    requested the last transfer
+ SPI1 is polled in this project, so it has no entry here.
+
+ Each source gets a log2 histogram (bucket b holds latencies of 2^b up
+ to 2^(b+1)-1 cycles), min, max and a record of its worst case: the
+ measured ISRs it had preempted (outermost first) and the ones that ran
+ between its trigger and its entry. A worst case with no blockers was
+ held off by something unmeasured: another ISR (I2C, PORTA, TPM0,
+ SysTick) or code running with interrupts masked, as in RTX's and the
+ drivers' critical sections.
+
+ Timestamps use osKernelGetSysTimerCount (core clock). Irq_Lat is for
+ the debugger's watch window; IRQ_Lat_Reset clears it.
+*/
+
+#define USE_IRQ_LAT (1)
+#define IRQ_LAT_BUCKETS (16)   // Last bucket collects 2^15 cycles and up
+#define IRQ_LAT_MAX_NEST (4)
+
+typedef enum {IRQ_LAT_ADC, IRQ_LAT_PIT0, IRQ_LAT_PIT1, IRQ_LAT_DMA_SOUND, IRQ_LAT_NUM_SRC} IRQ_LAT_SRC_E;
+
+typedef struct {
+	uint32_t Samples;
+	uint32_t Min, Max;            // Cycles
+	uint32_t Hist[IRQ_LAT_BUCKETS];
+	struct {
+		uint32_t Sample;            // Which sample it was
+		uint8_t Depth;              // Measured ISRs it preempted
+		uint8_t Preempted[IRQ_LAT_MAX_NEST]; // IRQ_LAT_SRC_E, outermost first
+		uint8_t Blockers;           // Bit per IRQ_LAT_SRC_E that ran while it waited
+	} Worst;
+} IRQ_LAT_T;
+
+extern volatile IRQ_LAT_T Irq_Lat[IRQ_LAT_NUM_SRC];
+extern volatile uint32_t Irq_Lat_Nest_Overflow;
+
+void IRQ_Lat_Reset(void);
+void IRQ_Lat_Enter(IRQ_LAT_SRC_E src, uint32_t cycles); // ISR entry, cycles since trigger
+void IRQ_Lat_Exit(IRQ_LAT_SRC_E src);
+
+#endif // IRQ_LAT_H
@@ -0,0 +1,54 @@
+#ifndef PERF_RUN_H
+#define PERF_RUN_H
+
+#include <stdint.h>
+
+/*
+ Performance regression runner. A build with USE_PERF_RUN runs the
+ standard benchmark set and writes the results as one text record:
+  - LCD benchmark (LCD_benchmark.h), in Thread_Boot before the UI starts
+  - after PERF_RUN_SETTLE_MS, control latency (Ctl_Timing), control
+    deadline overruns, interrupt latency (Irq_Lat) and CPU utilization,
+    all reset and then gathered over PERF_RUN_WINDOW_MS
+  - the boot time to the last Boot_Mark
+
+ The record, PERF_REC_VERSION 1, is lines of text:
+   PERF <version> <project> <build date and time>
+   <metric> <value> <unit> <dir>    dir: - lower is better, + higher
+                                    is better, = for information only
+   END <number of metric lines>
+ It stays in Perf_Record for the debugger, and Thread_Telemetry sends
+ it between telemetry record runs on UART0 every PERF_RUN_REPEAT_MS, so
+ a capture started late still gets one. Scripts/perf_compare.py, at
+ the top of the repo, picks it out of the stream and compares it with
+ a stored baseline.
+
+ With tickless idle on, the window includes sleeps (idle.sleeps) and
+ the control samples taken during them (ctl.held); ctl.overruns must
+ still be 0 there, which perf_compare.py --max ctl.overruns=0 checks
+ even without a baseline.
+
+ Metric names stay fixed from one version of the record to the next;
+ a new metric gets a new name, and a changed meaning a new version.
+*/
+
+#define USE_PERF_RUN (0)
+
+#define PERF_REC_VERSION (1)
+#define PERF_RUN_SETTLE_MS (2000)   // Boot transients before the window
+#define PERF_RUN_WINDOW_MS (10000)
+#define PERF_RUN_REPEAT_MS (5000)
+#define PERF_REC_MAX (1536)
+#define PERF_LINE_MAX (64)          // Longest metric line
+
+extern char Perf_Record[PERF_REC_MAX];
+extern volatile uint32_t Perf_Record_Len; // 0 until the run is done
+
+// Record building, one thread at a time
+void Perf_Begin(const char * project);
+void Perf_Metric(const char * name, int32_t value, const char * unit, char dir);
+void Perf_End(void);                      // Publishes Perf_Record_Len
+
+void Thread_Perf_Run(void * arg);
+
+#endif // PERF_RUN_H
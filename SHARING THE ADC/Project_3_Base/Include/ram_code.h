@@ -0,0 +1,32 @@
+#ifndef RAM_CODE_H
+#define RAM_CODE_H
+
+/*
+ Code run from SRAM. At 48 MHz the flash runs at half the core clock and
+ only a small prefetch buffer hides its wait states; SRAM has none.
+ Functions marked RAM_CODE go in section RamCode, which the project's
+ scatter file (TFT-TS-BL-Profiler-RTX-CMSIS.sct) places in RW_RAMCODE at
+ the bottom of SRAM_L. The C library's __main copies it there from flash
+ before main runs, like initialised data.
+
+ Calls between flash and RAM are out of BL range, so armlink adds a long
+ branch veneer to each; interrupt handlers are entered through the vector
+ table and pay nothing. Mark a RAM function's callees too, or they run
+ from flash. The static __inline helpers in FX.h are compiled into their
+ callers, so they follow them; the library's division helpers stay in
+ flash.
+
+ Scripts/ram_candidates.py ranks functions from a profiler capture by
+ samples per byte, the order to move them in. RW_RAMCODE holds at most
+ 2 KB, and every byte used comes out of the RAM for data and stacks.
+*/
+
+#define USE_RAM_CODE (1)
+
+#if USE_RAM_CODE
+#define RAM_CODE __attribute__((section("RamCode")))
+#else
+#define RAM_CODE
+#endif
+
+#endif // RAM_CODE_H
@@ -0,0 +1,57 @@
+#ifndef SD_AUDIO_H
+#define SD_AUDIO_H
+
+#include <stdint.h>
+#include "sound.h"
+
+/*
+ PCM prompts streamed from a uSD card. A clip is a run of raw sectors (no
+ file system, no header) of mono samples at AUDIO_SAMPLE_FREQ, signed
+ 16 bit little-endian or unsigned 8 bit (SD_AUDIO_BITS).
+
+ Thread_SD_Audio runs the ulibSD read FSM (..\..\ulibSD, SPI1 on PTE1-4) one
+ sector at a time straight into a block from the pool (blk_pool.h) and
+ queues it on a ring, yielding between FSM steps, so nothing else waits
+ on the card. The mixer (Sound_Fill_Buffer) adds the stream in like
+ another voice, one Waveform buffer at a time, and releases each block
+ it has used up. The ring holds SD_AUDIO_READAHEAD_MS of
+ audio beyond the buffer being mixed, which covers the card's read
+ latency. If the stream falls behind anyway, the rest of that buffer is
+ silence and SD_Audio_Underruns counts it.
+
+ A new clip cuts off the one playing. The reader resets the ring when it
+ takes the request; the mixer thread has the higher priority, so it is
+ never part way through a buffer then.
+
+ Needs USE_SOUND and two free DMA channels for the SPI data phase (else
+ the data phase is polled). The card's CS is PTE4, so the debug strobe
+ is not used.
+*/
+
+#define USE_SD_AUDIO (0)
+
+#define SD_AUDIO_BITS (16)          // 16: signed LE, 8: unsigned
+#define SD_AUDIO_READAHEAD_MS (40)
+#define SD_AUDIO_STEPS_PER_YIELD (16) // SD FSM steps (about a byte each) between yields
+
+#define SD_AUDIO_FLAG_WAKE (0x0800)
+
+// Sizes
+#define SD_AUDIO_SECTOR_BYTES (512)
+#define SD_AUDIO_BYTES_PER_SAMPLE (SD_AUDIO_BITS/8)
+#define SD_AUDIO_BYTES_PER_MS (((uint32_t) (AUDIO_SAMPLE_FREQ))/1000*SD_AUDIO_BYTES_PER_SAMPLE)
+#define SD_AUDIO_BUF_SECTORS ((NUM_WAVEFORM_SAMPLES*SD_AUDIO_BYTES_PER_SAMPLE + SD_AUDIO_SECTOR_BYTES-1)/SD_AUDIO_SECTOR_BYTES)
+#define SD_AUDIO_RING_SECTORS ((SD_AUDIO_READAHEAD_MS*SD_AUDIO_BYTES_PER_MS + SD_AUDIO_SECTOR_BYTES-1)/SD_AUDIO_SECTOR_BYTES \
+	+ SD_AUDIO_BUF_SECTORS)
+
+extern volatile uint8_t SD_Audio_Playing;
+extern volatile uint32_t SD_Audio_Underruns, SD_Audio_Read_Errors;
+
+// Any thread. Starts the clip after the current one is cut off. 0, or -1 if num_sectors is 0
+int SD_Audio_Play(uint32_t first_sector, uint32_t num_sectors, uint16_t volume); // volume scaled by 65536
+void SD_Audio_Stop(void);
+
+void SD_Audio_Mix(int32_t * buf, uint32_t n); // Mixer thread only, adds n samples to buf
+void Thread_SD_Audio(void * arg);
+
+#endif // SD_AUDIO_H
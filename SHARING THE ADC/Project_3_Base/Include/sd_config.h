@@ -0,0 +1,29 @@
+#ifndef SD_CONFIG_H
+#define SD_CONFIG_H
+
+#include "ram_code.h"   // SPI_RW runs from RAM
+
+/*
+ Build of the shared ulibSD driver (..\..\ulibSD) for this project: the
+ cooperative FSM, run to completion by Thread_SD_Audio (SD_AUDIO_RUN) or
+ Thread_SD_Log (SD_LOG_RUN), with the SPI timer on the RTX tick and the
+ data phase on two low priority channels from the DMA service, which
+ raise no interrupts.
+*/
+#define SD_IO_MODEL SD_IO_FSM
+#define SPI_TIMER   SPI_TIMER_RTX
+#define SPI_DMA_CH  SPI_DMA_SERVICE
+
+#define SD_IO_WRITE
+#define SD_IO_WRITE_PRE_ERASE   // Send ACMD23 before multi-block writes
+#define SD_IO_USE_DMA           // Move 512 byte data phase with SPI1 DMA, polled if SPI_Init got no channels
+#define SD_IO_DEFERRED_BUSY     // Finish write when data is accepted, wait for busy before next command
+#define SD_IO_SPEED_STEP_DOWN   // Lower the SPI clock after a data token, reject or CRC error
+// #define SD_IO_CRC            // CMD59 on: send real CRC7/CRC16, check CRC16 of read blocks
+// #define SD_IO_WARM_RESTART   // Needs a NoInit region in the scatter file, this project has none
+// #define SD_IO_FAST_INIT      // Spec power-up delay, ctx->idle_ms pauses between ACMD41 polls
+
+// #define SD_IO_DBG_COUNT
+// #define SD_IO_TRACE          // Ring of per-command timing records in SD_Trace
+
+#endif // SD_CONFIG_H
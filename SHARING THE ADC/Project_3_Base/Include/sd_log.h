@@ -0,0 +1,94 @@
+#ifndef SD_LOG_H
+#define SD_LOG_H
+
+#include <stdint.h>
+#include "MMA8451.h"
+
+/*
+ Telemetry log on a uSD card. Thread_SD_Log copies the control telemetry
+ records (telemetry.h, read alongside the UART stream) and accelerometer
+ samples into an append-only run of raw sectors starting at
+ SD_LOG_FIRST_SECTOR. The format is Project_2A's sd_log: each sector has
+ a header (session, sequence number, record count) and a CRC16 in its
+ last two bytes; at start the tail of an existing log is found by binary
+ search, a sector being part of the log if it has the first sector's
+ session and sequence number (first sector's + index).
+
+ Records are 8 bytes, raw like the UART stream, and told apart by their
+ first byte: TELEM_SYNC (TELEM_REC_T), SD_LOG_ACCEL_SYNC or
+ SD_LOG_MARK_SYNC. After every write a mark gives the tick count and the
+ control deadline overruns (Ctl_Deadline) so far and during that write.
+
+ The thread runs at the lowest priority and takes the card only through
+ the ulibSD FSM (SD_LOG_RUN): SPI1 is polled byte by byte and the data
+ phase goes over two low priority DMA channels without interrupts, and
+ nothing in the path masks interrupts, so the ADC ISR sees no more than
+ bus contention. Between FSM steps the thread refills the other batch of
+ sectors from the rings, so a slow write only costs records if it
+ outlasts the telemetry ring. SD_Log_Status.Card_Misses counts control
+ deadline overruns while a card operation was under way; it stays 0 if
+ the card really never holds up a control sample.
+
+ Not with USE_SD_AUDIO, which owns the same card. The card's CS is PTE4,
+ so the debug strobe is not used.
+*/
+
+#define USE_SD_LOG (0)
+
+#define SD_LOG_FIRST_SECTOR (2048)  // Past a partition table and clips
+#define SD_LOG_SECTORS (1024UL*1024) // 512 MB
+#define SD_LOG_BATCH (2)            // Sectors per write, two batches are buffered
+#define SD_LOG_ACCEL_RECS (32)      // Power of two
+#define SD_LOG_SYNC_MS (1000)       // Longest time a record waits for the card
+#define SD_LOG_PERIOD_MS (10)       // Poll interval with nothing to write
+#define SD_LOG_RETRY_MS (2000)      // Card init retry interval
+#define SD_LOG_STEPS_PER_COLLECT (16) // SD FSM steps between refills
+#define SD_LOG_PRE_ERASE (1)        // 1: erase region when starting a new log, speeds up later writes
+
+#define SD_LOG_MAGIC (0x31474F4CUL) // "LOG1"
+#define SD_LOG_REC_SIZE (8)
+#define SD_LOG_ACCEL_SYNC (0x5A)
+#define SD_LOG_MARK_SYNC (0x5B)
+
+typedef struct {
+	uint32_t Magic;
+	uint32_t Session;   // Same in all sectors of one log
+	uint32_t Seq;       // Increases by one per sector
+	uint16_t Count;     // Records in this sector
+	uint16_t Rec_Size;
+} SD_LOG_HDR_T;
+
+#define SD_LOG_RECS_PER_SECTOR ((512 - sizeof(SD_LOG_HDR_T) - 2) / SD_LOG_REC_SIZE)
+
+typedef struct {
+	uint8_t Sync;       // SD_LOG_ACCEL_SYNC
+	uint8_t Seq;        // Counts samples offered, including dropped ones
+	int16_t X, Y, Z;    // Raw, COUNTS_PER_G
+} SD_LOG_ACCEL_T;
+
+typedef struct {
+	uint8_t Sync;       // SD_LOG_MARK_SYNC
+	uint8_t Card_Misses; // Deadline overruns during the write just done, saturates
+	uint16_t Tick;      // osKernelGetTickCount, ms
+	uint32_t Overruns;  // Ctl_Deadline.Overruns
+} SD_LOG_MARK_T;
+
+typedef struct {
+	uint8_t Ready;      // Tail found, appending
+	uint8_t Full;       // End of region reached
+	int8_t Error;       // SDRESULTS of the first failed operation, logging stops
+	uint32_t Session;
+	uint32_t Tail;      // Index in region of next sector to write
+	uint32_t Sectors;   // Written this session
+	uint32_t Accel_Dropped;
+	uint32_t Write_Max_ms;
+	uint32_t Card_Misses; // Control deadline overruns with a card operation under way
+} SD_LOG_STATUS_T;
+
+extern volatile SD_LOG_STATUS_T SD_Log_Status;
+
+// Thread_Read_Accelerometer only. Queues n samples, drops (and counts) any that don't fit
+void SD_Log_Accel(const MMA_SAMPLE_T * s, uint32_t n);
+void Thread_SD_Log(void * arg);
+
+#endif // SD_LOG_H
@@ -5,11 +5,18 @@
 #include <cmsis_os2.h>
 
 // Configuration
+// DAC0 also drives the HBLED current reference (Set_DAC), so audio and the
+// converter can't share the DAC output. Off by default.
+#define USE_SOUND (0)
 #define NUM_VOICES (8)
 #define AUDIO_SAMPLE_FREQ (20000.0f)
-#define NUM_STEPS (64)
+#define SINE_TABLE_BITS (8)    // Power-of-two sine table, Q15
+#define NUM_STEPS (1 << SINE_TABLE_BITS)
+#define SINE_INTERPOLATE (1)    // Linear interpolation between table entries
 #define NUM_WAVEFORM_SAMPLES (512)
-#define USE_DOUBLE_BUFFER (0)
+#define USE_DOUBLE_BUFFER (1) // DMA plays one buffer while the refill thread fills the other
+#define SOUND_MSGQ_LEN (8)      // Pending note events
+#define SOUND_RELEASE_DECAY (600) // Note off fades out over a few ms instead of clicking
 
 // On Port E
 #define AMP_ENABLE_POS (29)
@@ -18,7 +25,10 @@
 
 // Conversions
 #define AUDIO_SAMPLE_PERIOD_US (1000000/AUDIO_SAMPLE_FREQ)
+#define MS_TO_SAMPLES(ms) ((uint32_t) ((ms)*(AUDIO_SAMPLE_FREQ/1000)))
+#define SOUND_BUFFER_MS ((uint32_t) (NUM_WAVEFORM_SAMPLES*1000/AUDIO_SAMPLE_FREQ))
 #define FREQ_TO_PERIOD(f) (AUDIO_SAMPLE_FREQ/(f))
+#define FREQ_TO_PHASE_INC(f) ((uint32_t) ((f)*(4294967296.0f/AUDIO_SAMPLE_FREQ))) // 2^32 per cycle
 
 // Voice type definitions
 typedef enum {VW_UNINIT, VW_NOISE, VW_SQUARE, VW_SINE} VW_E;
@@ -27,12 +37,34 @@ typedef struct {
 	uint16_t Volume; // scaled by 65536
 	int16_t Decay; // scaled by 65536. 0 means no decay in volume.
 	uint32_t Duration; // measured in samples
-	uint32_t Counter; // internal, measured in samples (for sine, is scaled by 256)
-	uint32_t CounterIncrement; // for sine only: internal, samples scaled by 256 
+	uint32_t Counter; // internal, measured in samples (for sine, is phase: 2^32 per cycle)
+	uint32_t CounterIncrement; // for sine only: phase step per sample, see FREQ_TO_PHASE_INC
 	uint16_t Period; // measured in samples
 	VW_E Type; // Sine, square, white noise
+	uint8_t Tag; // From the note on event, matched by note off
 } VOICE_T;
 
+/* Note events for the mixer. The mixer thread (Thread_Refill_Sound_Buffer)
+applies queued events before each buffer it fills: note on takes a free
+voice, or steals the quietest one when all are busy; note off fades out
+every voice with that tag. Callable from threads and ISRs, never blocks. */
+typedef enum {SND_NOTE_ON, SND_NOTE_OFF} SND_EV_E;
+
+#define SOUND_TAG_CLICK (1) // UI touch feedback
+
+typedef struct {
+	uint8_t Event;       // SND_EV_E
+	uint8_t Type;        // VW_E
+	uint8_t Tag;
+	uint16_t Volume;     // scaled by 65536
+	int16_t Decay;       // scaled by 65536, per sample
+	uint16_t Freq_Hz;
+	uint16_t Duration_ms;
+} SOUND_MSG_T;
+
+extern osMessageQueueId_t Sound_MsgQ;
+extern volatile uint32_t Sound_Voices_Stolen, Sound_Events_Dropped;
+
 typedef struct {
 	uint32_t Volume, Frequency, Decay, Duration, Delay;
 } NOTE_T;
@@ -44,11 +76,14 @@ void Sound_Init(void);
 void Sound_Enable_Amp(void);
 void Sound_Disable_Amp(void);
 
+int Sound_Note_On(VW_E type, uint16_t freq_hz, uint16_t volume, int16_t decay,
+	uint16_t duration_ms, uint8_t tag); // 0, or -1 if the queue is full
+int Sound_Note_Off(uint8_t tag);
+
 // void Play_Tone_with_DMA(unsigned int period, unsigned int num_cycles);
 void Sound_Refill_Buffer(uint32_t samples);
 void Play_Waveform_with_DMA(void);
 
-void Thread_Sound_Manager(void * arg);
 void Thread_Refill_Sound_Buffer(void * arg);
 
 #endif // SOUND_H
@@ -0,0 +1,36 @@
+#ifndef STACK_MON_H
+#define STACK_MON_H
+
+#include <stdint.h>
+#include <cmsis_os2.h>
+
+/*
+ Thread stack high-water marks, for sizing stacks. RTX fills each stack
+ with a watermark pattern when the thread is created (OS_STACK_WATERMARK
+ in RTX_Config.h); a periodic OS timer asks RTX how much of each stack
+ is still untouched and keeps the smallest value seen in Stack_Mon. The
+ table is meant for the debugger's watch window: Name, Size and Min_Free
+ in bytes for every live thread, including the idle and timer threads.
+
+ Stack_Mon_Low counts scans that found a thread within
+ STACK_MON_LOW_BYTES of the end of its stack.
+*/
+
+#define STACK_MON_PERIOD_MS (1000)
+#define STACK_MON_MAX_THREADS (12)
+#define STACK_MON_LOW_BYTES (32)
+
+typedef struct {
+	osThreadId_t Id;
+	const char * Name;
+	uint16_t Size;      // Bytes
+	uint16_t Min_Free;  // Bytes never used since creation
+} STACK_MON_T;
+
+extern STACK_MON_T Stack_Mon[STACK_MON_MAX_THREADS];
+extern volatile uint32_t Stack_Mon_Count, Stack_Mon_Low;
+
+void Stack_Mon_Init(void);  // Call after osKernelInitialize
+void Stack_Mon_Scan(void);  // Any thread, also run by the timer
+
+#endif // STACK_MON_H
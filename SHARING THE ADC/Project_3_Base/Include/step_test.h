@@ -0,0 +1,55 @@
+#ifndef STEP_TEST_H
+#define STEP_TEST_H
+
+#include <stdint.h>
+
+/*
+ Step-response characterization of the HBLED controller. For each control
+ mode and gain set, the setpoint is held at STEP_LOW_MA, the controller is
+ reset, and then the setpoint steps to STEP_HIGH_MA from inside the
+ control ISR. measured_current and g_duty_cycle are recorded at loop rate
+ (every Step_Decimation-th control sample). Flashing is disabled while
+ the test runs. Results land in Step_Results for the debugger.
+
+ Gain sets scale the compiled-in gains (x1, x0.5, x2) and apply to
+ Proportional, PID and PID_FX. PID_FX32 gains are compile-time constants,
+ so it is run once with P/I/D_GAIN_FX.
+*/
+
+#define USE_STEP_TEST (0)     // 1: setpoint thread runs the test instead of flashing
+
+#define STEP_SAMPLES (256)
+#define STEP_PRE_SAMPLES (16) // Recorded before the step
+#define STEP_LOW_MA (5)
+#define STEP_HIGH_MA (40)
+#define STEP_BAND_PCT (5)     // Settling band, percent of step size
+#define STEP_HOLD_MS (200)    // Time at STEP_LOW_MA before each step
+#define STEP_NUM_GAIN_SETS (3)
+#define STEP_NUM_MODES (6)    // BangBang .. PID_FX32
+
+#define STEP_FLAG_DONE (0x0200)
+
+typedef struct {
+	int16_t Current; // mA
+	int16_t Duty;
+} STEP_SAMPLE_T;
+
+typedef struct {
+	uint8_t Mode;          // CTL_MODE_E
+	uint8_t Gain_Set;
+	uint8_t Valid;         // 0 if the output never rose through 90% of the step
+	int32_t Rise_us;       // 10% to 90% of the step
+	int32_t Overshoot_10;  // Peak above final value, 0.1% of step
+	int32_t Settle_us;     // Step to last sample outside the band
+	int32_t SS_Error_mA;   // Setpoint minus final value
+} STEP_RESULT_T;
+
+extern volatile uint32_t Step_Decimation;
+extern STEP_SAMPLE_T Step_Buffer[STEP_SAMPLES];
+extern STEP_RESULT_T Step_Results[STEP_NUM_MODES][STEP_NUM_GAIN_SETS];
+
+void Step_Test_Sample(int current, int duty); // From Control_HBLED
+int Step_Test_Run(int mode, int gain_set, STEP_RESULT_T * r); // Blocks, 0 or -1
+void Step_Test_Run_All(void);
+
+#endif // STEP_TEST_H
@@ -0,0 +1,85 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <MKL25Z4.H>
+
+/*
+ Control loop telemetry. Control_HBLED writes one packed record every
+ Telem_Decimation control samples into a single-producer, single-consumer
+ ring buffer; the ISR side is a few stores and never waits. If the buffer
+ is full the record is dropped and counted.
+
+ Thread_Telemetry drains the buffer to UART0 (OpenSDA virtual COM port,
+ PTA2 TX): each contiguous run of records goes out on a low priority DMA
+ channel, and the slots are released only when that transfer is done.
+ The stream is raw little-endian records; a host resyncs on TELEM_SYNC
+ and checks Seq for gaps.
+
+ The same thread may put other frames between runs of records with
+ Telemetry_Send (e.g. profile snapshots, see profile.h). They start with
+ a sync byte other than TELEM_SYNC and carry their own length.
+
+ With USE_SD_LOG, Thread_SD_Log reads the records too (sd_log.h). Each
+ reader keeps its own position and a slot goes back to the producer once
+ every running reader is past it, so the slower one sets the drop rate.
+*/
+
+#define USE_TELEMETRY (1)
+
+#define TELEM_BUF_RECS (128)      // Power of two
+#define TELEM_DECIMATION (8)      // Default control samples per record
+#define TELEM_BAUD (921600)
+#define TELEM_UART_OSR (12)       // 13x oversampling keeps 921600 baud exact from 48 MHz
+#define TELEM_UART_CLK_HZ (48000000)
+#define TELEM_SYNC (0xA5)
+#define TELEM_FLAG_TX (0x0400)
+
+typedef struct {
+	uint8_t Sync;        // TELEM_SYNC
+	uint8_t Seq;         // Counts records offered, including dropped ones
+	int16_t Current;     // measured_current, mA
+	int16_t Duty;        // g_duty_cycle
+	int16_t Error;       // g_set_current - measured_current, mA
+} TELEM_REC_T;         // 8 bytes, no padding
+
+extern TELEM_REC_T Telem_Buf[TELEM_BUF_RECS];
+extern volatile uint32_t Telem_Head, Telem_Tail; // Free-running record counts
+extern volatile uint32_t Telem_Decimation, Telem_Dropped;
+extern uint32_t Telem_Decim_Count;
+extern uint8_t Telem_Seq;
+
+// Control ISR context only
+static __inline void Telemetry_Sample(int current, int duty, int err) {
+	TELEM_REC_T * r;
+	uint32_t h;
+
+	if (++Telem_Decim_Count < Telem_Decimation)
+		return;
+	Telem_Decim_Count = 0;
+	h = Telem_Head;
+	if (h - Telem_Tail >= TELEM_BUF_RECS) {
+		Telem_Dropped++;
+		Telem_Seq++;
+		return;
+	}
+	r = &Telem_Buf[h & (TELEM_BUF_RECS-1)];
+	r->Sync = TELEM_SYNC;
+	r->Seq = Telem_Seq++;
+	r->Current = current;
+	r->Duty = duty;
+	r->Error = err;
+	__DMB();
+	Telem_Head = h+1; // Publish after the record is complete
+}
+
+int Telemetry_Init(void);      // UART0 and DMA, call from the draining thread. 0 or -1
+uint32_t Telemetry_Drain(void); // Sends one contiguous run, blocks until done, returns records sent
+int Telemetry_Send(const void * buf, uint32_t len); // Draining thread only, blocks until sent. 0 or -1
+
+// SD log thread only. Start reads from the oldest record still held
+void Telemetry_Log_Start(void);
+void Telemetry_Log_Stop(void);
+uint32_t Telemetry_Log_Read(TELEM_REC_T * dest, uint32_t max); // Copies and releases up to max, returns records
+
+#endif // TELEMETRY_H
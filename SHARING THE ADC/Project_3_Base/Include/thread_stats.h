@@ -0,0 +1,59 @@
+#ifndef THREAD_STATS_H
+#define THREAD_STATS_H
+
+#include <stdint.h>
+#include <cmsis_os2.h>
+
+/*
+ Per-thread CPU time and scheduling latency, from RTX's own switch
+ events. The RTX library calls EvrRtxThreadUnblocked when a waiting
+ thread is made ready (flags, queue, delay or timeout) and
+ EvrRtxThreadSwitched when a thread starts running; they are weak
+ EventRecorder stubs in the library, and thread_stats.c replaces them.
+ Both run in the kernel's SVC/PendSV/SysTick context and only timestamp
+ (osKernelGetSysTimerCount, core clock) and add.
+
+ Each switch charges the time since the last one to the thread that was
+ running. Latency is the time from a thread being made ready to it
+ running, so it includes waiting for higher priority threads and ISRs.
+
+ A periodic OS timer turns the sums into Thread_Stats, one entry per
+ thread, for the debugger's watch window. Thread_Stats_Log keeps the
+ last THREAD_STATS_LOG_LEN ready/switch events; Thread_Stats_Log_Head
+ counts all events, so the newest is at (Head-1) % THREAD_STATS_LOG_LEN.
+*/
+
+#define THREAD_STATS (1)             // 0: hooks stay the library's empty stubs
+#define THREAD_STATS_WINDOW_MS (1000)
+#define THREAD_STATS_MAX_THREADS (12)
+#define THREAD_STATS_LOG_LEN (32)    // Power of two
+#define THREAD_STATS_FULL_SCALE (1000) // Load is reported in 0.1% steps
+
+#define THREAD_STATS_EV_READY (0)
+#define THREAD_STATS_EV_SWITCH (1)
+
+typedef struct {
+	osThreadId_t Id;
+	const char * Name;
+	uint16_t Load;        // Share of the last window, 0..THREAD_STATS_FULL_SCALE
+	uint16_t Load_Peak;
+	uint32_t Switches;    // Times switched in since init
+	uint32_t Lat_Avg_us;  // Ready to running, last window
+	uint32_t Lat_Max_us;  // Ready to running, since init
+} THREAD_STATS_T;
+
+typedef struct {
+	uint32_t Time;        // osKernelGetSysTimerCount
+	uint8_t Thread;       // Index into Thread_Stats, 0xff if the table was full
+	uint8_t Event;        // THREAD_STATS_EV_*
+	uint16_t Reserved;
+} THREAD_STATS_LOG_T;
+
+extern THREAD_STATS_T Thread_Stats[THREAD_STATS_MAX_THREADS];
+extern volatile uint32_t Thread_Stats_Count, Thread_Stats_Untracked;
+extern THREAD_STATS_LOG_T Thread_Stats_Log[THREAD_STATS_LOG_LEN];
+extern volatile uint32_t Thread_Stats_Log_Head;
+
+void Thread_Stats_Init(void); // Call after osKernelInitialize
+
+#endif // THREAD_STATS_H
@@ -10,18 +10,12 @@
 #define THREAD_SOUND_PERIOD_MS (100)  // 1 tick/ms
 #define THREAD_UPDATE_SCREEN_PERIOD_MS (50)
 #define THREAD_BUS_PERIOD_MS (10)
+#define THREAD_TELEMETRY_PERIOD_MS (5) // Poll interval when the ring buffer is empty
 
-#define USE_LCD_MUTEX (1)
-
-// Custom stack sizes for larger threads
-#define READ_ACCEL_STK_SZ 768 // 512
-typedef struct {                                                   // object data type
-  uint32_t ChannelNum ;
-  uint32_t *ResultPtr;
-	osThreadId_t TID;
-	uint32_t FlagNum;
-	int pos;
-} MSGQUEUE_OBJ_t;
+// Stack sizes, bytes, multiples of 8. See Stack_Mon for what each thread uses
+#define DEF_STK_SZ 512 // As OS_STACK_SIZE, the RTX default
+#define READ_ACCEL_STK_SZ 768 // 512. Float printf needs the extra
+#define READ_ACCEL_FX_STK_SZ 512 // Fixed-point angles, formatted with fmt.h
 
 
 void Init_Debug_Signals(void);
@@ -33,10 +27,19 @@ void Init_Debug_Signals(void);
 
 #define EV_REFILL_SOUND_BUFFER  (1)
 
+/* Boot_Flags, set once as bring-up stages finish in Thread_Boot and
+never cleared. Threads that need a stage wait for its flag: the LCD
+users for BOOT_FLAG_LCD, sound playback for BOOT_FLAG_SOUND. The
+accelerometer thread brings up its own sensor meanwhile. */
+#define BOOT_FLAG_LCD (0x0001)
+#define BOOT_FLAG_SOUND (0x0002)
+
+extern osEventFlagsId_t Boot_Flags;
+void Boot_Wait(uint32_t flags);
+
 void Create_OS_Objects(void);
  
-extern osThreadId_t t_Read_TS, t_Read_Accelerometer, t_Sound_Manager, t_US, t_Refill_Sound_Buffer;
-extern osMutexId_t LCD_mutex;
+extern osThreadId_t t_Read_TS, t_Read_Accelerometer, t_US, t_Refill_Sound_Buffer;
 
  
 // Game Constants
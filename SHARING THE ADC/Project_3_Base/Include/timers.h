@@ -6,15 +6,48 @@
 
 #define LCD_UPDATE_PERIOD 10
 
+/*
+ Timer resources. Each TPM and PIT channel has one owner, claimed at init.
+ A claim on a timer someone else holds is a configuration error: it lights
+ the red LED, records both owners in Timer_Conflict and, with
+ TIMER_CONFLICT_HALT, stops there so it is found on the bench rather
+ than as a drifting PWM frequency.
+*/
+#define TIMER_CONFLICT_HALT (1)
+
+typedef enum {TMR_TPM0, TMR_TPM1, TMR_TPM2, TMR_PIT0, TMR_PIT1, TMR_LPTMR0, TMR_NUM} TMR_E;
+
+#define TMR_DMAMUX_SOURCE(t) (54 + (t)) // TPM overflow DMA request, TPMs only
+
+typedef struct {
+	TMR_E Timer;
+	const char * Owner;     // Holder
+	const char * Claimant;  // Refused
+} TIMER_CONFLICT_T;
+
+extern const char * volatile Timer_Owner[TMR_NUM];
+extern volatile uint32_t Timer_Conflicts;
+extern TIMER_CONFLICT_T Timer_Conflict;
+
+int Timer_Claim(TMR_E t, const char * owner);  // 0, or -1 on conflict. Same owner may claim again.
+int Timer_Claim_TPM(TPM_Type * TPM, const char * owner);
+int Timer_Claim_Free_TPM(const char * owner);  // TMR_TPMx, or -1 if all are taken
+TPM_Type * Timer_TPM(TMR_E t);
+
 void PIT_Init(unsigned period);
 void PIT_Start(void);
 void PIT_Stop(void);
+void PIT1_Init(unsigned period);
+void PIT1_Start(void);
 
 void TPM_Init(unsigned period_ms);
 
 void TPM0_Init(void);
 void TPM0_Start(void);
-void Configure_TPM0_for_DMA(uint32_t period_us);
+void TPM_Start(TPM_Type * TPM);
+void Configure_TPM_for_DMA(TPM_Type * TPM, uint32_t period_us);
+void TPM2_Init_Trigger(uint32_t period);
+void TPM2_Set_Trigger_Period(uint32_t period);
 
 void PWM_Init(TPM_Type * TPM, uint8_t channel_num, uint16_t period, uint16_t duty, 
 	uint8_t pos_polarity, uint8_t prescaler_code);
@@ -28,13 +28,20 @@
 #include "cmsis_compiler.h"
 #include "rtx_os.h"
 #include <MKL25Z4.H>
+#include "cpu_util.h"
 #include "debug.h"
+#include "tickless.h"
 
 // OS Idle Thread
 __WEAK __NO_RETURN void osRtxIdleThread (void *argument) {
   (void)argument;
 
   for (;;) {
+#if USE_TICKLESS_IDLE
+		if (CPU_Util_Can_Sleep())
+			Tickless_Idle(); // Returns once a thread is ready, or the tick can't be spared
+#endif
+		CPU_Idle_Count++;
 		PTB->PTOR = MASK(DBG_TIDLE);
 	}
 }
@@ -0,0 +1,84 @@
+"""Live top-N view of the profiler snapshots sent on the telemetry UART.
+
+Usage: python profile_top.py <port or capture file> [region.c] [baud]
+
+Reads the UART0 stream (see profile.h and telemetry.h), skips telemetry
+records and prints each profile frame as a table. Region names come from
+region.c (default Source/Profiler/region.c), so use the one built into
+the running image. A port needs pyserial.
+"""
+import re
+import struct
+import sys
+
+TELEM_SYNC, TELEM_REC_LEN = 0xA5, 8
+FRAME_SYNC, FRAME_TYPE = 0x5A, 0x50
+HEADER_LEN, ENTRY_LEN = 12, 6
+
+
+def load_names(path):
+    names = {}
+    for line in open(path):
+        m = re.search(r'"([^"]*)"\s*\}\s*,\s*//\s*(\d+)', line)
+        if m:
+            names[int(m.group(2))] = m.group(1)
+    return names
+
+
+def open_stream(src, baud):
+    try:
+        return open(src, 'rb')
+    except OSError:
+        import serial
+        return serial.Serial(src, baud)
+
+
+def frames(stream):
+    buf = bytearray()
+    while True:
+        data = stream.read(256)
+        if not data:
+            return
+        buf += data
+        while len(buf) >= 2:
+            if buf[0] == TELEM_SYNC:
+                if len(buf) < TELEM_REC_LEN:
+                    break
+                del buf[:TELEM_REC_LEN]
+            elif buf[0] == FRAME_SYNC and buf[1] == FRAME_TYPE:
+                if len(buf) < HEADER_LEN:
+                    break
+                length = HEADER_LEN + ENTRY_LEN*buf[3] + 1
+                if len(buf) < length:
+                    break
+                frame = bytes(buf[:length])
+                if sum(frame[:-1]) & 0xff == frame[-1]:
+                    del buf[:length]
+                    yield frame
+                else:
+                    del buf[:1]  # Not a frame after all, resync
+            else:
+                del buf[:1]
+
+
+def show(frame, names):
+    seq, n = frame[2], frame[3]
+    samples, lost = struct.unpack_from('<II', frame, 4)
+    print('\n#%d  %d samples, %d lost' % (seq, samples, lost))
+    for i in range(n):
+        region, count = struct.unpack_from('<HI', frame, HEADER_LEN + ENTRY_LEN*i)
+        pct = 100.0*count/samples if samples else 0.0
+        print('%6.2f%% %9d  %s' % (pct, count, names.get(region, 'region %d' % region)))
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    names = load_names(sys.argv[2] if len(sys.argv) > 2 else 'Source/Profiler/region.c')
+    baud = int(sys.argv[3]) if len(sys.argv) > 3 else 921600
+    for frame in frames(open_stream(sys.argv[1], baud)):
+        show(frame, names)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,75 @@
+"""Rank profiled functions as candidates for RAM_CODE (ram_code.h).
+
+Usage: python ram_candidates.py <port or capture file> [region.c] [budget bytes]
+
+Reads profile frames from the telemetry UART stream like profile_top.py
+and, once the stream ends (or on Ctrl-C for a port), takes the last one.
+Each sampled region gets its size from region.c; they are ranked by
+samples per byte, so the hottest code per byte of RAM comes first, and
+marked "move" while they fit in the budget (default 2048, the size of
+RW_RAMCODE). Regions already in RAM are listed but not counted against
+it. A region's share of samples is the most that moving it can save;
+runs of straight-line code gain much less than branchy code and loops.
+
+Frames only carry the PROFILE_TOP_N busiest regions, so small helpers
+called from them may need a look at the call pairs too (PROFILE_CALL_STACK).
+"""
+import re
+import struct
+import sys
+
+from profile_top import frames, open_stream, HEADER_LEN, ENTRY_LEN
+
+RAM_START = 0x1FFFF000
+
+
+def load_regions(path):
+    regions = {}
+    for line in open(path):
+        m = re.search(r'\{\s*0x([0-9a-fA-F]+)\s*,\s*0x([0-9a-fA-F]+)\s*,\s*"([^"]*)"\s*\}\s*,\s*//\s*(\d+)', line)
+        if m:
+            start, end = int(m.group(1), 16), int(m.group(2), 16)
+            regions[int(m.group(4))] = (m.group(3), start, end - start + 1)
+    return regions
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    regions = load_regions(sys.argv[2] if len(sys.argv) > 2 else 'Source/Profiler/region.c')
+    budget = int(sys.argv[3]) if len(sys.argv) > 3 else 2048
+    last = None
+    try:
+        for last in frames(open_stream(sys.argv[1], 921600)):
+            pass
+    except KeyboardInterrupt:
+        pass
+    if last is None:
+        sys.exit('No profile frames')
+
+    samples, lost = struct.unpack_from('<II', last, 4)
+    rows = []
+    for i in range(last[3]):
+        region, count = struct.unpack_from('<HI', last, HEADER_LEN + ENTRY_LEN*i)
+        name, start, size = regions.get(region, ('region %d' % region, 0, 1))
+        rows.append((count/float(size), count, size, name, start >= RAM_START))
+    rows.sort(reverse=True)
+
+    print('%d samples, %d lost, budget %d bytes\n' % (samples, lost, budget))
+    print('%7s %9s %6s %8s %6s  %s' % ('share', 'samples', 'bytes', 'per byte', 'total', 'function'))
+    used = 0
+    for density, count, size, name, in_ram in rows:
+        pct = 100.0*count/samples if samples else 0.0
+        if in_ram:
+            note = 'RAM'
+        elif used + size <= budget:
+            used += size
+            note = 'move'
+        else:
+            note = ''
+        print('%6.2f%% %9d %6d %8.2f %6s  %s %s' % (pct, count, size, density,
+              used if note == 'move' else '', name, note))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,110 @@
+"""Decode a saved Dbg_Trace ring (debug.h, DBG_TRACE_MODE) into a timeline.
+
+Usage: python trace_decode.py <trace.hex | trace.bin> [--vcd out.vcd] [--debug-h path]
+
+The input is the Dbg_Trace structure as saved by the debugger, Intel HEX
+or raw binary. Prints events oldest first with the time since the first
+one, and the duration of each START..STOP span. --vcd also writes a VCD
+file, one wire per DBG channel, for GTKWave or similar viewers.
+"""
+import argparse
+import re
+import struct
+
+REC_LEN = 8
+EDGES = {0: 'STOP', 1: 'START', 2: 'TOGGLE'}
+
+
+def read_image(path):
+    if not path.lower().endswith('.hex'):
+        return open(path, 'rb').read()
+    mem, base = {}, 0
+    for line in open(path):
+        line = line.strip()
+        if not line.startswith(':'):
+            continue
+        raw = bytes.fromhex(line[1:])
+        n, adx, kind = raw[0], (raw[1] << 8) | raw[2], raw[3]
+        data = raw[4:4+n]
+        if kind == 0:
+            for i, b in enumerate(data):
+                mem[base + adx + i] = b
+        elif kind == 4:
+            base = ((data[0] << 8) | data[1]) << 16
+        elif kind == 2:
+            base = ((data[0] << 8) | data[1]) << 4
+    start = min(mem)
+    return bytes(mem.get(a, 0) for a in range(start, max(mem) + 1))
+
+
+def channel_names(path):
+    """DBG_n bit numbers, and the signal names mapped onto each."""
+    bits, names = {}, {}
+    try:
+        text = open(path).read()
+    except OSError:
+        return names
+    for m in re.finditer(r'#define\s+(DBG_\d+)\s+(\d+)', text):
+        bits[m.group(1)] = int(m.group(2))
+    for m in re.finditer(r'#define\s+DBG_(\w+?)(?:_POS)?\s+(DBG_\d+)\b', text):
+        names.setdefault(bits.get(m.group(2)), []).append(m.group(1))
+    for dbg, bit in bits.items():
+        names.setdefault(bit, [dbg])
+    return names
+
+
+def events(image):
+    head, freq = struct.unpack_from('<II', image, 0)
+    length = (len(image) - 8) // REC_LEN
+    count = min(head, length)
+    recs = []
+    for k in range(head - count, head):
+        t, ch, edge = struct.unpack_from('<IBB', image, 8 + REC_LEN*(k % length))
+        recs.append((t, ch, edge))
+    return freq, head, recs
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument('trace')
+    ap.add_argument('--vcd')
+    ap.add_argument('--debug-h', default='Include/debug.h')
+    args = ap.parse_args()
+
+    freq, head, recs = events(read_image(args.trace))
+    names = channel_names(args.debug_h)
+    if not recs:
+        print('No events')
+        return
+    print('%d events, last %d shown, %d Hz timer' % (head, len(recs), freq))
+    t0, started = recs[0][0], {}
+    for t, ch, edge in recs:
+        us = ((t - t0) & 0xffffffff)*1e6/freq
+        label = '/'.join(names.get(ch, ['DBG bit %d' % ch]))
+        extra = ''
+        if edge == 1:
+            started[ch] = t
+        elif edge == 0 and ch in started:
+            extra = '  %.2f us' % (((t - started.pop(ch)) & 0xffffffff)*1e6/freq)
+        print('%12.2f us  %-6s %s%s' % (us, EDGES.get(edge, '?'), label, extra))
+
+    if args.vcd:
+        chans = sorted(set(ch for _, ch, _ in recs))
+        ids = dict((ch, chr(33 + i)) for i, ch in enumerate(chans))
+        state = dict((ch, 0) for ch in chans)
+        with open(args.vcd, 'w') as f:
+            f.write('$timescale 1 ns $end\n$scope module dbg $end\n')
+            for ch in chans:
+                label = '_'.join(names.get(ch, ['bit%d' % ch]))
+                f.write('$var wire 1 %s %s $end\n' % (ids[ch], label))
+            f.write('$upscope $end\n$enddefinitions $end\n#0\n')
+            for ch in chans:
+                f.write('0%s\n' % ids[ch])
+            for t, ch, edge in recs:
+                state[ch] = (state[ch] ^ 1) if edge == 2 else edge
+                ns = int(((t - t0) & 0xffffffff)*1e9/freq)
+                f.write('#%d\n%d%s\n' % (ns, state[ch], ids[ch]))
+
+
+if __name__ == '__main__':
+    main()
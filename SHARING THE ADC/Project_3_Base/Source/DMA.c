@@ -7,26 +7,178 @@
 #include "threads.h"
 #include "gpio_defs.h"
 #include "debug.h"
+#include "sound.h"
+#include "DMA.h"
+#include "irq_lat.h"
 
 uint16_t * Reload_DMA_Source[2]={0,0};
 uint32_t Reload_DMA_Byte_Count=0;
 uint32_t DMA_Playback_Count=0;
 uint8_t read_buffer_num=0;
+volatile uint8_t DMA_Buffer_Full[2]={0,0};
+volatile uint32_t DMA_Underrun_Count=0;
 
 
+static int8_t Playback_Ch = -1;
+#if USE_DOUBLE_BUFFER
+// Played instead of a buffer the refill thread hasn't finished, so an underrun is a gap, not a repeat
+static const uint16_t Silence = MAX_DAC_CODE/2;
+static uint8_t Playing_Silence = 0;
+#endif
+static TMR_E Playback_Timer = TMR_TPM0; // Its overflow requests each sample
+
+void DMA_Set_Playback_Timer(TMR_E t) {
+	Playback_Timer = t;
+}
+
+const char * volatile DMA_Owner[DMA_NUM_CH];
+static DMA_CALLBACK_T DMA_Callback[DMA_NUM_CH];
+static const IRQn_Type DMA_IRQ[DMA_NUM_CH] = {DMA0_IRQn, DMA1_IRQn, DMA2_IRQn, DMA3_IRQn};
+
 void DMA_Init(void) {
 	SIM->SCGC7 |= SIM_SCGC7_DMA_MASK;
 	SIM->SCGC6 |= SIM_SCGC6_DMAMUX_MASK;
 }
 
+// Claim a free channel, caller has interrupts masked
+static void DMA_Claim(uint8_t ch, const char * owner, DMA_CALLBACK_T cb, uint8_t irq_prio) {
+	DMA_Owner[ch] = owner;
+	DMA_Callback[ch] = cb;
+	DMAMUX0->CHCFG[ch] = 0;
+	DMA0->DMA[ch].DCR = 0;
+	DMA0->DMA[ch].DSR_BCR = DMA_DSR_BCR_DONE_MASK;
+	NVIC_ClearPendingIRQ(DMA_IRQ[ch]);
+	if (cb != NULL) {
+		NVIC_SetPriority(DMA_IRQ[ch], irq_prio); // 0, 64, 128 or 192
+		NVIC_EnableIRQ(DMA_IRQ[ch]);
+	} else {
+		NVIC_DisableIRQ(DMA_IRQ[ch]);
+	}
+}
+
+int DMA_Reserve(uint8_t ch, const char * owner, DMA_CALLBACK_T cb, uint8_t irq_prio) {
+	uint32_t m;
+	int r = -1;
+
+	if (ch >= DMA_NUM_CH)
+		return -1;
+	DMA_Init();
+	m = __get_PRIMASK();
+	__disable_irq();
+	if (DMA_Owner[ch] == NULL) {
+		DMA_Claim(ch, owner, cb, irq_prio);
+		r = 0;
+	}
+	__set_PRIMASK(m);
+	return r;
+}
+
+int DMA_Alloc(DMA_PRIO_E prio, const char * owner, DMA_CALLBACK_T cb, uint8_t irq_prio) {
+	uint32_t m;
+	int i, ch = -1;
+
+	DMA_Init();
+	m = __get_PRIMASK();
+	__disable_irq();
+	for (i=0; i<DMA_NUM_CH; i++) {
+		ch = (prio == DMA_PRIO_HIGH) ? i : DMA_NUM_CH-1-i;
+		if (DMA_Owner[ch] == NULL)
+			break;
+	}
+	if (i < DMA_NUM_CH)
+		DMA_Claim(ch, owner, cb, irq_prio);
+	else
+		ch = -1;
+	__set_PRIMASK(m);
+	return ch;
+}
+
+void DMA_Free(uint8_t ch) {
+	if (ch >= DMA_NUM_CH)
+		return;
+	NVIC_DisableIRQ(DMA_IRQ[ch]);
+	DMAMUX0->CHCFG[ch] = 0;
+	DMA0->DMA[ch].DCR = 0;
+	DMA0->DMA[ch].DSR_BCR = DMA_DSR_BCR_DONE_MASK;
+	DMA_Callback[ch] = NULL;
+	DMA_Owner[ch] = NULL;
+}
+
+uint32_t DMA_Park(void) {
+	uint32_t m, parked = 0;
+	uint8_t ch;
+
+	m = __get_PRIMASK();
+	__disable_irq();
+	for (ch=0; ch<DMA_NUM_CH; ch++) {
+		NVIC_DisableIRQ(DMA_IRQ[ch]); // A pending callback could restart its channel
+		if (DMA0->DMA[ch].DCR & DMA_DCR_ERQ_MASK) {
+			DMA0->DMA[ch].DCR &= ~DMA_DCR_ERQ_MASK;
+			parked |= 1 << ch;
+		}
+	}
+	__set_PRIMASK(m);
+	return parked;
+}
+
+void DMA_Unpark(uint32_t parked) {
+	uint32_t m;
+	uint8_t ch;
+
+	m = __get_PRIMASK();
+	__disable_irq();
+	for (ch=0; ch<DMA_NUM_CH; ch++) {
+		if (parked & (1 << ch))
+			DMA0->DMA[ch].DCR |= DMA_DCR_ERQ_MASK;
+		if (DMA_Callback[ch] != NULL)
+			NVIC_EnableIRQ(DMA_IRQ[ch]);
+	}
+	__set_PRIMASK(m);
+}
+
+static void DMA_Dispatch(uint8_t ch) {
+	uint32_t dsr = DMA0->DMA[ch].DSR_BCR;
+
+	DMA0->DMA[ch].DSR_BCR = DMA_DSR_BCR_DONE_MASK; // Also clears the error bits
+	if (DMA_Callback[ch] != NULL)
+		DMA_Callback[ch](ch, dsr);
+}
+
+void DMA0_IRQHandler(void) {
+	DMA_Dispatch(0);
+}
+
+void DMA1_IRQHandler(void) {
+	DMA_Dispatch(1);
+}
+
+void DMA2_IRQHandler(void) {
+	DMA_Dispatch(2);
+}
+
+void DMA3_IRQHandler(void) {
+	DMA_Dispatch(3);
+}
+
+static void Playback_Done(uint8_t ch, uint32_t dsr);
+
 void Configure_DMA_For_Playback(uint16_t * source1, uint16_t * source2, uint32_t count, uint32_t num_playbacks) {
 	
+	if (Playback_Ch < 0) {
+		// Audio is paced by a timer with no slack, so take a high priority channel
+		Playback_Ch = DMA_Alloc(DMA_PRIO_HIGH, "Sound", Playback_Done, 128);
+		if (Playback_Ch < 0)
+			return;
+	}
 	// Disable DMA channel in order to allow changes
-	DMAMUX0->CHCFG[0] = 0;
+	DMAMUX0->CHCFG[Playback_Ch] = 0;
 
 	Reload_DMA_Source[0] = source1;
 	Reload_DMA_Source[1] = source2;
 	read_buffer_num = 0;
+#if USE_DOUBLE_BUFFER
+	Playing_Silence = 0;
+#endif
 
 	Reload_DMA_Byte_Count = count*2;
 	DMA_Playback_Count = num_playbacks;
@@ -34,62 +186,83 @@ void Configure_DMA_For_Playback(uint16_t * source1, uint16_t * source2, uint32_t
 	// Generate DMA interrupt when done
 	// Increment source, transfer words (16 bits)
 	// Enable peripheral request
-	DMA0->DMA[0].DCR = DMA_DCR_EINT_MASK | DMA_DCR_SINC_MASK | 
+	DMA0->DMA[Playback_Ch].DCR = DMA_DCR_EINT_MASK | DMA_DCR_SINC_MASK | 
 											DMA_DCR_SSIZE(2) | DMA_DCR_DSIZE(2) |
 											DMA_DCR_ERQ_MASK | DMA_DCR_CS_MASK;
 
-	
-	// Configure NVIC for DMA ISR
-	NVIC_SetPriority(DMA0_IRQn, 128); // 0, 64, 128 or 192
-	NVIC_ClearPendingIRQ(DMA0_IRQn); 
-	NVIC_EnableIRQ(DMA0_IRQn);	
-
 	// Enable DMA MUX channel without periodic triggering
-	// select TPM0 overflow as trigger
-	DMAMUX0->CHCFG[0] = DMAMUX_CHCFG_SOURCE(54);   
+	// select playback TPM overflow as trigger
+	DMAMUX0->CHCFG[Playback_Ch] = DMAMUX_CHCFG_SOURCE(TMR_DMAMUX_SOURCE(Playback_Timer));   
 }
 
 void Start_DMA_Playback() {
 	
-	// Select TPM0 as trigger for DMA
-	DMAMUX0->CHCFG[0] = DMAMUX_CHCFG_SOURCE(54);   
+	if (Playback_Ch < 0)
+		return;
+	// Select playback TPM as trigger for DMA
+	DMAMUX0->CHCFG[Playback_Ch] = DMAMUX_CHCFG_SOURCE(TMR_DMAMUX_SOURCE(Playback_Timer));   
 
 	// initialize source and destination pointers
-	DMA0->DMA[0].SAR = DMA_SAR_SAR((uint32_t) Reload_DMA_Source[read_buffer_num]);
-	DMA0->DMA[0].DAR = DMA_DAR_DAR((uint32_t) (&(DAC0->DAT[0])));
+#if USE_DOUBLE_BUFFER
+	if (Playing_Silence) {
+		// Same count of requests, all reading the one silent sample
+		DMA0->DMA[Playback_Ch].SAR = DMA_SAR_SAR((uint32_t) &Silence);
+		DMA0->DMA[Playback_Ch].DCR &= ~DMA_DCR_SINC_MASK;
+	} else {
+		DMA0->DMA[Playback_Ch].SAR = DMA_SAR_SAR((uint32_t) Reload_DMA_Source[read_buffer_num]);
+		DMA0->DMA[Playback_Ch].DCR |= DMA_DCR_SINC_MASK;
+	}
+#else
+	DMA0->DMA[Playback_Ch].SAR = DMA_SAR_SAR((uint32_t) Reload_DMA_Source[read_buffer_num]);
+#endif
+	DMA0->DMA[Playback_Ch].DAR = DMA_DAR_DAR((uint32_t) (&(DAC0->DAT[0])));
 	
 	// byte count
-	DMA0->DMA[0].DSR_BCR = DMA_DSR_BCR_BCR(Reload_DMA_Byte_Count);
+	DMA0->DMA[Playback_Ch].DSR_BCR = DMA_DSR_BCR_BCR(Reload_DMA_Byte_Count);
 	
 	// verify done flag is cleared
-	DMA0->DMA[0].DSR_BCR &= ~DMA_DSR_BCR_DONE_MASK; 
+	DMA0->DMA[Playback_Ch].DSR_BCR &= ~DMA_DSR_BCR_DONE_MASK; 
 	
 	// Enable DMA
-	DMAMUX0->CHCFG[0] |= DMAMUX_CHCFG_ENBL_MASK;
+	DMAMUX0->CHCFG[Playback_Ch] |= DMAMUX_CHCFG_ENBL_MASK;
 
 	// start the timer running
-	TPM0_Start();
+	TPM_Start(Timer_TPM(Playback_Timer));
 }
 
-void DMA0_IRQHandler(void) {
+// Playback channel callback, DONE already cleared
+static void Playback_Done(uint8_t ch, uint32_t dsr) {
+#if USE_IRQ_LAT
+	TPM_Type * tpm = Timer_TPM(Playback_Timer);
+
+	// The overflow that requested the last transfer restarted the count
+	IRQ_Lat_Enter(IRQ_LAT_DMA_SOUND, tpm->CNT << (tpm->SC & TPM_SC_PS_MASK));
+#endif
 	// Set debug signal
 	PTB->PSOR = MASK(DBG_IRQDMA_POS);
 
-	// Clear done flag 
-	DMA0->DMA[0].DSR_BCR |= DMA_DSR_BCR_DONE_MASK; 
-	
-	if (--DMA_Playback_Count > 0) { 
-		// Signal event requesting source buffer refill
-		osThreadFlagsSet(t_Refill_Sound_Buffer, EV_REFILL_SOUND_BUFFER);
+	if ((DMA_Playback_Count == DMA_PLAYBACK_FOREVER) || (--DMA_Playback_Count > 0)) { 
 #if USE_DOUBLE_BUFFER		
-		// switch to other buffer
-		read_buffer_num = 1 - read_buffer_num; 
+		// Buffer just played goes back to the refill thread, switch to the other one
+		if (!Playing_Silence) {
+			DMA_Buffer_Full[read_buffer_num] = 0;
+			read_buffer_num = 1 - read_buffer_num; 
+		}
+		// Refill thread fell behind: play a buffer of silence, then try this one again
+		Playing_Silence = !DMA_Buffer_Full[read_buffer_num];
+		if (Playing_Silence)
+			DMA_Underrun_Count++;
 #endif
-		Control_RGB_LEDs(0,0,read_buffer_num);			
-		// Start playback again
+		// Start playback again before the next sample request
 		Start_DMA_Playback();
+		// Signal event requesting source buffer refill
+		osThreadFlagsSet(t_Refill_Sound_Buffer, EV_REFILL_SOUND_BUFFER);
+		Control_RGB_LEDs(0,0,read_buffer_num);			
 	}
 	
+#if USE_IRQ_LAT
+	IRQ_Lat_Exit(IRQ_LAT_DMA_SOUND);
+#endif
 	// Clear debug signal
 	PTB->PCOR = MASK(DBG_IRQDMA_POS);
 }
@@ -9,9 +9,227 @@ typedef int32_t FX16_16;
 #define FX_TO_INT(x) ((int32_t)((x)/65536))
 #define FX_TO_FL(x) ((float)((x)/65536.0))
 
-FX16_16 Multiply_FX(FX16_16 a, FX16_16 b);
-FX16_16 Add_FX(FX16_16 a, FX16_16 b);
-FX16_16 Subtract_FX(FX16_16 a, FX16_16 b);
+#define FX_MAX ((FX16_16) 0x7fffffff)
+#define FX_MIN ((FX16_16) 0x80000000)
+#define FX_ONE ((FX16_16) 0x00010000)
 
+// Fractions in [-1, 1): Q15 for 16-bit data (samples, table entries), Q31 for 32-bit
+typedef int16_t Q15;
+typedef int32_t Q31;
+
+#define FL_TO_Q15(x) ((Q15)((x)*32768.0))
+#define Q15_TO_FL(x) ((float)((x)/32768.0))
+#define FL_TO_Q31(x) ((Q31)((x)*2147483648.0))
+#define Q31_TO_FL(x) ((float)((x)/2147483648.0))
+
+#define Q15_MAX ((Q15) 0x7fff)
+#define Q15_MIN ((Q15) 0x8000)
+#define Q31_MAX ((Q31) 0x7fffffff)
+#define Q31_MIN ((Q31) 0x80000000)
+
+// Set to 1 to toggle DBG_CONTROLLER_POS around each 64-bit multiply
+#define FX_DEBUG_SIGNALS (0)
+
+#if FX_DEBUG_SIGNALS
+#include <MKL25Z4.h>
+#include "debug.h"
+#define FX_DEBUG_TOGGLE() { FPTB->PTOR = MASK(DBG_CONTROLLER_POS); }
+#else
+#define FX_DEBUG_TOGGLE()
+#endif
+
+static __inline FX16_16 Multiply_FX(FX16_16 a, FX16_16 b) {
+	int64_t p;
+	
+	// Long multiply first, then normalize
+	FX_DEBUG_TOGGLE();
+	p = (int64_t) a * b;
+	FX_DEBUG_TOGGLE();
+	p >>= 16;
+	return (FX16_16)(p&0xffffffff);
+}
+
+// Add and subtract saturate at FX_MAX/FX_MIN instead of wrapping
+static __inline FX16_16 Add_FX(FX16_16 a, FX16_16 b) {
+	FX16_16 p;
+	
+	p = (FX16_16) ((uint32_t) a + (uint32_t) b);
+	if (((a ^ p) & (b ^ p)) < 0) // Operands agree in sign, result does not
+		p = (a < 0) ? FX_MIN : FX_MAX;
+	return p;
+}
+
+static __inline FX16_16 Subtract_FX(FX16_16 a, FX16_16 b) {
+	FX16_16 p;
+	
+	p = (FX16_16) ((uint32_t) a - (uint32_t) b);
+	if (((a ^ b) & (a ^ p)) < 0) // Operands differ in sign, result differs from a
+		p = (a < 0) ? FX_MIN : FX_MAX;
+	return p;
+}
+
+// Clamp a 64-bit intermediate to 32 bits
+static __inline int32_t Saturate_32(int64_t x) {
+	if (x > (int64_t) FX_MAX)
+		return FX_MAX;
+	if (x < (int64_t) FX_MIN)
+		return FX_MIN;
+	return (int32_t) x;
+}
+
+static __inline int16_t Saturate_16(int32_t x) {
+	if (x > Q15_MAX)
+		return Q15_MAX;
+	if (x < Q15_MIN)
+		return Q15_MIN;
+	return (int16_t) x;
+}
+
+// As Multiply_FX, but saturates at FX_MAX/FX_MIN instead of wrapping
+static __inline FX16_16 Multiply_FX_Sat(FX16_16 a, FX16_16 b) {
+	int64_t p;
+	
+	FX_DEBUG_TOGGLE();
+	p = (int64_t) a * b;
+	FX_DEBUG_TOGGLE();
+	return Saturate_32(p >> 16);
+}
+
+/*
+ Multiply-accumulate: sums of products stay in a 64-bit FX32_32 accumulator
+ and are normalized once, so a dot product or filter tap loop rounds and
+ saturates only at the end.
+*/
+static __inline int64_t MAC_FX(int64_t acc, FX16_16 a, FX16_16 b) {
+	return acc + (int64_t) a * b;
+}
+
+static __inline FX16_16 MAC_To_FX(int64_t acc) {
+	return Saturate_32(acc >> 16);
+}
+
+/*
+ a/b and 1/a. The M0+ has no divide instruction, so each is a 64-bit
+ library divide: keep them out of per-sample code, or take the
+ reciprocal once and Multiply_FX by it. Dividing by zero saturates
+ towards the sign of the dividend.
+*/
+static __inline FX16_16 Divide_FX(FX16_16 a, FX16_16 b) {
+	if (b == 0)
+		return (a < 0) ? FX_MIN : FX_MAX;
+	return Saturate_32(((int64_t) a * 65536) / b); // Not a << 16: a may be negative
+}
+
+static __inline FX16_16 Reciprocal_FX(FX16_16 a) {
+	return Divide_FX(FX_ONE, a);
+}
+
+// a*2^n, saturating, for 0 <= n < 32
+static __inline int32_t Shift_Left_Sat(int32_t a, uint32_t n) {
+	if (a > (FX_MAX >> n))
+		return FX_MAX;
+	if (a < (FX_MIN >> n))
+		return FX_MIN;
+	return (int32_t) ((uint32_t) a << n);
+}
+
+// a/2^n rounded to nearest (half up) instead of toward minus infinity, 0 < n < 32
+static __inline int32_t Shift_Right_Round(int32_t a, uint32_t n) {
+	return (int32_t) (((int64_t) a + (1L << (n-1))) >> n);
+}
+
+/*
+ Q15 kernels are 16x16->32 multiplies, a single MULS. Only -1*-1 can
+ leave the range, and saturates. MAC_Q15's Q30 accumulator does not
+ saturate and has no headroom: one -1*-1 product is 2^30, so two of
+ them already overflow. The sum of |a*b| over all terms must stay
+ below 2^31 (e.g. taps whose magnitudes add up to under 1.0); for
+ anything larger, accumulate in 64 bits with MAC_Q31's pattern.
+*/
+static __inline Q15 Add_Q15(Q15 a, Q15 b) {
+	return Saturate_16((int32_t) a + b);
+}
+
+static __inline Q15 Subtract_Q15(Q15 a, Q15 b) {
+	return Saturate_16((int32_t) a - b);
+}
+
+static __inline Q15 Multiply_Q15(Q15 a, Q15 b) {
+	return Saturate_16(((int32_t) a * b) >> 15);
+}
+
+static __inline int32_t MAC_Q15(int32_t acc, Q15 a, Q15 b) {
+	return acc + (int32_t) a * b;
+}
+
+static __inline Q15 MAC_To_Q15(int32_t acc) {
+	return Saturate_16(acc >> 15);
+}
+
+// Q31 passes through 64 bits like FX16_16; add and subtract are Add_FX and Subtract_FX
+static __inline Q31 Multiply_Q31(Q31 a, Q31 b) {
+	return Saturate_32(((int64_t) a * b) >> 31);
+}
+
+static __inline int64_t MAC_Q31(int64_t acc, Q31 a, Q31 b) {
+	return acc + (int64_t) a * b;
+}
+
+static __inline Q31 MAC_To_Q31(int64_t acc) {
+	return Saturate_32(acc >> 31);
+}
+
+/*
+ 32-bit fast-path PID. Inputs and states are plain integers (mA), gains
+ are FX16_16, so each product is a single 32x32->32 multiply:
+ |input| <= FX_PID_IN_LIM (2^11) and |gain| < 16.0 (2^20) keeps every
+ product under 2^31. The integrator state is bounded the same way, so
+ iMax and iMin must be within FX_PID_IN_LIM. Check a controller's
+ constant gains and bounds with FX_STATIC_ASSERT(FX_PID_GAIN_OK(...)) and
+ FX_PID_I_OK. Pass the gains as constants so that, once inlined, the
+ compiler folds a zero gain's term away. Returns the output in whole
+ units, rounded toward minus infinity (shift, no divide).
+*/
+#define FX_PID_IN_LIM (2047)
+#define FX_PID_GAIN_LIM (FL_TO_FX(16.0))
+
+typedef struct {
+	int32_t dState; // Last position input
+	int32_t iState; // Integrator state
+	int32_t iMax, iMin; // Maximum and minimum allowable integrator state
+} SPidFX32;
+
+// C99 has no _Static_assert: a false cond is a negative array size
+#define FX_STATIC_ASSERT(cond, name) typedef char name[(cond) ? 1 : -1]
+#define FX_PID_GAIN_OK(g) (((g) < FX_PID_GAIN_LIM) && ((g) > -FX_PID_GAIN_LIM))
+#define FX_PID_I_OK(max, min) (((max) <= FX_PID_IN_LIM) && ((min) >= -FX_PID_IN_LIM))
+
+static __inline int32_t Clamp_FX_PID_In(int32_t x) {
+	if (x > FX_PID_IN_LIM)
+		return FX_PID_IN_LIM;
+	if (x < -FX_PID_IN_LIM)
+		return -FX_PID_IN_LIM;
+	return x;
+}
+
+static __inline int32_t UpdatePID_FX32(SPidFX32 * pid, int32_t error, int32_t position,
+	const FX16_16 pGain, const FX16_16 iGain, const FX16_16 dGain) {
+	FX16_16 out;
+
+	error = Clamp_FX_PID_In(error);
+	out = pGain * error;
+	if (iGain != 0) {
+		pid->iState += error;
+		if (pid->iState > pid->iMax) 
+			pid->iState = pid->iMax;
+		else if (pid->iState < pid->iMin) 
+			pid->iState = pid->iMin;
+		out = Add_FX(out, iGain * pid->iState);
+	}
+	if (dGain != 0)
+		out = Subtract_FX(out, dGain * Clamp_FX_PID_In(position - pid->dState));
+	pid->dState = position;
+	return out >> 16;
+}
 
 #endif // FX_H
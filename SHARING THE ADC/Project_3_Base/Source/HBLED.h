@@ -26,13 +26,29 @@
 #define V_REF_MV ((int) (V_REF*1000))
 
 #define ADC_FULL_SCALE (0x10000)
+#define ADC_FULL_SCALE_BITS (16)
 #define MA_SCALING_FACTOR (1000)
 
 #define DAC_POS 30
 #define DAC_RESOLUTION 4096
 
 // #define MA_TO_DAC_CODE(i) (i*2.2*DAC_RESOLUTION/V_REF_MV) // Introduces timing delay and interesting bug!
-#define MA_TO_DAC_CODE(i) ((i)*(2.2f*DAC_RESOLUTION/V_REF_MV))
+// #define MA_TO_DAC_CODE(i) ((i)*(2.2f*DAC_RESOLUTION/V_REF_MV))
+
+/* Integer scale factors, folded at compile time from the constants above.
+ ADC_TO_MA_SCALE is mA at ADC full scale: mA = (code*scale) >> 16.
+ MA_TO_DAC_Q16 is DAC codes per mA in Q16: code = (mA*scale + 0x8000) >> 16.
+ The ADC product fits in 32 bits for any 16-bit code. The DAC product
+ does only up to about 24 A, so callers clamp the current to DAC_MAX_MA,
+ the least that reaches full scale (DAC_RESOLUTION-1), before converting
+ and the code to DAC_RESOLUTION-1 after. */
+#define ADC_TO_MA_SCALE ((unsigned) ((V_REF_MV*MA_SCALING_FACTOR + R_SENSE_MO/2)/R_SENSE_MO))
+#define MA_TO_DAC_Q16 ((unsigned) ((((unsigned long long) R_SENSE_MO*DAC_RESOLUTION) << 16) / \
+	((unsigned long long) V_REF_MV*MA_SCALING_FACTOR)))
+
+#define ADC_CODE_TO_MA(c) ((int) (((unsigned) (c)*ADC_TO_MA_SCALE) >> ADC_FULL_SCALE_BITS))
+#define MA_TO_DAC_CODE(i) ((((unsigned) (i))*MA_TO_DAC_Q16 + 0x8000u) >> 16)
+#define DAC_MAX_MA ((((unsigned) (DAC_RESOLUTION-1) << 16) + MA_TO_DAC_Q16-1)/MA_TO_DAC_Q16)
 
 #define MIN(a,b) ((a<b)?a:b)
 #define MAX(a,b) ((a>b)?a:b)
@@ -1,6 +1,16 @@
 #include <MKL25Z4.H>
 #include "i2c.h"
 #include "debug.h"
+#include <stddef.h>
+#include <cmsis_os2.h>
+
+typedef enum {XS_IDLE, XS_DEV_W, XS_REG, XS_WRITE, XS_DEV_R, XS_READ} XFER_STATE_E;
+
+static I2C_XFER_T * volatile Xfer; // Transaction the ISR is running, NULL if none
+static volatile uint8_t Xfer_State = XS_IDLE;
+static uint16_t Xfer_Index;
+
+volatile uint32_t I2C_Errors, I2C_Timeouts;
 
 //init i2c0
 void i2c_init(void)
@@ -27,6 +37,11 @@ void i2c_init(void)
 	
 	// Select high drive mode
 	I2C0->C2 |= (I2C_C2_HDRS_MASK);
+
+	// IICIE is set only while a transaction runs, so polled use is unaffected
+	NVIC_SetPriority(I2C0_IRQn, 192);
+	NVIC_ClearPendingIRQ(I2C0_IRQn);
+	NVIC_EnableIRQ(I2C0_IRQn);
 }
 
 
@@ -184,3 +199,151 @@ void i2c_write_byte(uint8_t dev, uint8_t address, uint8_t data)
 	I2C_M_STOP;
 	
 }
+
+
+////////// Interrupt-driven transactions
+int I2C_Start_Xfer(I2C_XFER_T * x) {
+	uint32_t m;
+
+	m = __get_PRIMASK();
+	__disable_irq();
+	if (Xfer != NULL) {
+		__set_PRIMASK(m);
+		return -1;
+	}
+	Xfer = x;
+	__set_PRIMASK(m);
+
+	x->Status = I2C_IN_PROGRESS;
+	Xfer_Index = 0;
+	Xfer_State = XS_DEV_W;
+	I2C0->S = I2C_S_IICIF_MASK | I2C_S_ARBL_MASK; // Clear stale flags
+	I2C0->C1 |= I2C_C1_IICIE_MASK;
+	I2C_TRAN;
+	I2C_M_START;
+	I2C0->D = x->Dev;
+	return 0;
+}
+
+// ISR context, or thread with the IRQ masked
+static void I2C_End_Xfer(uint8_t status, int signal) {
+	I2C_XFER_T * x = Xfer;
+
+	I2C0->C1 &= ~I2C_C1_IICIE_MASK;
+	if (I2C0->C1 & I2C_C1_MST_MASK)
+		I2C_M_STOP;
+	Xfer_State = XS_IDLE;
+	Xfer = NULL;
+	if (status != I2C_OK)
+		I2C_Errors++;
+	x->Status = status;
+	if (signal)
+		osThreadFlagsSet(x->TID, x->Flag);
+}
+
+void I2C_Abort_Xfer(void) {
+	NVIC_DisableIRQ(I2C0_IRQn);
+	if (Xfer != NULL) {
+		I2C_Timeouts++;
+		I2C_End_Xfer(I2C_ERR_TIMEOUT, 0);
+		i2c_busy(); // Slave may be holding SDA
+	}
+	NVIC_ClearPendingIRQ(I2C0_IRQn);
+	NVIC_EnableIRQ(I2C0_IRQn);
+}
+
+void I2C0_IRQHandler(void) {
+	I2C_XFER_T * x = Xfer;
+	uint8_t s = I2C0->S;
+
+	I2C0->S = I2C_S_IICIF_MASK;
+	if (x == NULL)
+		return;
+	if (s & I2C_S_ARBL_MASK) {
+		I2C0->S = I2C_S_ARBL_MASK; // Master mode already dropped by hardware
+		I2C_End_Xfer(I2C_ERR_ARB, 1);
+		return;
+	}
+	// Everything we transmitted must be ACKed
+	if ((Xfer_State != XS_READ) && (s & I2C_S_RXAK_MASK)) {
+		I2C_End_Xfer(I2C_ERR_NACK, 1);
+		return;
+	}
+	switch (Xfer_State) {
+		case XS_DEV_W:
+			I2C0->D = x->Reg;
+			Xfer_State = XS_REG;
+			break;
+		case XS_REG:
+			if (x->Read) {
+				I2C_M_RSTART;
+				I2C0->D = x->Dev | 0x01;
+				Xfer_State = XS_DEV_R;
+			} else if (x->Len == 0) {
+				I2C_End_Xfer(I2C_OK, 1);
+			} else {
+				I2C0->D = x->Data[Xfer_Index++];
+				Xfer_State = XS_WRITE;
+			}
+			break;
+		case XS_WRITE:
+			if (Xfer_Index < x->Len)
+				I2C0->D = x->Data[Xfer_Index++];
+			else
+				I2C_End_Xfer(I2C_OK, 1);
+			break;
+		case XS_DEV_R:
+			if (x->Len == 0) {
+				I2C_End_Xfer(I2C_OK, 1);
+				break;
+			}
+			I2C_REC;
+			if (x->Len == 1)
+				NACK;
+			else
+				ACK;
+			(void) I2C0->D; // Dummy read starts the first byte
+			Xfer_State = XS_READ;
+			break;
+		case XS_READ:
+			if (Xfer_Index == x->Len - 1) {
+				I2C_M_STOP; // Before reading D, so no further byte is clocked in
+				x->Data[Xfer_Index++] = I2C0->D;
+				I2C_End_Xfer(I2C_OK, 1);
+				break;
+			}
+			if (Xfer_Index == x->Len - 2)
+				NACK; // For the last byte, which reading D now starts
+			x->Data[Xfer_Index++] = I2C0->D;
+			break;
+		default:
+			break;
+	}
+}
+
+static int i2c_burst(uint8_t dev, uint8_t reg, uint8_t * data, uint16_t len, uint8_t read) {
+	I2C_XFER_T x;
+
+	x.Dev = dev;
+	x.Reg = reg;
+	x.Read = read;
+	x.Data = data;
+	x.Len = len;
+	x.TID = osThreadGetId();
+	x.Flag = I2C_FLAG_DONE;
+	if (I2C_Start_Xfer(&x) != 0)
+		return -1;
+	if (osThreadFlagsWait(I2C_FLAG_DONE, osFlagsWaitAny, I2C_TIMEOUT_MS) & osFlagsError) {
+		I2C_Abort_Xfer();
+		osThreadFlagsClear(I2C_FLAG_DONE); // In case it finished just as we gave up
+	}
+	return (x.Status == I2C_OK) ? 0 : -1;
+}
+
+int i2c_read_burst(uint8_t dev, uint8_t reg, uint8_t * data, uint16_t len) {
+	return i2c_burst(dev, reg, data, len, 1);
+}
+
+int i2c_write_burst(uint8_t dev, uint8_t reg, uint8_t * data, uint16_t len) {
+	return i2c_burst(dev, reg, data, len, 0);
+}
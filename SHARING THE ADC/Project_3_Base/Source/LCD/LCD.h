@@ -15,6 +15,9 @@ typedef struct {
 
 extern COLOR_T black, white;
 
+// 5-6-5 packing used by the TFT controllers, high byte first on the bus
+#define LCD_COLOR_565(c) ((uint16_t) ((((c)->R & 0xf8) << 8) | (((c)->G & 0xfc) << 3) | ((c)->B >> 3)))
+
 /*** ***/
 
 // Ported functions for common LCD API
@@ -26,10 +29,17 @@ extern COLOR_T black, white;
 /** Set pixel color
 */
  void LCD_Plot_Pixel(PT_T * pos, COLOR_T * color);
+ // count pixels going right from pos, clipped at the right edge
+ void LCD_Write_Span(PT_T * pos, uint32_t count, COLOR_T * color);
 
-/** Refresh LCD from local MCU frame buffer
+/** Refresh LCD from local MCU frame buffer (only what changed)
 */
  void LCD_Refresh(void);
+/** Hold off refreshes while drawing several things; LCD_Refresh does
+nothing until the matching resume, which refreshes once. Calls nest.
+*/
+ void LCD_Refresh_Defer(void);
+ void LCD_Refresh_Resume(void);
 
 /** Fill entire LCD with given color
 */
@@ -51,6 +61,8 @@ void LCD_Plot_Packed_Pixels_Unaligned(uint8_t fill_byte, uint8_t r_shift, PT_T *
  void LCD_Fill_Rectangle(PT_T * p1, PT_T * p2, COLOR_T * color);
  uint32_t LCD_Start_Rectangle(PT_T * p1, PT_T * p2);
  void LCD_Write_Rectangle_Pixel(COLOR_T * color, unsigned int count);
+ // Runs of pixels alternating c0, c1 (5-6-5), starting with c0. Zero length runs are allowed
+ void LCD_Write_Rectangle_Runs(const uint8_t * runs, uint32_t num_runs, uint16_t c0, uint16_t c1);
 
 /*** ***/
  
@@ -65,8 +77,10 @@ void LCD_Plot_Packed_Pixels_Unaligned(uint8_t fill_byte, uint8_t r_shift, PT_T *
  void LCD_Text_PrintChar(PT_T * pos, char ch);
  void LCD_Text_PrintStr(PT_T * pos, char * str);
  void LCD_Text_PrintStr_RC( uint8_t  row, uint8_t col, char *  str);
+ // After drawing over text rows by other means, so LCD_Text_PrintStr_RC repaints those cells
+ void LCD_Text_Invalidate(void);
+ void LCD_Text_Invalidate_Rect(PT_T * p1, PT_T * p2);
 
- void Graphics_Test(void);
  void LCD_Draw_Line(PT_T * p1, PT_T * p2, COLOR_T * color);
  void LCD_Draw_Circle(PT_T * p1, int radius, COLOR_T * color, int filled);
 
@@ -76,6 +90,9 @@ void LCD_Plot_Packed_Pixels_Unaligned(uint8_t fill_byte, uint8_t r_shift, PT_T *
  void LCD_TS_Blocking_Read(PT_T * position);
  void LCD_TS_Test(void);
  void LCD_TS_Calibrate(void);
+ int LCD_TS_Cal_Load(void);
+ int LCD_TS_Cal_Save(void);
+ extern uint8_t LCD_TS_Cal_Stored;
 
  extern uint8_t G_LCD_char_width, G_LCD_char_height;
 
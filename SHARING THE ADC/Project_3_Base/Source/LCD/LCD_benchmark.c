@@ -0,0 +1,188 @@
+/* Timed LCD benchmark, see LCD_benchmark.h. */
+
+#include <MKL25Z4.H>
+#include <stdint.h>
+#include <stdio.h>
+#include <cmsis_os2.h>
+#include "LCD.h"
+#include "LCD_driver.h"
+#include "LCD_benchmark.h"
+#include "font.h"
+
+#include "ST7789.h"
+#include "T6963.h"
+#include "delay.h"
+
+typedef enum {B_FILL, B_RECT, B_LINE, B_CIRCLE, B_TEXT} BENCH_OP_E;
+
+typedef struct {
+	const char * Name;   // Up to 7 characters
+	uint8_t Op;          // BENCH_OP_E
+	uint16_t Reps;
+	int16_t A, B;        // Rectangle: width, height. Line: dx, dy. Circle: radius, filled. Text: font
+} BENCH_TEST_T;
+
+static const BENCH_TEST_T Tests[LCD_BENCH_NUM_TESTS] = {
+	{"Fill",    B_FILL,    4, 0, 0},
+	{"Rect8",   B_RECT,   64, 8, 8},
+	{"RectL",   B_RECT,    8, LCD_WIDTH/2, LCD_HEIGHT/2},
+	{"LineH",   B_LINE,   32, LCD_WIDTH-1, 0},
+	{"LineV",   B_LINE,   32, 0, LCD_HEIGHT-1},
+	{"Line45",  B_LINE,   32, LCD_HEIGHT/2, LCD_HEIGHT/2},
+	{"Line1:4", B_LINE,   32, LCD_WIDTH-1, (LCD_WIDTH-1)/4},
+	{"Line4:1", B_LINE,   32, (LCD_HEIGHT-1)/4, LCD_HEIGHT-1},
+	{"Circle",  B_CIRCLE, 16, LCD_HEIGHT/4, 0},
+	{"CircleF", B_CIRCLE,  8, LCD_HEIGHT/4, 1},
+	{"Text8",   B_TEXT,   16, 0, 0},
+	{"Text12",  B_TEXT,   16, 1, 0},
+	{"Text20",  B_TEXT,   16, 2, 0},
+};
+
+// On the T6963 only G matters, so about half of these are set pixels
+static COLOR_T Bench_Colors[] = {
+	{255, 255, 255}, {255, 0, 0}, {0, 255, 0}, {0, 0, 255}, {255, 255, 0}, {0, 0, 0}
+};
+#define NUM_BENCH_COLORS (sizeof(Bench_Colors)/sizeof(Bench_Colors[0]))
+
+LCD_BENCH_RESULT_T LCD_Bench_Results[LCD_BENCH_NUM_TESTS];
+
+static uint32_t Bench_Hz;    // Of Bench_Now
+static uint8_t Bench_Kernel; // Timing on the kernel's system timer
+
+/* Before the kernel, SysTick free-running on the reference clock with
+no interrupt; once RTX owns SysTick, the kernel's system timer. */
+static void Bench_Timer_Start(void) {
+	Bench_Kernel = (osKernelGetState() == osKernelRunning);
+	if (Bench_Kernel) {
+		Bench_Hz = osKernelGetSysTimerFreq();
+		return;
+	}
+	Bench_Hz = SystemCoreClock/16;
+	SysTick->CTRL = 0;
+	SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+	SysTick->VAL = 0;
+	SysTick->CTRL = SysTick_CTRL_ENABLE_Msk; // CLKSOURCE 0: reference clock
+}
+
+static void Bench_Timer_Stop(void) {
+	if (!Bench_Kernel)
+		SysTick->CTRL = 0; // RTX sets it up again
+}
+
+// Counts up
+static uint32_t Bench_Now(void) {
+	if (Bench_Kernel)
+		return osKernelGetSysTimerCount();
+	return SysTick_LOAD_RELOAD_Msk - SysTick->VAL;
+}
+
+static uint32_t Bench_Elapsed(uint32_t start) {
+	if (Bench_Kernel)
+		return Bench_Now() - start;
+	return (Bench_Now() - start) & SysTick_LOAD_RELOAD_Msk;
+}
+
+// Repetition i of test t. Returns the pixels drawn
+static uint32_t Bench_Op(const BENCH_TEST_T * t, uint32_t i) {
+	PT_T p1, p2;
+	COLOR_T * c = &Bench_Colors[i % NUM_BENCH_COLORS];
+	char str[LCD_BENCH_TEXT_MAX+1];
+	uint32_t n, k;
+
+	switch (t->Op) {
+		case B_FILL:
+			LCD_Fill_Buffer(c);
+			return LCD_WIDTH*LCD_HEIGHT;
+		case B_RECT:
+			p1.X = (i*37) % (LCD_WIDTH - t->A + 1);
+			p1.Y = (i*53) % (LCD_HEIGHT - t->B + 1);
+			p2.X = p1.X + t->A - 1;
+			p2.Y = p1.Y + t->B - 1;
+			LCD_Fill_Rectangle(&p1, &p2, c);
+			return t->A*t->B;
+		case B_LINE:
+			p1.X = (i*7) % (LCD_WIDTH - t->A);
+			p1.Y = (i*5) % (LCD_HEIGHT - t->B);
+			p2.X = p1.X + t->A;
+			p2.Y = p1.Y + t->B;
+			if (i & 1) { // Every other line slopes the other way
+				n = p1.Y;
+				p1.Y = p2.Y;
+				p2.Y = n;
+			}
+			LCD_Draw_Line(&p1, &p2, c);
+			return MAX(t->A, t->B) + 1;
+		case B_CIRCLE:
+			p1.X = t->A + (i*7) % (LCD_WIDTH - 2*t->A);
+			p1.Y = t->A + (i*5) % (LCD_HEIGHT - 2*t->A);
+			LCD_Draw_Circle(&p1, t->A, c, t->B);
+			return t->B ? (t->A*t->A*355)/113 : (t->A*5657)/1000;
+		case B_TEXT:
+			// Shifted by one each time, so every cell changes
+			n = MIN(LCD_MAX_COLS, LCD_BENCH_TEXT_MAX);
+			for (k=0; k<n; k++)
+				str[k] = 'A' + (i + k) % 26;
+			str[n] = '\0';
+			LCD_Text_PrintStr_RC(i % LCD_MAX_ROWS, 0, str);
+			return n*CHAR_WIDTH*CHAR_HEIGHT;
+		default:
+			return 0;
+	}
+}
+
+static void Bench_Test(const BENCH_TEST_T * t, LCD_BENCH_RESULT_T * r) {
+	uint32_t i, start, pixels = 0, ticks = 0;
+
+	if (t->Op == B_TEXT)
+		LCD_Text_Init(t->A);
+	LCD_Erase();
+	LCD_Refresh();
+	for (i=0; i<t->Reps; i++) {
+		start = Bench_Now();
+		pixels += Bench_Op(t, i);
+		LCD_Refresh(); // Mono LCD: sending the frame buffer is part of the cost
+		ticks += Bench_Elapsed(start);
+	}
+	r->Name = t->Name;
+	r->Reps = t->Reps;
+	r->Pixels = pixels/t->Reps;
+	r->Ticks = ticks;
+	r->us_Per_Op = (uint32_t) (((uint64_t) ticks*1000000)/((uint64_t) Bench_Hz*t->Reps));
+	r->Pixels_Per_s = (ticks > 0) ? (uint32_t) (((uint64_t) pixels*Bench_Hz)/ticks) : 0;
+}
+
+void LCD_Benchmark_Run(void) {
+	unsigned t;
+
+	Bench_Timer_Start();
+	for (t=0; t<LCD_BENCH_NUM_TESTS; t++)
+		Bench_Test(&Tests[t], &LCD_Bench_Results[t]);
+	Bench_Timer_Stop();
+	LCD_Text_Init(1);
+	LCD_Erase();
+	LCD_Refresh();
+}
+
+void LCD_Benchmark_Show(void) {
+	char buffer[32];
+	unsigned t, row, rows;
+	LCD_BENCH_RESULT_T * r;
+
+	LCD_Text_Init(0); // 20 columns fit the T6963
+	rows = LCD_MAX_ROWS - 1;
+	for (t=0; t<LCD_BENCH_NUM_TESTS; t += rows) {
+		LCD_Erase();
+		LCD_Text_PrintStr_RC(0, 0, "Test     us/op kpx/s");
+		for (row=0; (row < rows) && (t+row < LCD_BENCH_NUM_TESTS); row++) {
+			r = &LCD_Bench_Results[t+row];
+			sprintf(buffer, "%-7s%7lu%6lu", r->Name, (unsigned long) r->us_Per_Op,
+				(unsigned long) (r->Pixels_Per_s/1000));
+			LCD_Text_PrintStr_RC(row+1, 0, buffer);
+		}
+		LCD_Refresh();
+		Wait_ms(LCD_BENCH_PAGE_MS);
+	}
+	LCD_Text_Init(1);
+	LCD_Erase();
+	LCD_Refresh();
+}
@@ -0,0 +1,43 @@
+#ifndef LCD_BENCHMARK_H
+#define LCD_BENCHMARK_H
+
+#include <stdint.h>
+
+/*
+ Timed LCD benchmark, for measuring each graphics change on both the TFT
+ and the T6963 builds. A fixed set of operations (full fill, small and
+ large rectangles, lines at several slopes, circles, text in each Lucida
+ font) is repeated with varying positions and colours. Each repetition,
+ including its LCD_Refresh, is timed. Before the kernel starts that is
+ SysTick on the reference clock (core clock/16, 3 MHz, 24 bits: 5.5 s
+ per operation at most). Once RTX owns SysTick it is the kernel's system
+ timer, and the times include whatever preempts the calling thread, so
+ run it from a thread above the others that draw (Thread_Boot). Results
+ land in LCD_Bench_Results for the debugger and the perf runner, and
+ LCD_Benchmark_Show puts them on the LCD a page at a time.
+
+ Pixel counts for circles are the nominal area or circumference; text
+ counts whole character cells.
+*/
+
+#define USE_LCD_BENCHMARK (0)     // 1: main runs the benchmark at startup
+
+#define LCD_BENCH_NUM_TESTS (13)
+#define LCD_BENCH_TEXT_MAX (24)   // Characters per text operation, at most
+#define LCD_BENCH_PAGE_MS (4000)  // Time each page of results is shown
+
+typedef struct {
+	const char * Name;
+	uint32_t Reps;
+	uint32_t Pixels;           // Per operation
+	uint32_t Ticks;            // All reps, benchmark timer
+	uint32_t us_Per_Op;
+	uint32_t Pixels_Per_s;
+} LCD_BENCH_RESULT_T;
+
+extern LCD_BENCH_RESULT_T LCD_Bench_Results[LCD_BENCH_NUM_TESTS];
+
+void LCD_Benchmark_Run(void);  // Leaves the screen erased, font 1
+void LCD_Benchmark_Show(void); // Blocks about LCD_BENCH_PAGE_MS per page
+
+#endif // LCD_BENCHMARK_H
@@ -0,0 +1,258 @@
+/* Dirty-rectangle compositor for filled rectangles, see LCD_compositor.h. */
+
+#include <stdint.h>
+#include "LCD.h"
+#include "LCD_driver.h"
+#include "LCD_compositor.h"
+
+#include "ST7789.h"
+#include "T6963.h"
+
+typedef struct {
+	int16_t X0, Y0, X1, Y1; // Inclusive, empty if X0 > X1 or Y0 > Y1
+} RECT_T;
+
+typedef struct {
+	RECT_T Cur, Next;    // Box on screen, box after the next render
+	COLOR_T Color;       // After the next render
+	uint16_t Next_565, Cur_565;
+	uint8_t Visible, Shown;
+} COMP_OBJ_T;
+
+static COMP_OBJ_T Obj[LCD_COMP_MAX_OBJS];
+static unsigned Num_Objs;
+static COLOR_T Background;
+static uint16_t Background_565; // Colours are compared as 5-6-5, so ones that look the same are equal
+
+static RECT_T Dirty[LCD_COMP_MAX_DIRTY];
+static unsigned Num_Dirty;
+
+static RECT_T Rect_From_Pts(PT_T * p1, PT_T * p2) {
+	RECT_T r;
+
+	r.X0 = MIN(p1->X, p2->X);
+	r.X1 = MAX(p1->X, p2->X);
+	r.Y0 = MIN(p1->Y, p2->Y);
+	r.Y1 = MAX(p1->Y, p2->Y);
+	r.X1 = MIN(r.X1, LCD_WIDTH-1);
+	r.Y1 = MIN(r.Y1, LCD_HEIGHT-1);
+	return r;
+}
+
+static int Rect_Empty(const RECT_T * r) {
+	return (r->X0 > r->X1) || (r->Y0 > r->Y1);
+}
+
+static int32_t Rect_Area(const RECT_T * r) {
+	return Rect_Empty(r) ? 0 : (int32_t) (r->X1 - r->X0 + 1)*(r->Y1 - r->Y0 + 1);
+}
+
+static int Rect_Overlap(const RECT_T * a, const RECT_T * b) {
+	return (a->X0 <= b->X1) && (b->X0 <= a->X1) && (a->Y0 <= b->Y1) && (b->Y0 <= a->Y1);
+}
+
+static RECT_T Rect_Union(const RECT_T * a, const RECT_T * b) {
+	RECT_T u;
+
+	u.X0 = MIN(a->X0, b->X0);
+	u.Y0 = MIN(a->Y0, b->Y0);
+	u.X1 = MAX(a->X1, b->X1);
+	u.Y1 = MAX(a->Y1, b->Y1);
+	return u;
+}
+
+/* Add r to the dirty list. It merges with a rectangle it overlaps or sits
+close to, and the union is added again since it may now reach others. */
+static void Comp_Add_Dirty(RECT_T r) {
+	unsigned i, best = 0;
+	int32_t waste, best_waste = INT32_MAX;
+	RECT_T u;
+
+	if (Rect_Empty(&r))
+		return;
+	for (i=0; i<Num_Dirty; i++) {
+		u = Rect_Union(&Dirty[i], &r);
+		waste = Rect_Area(&u) - Rect_Area(&Dirty[i]) - Rect_Area(&r);
+		if (Rect_Overlap(&Dirty[i], &r) || (waste <= LCD_COMP_MERGE_SLACK)) {
+			Dirty[i] = Dirty[--Num_Dirty];
+			Comp_Add_Dirty(u);
+			return;
+		}
+		if (waste < best_waste) {
+			best_waste = waste;
+			best = i;
+		}
+	}
+	if (Num_Dirty < LCD_COMP_MAX_DIRTY) {
+		Dirty[Num_Dirty++] = r;
+		return;
+	}
+	// List is full: fold r into the rectangle it grows least
+	u = Rect_Union(&Dirty[best], &r);
+	Dirty[best] = Dirty[--Num_Dirty];
+	Comp_Add_Dirty(u);
+}
+
+// Add a minus b, at most four bands
+static void Comp_Add_Difference(const RECT_T * a, const RECT_T * b) {
+	RECT_T r;
+
+	if (!Rect_Overlap(a, b)) {
+		Comp_Add_Dirty(*a);
+		return;
+	}
+	r = *a;
+	r.Y1 = b->Y0 - 1;
+	Comp_Add_Dirty(r);      // Above b
+	r = *a;
+	r.Y0 = b->Y1 + 1;
+	Comp_Add_Dirty(r);      // Below b
+	r = *a;
+	r.Y0 = MAX(a->Y0, b->Y0);
+	r.Y1 = MIN(a->Y1, b->Y1);
+	r.X1 = b->X0 - 1;
+	Comp_Add_Dirty(r);      // Left of b
+	r.X1 = a->X1;
+	r.X0 = b->X1 + 1;
+	Comp_Add_Dirty(r);      // Right of b
+}
+
+// Topmost visible object covering (x, y), -1 for background
+static int Comp_Top(int16_t x, int16_t y) {
+	int i;
+
+	for (i=Num_Objs-1; i>=0; i--) {
+		if (Obj[i].Visible && (x >= Obj[i].Next.X0) && (x <= Obj[i].Next.X1) &&
+			(y >= Obj[i].Next.Y0) && (y <= Obj[i].Next.Y1))
+			return i;
+	}
+	return -1;
+}
+
+static uint16_t Comp_Key(int top) {
+	return (top < 0) ? Background_565 : Obj[top].Next_565;
+}
+
+/* Sorted cell boundaries from lo to hi+1: the ends, plus every object edge
+strictly inside. Returns the count, at most 2*LCD_COMP_MAX_OBJS+2. */
+static unsigned Comp_Breaks(int16_t * b, int16_t lo, int16_t hi, int rows) {
+	unsigned n = 2, i, j, k, m;
+	int16_t e[2], v;
+
+	b[0] = lo;
+	b[1] = hi + 1;
+	for (i=0; i<Num_Objs; i++) {
+		if (!Obj[i].Visible)
+			continue;
+		e[0] = rows ? Obj[i].Next.Y0 : Obj[i].Next.X0;
+		e[1] = (rows ? Obj[i].Next.Y1 : Obj[i].Next.X1) + 1;
+		for (k=0; k<2; k++) {
+			v = e[k];
+			if ((v <= lo) || (v > hi))
+				continue;
+			for (j=1; b[j] < v; j++)
+				;
+			if (b[j] == v)
+				continue;
+			for (m=n; m>j; m--) // Open a gap at j
+				b[m] = b[m-1];
+			b[j] = v;
+			n++;
+		}
+	}
+	return n;
+}
+
+static uint32_t Comp_Paint(const RECT_T * d) {
+	int16_t xs[2*LCD_COMP_MAX_OBJS+2], ys[2*LCD_COMP_MAX_OBJS+2];
+	unsigned nx, ny, i, j, run;
+	int top = -1, run_top;
+	uint32_t pixels = 0;
+	PT_T p1, p2;
+
+	nx = Comp_Breaks(xs, d->X0, d->X1, 0);
+	ny = Comp_Breaks(ys, d->Y0, d->Y1, 1);
+	for (j=0; j+1<ny; j++) {
+		// Cells of this band with the same colour go out as one window
+		run = 0;
+		run_top = Comp_Top(xs[0], ys[j]);
+		for (i=1; i<nx; i++) {
+			if (i < nx-1) {
+				top = Comp_Top(xs[i], ys[j]);
+				if (Comp_Key(top) == Comp_Key(run_top))
+					continue;
+			}
+			p1.X = xs[run];
+			p2.X = xs[i] - 1;
+			p1.Y = ys[j];
+			p2.Y = ys[j+1] - 1;
+			LCD_Fill_Rectangle(&p1, &p2, (run_top < 0) ? &Background : &Obj[run_top].Color);
+			pixels += (p2.X - p1.X + 1)*(p2.Y - p1.Y + 1);
+			run = i;
+			run_top = top;
+		}
+	}
+	return pixels;
+}
+
+void LCD_Comp_Init(COLOR_T * background) {
+	Background = *background;
+	Background_565 = LCD_COLOR_565(background);
+	Num_Objs = 0;
+	Num_Dirty = 0;
+}
+
+int LCD_Comp_Add_Rect(PT_T * p1, PT_T * p2, COLOR_T * color) {
+	COMP_OBJ_T * o;
+
+	if (Num_Objs >= LCD_COMP_MAX_OBJS)
+		return -1;
+	o = &Obj[Num_Objs];
+	o->Next = o->Cur = Rect_From_Pts(p1, p2);
+	o->Color = *color;
+	o->Next_565 = o->Cur_565 = LCD_COLOR_565(color);
+	o->Visible = 1;
+	o->Shown = 0;
+	return Num_Objs++;
+}
+
+void LCD_Comp_Move_Rect(int id, PT_T * p1, PT_T * p2) {
+	Obj[id].Next = Rect_From_Pts(p1, p2);
+}
+
+void LCD_Comp_Set_Color(int id, COLOR_T * color) {
+	Obj[id].Color = *color;
+	Obj[id].Next_565 = LCD_COLOR_565(color);
+}
+
+void LCD_Comp_Show(int id, int visible) {
+	Obj[id].Visible = (visible != 0);
+}
+
+uint32_t LCD_Comp_Render(void) {
+	unsigned i;
+	uint32_t pixels = 0;
+	COMP_OBJ_T * o;
+
+	for (i=0; i<Num_Objs; i++) {
+		o = &Obj[i];
+		if ((o->Visible != o->Shown) || (o->Visible && (o->Next_565 != o->Cur_565))) {
+			// Every pixel of the old and new box may change
+			if (o->Shown)
+				Comp_Add_Dirty(o->Cur);
+			if (o->Visible)
+				Comp_Add_Dirty(o->Next);
+		} else if (o->Visible) {
+			// Same colour: only pixels that entered or left the box
+			Comp_Add_Difference(&o->Cur, &o->Next);
+			Comp_Add_Difference(&o->Next, &o->Cur);
+		}
+		o->Cur = o->Next;
+		o->Cur_565 = o->Next_565;
+		o->Shown = o->Visible;
+	}
+	for (i=0; i<Num_Dirty; i++)
+		pixels += Comp_Paint(&Dirty[i]);
+	Num_Dirty = 0;
+	return pixels;
+}
@@ -0,0 +1,36 @@
+#ifndef LCD_COMPOSITOR_H
+#define LCD_COMPOSITOR_H
+
+#include <stdint.h>
+#include "LCD.h"
+
+/*
+ Retained-mode layer for filled rectangles over a solid background, for
+ moving things like the paddle. There is no frame buffer: callers change
+ rectangles, and LCD_Comp_Render works out which pixels can differ from
+ what is on screen and repaints only those.
+
+ A move adds the symmetric difference of the old and new boxes to the
+ frame's dirty list; a colour or visibility change adds both boxes.
+ Overlapping dirty rectangles are merged, as are nearby ones when their
+ bounding box wastes at most LCD_COMP_MERGE_SLACK pixels. Each dirty
+ rectangle is then cut at the object edges inside it into cells of one
+ colour (topmost object, else background), and each row of cells goes
+ out as the fewest CASET/RASET windows. Every pixel is written once.
+
+ Objects stack in the order they were added, later ones on top. Text
+ isn't composited; keep objects clear of text rows.
+*/
+
+#define LCD_COMP_MAX_OBJS (8)
+#define LCD_COMP_MAX_DIRTY (16)
+#define LCD_COMP_MERGE_SLACK (64) // Pixels
+
+void LCD_Comp_Init(COLOR_T * background);
+int LCD_Comp_Add_Rect(PT_T * p1, PT_T * p2, COLOR_T * color); // Object id, or -1 if full. Shown at next render
+void LCD_Comp_Move_Rect(int id, PT_T * p1, PT_T * p2);
+void LCD_Comp_Set_Color(int id, COLOR_T * color);
+void LCD_Comp_Show(int id, int visible);
+uint32_t LCD_Comp_Render(void); // Caller owns the LCD (display thread). Returns pixels written
+
+#endif // LCD_COMPOSITOR_H
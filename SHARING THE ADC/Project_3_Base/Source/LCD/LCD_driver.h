@@ -71,13 +71,18 @@
 
 // Touchscreen Configuration
 #define TS_DELAY (1)
+#define TS_SETTLE_SAMPLES (12) // Control samples (24 kHz) after switching plates, ~0.5 ms
 #define TS_CALIB_SAMPLES (10)
+#define TS_CAL_IF_MISSING (1)  // Calibrate at startup when flash holds none. Holding a press at startup always does
+#define TS_NUM_SAMPLES (5)     // Conversions per axis per read, median taken. 1 to 9
+#define TS_IIR_SHIFT (1)       // Smoothing of scaled position while pressed, 0 for none
+#define TS_MAX_R_TOUCH (384)   // Reject lighter touches: contact resistance in X plates/256, 0 for no check
 
 /**************************************************************/
 #define	GPIO_ResetBit(pos)	(FPTC->PCOR = MASK(pos))
 #define	GPIO_SetBit(pos) 		(FPTC->PSOR = MASK(pos))
-#define GPIO_Write(cmd) 		FPTC->PDOR &= ~LCD_DATA_MASK; \
-														FPTC->PDOR |= (cmd & 0xff) << LCD_DB8_POS;
+// One store: toggle the data bus bits that differ, the rest of port C is untouched
+#define GPIO_Write(cmd) 		(FPTC->PTOR = (FPTC->PDOR ^ (((cmd) & 0xff) << LCD_DB8_POS)) & LCD_DATA_MASK)
 /**************************************************************/
 
 #define LCD_CTRL_INIT_SEQ_END 0
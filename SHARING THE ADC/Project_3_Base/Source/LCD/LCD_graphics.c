@@ -4,152 +4,36 @@
 #include "ST7789.h"
 #include "T6963.h"
 
-#define DRAW_RUNS_AS_LINES (0)
-#define STEP 8
-
 COLOR_T black={0,0,0}, white={255,255,255};
 
-void Graphics_Test(void) {
-	int x, y, r;
-	PT_T p1, p2;
-	COLOR_T c;
-	volatile int n;
-	
-	p1.X = LCD_WIDTH/2;
-	p1.Y = LCD_HEIGHT/2;
-
-	c.R = 100;
-	c.G = 255;
-	c.B = 255;
-
-	LCD_Fill_Buffer(&c);
-	LCD_Refresh();
-
-	c.G = 0;
-	LCD_Fill_Buffer(&c);
-	LCD_Refresh();
-
-	c.G = 255;
-	p1.X = p1.Y = 0;
-	for (x = 0; x<LCD_WIDTH; x++) {
-		p1.X++;
-		if (x&1)
-			p1.Y++;
-		LCD_Plot_Pixel(&p1, &c);
-		LCD_Refresh();
-	}
-	
-	// vertical lines
-	p1.Y = 0;
-	p2.Y = LCD_HEIGHT-1;
-	for (x=0; x<LCD_WIDTH; x += 1) {
-		p1.X = p2.X = x;
-		LCD_Draw_Line(&p1, &p2, &c);
-		LCD_Refresh();
-	}
-	
-	p1.X = LCD_WIDTH/2;
-	p1.Y = LCD_HEIGHT/2;
-	c.G = 0xff;
-
-	// Do circles	
-	// Time filled circles
-	for (r = 100; r>8; r -= 1) {
-		LCD_Draw_Circle(&p1, r, &c, 1);
-		LCD_Refresh();
-		c.B -= 8;
-		c.G ^= 0xff;
-		c.R -= 16;
-	}
-
-	c.G = 100;
-	for (x=0; x<LCD_WIDTH; x += STEP) {
-		p1.X = x+20;
-		LCD_Draw_Circle(&p1, 5 + x/10, &c, 1);
-		LCD_Refresh();
-	}
-	
-	// Time drawing lines radiating from center
-	p1.X = LCD_WIDTH/2;
-	p1.Y = LCD_HEIGHT/2;
-	
-	p2.Y = 0;
-	c.G = 100;
-	for (x=0; x<LCD_WIDTH; x += STEP) {
-		p2.X = x;
-		LCD_Draw_Line(&p1, &p2, &c);
-		LCD_Refresh();
-	}
-	
-	c.G = 100;
-	c.B = 100;
-	c.R = 255;
-	p2.X = LCD_WIDTH-1;
-	for (y=0; y<LCD_HEIGHT; y += STEP) {
-		p2.Y = y;
-		LCD_Draw_Line(&p1, &p2, &c);
-		LCD_Refresh();
-	}
-
-	c.R = 100;
-	c.B = 100;
-	c.G = 255;
-	p2.Y = LCD_HEIGHT-1;
-	for (x=0; x<LCD_WIDTH; x += STEP) {
-		p2.X = x;
-		LCD_Draw_Line(&p1, &p2, &c);
-		LCD_Refresh();
-	}
+/* Draw len pixels from (x, y) as one window and one burst of the colour.
+The run is horizontal in direction dx (+1 or -1), or vertical and going
+down if dx is 0. */
+static void Draw_Run(int x, int y, int len, int dx, COLOR_T * color) {
+	PT_T p, pe;
 
-	c.R = 200;
-	c.B = 100;
-	c.G = 255;
-	p2.X = 0;
-	for (y=0; y<LCD_HEIGHT; y += STEP) {
-		p2.Y = y;
-		LCD_Draw_Line(&p1, &p2, &c);
-		LCD_Refresh();
-	}
-
-#if 0 	
-	// Dither test
-	c.G = 0;
-	LCD_Fill_Buffer(&c);
-	p1.X = 0;
-	p2.X = LCD_WIDTH-1;
-	p1.Y = p2.Y = LCD_HEIGHT/2;
-	n = 0;
-	c.G = 0xff;
-	LCD_Draw_Line(&p1, &p2, &c);
-	LCD_Refresh();
-	p1.Y+=2;
-	p2.Y+=2;
-	while (1) {
-		if (n++ & 1)
-			c.G = 0xff;
-		else 
-			c.G = 0;
-		LCD_Draw_Line(&p1, &p2, &c);
-		LCD_Refresh();
-	}
-#endif
-	
+	if (len <= 0)
+		return;
+	p.X = pe.X = x;
+	p.Y = pe.Y = y;
+	if (dx == 0)
+		pe.Y = y + len - 1;
+	else
+		pe.X = x + dx*(len - 1); // Window corners can be in either order
+	LCD_Start_Rectangle(&p, &pe);
+	LCD_Write_Rectangle_Pixel(color, len);
 }
 
 void LCD_Draw_Line(PT_T * p1, PT_T * p2, COLOR_T * color)
-// Scan line conversion code from Michael Abrash
+// Scan line conversion code from Michael Abrash, each run drawn as one window
 {
-	PT_T p;
-#if DRAW_RUNS_AS_LINES
-	PT_T pe;
-#endif
-	
   int Temp, AdjUp, AdjDown, ErrorTerm, XAdvance, XDelta, YDelta;	 
-  int WholeStep, InitialPixelCount, FinalPixelCount, i,j, RunLength;
+  int WholeStep, InitialPixelCount, FinalPixelCount, i, RunLength;
   int XStart;
   int YStart;
   int XEnd;
   int YEnd;
+  int x, y;
 
   XStart = p1->X;
   YStart = p1->Y;
@@ -185,57 +69,31 @@ void LCD_Draw_Line(PT_T * p1, PT_T * p2, COLOR_T * color)
   ** to avoid nasty boundary conditions and division by 0
   */
 
-	p.X = XStart;
-	p.Y = YStart;
-	 
-  /* Vertical Line case */
+  /* Vertical line: one window */
   if (XDelta == 0) {
-    /* Vertical line */
-#if DRAW_RUNS_AS_LINES
-		pe.X = XEnd;
-		pe.Y = YEnd;
-		LCD_Fill_Rectangle(&p, &pe, color);
-#else		
-    for (i = 0; i <= YDelta; i++) {
-				p.Y++;
-				LCD_Plot_Pixel(&p, color);
-     }
-#endif
+		Draw_Run(XStart, YStart, YDelta + 1, 0, color);
     return;
   }
   
-  /* Horizontal Line Case */
+  /* Horizontal line: one window */
   if (YDelta == 0) {
-    /* Horizontal line */
-#if DRAW_RUNS_AS_LINES
-		pe.X = XEnd;
-		pe.Y = YEnd;
-		LCD_Fill_Rectangle(&p, &pe, color);
-#else
-    for (i = 0; i <= XDelta; i++) {
-				LCD_Plot_Pixel(&p, color);
-				p.X += XAdvance;
-    }  
-#endif
+		Draw_Run(XStart, YStart, XDelta + 1, XAdvance, color);
     return;
   }
    
-  /* Diagonal Case */
+  /* Diagonal line: every run is one pixel */
   if (XDelta == YDelta) {
-    /* Diagonal line */
-    for (i = 0; i <= XDelta; i++)
-      {
-				LCD_Plot_Pixel(&p, color);
-				p.X += XAdvance;
-				p.Y++;
-      }
+		x = XStart;
+    for (y = YStart; y <= YEnd; y++) {
+			Draw_Run(x, y, 1, XAdvance, color);
+			x += XAdvance;
+		}
     return;
   }
    
-   
   /* Determine whether the line is X or Y major, and handle accordingly */
   if (XDelta >= YDelta) {
-    /* X major line */
+    /* X major line, runs are horizontal */
     /* Minimum # of pixels in a run in this line */
     WholeStep = XDelta / YDelta;													/* DIV */
     
@@ -277,24 +135,11 @@ void LCD_Draw_Line(PT_T * p1, PT_T * p2, COLOR_T * color)
       ErrorTerm += YDelta;
     
     /* Draw the first, partial run of pixels */
-		#if DRAW_RUNS_AS_LINES // TODO: Fixing here
-		p.X = XStart;
-		p.Y = pe.Y = YStart;
-		if (XAdvance > 0) {
-			pe.X = XStart + InitialPixelCount;
-			LCD_Fill_Rectangle(&p, &pe, color);
-		} else {
-			pe.X = XStart - InitialPixelCount;
-			LCD_Fill_Rectangle(&pe, &p, color);
-		}
-		p.X = pe.X;
-#else
-    for (j = 0; j < InitialPixelCount; j++) {
-			LCD_Plot_Pixel(&p, color);
-			p.X += XAdvance;
-		}
-#endif
-    p.Y++;
+		x = XStart;
+		y = YStart;
+		Draw_Run(x, y, InitialPixelCount, XAdvance, color);
+		x += XAdvance*InitialPixelCount;
+    y++;
     
     /* Draw all full runs */
     for (i = 0; i < (YDelta - 1); i++) {
@@ -308,37 +153,16 @@ void LCD_Draw_Line(PT_T * p1, PT_T * p2, COLOR_T * color)
 			}
 
 			/* Draw this scan line's run */
-#if DRAW_RUNS_AS_LINES
-			pe.Y = p.Y;
-			pe.X = p.X + RunLength;
-			LCD_Fill_Rectangle(&p, &pe, color);
-			p.X = pe.X;
-#else
-			for (j = 0; j < RunLength; j++) {
-				LCD_Plot_Pixel(&p, color);
-				p.X += XAdvance;
-			}
-#endif
-			p.Y++;
+			Draw_Run(x, y, RunLength, XAdvance, color);
+			x += XAdvance*RunLength;
+			y++;
 		}
     
     /* Draw the final run of pixels */
-#if DRAW_RUNS_AS_LINES
-		pe.Y = p.Y;
-		pe.X = pe.X + FinalPixelCount;
-		LCD_Fill_Rectangle(&p, &pe, color);
-		p.X = pe.X;
-#else
-    for (j = 0; j < FinalPixelCount; j++) {
-			LCD_Plot_Pixel(&p, color);
-			p.X += XAdvance;
-		}
-#endif
-    p.Y++;
-    
+		Draw_Run(x, y, FinalPixelCount, XAdvance, color);
     return;
   } else {
-    /* Y major line */
+    /* Y major line, runs are vertical */
     
     /* Minimum # of pixels in a run in this line */
     WholeStep = YDelta / XDelta;										/* DIV */
@@ -383,19 +207,12 @@ void LCD_Draw_Line(PT_T * p1, PT_T * p2, COLOR_T * color)
 			}
       
       /* Draw the first, partial run of pixels */
-#if DRAW_RUNS_AS_LINES
-			p.X = pe.X = XStart;
-			p.Y = YStart;
-			pe.Y = YStart + InitialPixelCount;
-			LCD_Fill_Rectangle(&p, &pe, color);
-#else
-      for (j = 0; j < InitialPixelCount; j++) {
-				LCD_Plot_Pixel(&p, color);
-				p.Y++;
-			}
+			x = XStart;
+			y = YStart;
+			Draw_Run(x, y, InitialPixelCount, 0, color);
+			y += InitialPixelCount;
       /* Update x,y position */
-      p.X += XAdvance;
-#endif
+      x += XAdvance;
       
       /* Draw all full runs */
       for (i = 0; i < (XDelta - 1); i++) {
@@ -410,85 +227,68 @@ void LCD_Draw_Line(PT_T * p1, PT_T * p2, COLOR_T * color)
 				}
 				
 				/* Draw this scan line's run */
-#if DRAW_RUNS_AS_LINES
-				p.X = pe.X = XStart;
-				p.Y = YStart;
-				pe.Y = YStart + RunLength;
-				LCD_Fill_Rectangle(&p, &pe, color);
-#else
-				for (j = 0; j < RunLength; j++) {
-					LCD_Plot_Pixel(&p, color);
-					p.Y++;
-				}
+				Draw_Run(x, y, RunLength, 0, color);
+				y += RunLength;
 				/* Update x,y position */
-				p.X += XAdvance;
-#endif
+				x += XAdvance;
 			}
       
       /* Draw the final run of pixels */
-#if DRAW_RUNS_AS_LINES
-			p.X = pe.X= XStart;
-			p.Y = YStart;
-			pe.Y = YStart + FinalPixelCount;
-			LCD_Fill_Rectangle(&p, &pe, color);
-#else
-      for (j= 0; j < FinalPixelCount; j++) {
-				LCD_Plot_Pixel(&p, color);
-				p.Y++;
-			}
-      /* Update x,y position */
-      p.X += XAdvance;
-#endif    
+			Draw_Run(x, y, FinalPixelCount, 0, color);
       return;
 	}
 }
 
-/* Draw a circle at coordinates xm, ym with radius r and specified color c. */
-void LCD_Draw_Circle(PT_T * pc, int radius, COLOR_T * c, int filled) {
-	PT_T p1, p2;
-  int x = -radius, y = 0, err = 2-2*radius; /* II. Quadrant */ 
-  if (filled>0) { 
-		do {
-      //setPixel(xm+x, ym-y); /* III. Quadrant */
-		 	p1.X=pc->X+x;
-			p1.Y=pc->Y-y;
-			p2.X=pc->X-x;
-			p2.Y=pc->Y-y;
-			LCD_Draw_Line(&p1, &p2, c);
-			p1.Y=pc->Y+y;
-			p2.Y=pc->Y+y;
-			LCD_Draw_Line(&p1, &p2, c);
+/* One step's worth of a circle: the points (a..b, y) of the first octant,
+mirrored into all eight. Each mirror of the run is a row or column run. */
+static void Circle_Runs(PT_T * pc, int a, int b, int y, COLOR_T * c, int filled) {
+	int cx = pc->X, cy = pc->Y, n = b - a + 1, k;
 
-			radius = err;
-      if (radius <= y) 
-				err += ++y*2+1;           /* e_xy+e_y < 0 */
-      if (radius > x || err > y) 
-				err += ++x*2+1; /* e_xy+e_x > 0 or no 2nd y-step */
-		} while (x < 0); 
- } else {
-		do {
-      //setPixel(xm-x, ym+y); /*   I. Quadrant */
-			p1.X=pc->X-x;
-			p1.Y=pc->Y+y;
-			LCD_Plot_Pixel(&p1,c);
-      //setPixel(xm-y, ym-x); /*  II. Quadrant */
-		 	p1.X=pc->X-y;
-			p1.Y=pc->Y-x;
-			LCD_Plot_Pixel(&p1,c);
-      //setPixel(xm+x, ym-y); /* III. Quadrant */
-		 	p1.X=pc->X+x;
-			p1.Y=pc->Y-y;
-			LCD_Plot_Pixel(&p1,c);
-      //setPixel(xm+y, ym+x); /*  IV. Quadrant */
-		 	p1.X=pc->X+y;
-			p1.Y=pc->Y+x;
-			LCD_Plot_Pixel(&p1,c);
-      radius = err;
-      if (radius <= y) err += ++y*2+1;           /* e_xy+e_y < 0 */
-      if (radius > x || err > y) 
-				err += ++x*2+1; /* e_xy+e_x > 0 or no 2nd y-step */
-		} while (x < 0);
+	if (filled) {
+		// Rows cy+-y span +-b; rows cy+-k span +-y
+		Draw_Run(cx - b, cy + y, 2*b + 1, 1, c);
+		if (y != 0)
+			Draw_Run(cx - b, cy - y, 2*b + 1, 1, c);
+		for (k = a; k <= b; k++) {
+			if (k == y)
+				continue; // Row already drawn above
+			Draw_Run(cx - y, cy + k, 2*y + 1, 1, c);
+			if (k != 0)
+				Draw_Run(cx - y, cy - k, 2*y + 1, 1, c);
+		}
+	} else {
+		Draw_Run(cx + a, cy + y, n, 1, c);
+		Draw_Run(cx - b, cy + y, n, 1, c);
+		Draw_Run(cx + a, cy - y, n, 1, c);
+		Draw_Run(cx - b, cy - y, n, 1, c);
+		Draw_Run(cx + y, cy + a, n, 0, c);
+		Draw_Run(cx + y, cy - b, n, 0, c);
+		Draw_Run(cx - y, cy + a, n, 0, c);
+		Draw_Run(cx - y, cy - b, n, 0, c);
 	}
 }
 
+/* Draw a circle at coordinates xm, ym with radius r and specified color c.
+Midpoint algorithm over the first octant (x from 0 up to y); the points
+that share a y go out together as runs, each one window, and a filled
+circle is one span per scanline. */
+void LCD_Draw_Circle(PT_T * pc, int radius, COLOR_T * c, int filled) {
+	int x = 0, y = radius, d = 1 - radius, x0 = 0, step;
 
+	while (x <= y) {
+		if (d < 0) {
+			d += 2*x + 3;
+			step = 0;
+		} else {
+			d += 2*(x - y) + 5;
+			step = 1;
+		}
+		if (step || (x + 1 > y)) {
+			// y changes next (or the octant ends), so the run x0..x is complete
+			Circle_Runs(pc, x0, x, y, c, filled > 0);
+			x0 = x + 1;
+		}
+		x++;
+		y -= step;
+	}
+}
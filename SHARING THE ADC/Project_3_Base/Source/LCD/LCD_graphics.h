@@ -12,7 +12,6 @@ typedef struct {
 									 // Values are left aligned here
 } COLOR_T;
 
-void Graphics_Test(void);
 void DrawLine(PT_T * p1, PT_T * p2, COLOR_T * color);
 
 #define STEP 8
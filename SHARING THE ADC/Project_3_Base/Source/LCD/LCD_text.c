@@ -1,9 +1,11 @@
+#include <stddef.h>
 #include "font.h"
 #include "LCD.h"
 #include "LCD_driver.h"
 
 #include "ST7789.h"
 #include "T6963.h"
+#include "LCD_benchmark.h"
 
 #include "delay.h"
 
@@ -12,16 +14,133 @@ FONT_HEADER_T * font_header;
 GLYPH_INDEX_T * glyph_index; 
 
 COLOR_T fg, bg;
+static uint16_t fg_565, bg_565;
+
+#if LCD_GLYPH_CACHE
+typedef struct {
+	char Ch;
+	uint8_t Num_Runs; // 0: entry unused
+	uint32_t Last_Use;
+	uint8_t Runs[GLYPH_CACHE_MAX_RUNS]; // bg first, then alternating fg, bg, ...
+} GLYPH_CACHE_T;
+
+static GLYPH_CACHE_T Glyph_Cache[GLYPH_CACHE_ENTRIES];
+static uint32_t Glyph_Cache_Clock;
+uint32_t Glyph_Cache_Hits, Glyph_Cache_Misses;
+#endif
+
+#if LCD_TEXT_SHADOW
+#if LCD_WIDTH > 255
+#error "Text shadow keeps X in a byte"
+#endif
+typedef struct {
+	char Ch;      // 0: unknown, print it
+	uint8_t X;
+	uint8_t Attr; // Colour pair, and TEXT_CELL_TAIL if last of its string
+} TEXT_CELL_T;
+
+#define TEXT_CELL_TAIL (0x80) // Whole CHAR_WIDTH cell is this glyph's, else just its advance
+
+static TEXT_CELL_T Shadow[TEXT_SHADOW_ROWS][TEXT_SHADOW_COLS];
+static uint16_t Pair_fg_565[TEXT_SHADOW_COLORS], Pair_bg_565[TEXT_SHADOW_COLORS];
+static uint8_t Num_Pairs, Next_Pair, Cur_Pair;
+#endif
 
 uint8_t G_LCD_char_width, G_LCD_char_height;
 
 // ROM Size Reduction: only include name(s) of fonts to use here!
+#if USE_LCD_BENCHMARK
+const uint8_t * fonts[] = {Lucida_Console8x13, Lucida_Console12x19, Lucida_Console20x31}; // Benchmark times each font
+#else
 const uint8_t * fonts[] = {0, Lucida_Console12x19, 0}; 
 // const uint8_t * fonts[] = {Lucida_Console8x13, Lucida_Console12x19, Lucida_Console20x31}; // Full font set
+#endif
 
 const uint8_t char_widths[] = {8, 12, 20};
 const uint8_t char_heights[] = {13, 19, 31};
 
+// Distance to the next character's position
+static uint32_t Text_Advance(char ch) {
+#if FORCE_MONOSPACE
+	return CHAR_WIDTH; // forces monospacing for fonts
+#else
+	if (ch == ' ')
+		return CHAR_WIDTH; // Increase width for space character!
+	else
+		return glyph_index[(uint8_t) (ch - font_header->FirstChar)].Width+1; // add a pixel of padding 
+#endif
+}
+
+#if LCD_TEXT_SHADOW
+/* A cell owns the pixels from its X to the next character of its string,
+or its whole CHAR_WIDTH cell if it ended the string. Forget the cells of
+row that own any of columns x0 to x1. */
+static void Text_Shadow_Forget(uint32_t row, int32_t x0, int32_t x1) {
+	TEXT_CELL_T * cell;
+	int32_t end;
+	uint32_t c;
+
+	for (c=0; c<TEXT_SHADOW_COLS; c++) {
+		cell = &Shadow[row][c];
+		if (cell->Ch == 0)
+			continue;
+		end = cell->X + ((cell->Attr & TEXT_CELL_TAIL) ? CHAR_WIDTH : Text_Advance(cell->Ch)) - 1;
+		if ((cell->X <= x1) && (end >= x0))
+			cell->Ch = 0;
+	}
+}
+
+/* Colours are part of a cell's contents. Pairs get small ids; when they
+run out, the oldest id is reused and the cells drawn with it forgotten. */
+static void Text_Shadow_Select_Pair(void) {
+	uint32_t i, r, c;
+
+	for (i=0; i<Num_Pairs; i++) {
+		if ((Pair_fg_565[i] == fg_565) && (Pair_bg_565[i] == bg_565)) {
+			Cur_Pair = i;
+			return;
+		}
+	}
+	if (Num_Pairs < TEXT_SHADOW_COLORS) {
+		i = Num_Pairs++;
+	} else {
+		i = Next_Pair;
+		Next_Pair = (Next_Pair + 1) % TEXT_SHADOW_COLORS;
+		for (r=0; r<TEXT_SHADOW_ROWS; r++) {
+			for (c=0; c<TEXT_SHADOW_COLS; c++) {
+				if ((Shadow[r][c].Attr & ~TEXT_CELL_TAIL) == i)
+					Shadow[r][c].Ch = 0;
+			}
+		}
+	}
+	Pair_fg_565[i] = fg_565;
+	Pair_bg_565[i] = bg_565;
+	Cur_Pair = i;
+}
+#endif
+
+void LCD_Text_Invalidate(void) {
+#if LCD_TEXT_SHADOW
+	uint32_t r, c;
+
+	for (r=0; r<TEXT_SHADOW_ROWS; r++) {
+		for (c=0; c<TEXT_SHADOW_COLS; c++)
+			Shadow[r][c].Ch = 0;
+	}
+#endif
+}
+
+void LCD_Text_Invalidate_Rect(PT_T * p1, PT_T * p2) {
+#if LCD_TEXT_SHADOW
+	int32_t r, r1;
+
+	r = MAX(0, MIN(p1->Y, p2->Y))/CHAR_HEIGHT;
+	r1 = MIN(MAX(p1->Y, p2->Y)/CHAR_HEIGHT, TEXT_SHADOW_ROWS-1);
+	for (; r<=r1; r++)
+		Text_Shadow_Forget(r, MIN(p1->X, p2->X), MAX(p1->X, p2->X));
+#endif
+}
+
 uint8_t Bit_Reverse_Byte(uint8_t v) {
 // http://graphics.stanford.edu/~seander/bithacks.html#BitReverseObvious
 	// v: input bits to be reversed
@@ -45,34 +164,29 @@ void LCD_Text_Set_Colors(COLOR_T * foreground, COLOR_T * background) {
 	bg.R = background->R;
 	bg.G = background->G;
 	bg.B = background->B;
+	fg_565 = LCD_COLOR_565(&fg);
+	bg_565 = LCD_COLOR_565(&bg);
+#if LCD_TEXT_SHADOW
+	Text_Shadow_Select_Pair();
+#endif
 }
 
 void LCD_Erase(void) {
 	LCD_Fill_Buffer(&bg);
+	LCD_Text_Invalidate();
 }
 
 void LCD_Text_Init(uint8_t font_num) {
+#if LCD_GLYPH_CACHE
+	int i;
+#endif
 	
-#if 0  // Code for multiple fonts not working yet
+	// Fonts left out of fonts[] fall back to 12x19
+	if ((font_num >= sizeof(char_widths)) || (fonts[font_num] == 0))
+		font_num = 1;
 	font = fonts[font_num];
 	G_LCD_char_width = char_widths[font_num];
 	G_LCD_char_height = char_heights[font_num];
-#endif
-	
-//#if 0 // This code is not working
-//	font = Lucida_Console20x31;
-//	G_LCD_char_width = 20;
-//	G_LCD_char_height = 31;
-	
-#if 1 // This code is working
-	font = Lucida_Console12x19;
-	G_LCD_char_width = 12;
-	G_LCD_char_height = 19;
-#else
-	font = Lucida_Console8x13;
-	G_LCD_char_width = 8;
-	G_LCD_char_height = 13;
-#endif
 	
 	font_header = (FONT_HEADER_T *) font;
 	glyph_index = (GLYPH_INDEX_T *) (font + sizeof(FONT_HEADER_T));
@@ -85,6 +199,18 @@ void LCD_Text_Init(uint8_t font_num) {
 	bg.R = 0;
 	bg.G = 0;
 	bg.B = 0;
+	fg_565 = LCD_COLOR_565(&fg);
+	bg_565 = LCD_COLOR_565(&bg);
+#if LCD_TEXT_SHADOW
+	Num_Pairs = Next_Pair = 0;
+	Text_Shadow_Select_Pair();
+	LCD_Text_Invalidate(); // Cells depend on the font
+#endif
+
+#if LCD_GLYPH_CACHE
+	for (i=0; i<GLYPH_CACHE_ENTRIES; i++)
+		Glyph_Cache[i].Num_Runs = 0; // Runs depend on the font
+#endif
 }
 
 uint8_t LCD_Text_GetGlyphWidth(char ch) {
@@ -93,6 +219,66 @@ uint8_t LCD_Text_GetGlyphWidth(char ch) {
 	glyph_index_entry = ch - font_header->FirstChar;
 	return glyph_index[glyph_index_entry].Width;
 }
+#if LCD_GLYPH_CACHE
+/* Scan the glyph's cell in raster order (the order LCD_Text_PrintChar
+writes it) into runs of one colour. Runs carry on across rows. Returns
+the number of runs, or 0 if more than max are needed. */
+static uint32_t Glyph_Runs(char ch, uint8_t * runs, uint32_t max) {
+	GLYPH_INDEX_T * gi = &glyph_index[(uint8_t) (ch - font_header->FirstChar)];
+	const uint8_t * glyph_data = &(font[gi->Offset]);
+	uint32_t row, x, width = gi->Width, bytes_per_row, n = 0, cur = 0, len = 0, bit;
+
+	bytes_per_row = (width > 0) ? (width + 7)/8 : 1;
+	for (row = 0; row < CHAR_HEIGHT; row++) {
+		for (x = 0; x < MAX(width, CHAR_WIDTH); x++) {
+			bit = (x < width) ? ((glyph_data[x/8] >> (x & 7)) & 1) : 0; // LSB is leftmost
+			if ((bit != cur) || (len == 255)) {
+				// Close the run. A full one is followed by an empty run of the other colour.
+				if (n + 2 > max)
+					return 0;
+				runs[n++] = len;
+				if (bit == cur)
+					runs[n++] = 0;
+				else
+					cur = bit;
+				len = 0;
+			}
+			len++;
+		}
+		glyph_data += bytes_per_row;
+	}
+	if (n >= max)
+		return 0;
+	runs[n++] = len;
+	return n;
+}
+
+// Entry holding ch's runs, built on a miss. NULL if the glyph has too many runs.
+static GLYPH_CACHE_T * Glyph_Cache_Lookup(char ch) {
+	GLYPH_CACHE_T * e, * victim = &Glyph_Cache[0];
+	int i;
+
+	Glyph_Cache_Clock++;
+	for (i=0; i<GLYPH_CACHE_ENTRIES; i++) {
+		e = &Glyph_Cache[i];
+		if ((e->Num_Runs > 0) && (e->Ch == ch)) {
+			Glyph_Cache_Hits++;
+			e->Last_Use = Glyph_Cache_Clock;
+			return e;
+		}
+		if ((victim->Num_Runs > 0) && ((e->Num_Runs == 0) || (e->Last_Use < victim->Last_Use)))
+			victim = e; // Empty entry, else least recently used
+	}
+	Glyph_Cache_Misses++;
+	victim->Num_Runs = Glyph_Runs(ch, victim->Runs, GLYPH_CACHE_MAX_RUNS);
+	if (victim->Num_Runs == 0)
+		return NULL;
+	victim->Ch = ch;
+	victim->Last_Use = Glyph_Cache_Clock;
+	return victim;
+}
+#endif
+
 void LCD_Text_PrintChar(PT_T * pos, char ch) {
 	uint8_t glyph_index_entry;
 	const uint8_t * glyph_data; // start of the data
@@ -105,6 +291,9 @@ void LCD_Text_PrintChar(PT_T * pos, char ch) {
 	uint8_t glyph_width, x_bm;
 	uint32_t offset;
 	uint32_t row, col, num_pixels;
+#if (BITS_PER_PIXEL != 1) && LCD_GLYPH_CACHE
+	GLYPH_CACHE_T * cached;
+#endif
 	
 	glyph_index_entry = ch - font_header->FirstChar;
 	glyph_width = glyph_index[glyph_index_entry].Width;
@@ -150,6 +339,14 @@ void LCD_Text_PrintChar(PT_T * pos, char ch) {
 
 	LCD_Start_Rectangle(pos, &end_pos); 
 
+#if LCD_GLYPH_CACHE
+	cached = Glyph_Cache_Lookup(ch);
+	if (cached != NULL) {
+		LCD_Write_Rectangle_Runs(cached->Runs, cached->Num_Runs, bg_565, fg_565);
+		return;
+	}
+#endif
+
 	for (row = 0; row < CHAR_HEIGHT; row++) {
 		x_bm = 0; // x position within glyph bitmap, can span bytes 
 		do {
@@ -219,38 +416,57 @@ void LCD_Text_PrintChar(PT_T * pos, char ch) {
 }
 
 void LCD_Text_PrintStr(PT_T * pos, char * str) {
+	LCD_Refresh_Defer(); // One refresh for the string, not one per character
 	while (*str) {
 		LCD_Text_PrintChar(pos, *str);
-#if FORCE_MONOSPACE
-		pos->X += CHAR_WIDTH; // forces monospacing for fonts
-#else
-		if (*str == ' ')
-			pos->X += CHAR_WIDTH; // Increase width for space character!
-		else
-			pos->X += LCD_Text_GetGlyphWidth(*str)+1; // add a pixel of padding 
-#endif
+		pos->X += Text_Advance(*str);
 		str++;
 	}
+	LCD_Refresh_Resume();
 }
 
+/* With the shadow, a character is skipped if its cell already shows it
+at the same place in the same colours. Drawing one overwrites its whole
+CHAR_WIDTH cell, so the characters that start inside it are drawn too. */
 void LCD_Text_PrintStr_RC( uint8_t  row, uint8_t  col, char  *str )
 {
 	PT_T pos;
+#if LCD_TEXT_SHADOW
+	TEXT_CELL_T * cell;
+	int32_t drawn_to = -1; // Last column written by this string so far
+	uint32_t c = col;
+	uint8_t attr;
+#endif
 	pos.X = COL_TO_X( col );
 	pos.Y = ROW_TO_Y( row );
+	LCD_Refresh_Defer(); // One refresh for the string, not one per character
 	while( *str )
 	{
-		LCD_Text_PrintChar( &pos, *str );
-#if FORCE_MONOSPACE
-		pos.X += CHAR_WIDTH; // forces monospacing for fonts
+#if LCD_TEXT_SHADOW
+		cell = ((row < TEXT_SHADOW_ROWS) && (c < TEXT_SHADOW_COLS)) ? &Shadow[row][c] : NULL;
+		attr = Cur_Pair | ((str[1] == 0) ? TEXT_CELL_TAIL : 0);
+		if ((cell != NULL) && (cell->Ch == *str) && (cell->X == pos.X) && (pos.X > drawn_to) &&
+			((cell->Attr & ~TEXT_CELL_TAIL) == Cur_Pair) && ((cell->Attr & attr & TEXT_CELL_TAIL) == (attr & TEXT_CELL_TAIL))) {
+			cell->Attr = attr; // Pixels beyond the new advance now belong to the next character
+		} else {
+			LCD_Text_PrintChar( &pos, *str );
+			drawn_to = pos.X + CHAR_WIDTH - 1;
+			if (row < TEXT_SHADOW_ROWS)
+				Text_Shadow_Forget(row, pos.X, drawn_to);
+			if ((cell != NULL) && (pos.X < LCD_WIDTH)) {
+				cell->Ch = *str;
+				cell->X = pos.X;
+				cell->Attr = attr;
+			}
+		}
+		c++;
 #else
-		if (*str == ' ')
-			pos.X += CHAR_WIDTH; // Increase width for space character!
-		else
-			pos.X += LCD_Text_GetGlyphWidth(*str)+1; // add a pixel of padding 
-#endif		
+		LCD_Text_PrintChar( &pos, *str );
+#endif
+		pos.X += Text_Advance(*str);
 		str++;
 	}
+	LCD_Refresh_Resume();
 }
 
  void LCD_Text_Test(void) {
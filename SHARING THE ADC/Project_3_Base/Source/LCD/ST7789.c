@@ -17,7 +17,7 @@
 
 #include "ST7789.h"
 
-extern void Delay(uint32_t);
+#include "delay.h"
 
 const LCD_CTLR_INIT_SEQ_T Init_Seq_ILI9341[] = {
 	{LCD_CTRL_INIT_SEQ_CMD, 0x28}, 	
@@ -106,6 +106,7 @@ void LCD_GPIO_Init(void) {
 
 /* Initialize hardware for LCD backlight control and set to default value. */
 static void LCD_Init_Backlight(void) {
+	Timer_Claim_TPM(LCD_BL_TPM, "LCD backlight");
 	PWM_Init(LCD_BL_TPM, LCD_BL_TPM_CHANNEL, LCD_BL_PERIOD, LCD_BL_PERIOD/3, 1, 0);	
 	//set multiplexer to connect TPM1 Ch 0 to PTA12
 	PORTA->PCR[12] &= PORT_PCR_MUX_MASK; 
@@ -119,9 +120,47 @@ void LCD_Set_Backlight_Brightness(uint32_t brightness_percent){
 	PWM_Set_Value(LCD_BL_TPM, LCD_BL_TPM_CHANNEL, (brightness_percent*LCD_BL_PERIOD)/100);
 }
 
+/* Pixel path. Data is latched on the rising edge of /WR; the /WR cycle
+must be at least 66 ns, four core clocks at 48 MHz with single cycle
+FGPIO stores. */
+#define LCD_WR_STROBE() { FPTC->PCOR = MASK(LCD_NWR_POS); FPTC->PSOR = MASK(LCD_NWR_POS); }
+// Pixel bytes alternate b1, b2, so flipping the bits that differ gives the next byte
+#define LCD_PIXEL(t) { LCD_WR_STROBE(); FPTC->PTOR = (t); __NOP(); \
+	LCD_WR_STROBE(); FPTC->PTOR = (t); __NOP(); }
+
+/* Send count pixels of one 5-6-5 colour (b1 high byte) after a Memory Write
+command. D/C is set once and the bus changes with one toggle per byte. */
+static __inline void LCD_24S_Write_Pixels(uint8_t b1, uint8_t b2, uint32_t count)
+{
+	uint32_t t = ((uint32_t) (b1 ^ b2)) << LCD_DB8_POS;
+
+	GPIO_SetBit(LCD_D_NC_POS);
+	GPIO_Write(b1);
+	while (count >= 4) {
+		LCD_PIXEL(t);
+		LCD_PIXEL(t);
+		LCD_PIXEL(t);
+		LCD_PIXEL(t);
+		count -= 4;
+	}
+	while (count-- > 0) {
+		LCD_PIXEL(t);
+	}
+}
+
+/* The controller's address window, as last set, and its write pointer.
+Redundant CASET/RASET commands are skipped. The pointer is only followed
+through Plot_Pixel and span writes, so those can carry on without any
+command; other pixel writes leave it unknown. */
+static uint16_t Win_C0, Win_C1, Win_R0, Win_R1;
+static uint16_t Ptr_X, Ptr_Y;
+static uint8_t Ptr_Valid; // In a memory write, next pixel goes to Ptr_X, Ptr_Y
+static uint16_t Last_X, Last_Y; // Last pixel plotted
+
 /* Write one byte as a command to the TFT LCD controller. */
 static void LCD_24S_Write_Command(uint8_t command)
 {
+	Ptr_Valid = 0; // Any command ends a memory write
 	GPIO_ResetBit(LCD_D_NC_POS);
 	GPIO_Write(command);
 	GPIO_ResetBit(LCD_NWR_POS);
@@ -142,10 +181,11 @@ void LCD_Controller_Init(const LCD_CTLR_INIT_SEQ_T init_seq[]) {
 	
 	GPIO_SetBit(LCD_NRD_POS);
 	GPIO_ResetBit(LCD_NWR_POS);
+	// Reset waits sleep when called from a thread, so other bring-up overlaps them
 	GPIO_ResetBit(LCD_NRST_POS);
-	Delay(100);
+	Wait_ms(100);
 	GPIO_SetBit(LCD_NRST_POS);
-	Delay(100);
+	Wait_ms(100);
 	
 	while (!done) {
 		switch (init_seq[i].Type) {
@@ -163,7 +203,54 @@ void LCD_Controller_Init(const LCD_CTLR_INIT_SEQ_T init_seq[]) {
 		}
 		i++;
 	}
-	Delay(10);
+	// Init sequences end with the full screen window
+	Win_C0 = Win_R0 = 0;
+	Win_C1 = LCD_WIDTH-1;
+	Win_R1 = LCD_HEIGHT-1;
+	Wait_ms(10);
+}
+
+/* Set the address window, sending CASET and RASET only if they change,
+and start a memory write at its top left corner. */
+static void LCD_Set_Window(uint16_t c_min, uint16_t c_max, uint16_t r_min, uint16_t r_max) {
+	if ((c_min != Win_C0) || (c_max != Win_C1)) {
+		LCD_24S_Write_Command(0x002A); //column address set
+		LCD_24S_Write_Data(c_min >> 8);
+		LCD_24S_Write_Data(c_min & 0xff); //start 
+		LCD_24S_Write_Data(c_max >> 8);
+		LCD_24S_Write_Data(c_max & 0xff); //end 
+		Win_C0 = c_min;
+		Win_C1 = c_max;
+	}
+	if ((r_min != Win_R0) || (r_max != Win_R1)) {
+		LCD_24S_Write_Command(0x002B); //page address set
+		LCD_24S_Write_Data(r_min >> 8);
+		LCD_24S_Write_Data(r_min & 0xff); //start 
+		LCD_24S_Write_Data(r_max >> 8);
+		LCD_24S_Write_Data(r_max & 0xff); //end 
+		Win_R0 = r_min;
+		Win_R1 = r_max;
+	}
+	// Memory Write 0x2c
+	LCD_24S_Write_Command(0x002c);
+	Ptr_X = c_min;
+	Ptr_Y = r_min;
+	Ptr_Valid = 1;
+}
+
+// Is the write pointer at (x, y), with room for count pixels before the window edge?
+static __inline int LCD_Ptr_At(uint32_t x, uint32_t y, uint32_t count) {
+	return Ptr_Valid && (x == Ptr_X) && (y == Ptr_Y) && (count <= Win_C1 - x + 1);
+}
+
+// Follow the pointer over count pixels, which don't go past the window edge
+static __inline void LCD_Ptr_Advance(uint32_t count) {
+	Ptr_X += count;
+	if (Ptr_X > Win_C1) {
+		Ptr_X = Win_C0;
+		if (++Ptr_Y > Win_R1)
+			Ptr_Y = Win_R0;
+	}
 }
 
 /* Initialize the relevant peripherals (GPIO, TPM, ADC) and the display
@@ -182,63 +269,60 @@ void LCD_Init(void)
 	
 }
 
-/* Set the pixel at pos to the given color. */
+/* Set the pixel at pos to the given color. The pixel to its right, or
+below it when going down a column, then needs no address commands. */
 void LCD_Plot_Pixel(PT_T * pos, COLOR_T * color) {
 	uint8_t b1, b2;
 
-	// Column address set 0x2a
-	LCD_24S_Write_Command(0x002A); //column address set
-	LCD_24S_Write_Data(0);
-	LCD_24S_Write_Data(pos->X & 0xff); //start 
-	LCD_24S_Write_Data(0x0000);
-	LCD_24S_Write_Data(0x00EF); //end 0x00EF
-	
-	// Page (row) address set 0x2b
-	LCD_24S_Write_Command(0x002B); //page address set
-	LCD_24S_Write_Data(pos->Y >> 8);
-	LCD_24S_Write_Data(pos->Y & 0xff); //start 
-	LCD_24S_Write_Data(0x0001);
-	LCD_24S_Write_Data(0x003F); //end 0x013F	
+	if ((pos->X >= LCD_WIDTH) || (pos->Y >= LCD_HEIGHT))
+		return;
+	if (!LCD_Ptr_At(pos->X, pos->Y, 1)) {
+		if ((pos->X == Last_X) && (pos->Y == Last_Y + 1))
+			LCD_Set_Window(pos->X, pos->X, pos->Y, LCD_HEIGHT-1); // One column wide, so the pointer goes down
+		else
+			LCD_Set_Window(pos->X, LCD_WIDTH-1, pos->Y, LCD_HEIGHT-1);
+	}
 	
-	// Memory Write 0x2c
 	// 16 bpp, 5-6-5. Assume color channel data is left-aligned
 	b1 = (color->R&0xf8) | ((color->G&0xe0)>>5);
 	b2 = ((color->G&0x1c)<<3) | ((color->B&0xf8)>>3);
+	LCD_24S_Write_Pixels(b1, b2, 1);
+	LCD_Ptr_Advance(1);
+	Last_X = pos->X;
+	Last_Y = pos->Y;
+}
 
-	LCD_24S_Write_Command(0x002c);
-	LCD_24S_Write_Data(b1);
-	LCD_24S_Write_Data(b2);
+/* Write count pixels of color going right from pos. A span starting where
+the last one (or the last plotted pixel) left off needs no commands. */
+void LCD_Write_Span(PT_T * pos, uint32_t count, COLOR_T * color) {
+	uint8_t b1, b2;
+
+	if ((pos->X >= LCD_WIDTH) || (pos->Y >= LCD_HEIGHT) || (count == 0))
+		return;
+	count = MIN(count, LCD_WIDTH - pos->X);
+	if (!LCD_Ptr_At(pos->X, pos->Y, count))
+		LCD_Set_Window(pos->X, LCD_WIDTH-1, pos->Y, LCD_HEIGHT-1);
+
+	// 16 bpp, 5-6-5. Assume color channel data is left-aligned
+	b1 = (color->R&0xf8) | ((color->G&0xe0)>>5);
+	b2 = ((color->G&0x1c)<<3) | ((color->B&0xf8)>>3);
+	LCD_24S_Write_Pixels(b1, b2, count);
+	LCD_Ptr_Advance(count);
 }
 
 /* Fill the entire display buffer with the given color. */
 void LCD_Fill_Buffer(COLOR_T * color) {
-	uint32_t x, y;
 	uint8_t b1, b2;
 	
 	// Enable access to full screen, reset write pointer to origin
-	LCD_24S_Write_Command(0x002A); //column address set
-	LCD_24S_Write_Data(0x0000);
-	LCD_24S_Write_Data(0x0000); //start 0x0000
-	LCD_24S_Write_Data(0x0000);
-	LCD_24S_Write_Data(0x00EF); //end 0x00EF
-	LCD_24S_Write_Command(0x002B); //page address set
-	LCD_24S_Write_Data(0x0000);
-	LCD_24S_Write_Data(0x0000); //start 0x0000
-	LCD_24S_Write_Data(0x0001);
-	LCD_24S_Write_Data(0x003F); //end 0x013F
+	LCD_Set_Window(0, LCD_WIDTH-1, 0, LCD_HEIGHT-1);
 	
-	// Memory Write 0x2c
 	// 16 bpp, 5-6-5. Assume color channel data is left-aligned
 	b1 = (color->R&0xf8) | ((color->G&0xe0)>>5);
 	b2 = ((color->G&0x1c)<<3) | ((color->B&0xf8)>>3);
 	
-	LCD_24S_Write_Command(0x002c);
-	for (y=0; y<320; y++) {
-		for (x=0; x<240; x++) {
-			LCD_24S_Write_Data(b1);
-			LCD_24S_Write_Data(b2);
-		}
-	}		
+	LCD_24S_Write_Pixels(b1, b2, LCD_WIDTH*LCD_HEIGHT);
+	// The pointer has wrapped back to the origin, so it is still right
 }
 /* Draw a rectangle from p1 to p2 filled with specified color. */
 void LCD_Fill_Rectangle(PT_T * p1, PT_T * p2, COLOR_T * color) {
@@ -258,29 +342,14 @@ void LCD_Fill_Rectangle(PT_T * p1, PT_T * p2, COLOR_T * color) {
 	if (n == 0)
 		return;
 	
-	// Enable access to full screen, reset write pointer to origin
-	LCD_24S_Write_Command(0x002A); //column address set
-	LCD_24S_Write_Data(c_min >> 8);
-	LCD_24S_Write_Data(c_min & 0xff); //start 
-	LCD_24S_Write_Data(c_max >> 8);
-	LCD_24S_Write_Data(c_max & 0xff); //end 
-	LCD_24S_Write_Command(0x002B); //page address set
-	LCD_24S_Write_Data(r_min >> 8);
-	LCD_24S_Write_Data(r_min & 0xff); //start 
-	LCD_24S_Write_Data(r_max >> 8);
-	LCD_24S_Write_Data(r_max & 0xff); //end 
+	LCD_Set_Window(c_min, c_max, r_min, r_max);
 	
-	// Memory Write 0x2c
 	// 16 bpp, 5-6-5. Assume color channel data is left-aligned
 	b1 = (color->R&0xf8) | ((color->G&0xe0)>>5);
 	b2 = ((color->G&0x1c)<<3) | ((color->B&0xf8)>>3);
 	
-	LCD_24S_Write_Command(0x002c);
-	
-	while (n-- > 0) {
-		LCD_24S_Write_Data(b1);
-		LCD_24S_Write_Data(b2);
-	}	
+	LCD_24S_Write_Pixels(b1, b2, n);
+	// Whole window written, so the pointer is back at its start
 }
 
 /* Prepare LCD controller draw rectangle from p1 to p2 using future pixels provided 
@@ -304,20 +373,8 @@ uint32_t LCD_Start_Rectangle(PT_T * p1, PT_T * p2) {
 	
 	n = (c_max - c_min + 1)*(r_max - r_min + 1);
 	if (n > 0) {
-		// Enable access to full screen, reset write pointer to origin
-		LCD_24S_Write_Command(0x002A); //column address set
-		LCD_24S_Write_Data(c_min >> 8);
-		LCD_24S_Write_Data(c_min & 0xff); //start 
-		LCD_24S_Write_Data(c_max >> 8);
-		LCD_24S_Write_Data(c_max & 0xff); //end 
-		LCD_24S_Write_Command(0x002B); //page address set
-		LCD_24S_Write_Data(r_min >> 8);
-		LCD_24S_Write_Data(r_min & 0xff); //start 
-		LCD_24S_Write_Data(r_max >> 8);
-		LCD_24S_Write_Data(r_max & 0xff); //end 
-		
-		// Memory Write 0x2c
-		LCD_24S_Write_Command(0x002c);
+		LCD_Set_Window(c_min, c_max, r_min, r_max);
+		Ptr_Valid = 0; // Rectangle pixels aren't followed
 	}	
 	return n;
 }
@@ -330,16 +387,30 @@ void LCD_Write_Rectangle_Pixel(COLOR_T * color, unsigned int count) {
 	// 16 bpp, 5-6-5. Assume color channel data is left-aligned
 	b1 = (color->R&0xf8) | ((color->G&0xe0)>>5);
 	b2 = ((color->G&0x1c)<<3) | ((color->B&0xf8)>>3);
-	while (count--) {
-		LCD_24S_Write_Data(b1);
-		LCD_24S_Write_Data(b2);
+	LCD_24S_Write_Pixels(b1, b2, count);
+}
+
+void LCD_Write_Rectangle_Runs(const uint8_t * runs, uint32_t num_runs, uint16_t c0, uint16_t c1) {
+	uint32_t i;
+
+	for (i=0; i+1<num_runs; i+=2) {
+		LCD_24S_Write_Pixels(c0 >> 8, c0 & 0xff, runs[i]);
+		LCD_24S_Write_Pixels(c1 >> 8, c1 & 0xff, runs[i+1]);
 	}
+	if (i < num_runs)
+		LCD_24S_Write_Pixels(c0 >> 8, c0 & 0xff, runs[i]);
 }
 
 void LCD_Refresh(void) {
 	// Empty, since no local frame buffer used
 }
 
+void LCD_Refresh_Defer(void) {
+}
+
+void LCD_Refresh_Resume(void) {
+}
+
 /* Enable (on > 0) or disable LED backlight via LCD controller. */
 void LCD_Set_BL(uint8_t on) {
 	LCD_24S_Write_Command(0x53);
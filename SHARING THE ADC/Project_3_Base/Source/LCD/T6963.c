@@ -17,32 +17,28 @@
 
 #include "gpio_defs.h"
 #include "timers.h"
+#include "delay.h"
 
 #if (LCD_CONTROLLER == CTLR_T6963)
 #include "T6963.h"
 
 unsigned char FrameBuffer[LCD_GRAPHICS_WIDTH_BYTES][LCD_GRAPHICS_HEIGHT]; 
 
-void delay_us(unsigned a) { // Probably not tuned for KL25Z! 
- 	volatile int i;
-	for (i=0; i<a; i++) {
-		__nop();
-		__nop();
-		__nop();
-		__nop();
-		__nop();
-		__nop();
-		__nop();
-		__nop();
-		__nop();
-	}
-		
-}
+/* Bytes of each frame buffer row changed since the last refresh, first
+to last. A clean row has Dirty_First > Dirty_Last. */
+static uint8_t Dirty_First[LCD_GRAPHICS_HEIGHT], Dirty_Last[LCD_GRAPHICS_HEIGHT];
+static uint8_t Refresh_Deferred; // Nesting depth of LCD_Refresh_Defer
+
+#define MARK_DIRTY(xb, y) { if ((xb) < Dirty_First[y]) Dirty_First[y] = (xb); \
+	if ((xb) > Dirty_Last[y]) Dirty_Last[y] = (xb); }
 
-void delay_ms(unsigned a) { // Probably not tuned for KL25Z! 
- 	volatile long i;
-	for (i=0; i<a*100; i++)
-		;
+static void Mark_All_Clean(void) {
+	unsigned y;
+
+	for (y=0; y<LCD_GRAPHICS_HEIGHT; y++) {
+		Dirty_First[y] = 0xff;
+		Dirty_Last[y] = 0;
+	}
 }
 
 #if 0
@@ -99,7 +95,7 @@ void GrLCD_setup_test(void) {
 				GrLCD_update_seg_digit(n, n-1, W_SEG+7, 0);
 				GrLCD_update_seg_digit(n, n-1, 2*(W_SEG+8)-1, 0);	
 				GrLCD_refresh();
-				// delay_ms(300);
+				// Delay(300);
 			}
 
 			for (n=0; n<11; n++) {
@@ -109,7 +105,7 @@ void GrLCD_setup_test(void) {
 				GrLCD_draw_seg_digit(n+3, 3*(W_SEG+8)-1, 0, 1);	
 				GrLCD_draw_seg_digit(n+4, 4*(W_SEG+8)-1, 0, 1);	
 				GrLCD_refresh();
-			  //	delay_ms(14000);
+			  //	Delay(14000);
 				GrLCD_clear_graphics();
 				GrLCD_refresh();
 			}
@@ -117,17 +113,6 @@ void GrLCD_setup_test(void) {
 }
 #endif
 
-void Test_LCD_Plot_Speed(void) {
-  unsigned char x, y;
-
-  for (y=0; y<LCD_GRAPHICS_HEIGHT; y++)
-    for (x=0; x<LCD_GRAPHICS_WIDTH; x++)
-      GrLCD_set_pixel(x,y);
-  for (y=0; y<LCD_GRAPHICS_HEIGHT; y++)
-    for (x=0; x<LCD_GRAPHICS_WIDTH; x++)
-      GrLCD_clear_pixel(x,y);
-}
-
 void LCD_Init(void)
 {
 	int i,j;
@@ -137,6 +122,7 @@ void LCD_Init(void)
 			FrameBuffer[i][j] = 0;
 		}
 	}
+	Mark_All_Clean(); // Graphic RAM gets cleared below too
 	ENABLE_LCD_PORT_CLOCKS
 	
 	/* Select GPIO for port C bits */
@@ -166,7 +152,7 @@ void LCD_Init(void)
   
   /* Hold Reset Line for 1ms */
   CLEAR_BITMASK(PIN_CONTROL_PT, PIN_RST);
-  delay_us(2000);
+  Delay_us(2000);
   SET_BITMASK(PIN_CONTROL_PT, PIN_RST);
 
   /* Set Char Gen Up */
@@ -236,7 +222,7 @@ void GrLCD_write_data(unsigned char data)
     CLEAR_BITMASK(PIN_CONTROL_PT, PIN_CE);
     CLEAR_BITMASK(PIN_CONTROL_PT, PIN_WR);
 
-    delay_us(WRITE_DELAY_US);
+    Delay_us(WRITE_DELAY_US);
 
     /* Set CE and RD*/
     SET_BITMASK(PIN_CONTROL_PT, PIN_CE);
@@ -256,7 +242,7 @@ unsigned char GrLCD_read_data(void)
     unsigned char data;
 	
 #if FAKE_READ
-		delay_us(FAKE_READ_DELAY_US);
+		Delay_us(FAKE_READ_DELAY_US);
 		data = 0xff;
 #else
     /* While BUSY1 and BUSY2 are not 1 */
@@ -275,7 +261,7 @@ unsigned char GrLCD_read_data(void)
     CLEAR_BITMASK(PIN_CONTROL_PT, PIN_CE);
     CLEAR_BITMASK(PIN_CONTROL_PT, PIN_RD);
 
-    delay_us(3);
+    Delay_us(3);
     /* Read Data Bus */
     data = GET_LCD_DATA_IN;
 
@@ -311,7 +297,7 @@ void GrLCD_write_command(unsigned char data)
     CLEAR_BITMASK(PIN_CONTROL_PT, PIN_CE);
     CLEAR_BITMASK(PIN_CONTROL_PT, PIN_WR);
 
-    delay_us(WRITE_DELAY_US);
+    Delay_us(WRITE_DELAY_US);
     
     /* Set CE and RD*/
     SET_BITMASK(PIN_CONTROL_PT, PIN_CE);
@@ -331,7 +317,7 @@ unsigned char GrLCD_read_status(void)
     unsigned char data;
 
 #if FAKE_READ
-	delay_us(FAKE_READ_DELAY_US);
+	Delay_us(FAKE_READ_DELAY_US);
 	data = LCD_STATUS_BUSY1 | LCD_STATUS_BUSY2;
 #else
 	   /* Set C/D# */
@@ -344,7 +330,7 @@ unsigned char GrLCD_read_status(void)
     CLEAR_BITMASK(PIN_CONTROL_PT, PIN_CE);
     CLEAR_BITMASK(PIN_CONTROL_PT, PIN_RD);
 
-    delay_us(1);
+    Delay_us(1);
 
     /* Read Data Bus */
     data = GET_LCD_DATA_IN;
@@ -521,6 +507,7 @@ uint32_t x, y;
 		FrameBuffer[x/8][y] |= 1 << (7 - (x&7));
 	else
 		FrameBuffer[x/8][y] &= ~(1 << (7 - (x&7)));
+	MARK_DIRTY(x/8, y);
 
 #else
 		unsigned char data;
@@ -567,6 +554,7 @@ void GrLCD_set_pixel(unsigned char x, unsigned char y)
 {
 	#if USE_LOCAL_FRAME_BUFFER
 		FrameBuffer[x/8][y] |= 1 << (7 - (x&7));
+		MARK_DIRTY(x/8, y);
 	#else
     unsigned char data;
     unsigned int address, shift;
@@ -615,6 +603,7 @@ void LCD_Fill_Buffer(COLOR_T * color) {
 
 void LCD_Plot_Packed_Pixels(uint8_t fill_byte, PT_T * pos) {
 		FrameBuffer[pos->X/8][pos->Y] = fill_byte;
+		MARK_DIRTY(pos->X/8, pos->Y);
 }
 
 void LCD_Plot_Packed_Pixels_Unaligned(uint8_t fill_byte, uint8_t r_shift, PT_T * pos) {
@@ -630,6 +619,8 @@ void LCD_Plot_Packed_Pixels_Unaligned(uint8_t fill_byte, uint8_t r_shift, PT_T *
 	t2 = fill_byte << (8-r_shift);
 	FrameBuffer[col+1][pos->Y] |= t2;
 	//	LCD_Refresh();
+	MARK_DIRTY(col, pos->Y);
+	MARK_DIRTY(col+1, pos->Y);
 }
 
 
@@ -644,6 +635,7 @@ void GrLCD_fill_byte(unsigned char fill_byte, unsigned char x, unsigned char y)
 {
 #if USE_LOCAL_FRAME_BUFFER
 		FrameBuffer[x/8][y] = fill_byte;
+		MARK_DIRTY(x/8, y);
 #else
     unsigned char data;
     unsigned int address;
@@ -698,29 +690,58 @@ void GrLCD_display_bitmap(unsigned char * p)
     }
 }
 
+/* Send the dirty bytes of the frame buffer, 9 ms if it all changed. Each
+run of dirty bytes (in display RAM order, rows back to back) goes out as
+one auto-write burst. Bursts closer than REFRESH_MERGE_GAP bytes are
+joined by resending the clean bytes between them, which is cheaper than
+setting the address again. */
+#define REFRESH_MERGE_GAP (4)
+
 void LCD_Refresh(void) {
-	unsigned int address, n, x, y;
-
-	address = LCD_GRAPHICS_HOME;		
-	GrLCD_write_data(address & 0xff);
-	GrLCD_write_data(address >> 0x08);
-	GrLCD_write_command(LCD_ADDRESS_POINTER_SET);
-#if 0 // 18 ms per refresh
-	for (y = 0; y < 128; y++) { 
-		for (x = 0; x < LCD_GRAPHICS_WIDTH_BYTES; x++) {
-			GrLCD_write_data(FrameBuffer[x][y]);
-			GrLCD_write_command(LCD_DATA_WRITE_AUTO_INCREMENT);
+	unsigned int address, x, y, first, last;
+	int open = 0;      // Auto-write burst in progress
+	unsigned next = 0; // Address the open burst writes next
+
+	if (Refresh_Deferred)
+		return;
+	for (y = 0; y < LCD_GRAPHICS_HEIGHT; y++) {
+		first = Dirty_First[y];
+		last = Dirty_Last[y];
+		if (first > last)
+			continue;
+		address = LCD_GRAPHICS_HOME + y*LCD_GRAPHICS_WIDTH_BYTES + first;
+		if (open && (address - next <= REFRESH_MERGE_GAP)) {
+			// Carry the burst on through the clean bytes in between
+			for (; next < address; next++) {
+				x = (next - LCD_GRAPHICS_HOME) % LCD_GRAPHICS_WIDTH_BYTES;
+				GrLCD_write_data(FrameBuffer[x][(next - LCD_GRAPHICS_HOME)/LCD_GRAPHICS_WIDTH_BYTES]);
+			}
+		} else {
+			if (open)
+				GrLCD_write_command(LCD_DATA_AUTO_RESET);
+			GrLCD_write_data(address & 0xff);
+			GrLCD_write_data(address >> 0x08);
+			GrLCD_write_command(LCD_ADDRESS_POINTER_SET);
+			GrLCD_write_command(LCD_DATA_AUTO_WRITE_SET);
+			open = 1;
 		}
-	}
-#else // 9 ms per refresh
-	GrLCD_write_command(LCD_DATA_AUTO_WRITE_SET);
-	for (y = 0; y < 128; y++) {
-		for (x = 0; x < LCD_GRAPHICS_WIDTH_BYTES; x++) {
+		for (x = first; x <= last; x++)
 			GrLCD_write_data(FrameBuffer[x][y]);
-		}
+		next = address + last - first + 1;
+		Dirty_First[y] = 0xff;
+		Dirty_Last[y] = 0;
 	}
-	GrLCD_write_command(LCD_DATA_AUTO_RESET);
-#endif
+	if (open)
+		GrLCD_write_command(LCD_DATA_AUTO_RESET);
+}
+
+void LCD_Refresh_Defer(void) {
+	Refresh_Deferred++;
+}
+
+void LCD_Refresh_Resume(void) {
+	if ((Refresh_Deferred > 0) && (--Refresh_Deferred == 0))
+		LCD_Refresh();
 }
 
 /********************************************
@@ -734,6 +755,7 @@ void GrLCD_clear_pixel(unsigned char x, unsigned char y)
 
 #if USE_LOCAL_FRAME_BUFFER
 		FrameBuffer[x/8][y] &= ~(1 << (7 - (x&7)));
+		MARK_DIRTY(x/8, y);
 #else
     unsigned char data;
     unsigned int address;
@@ -815,19 +837,74 @@ void GrLCD_page_test(void) {
 	for (adx = LCD_GRAPHICS_HOME; adx < 0x4000; adx += 0x0100) {
 		GrLCD_set_page(adx);
 		/* GrLCD_DrawRectangle(10, 10, 50, 50, 1); */
-		delay_ms(1);
+		Delay(1);
+	}
+}
+
+/* Window set by LCD_Start_Rectangle. LCD_Write_Rectangle_Pixel fills it
+in the frame buffer left to right, then down, like the TFT controllers. */
+static uint32_t Win_X0, Win_X1, Win_Y1, Win_X, Win_Y;
+
+// Set (on) or clear pixels x0 to x1 of row y, a byte at a time
+static void Fill_Row_Bits(uint32_t y, uint32_t x0, uint32_t x1, int on) {
+	uint32_t xb, xb0, xb1;
+	uint8_t mask;
+
+	x1 = MIN(x1, LCD_GRAPHICS_WIDTH-1);
+	if ((y >= LCD_GRAPHICS_HEIGHT) || (x0 > x1))
+		return;
+	xb0 = x0/8;
+	xb1 = x1/8;
+	for (xb = xb0; xb <= xb1; xb++) {
+		mask = 0xff;
+		if (xb == xb0)
+			mask &= (uint8_t) (0xff >> (x0 & 7));
+		if (xb == xb1)
+			mask &= (uint8_t) (0xff << (7 - (x1 & 7)));
+		if (on)
+			FrameBuffer[xb][y] |= mask;
+		else
+			FrameBuffer[xb][y] &= ~mask;
 	}
+	MARK_DIRTY(xb0, y);
+	MARK_DIRTY(xb1, y);
 }
 
- void LCD_Fill_Rectangle(PT_T * p1, PT_T * p2, COLOR_T * color){
- }
- 
- uint32_t LCD_Start_Rectangle(PT_T * p1, PT_T * p2) {
-	 return 0;
- }
- 
- void LCD_Write_Rectangle_Pixel(COLOR_T * color, unsigned int count) {
- }
+void LCD_Fill_Rectangle(PT_T * p1, PT_T * p2, COLOR_T * color) {
+	uint32_t y, y_max, x_min, x_max;
+
+	x_min = MIN(p1->X, p2->X);
+	x_max = MAX(p1->X, p2->X);
+	y_max = MIN(MAX(p1->Y, p2->Y), LCD_GRAPHICS_HEIGHT-1);
+	for (y = MIN(p1->Y, p2->Y); y <= y_max; y++)
+		Fill_Row_Bits(y, x_min, x_max, color->G > 0);
+}
+
+uint32_t LCD_Start_Rectangle(PT_T * p1, PT_T * p2) {
+	Win_X0 = MIN(p1->X, p2->X);
+	Win_X1 = MIN(MAX(p1->X, p2->X), LCD_GRAPHICS_WIDTH-1);
+	Win_Y1 = MIN(MAX(p1->Y, p2->Y), LCD_GRAPHICS_HEIGHT-1);
+	Win_X = Win_X0;
+	Win_Y = MIN(p1->Y, p2->Y);
+	if ((Win_X0 > Win_X1) || (Win_Y > Win_Y1))
+		return 0;
+	return (Win_X1 - Win_X0 + 1)*(Win_Y1 - Win_Y + 1);
+}
+
+void LCD_Write_Rectangle_Pixel(COLOR_T * color, unsigned int count) {
+	uint32_t n;
+
+	while ((count > 0) && (Win_Y <= Win_Y1) && (Win_X0 <= Win_X1)) {
+		n = MIN(count, Win_X1 - Win_X + 1); // Rest of this row of the window
+		Fill_Row_Bits(Win_Y, Win_X, Win_X + n - 1, color->G > 0);
+		count -= n;
+		Win_X += n;
+		if (Win_X > Win_X1) {
+			Win_X = Win_X0;
+			Win_Y++;
+		}
+	}
+}
 
 
 #endif // LCD controller
@@ -285,7 +285,6 @@ void GrLCD_DrawRectangle(unsigned char x1, unsigned char y1,
 			 unsigned char x2, unsigned char y2, unsigned char c);
 
 void GrLCD_setup_test(void);
-void Test_LCD_Plot_Speed(void);
 void GrLCD_display_bitmap(unsigned char * p);
 /** Display one row of a bitmap from flash.
 CSNo: dataflash chip to read from
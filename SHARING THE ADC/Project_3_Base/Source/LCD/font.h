@@ -5,6 +5,23 @@
 // Font controls
 #define FORCE_MONOSPACE (0)
 
+/* Glyph cache: each cell's pixels as alternating bg/fg run lengths, so a
+cached character goes out as one window of solid runs. Runs don't depend
+on the colours. Glyphs with more runs than fit take the bitmap path. */
+#define LCD_GLYPH_CACHE (1)
+#define GLYPH_CACHE_ENTRIES (16)
+#define GLYPH_CACHE_MAX_RUNS (64) // Lucida 12x19 needs at most 61
+
+/* Text shadow: what LCD_Text_PrintStr_RC last put in each row/column cell
+(character, X, colour pair), so reprinting mostly unchanged text only
+repaints the cells that differ. Sized for the 12x19 font; proportional
+text fits more than LCD_WIDTH/12 characters in a row, and characters past
+the last shadow column are always drawn. */
+#define LCD_TEXT_SHADOW (1)
+#define TEXT_SHADOW_ROWS (16)
+#define TEXT_SHADOW_COLS (24)
+#define TEXT_SHADOW_COLORS (4) // Colour pairs told apart, reused round-robin
+
 // Font type definitions
 typedef struct {
 	uint8_t FontID;
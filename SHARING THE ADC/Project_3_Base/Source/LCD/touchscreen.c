@@ -13,13 +13,12 @@
 
 #include "gpio_defs.h"
 #include "timers.h"
+#include "adc_server.h"
+#include "display.h"
+#include "ftfa.h"
 
-extern osMessageQueueId_t mid_MsgQueue;
-extern int pos;
 extern void Delay(uint32_t);
 uint16_t state = 0;
-MSGQUEUE_OBJ_t msg;
-	MSGQUEUE_OBJ_t msg1;
 /* Is set to one if touchscreen been calibrated. */
 uint8_t LCD_TS_Calibrated = 1;
 uint32_t LCD_TS_X_Scale=209, LCD_TS_X_Offset=6648;
@@ -28,11 +27,31 @@ uint32_t LCD_TS_Y_Scale=159, LCD_TS_Y_Offset=6689;
 PT_T TS_Min;
 PT_T TS_Max;
 
+/* Calibration kept in the reserved flash sector. Written by
+LCD_TS_Calibrate, checked and loaded by LCD_TS_Init. */
+#define TS_CAL_MAGIC (0x54534331) // "TSC1"
+#define TS_CAL_WORDS (6)
+
+typedef struct {
+	uint32_t Magic;
+	uint32_t X_Scale, X_Offset, Y_Scale, Y_Offset;
+	uint32_t CRC;    // CRC16 of the words above
+} TS_CAL_T;
+
+uint8_t LCD_TS_Cal_Stored = 0;  // Calibration came from flash
+
+// Raw to pixels is ((raw - offset)*recip) >> 16, recip = 65536/scale rounded
+static uint32_t TS_X_Recip, TS_Y_Recip;
+
+static void TS_Init_Steps(void);
+
 void Init_ADC(void) {
 	
 	SIM->SCGC6 |= SIM_SCGC6_ADC0_MASK; 
-	ADC0->CFG1 = 0x9C; // 16 bit
-	ADC0->SC2 = 0;
+	// Plates are high impedance: long sample and averaging, about 15 us per
+	// conversion. The ADC server loads these only for touch conversions.
+	ADC_Set_Channel_Config(LCD_TS_YU_CHANNEL, ADC_RES_16, ADC_SAMPLE_LONG_20, ADC_AVG_8);
+	ADC_Set_Channel_Config(LCD_TS_XL_CHANNEL, ADC_RES_16, ADC_SAMPLE_LONG_20, ADC_AVG_8);
 }
 
 
@@ -40,20 +59,143 @@ void Init_ADC(void) {
 void LCD_TS_Init(void) {
 	// Configure ADC
 	Init_ADC();
+	TS_Init_Steps();
+	LCD_TS_Cal_Load();
 	
 
 }
 
 
+/* Drive X plates, sense on YU. Called from the ADC ISR. */
+static void TS_Config_X(void) {
+	// Configure inputs to ADC
+	LCD_TS_YU_PORT->PCR[LCD_TS_YU_BIT] &= ~PORT_PCR_MUX_MASK;
+	LCD_TS_YU_PORT->PCR[LCD_TS_YU_BIT] |= PORT_PCR_MUX(0);
+	LCD_TS_YD_PORT->PCR[LCD_TS_YD_BIT] &= ~PORT_PCR_MUX_MASK;
+	LCD_TS_YD_PORT->PCR[LCD_TS_YD_BIT] |= PORT_PCR_MUX(0);
+
+	
+	// Configure outputs to GPIO
+	LCD_TS_XL_PORT->PCR[LCD_TS_XL_BIT] &= ~PORT_PCR_MUX_MASK;
+	LCD_TS_XL_PORT->PCR[LCD_TS_XL_BIT] |= PORT_PCR_MUX(1);
+	LCD_TS_XR_PORT->PCR[LCD_TS_XR_BIT] &= ~PORT_PCR_MUX_MASK;
+	LCD_TS_XR_PORT->PCR[LCD_TS_XR_BIT] |= PORT_PCR_MUX(1);
+	LCD_TS_XL_PT->PDDR |= MASK(LCD_TS_XL_BIT); 
+	LCD_TS_XR_PT->PDDR |= MASK(LCD_TS_XR_BIT);
+	LCD_TS_XR_PT->PSOR = MASK(LCD_TS_XR_BIT); // Set XR to 1
+	LCD_TS_XL_PT->PCOR = MASK(LCD_TS_XL_BIT); // Clear XL to 0
+}
+
+/* Drive Y plates, sense on XL. Called from the ADC ISR. */
+static void TS_Config_Y(void) {
+	// Configure inputs to ADC
+	LCD_TS_XL_PORT->PCR[LCD_TS_XL_BIT] &= ~PORT_PCR_MUX_MASK;
+	LCD_TS_XL_PORT->PCR[LCD_TS_XL_BIT] |= PORT_PCR_MUX(0);
+	LCD_TS_XR_PORT->PCR[LCD_TS_XR_BIT] &= ~PORT_PCR_MUX_MASK;
+	LCD_TS_XR_PORT->PCR[LCD_TS_XR_BIT] |= PORT_PCR_MUX(0);
+	// Disable pull-up - just to be sure
+	LCD_TS_XR_PORT->PCR[LCD_TS_XR_BIT] &= ~PORT_PCR_PE_MASK; 
+	
+	// Configure outputs to GPIO
+	LCD_TS_YU_PORT->PCR[LCD_TS_YU_BIT] &= ~PORT_PCR_MUX_MASK;
+	LCD_TS_YU_PORT->PCR[LCD_TS_YU_BIT] |= PORT_PCR_MUX(1);
+	LCD_TS_YD_PORT->PCR[LCD_TS_YD_BIT] &= ~PORT_PCR_MUX_MASK;
+	LCD_TS_YD_PORT->PCR[LCD_TS_YD_BIT] |= PORT_PCR_MUX(1);
+	LCD_TS_YU_PT->PDDR |= MASK(LCD_TS_YU_BIT);
+	LCD_TS_YD_PT->PDDR |= MASK(LCD_TS_YD_BIT);
+	LCD_TS_YD_PT->PSOR = MASK(LCD_TS_YD_BIT); // Set YD to 1
+	LCD_TS_YU_PT->PCOR = MASK(LCD_TS_YU_BIT); // Clear YU to 0
+}
+
+/* Drive XR high and YD low, sense both XL and YU. Current flows through
+the contact, so the two plates read apart by its resistance. Called from
+the ADC ISR. */
+static void TS_Config_Z(void) {
+	// Configure inputs to ADC
+	LCD_TS_XL_PORT->PCR[LCD_TS_XL_BIT] &= ~PORT_PCR_MUX_MASK;
+	LCD_TS_XL_PORT->PCR[LCD_TS_XL_BIT] |= PORT_PCR_MUX(0);
+	LCD_TS_YU_PORT->PCR[LCD_TS_YU_BIT] &= ~PORT_PCR_MUX_MASK;
+	LCD_TS_YU_PORT->PCR[LCD_TS_YU_BIT] |= PORT_PCR_MUX(0);
+
+	// Configure outputs to GPIO
+	LCD_TS_XR_PORT->PCR[LCD_TS_XR_BIT] &= ~(PORT_PCR_MUX_MASK | PORT_PCR_PE_MASK);
+	LCD_TS_XR_PORT->PCR[LCD_TS_XR_BIT] |= PORT_PCR_MUX(1);
+	LCD_TS_YD_PORT->PCR[LCD_TS_YD_BIT] &= ~PORT_PCR_MUX_MASK;
+	LCD_TS_YD_PORT->PCR[LCD_TS_YD_BIT] |= PORT_PCR_MUX(1);
+	LCD_TS_XR_PT->PDDR |= MASK(LCD_TS_XR_BIT);
+	LCD_TS_YD_PT->PDDR |= MASK(LCD_TS_YD_BIT);
+	LCD_TS_XR_PT->PSOR = MASK(LCD_TS_XR_BIT); // Set XR to 1
+	LCD_TS_YD_PT->PCOR = MASK(LCD_TS_YD_BIT); // Clear YD to 0
+}
+
+/* One ADC request per read: a burst of TS_NUM_SAMPLES for X, the same for
+Y, then the two pressure samples. Only the first step of each burst
+switches pins and settles; the rest run back-to-back. */
+#define TS_STEP_X (0)
+#define TS_STEP_Y (TS_NUM_SAMPLES)
+#define TS_STEP_Z (2*TS_NUM_SAMPLES)
+#define TS_NUM_STEPS (2*TS_NUM_SAMPLES + 2)
+
+static ADC_STEP_T ts_steps[TS_NUM_STEPS];
+
+uint32_t LCD_TS_Rejects = 0; // Touches too light to trust
+
+static void TS_Init_Steps(void) {
+	int i;
+	
+	for (i=0; i<TS_NUM_SAMPLES; i++) {
+		ts_steps[TS_STEP_X+i].Channel = LCD_TS_YU_CHANNEL;
+		ts_steps[TS_STEP_Y+i].Channel = LCD_TS_XL_CHANNEL;
+	}
+	ts_steps[TS_STEP_X].Setup = TS_Config_X;
+	ts_steps[TS_STEP_X].Settle = TS_SETTLE_SAMPLES;
+	ts_steps[TS_STEP_Y].Setup = TS_Config_Y;
+	ts_steps[TS_STEP_Y].Settle = TS_SETTLE_SAMPLES;
+	ts_steps[TS_STEP_Z].Channel = LCD_TS_XL_CHANNEL;
+	ts_steps[TS_STEP_Z].Setup = TS_Config_Z;
+	ts_steps[TS_STEP_Z].Settle = TS_SETTLE_SAMPLES;
+	ts_steps[TS_STEP_Z+1].Channel = LCD_TS_YU_CHANNEL;
+}
+
+// Median of the n results starting at s. Insertion sort, n is small
+static uint32_t TS_Median(ADC_STEP_T * s, int n) {
+	uint16_t v[TS_NUM_SAMPLES], t;
+	int i, j;
+	
+	for (i=0; i<n; i++) {
+		t = s[i].Result;
+		for (j=i; (j>0) && (v[j-1] > t); j--)
+			v[j] = v[j-1];
+		v[j] = t;
+	}
+	return v[n/2];
+}
+
+/* Contact resistance in units of the X plate resistance/256. The current
+through the contact is what drops across the X plate from XR to the
+touch, (full scale - z1) over the (full scale - x)/full scale of the
+plate; the contact drops z1 - z2 of it. */
+static uint32_t TS_R_Touch(uint32_t x, uint32_t z1, uint32_t z2) {
+	if (z1 <= z2)
+		return 0; // Plates at the same voltage: hard press
+	if (z1 >= 0xffff)
+		return UINT32_MAX; // No current through the contact
+	return (((0x10000 - x) >> 8)*(z1 - z2))/(0x10000 - z1);
+}
+
 static uint16_t xl=0, yu=0;
 
-/* Read touch screen. Returns 1 if touched, and updates position. Else returns 0 leaving 
-position unchanged. */
-uint32_t LCD_TS_Read(PT_T * position) {
-	static uint32_t x, y;
-	static uint32_t b;
+// Smoothed position while pressed, scaled by 2^TS_IIR_SHIFT. Restarts on each press
+static uint32_t TS_Filt_X, TS_Filt_Y;
+static uint8_t TS_Filt_Valid = 0;
 
-	// Determine if screen was pressed.
+/* Press detection bias. Stays set between reads until a touch is
+converted, so polling an idle screen is one pin read: no pin changes,
+settling delay or ADC request. (XR is PTE23, and only ports A and D
+have pin interrupts on the KL25Z, so the pin is polled.) */
+static uint8_t TS_Detect_Biased = 0;
+
+static void TS_Config_Detect(void) {
 	// Set YU digital output at ground, 
 	LCD_TS_YU_PORT->PCR[LCD_TS_YU_BIT] &= ~PORT_PCR_MUX_MASK;
 	LCD_TS_YU_PORT->PCR[LCD_TS_YU_BIT] |= PORT_PCR_MUX(1);
@@ -75,106 +217,75 @@ uint32_t LCD_TS_Read(PT_T * position) {
 	LCD_TS_XR_PORT->PCR[LCD_TS_XR_BIT] |= PORT_PCR_MUX(1);
 	LCD_TS_XR_PORT->PCR[LCD_TS_XR_BIT] |= PORT_PCR_PE_MASK; // Enable pull-up
 	LCD_TS_XR_PT->PDDR &= ~MASK(LCD_TS_XR_BIT); // Input
-		
-	// Wait for the inputs to settle
-	osDelay(TS_DELAY);
+}
+
+/* Read touch screen. Returns 1 if touched, and updates position. Else returns 0 leaving 
+position unchanged. */
+uint32_t LCD_TS_Read(PT_T * position) {
+	static uint32_t x, y;
+	static uint32_t b;
+	uint32_t px, py;
+
+	// Determine if screen was pressed.
+	if (!TS_Detect_Biased) {
+		TS_Config_Detect();
+		// Wait for the inputs to settle
+		osDelay(TS_DELAY);
+		TS_Detect_Biased = 1;
+	}
 	// Read XR input via digital
 	// if XR is 0, then screen is pressed
 	b = (LCD_TS_XR_PT->PDIR) & MASK(LCD_TS_XR_BIT);
 	
 	if (b>0) {
 		// Screen not pressed
+		TS_Filt_Valid = 0;
 		return 0;
 	} else {
 
 
 
-		// Read X Position
-		// Configure inputs to ADC
-		LCD_TS_YU_PORT->PCR[LCD_TS_YU_BIT] &= ~PORT_PCR_MUX_MASK;
-		LCD_TS_YU_PORT->PCR[LCD_TS_YU_BIT] |= PORT_PCR_MUX(0);
-		LCD_TS_YD_PORT->PCR[LCD_TS_YD_BIT] &= ~PORT_PCR_MUX_MASK;
-		LCD_TS_YD_PORT->PCR[LCD_TS_YD_BIT] |= PORT_PCR_MUX(0);
-
-		
-		// Configure outputs to GPIO
-		LCD_TS_XL_PORT->PCR[LCD_TS_XL_BIT] &= ~PORT_PCR_MUX_MASK;
-		LCD_TS_XL_PORT->PCR[LCD_TS_XL_BIT] |= PORT_PCR_MUX(1);
-		LCD_TS_XR_PORT->PCR[LCD_TS_XR_BIT] &= ~PORT_PCR_MUX_MASK;
-		LCD_TS_XR_PORT->PCR[LCD_TS_XR_BIT] |= PORT_PCR_MUX(1);
-		LCD_TS_XL_PT->PDDR |= MASK(LCD_TS_XL_BIT); 
-		LCD_TS_XR_PT->PDDR |= MASK(LCD_TS_XR_BIT);
-		LCD_TS_XR_PT->PSOR = MASK(LCD_TS_XR_BIT); // Set XR to 1
-		LCD_TS_XL_PT->PCOR = MASK(LCD_TS_XL_BIT); // Clear XL to 0
-		// Wait for inputs to settle
-		osDelay(TS_DELAY);
-		
-		msg.pos=0;
-		msg.ChannelNum=LCD_TS_YU_CHANNEL;
-		msg.TID = osThreadGetId();
-		msg.ResultPtr= &x;
-		//msg.FlagNum=0;
-		
-		osMessageQueuePut(mid_MsgQueue, &msg,0,NULL);
-		
-		osThreadFlagsWait(msg.FlagNum,osFlagsWaitAll, osWaitForever);
-		
-		
-		
-		// Read Y Position
-		// Configure inputs to ADC
-		LCD_TS_XL_PORT->PCR[LCD_TS_XL_BIT] &= ~PORT_PCR_MUX_MASK;
-		LCD_TS_XL_PORT->PCR[LCD_TS_XL_BIT] |= PORT_PCR_MUX(0);
-		LCD_TS_XR_PORT->PCR[LCD_TS_XR_BIT] &= ~PORT_PCR_MUX_MASK;
-		LCD_TS_XR_PORT->PCR[LCD_TS_XR_BIT] |= PORT_PCR_MUX(0);
-		// Disable pull-up - just to be sure
-		LCD_TS_XR_PORT->PCR[LCD_TS_XR_BIT] &= ~PORT_PCR_PE_MASK; 
-		
-		// Configure outputs to GPIO
-		LCD_TS_YU_PORT->PCR[LCD_TS_YU_BIT] &= ~PORT_PCR_MUX_MASK;
-		LCD_TS_YU_PORT->PCR[LCD_TS_YU_BIT] |= PORT_PCR_MUX(1);
-		LCD_TS_YD_PORT->PCR[LCD_TS_YD_BIT] &= ~PORT_PCR_MUX_MASK;
-		LCD_TS_YD_PORT->PCR[LCD_TS_YD_BIT] |= PORT_PCR_MUX(1);
-		LCD_TS_YU_PT->PDDR |= MASK(LCD_TS_YU_BIT);
-		LCD_TS_YD_PT->PDDR |= MASK(LCD_TS_YD_BIT);
-		LCD_TS_YD_PT->PSOR = MASK(LCD_TS_YD_BIT); // Set YD to 1
-		LCD_TS_YU_PT->PCOR = MASK(LCD_TS_YU_BIT); // Clear YU to 0
-		// Wait for the inputs to settle
-		osDelay(TS_DELAY);
-
-	/*
-		// Read inputs
-		ADC0->SC1[0] = LCD_TS_XL_CHANNEL; // start conversion on channel XL
-		while (!(ADC0->SC1[0] & ADC_SC1_COCO_MASK))
-			;
-		xl = ADC0->R[0];*/
-		
-		msg1.pos=1;
-		msg1.ChannelNum=LCD_TS_XL_CHANNEL;
-		msg1.TID = osThreadGetId();
-		msg1.ResultPtr= &y;
-	//	msg.FlagNum=0;
-		
-		osMessageQueuePut(mid_MsgQueue, &msg1,0,NULL);
-		
-		osThreadFlagsWait(msg.FlagNum,osFlagsWaitAll,osWaitForever);
+		// Read X, Y and pressure in one ADC request; pins are switched in the ADC ISR
+		ADC_Convert_Seq(ts_steps, TS_NUM_STEPS, ADC_PRIO_FAST);
+		TS_Detect_Biased = 0; // Plates are left driven for Z
+		x = TS_Median(&ts_steps[TS_STEP_X], TS_NUM_SAMPLES);
+		y = TS_Median(&ts_steps[TS_STEP_Y], TS_NUM_SAMPLES);
+#if TS_MAX_R_TOUCH
+		if (TS_R_Touch(x, ts_steps[TS_STEP_Z].Result, ts_steps[TS_STEP_Z+1].Result) > TS_MAX_R_TOUCH) {
+			// Contact too light, plates may have been floating
+			LCD_TS_Rejects++;
+			return 0;
+		}
+#endif
 		
 		// Apply calibration factors to raw position information
 		if (LCD_TS_Calibrated) {
 			if (x<LCD_TS_X_Offset) {
-				position->X = 0;
+				px = 0;
 			} else {
-				position->X = (x - LCD_TS_X_Offset)/LCD_TS_X_Scale;
+				px = ((x - LCD_TS_X_Offset)*TS_X_Recip) >> 16;
 			}
 			if (y<LCD_TS_Y_Offset) {
-				position->Y = 0;
+				py = 0;
 			} else {
-				position->Y = (y - LCD_TS_Y_Offset)/LCD_TS_Y_Scale;
+				py = ((y - LCD_TS_Y_Offset)*TS_Y_Recip) >> 16;
 			}
 		} else {
-			position->X = x;
-			position->Y = y;
+			px = x;
+			py = y;
 		}
+		
+		// First-order IIR, new sample weighted 1/2^TS_IIR_SHIFT
+		if (!TS_Filt_Valid) {
+			TS_Filt_X = px << TS_IIR_SHIFT;
+			TS_Filt_Y = py << TS_IIR_SHIFT;
+			TS_Filt_Valid = 1;
+		} else {
+			TS_Filt_X += px - (TS_Filt_X >> TS_IIR_SHIFT);
+			TS_Filt_Y += py - (TS_Filt_Y >> TS_IIR_SHIFT);
+		}
+		position->X = TS_Filt_X >> TS_IIR_SHIFT;
+		position->Y = TS_Filt_Y >> TS_IIR_SHIFT;
 		state = 0;
 		return 1;
 	}
@@ -249,22 +360,87 @@ void LCD_TS_Test(void) {
 }
 #endif
 
-/* Calibrate touchscreen. */
+static uint32_t TS_Recip(uint32_t scale) {
+	if (scale == 0)
+		scale = 1;
+	return (0x10000 + scale/2)/scale; // (raw - offset) < 2^16, so the product fits
+}
+
+static void TS_Set_Map(void) {
+	TS_X_Recip = TS_Recip(LCD_TS_X_Scale);
+	TS_Y_Recip = TS_Recip(LCD_TS_Y_Scale);
+}
+
+// CRC16 (CCITT, x^16+x^12+x^5+1, initial 0) of n words, low byte first
+static uint32_t TS_Cal_CRC(const uint32_t * w, int n) {
+	uint32_t crc = 0, b;
+	int i, k;
+
+	for (i=0; i<4*n; i++) {
+		b = (w[i/4] >> (8*(i%4))) & 0xff;
+		crc ^= b << 8;
+		for (k=0; k<8; k++)
+			crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+		crc &= 0xffff;
+	}
+	return crc;
+}
+
+/* Use the calibration in flash if there is a valid one, else keep the
+built-in one. Returns 0 if loaded. */
+int LCD_TS_Cal_Load(void) {
+	const TS_CAL_T * c = (const TS_CAL_T *) FTFA_NV_SECTOR;
+
+	LCD_TS_Cal_Stored = (c->Magic == TS_CAL_MAGIC) && (c->X_Scale != 0) && (c->Y_Scale != 0) &&
+		(c->CRC == TS_Cal_CRC(&c->Magic, TS_CAL_WORDS-1));
+	if (LCD_TS_Cal_Stored) {
+		LCD_TS_X_Scale = c->X_Scale;
+		LCD_TS_X_Offset = c->X_Offset;
+		LCD_TS_Y_Scale = c->Y_Scale;
+		LCD_TS_Y_Offset = c->Y_Offset;
+		LCD_TS_Calibrated = 1;
+	}
+	TS_Set_Map();
+	return LCD_TS_Cal_Stored ? 0 : -1;
+}
+
+/* Write the calibration in use to flash. The control loop and DMA are
+parked while it's written (ftfa.h). Returns 0, or -1 if flash reported
+an error. */
+int LCD_TS_Cal_Save(void) {
+	TS_CAL_T c;
+
+	c.Magic = TS_CAL_MAGIC;
+	c.X_Scale = LCD_TS_X_Scale;
+	c.X_Offset = LCD_TS_X_Offset;
+	c.Y_Scale = LCD_TS_Y_Scale;
+	c.Y_Offset = LCD_TS_Y_Offset;
+	c.CRC = TS_Cal_CRC(&c.Magic, TS_CAL_WORDS-1);
+	if (FTFA_Write_Record(FTFA_NV_SECTOR, &c.Magic, TS_CAL_WORDS) != 0)
+		return -1;
+	return LCD_TS_Cal_Load();
+}
+
+/* Calibrate touchscreen and store the result in flash. Needs the ADC
+server, so runs in a thread; prompts go through the display server. */
 void LCD_TS_Calibrate(void) {
-	PT_T p, bp, p_bound;
+	PT_T p, p_bound, p1, p2;
+	COLOR_T black = {0, 0, 0};
 	uint32_t i;
 	
-	bp.X = COL_TO_X(0);
-	bp.Y = ROW_TO_Y(3);
-
-	LCD_Text_PrintStr(&bp, "Calibrate TS");
-	bp.X = COL_TO_X(0);
-	bp.Y = ROW_TO_Y(4);
-	LCD_Text_PrintStr(&bp, "by pressing each +");
+	LCD_TS_Calibrated = 0; // Fit to raw readings
+	// Wait for release, a press at startup asks for calibration
+	while (LCD_TS_Read(&p))
+		;
 	
-	bp.X = COL_TO_X(0);
-	bp.Y = ROW_TO_Y(0);
-	LCD_Text_PrintStr(&bp, "+");
+	p1.X = 0;
+	p1.Y = 0;
+	p2.X = LCD_WIDTH-1;
+	p2.Y = LCD_HEIGHT-1;
+	Disp_Fill_Rect(&p1, &p2, &black);
+	Disp_Text_RC(3, 0, "Calibrate TS", NULL, NULL);
+	Disp_Text_RC(4, 0, "by pressing each +", NULL, NULL);
+	Disp_Text_RC(0, 0, "+", NULL, NULL);
 	
 	p_bound.X = 0xffff;
 	p_bound.Y = 0xffff;
@@ -286,15 +462,8 @@ void LCD_TS_Calibrate(void) {
 	while (LCD_TS_Read(&p))
 		;
 	
-	LCD_Erase();
-
-	/*
-	bp.X = COL_TO_X(LCD_MAX_COLS-1);
-	bp.Y = ROW_TO_Y(LCD_MAX_ROWS-1);
-	*/
-	bp.X = LCD_WIDTH - CHAR_WIDTH - 1;
-	bp.Y = LCD_HEIGHT - CHAR_HEIGHT - 1;
-	LCD_Text_PrintStr(&bp, "+");
+	Disp_Fill_Rect(&p1, &p2, &black);
+	Disp_Text_RC(LCD_MAX_ROWS-1, LCD_MAX_COLS-1, "+", NULL, NULL);
 
 	p_bound.X = 0;
 	p_bound.Y = 0;
@@ -316,6 +485,8 @@ void LCD_TS_Calibrate(void) {
 	while (LCD_TS_Read(&p))
 		;
 	
+	Disp_Fill_Rect(&p1, &p2, &black);
 	LCD_TS_Calibrated = 1;
-
+	TS_Set_Map();
+	LCD_TS_Cal_Save();
 }
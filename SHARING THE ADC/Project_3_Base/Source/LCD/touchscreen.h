@@ -5,6 +5,8 @@ void LCD_TS_Init(void);
 uint32_t LCD_TS_Read(PT_T * position);
 void LCD_TS_Blocking_Read(PT_T * position);
 void LCD_TS_Calibrate(void);
+int LCD_TS_Cal_Load(void);
+int LCD_TS_Cal_Save(void);
 void LCD_TS_Test(void);
 
 #endif
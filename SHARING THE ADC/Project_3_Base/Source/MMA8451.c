@@ -3,7 +3,9 @@
 #include "I2C.h"
 #include "delay.h"
 #include "LEDs.h"
+#include "FX.h"
 #include <math.h>
+#include <cmsis_os2.h>
 
 #define M_PI_2 (M_PI/2.0)
 #define M_PI_4 (M_PI/4.0)
@@ -15,10 +17,36 @@ volatile float x, y;
 
 int16_t acc_X=0, acc_Y=0, acc_Z=0;
 float roll=0.0, pitch=0.0;
+int32_t roll_fx=0, pitch_fx=0;
 
 //mma data ready
 extern uint32_t DATA_READY;
 
+#if MMA_USE_FIFO
+MMA_SAMPLE_T MMA_Fifo[MMA_FIFO_SIZE];
+volatile uint32_t MMA_Fifo_Overflows, MMA_Int_Timeouts;
+static osThreadId_t MMA_TID; // Waiting in read_fifo_xyz
+static uint8_t Fifo_Bytes[MMA_FIFO_SIZE*6];
+
+// INT2 (active low, push-pull) on a falling edge interrupt
+static void init_mma_int_pin(void) {
+	SIM->SCGC5 |= SIM_SCGC5_PORTA_MASK;
+	PORTA->PCR[MMA_INT2_PIN] = PORT_PCR_MUX(1) | PORT_PCR_ISF_MASK | PORT_PCR_IRQC(0x0a);
+	PTA->PDDR &= ~(1UL << MMA_INT2_PIN);
+	NVIC_SetPriority(PORTA_IRQn, 192);
+	NVIC_ClearPendingIRQ(PORTA_IRQn);
+	NVIC_EnableIRQ(PORTA_IRQn);
+}
+
+void PORTA_IRQHandler(void) {
+	if (PORTA->ISFR & (1UL << MMA_INT2_PIN)) {
+		PORTA->ISFR = 1UL << MMA_INT2_PIN;
+		if (MMA_TID != NULL)
+			osThreadFlagsSet(MMA_TID, MMA_FLAG_FIFO);
+	}
+}
+#endif
+
 /*
  Initializes mma8451 sensor. I2C has to already be enabled.
  */
@@ -27,12 +55,25 @@ int init_mma()
 	  //check for device
 		if(i2c_read_byte(MMA_ADDR, REG_WHOAMI) == WHOAMI)	{
 			
-		  Delay(100);
+		  Wait_ms(100);
+#if MMA_USE_FIFO
+		  //standby while configuring, then circular FIFO with watermark
+		  i2c_write_byte(MMA_ADDR, REG_CTRL1, 0x00);
+		  i2c_write_byte(MMA_ADDR, REG_F_SETUP, 0x40 | MMA_FIFO_WATERMARK);
+		  //FIFO irq only, routed to int2 (PTA15)
+		  i2c_write_byte(MMA_ADDR, REG_CTRL4, 0x40);
+		  i2c_write_byte(MMA_ADDR, REG_CTRL5, 0x00);
+		  init_mma_int_pin();
+		  Wait_ms(100);
+		  //set active 14bit mode at MMA_FIFO_DR
+		  i2c_write_byte(MMA_ADDR, REG_CTRL1, (MMA_FIFO_DR << 3) | 0x01);
+#else
 		  //turn on data ready irq; defaults to int2 (PTA15)
 		  i2c_write_byte(MMA_ADDR, REG_CTRL4, 0x01);
-		  Delay(100);
+		  Wait_ms(100);
 		  //set active 14bit mode and 100Hz (0x19)
 		  i2c_write_byte(MMA_ADDR, REG_CTRL1, 0x01);
+#endif
 				
 		  //enable the irq in the NVIC
 		  //NVIC_EnableIRQ(PORTA_IRQn);
@@ -45,29 +86,116 @@ int init_mma()
 }
 
 /* 
-  Reads full 16-bit X, Y, Z accelerations.
+  Reads full 16-bit X, Y, Z accelerations as one interrupt-driven burst;
+  the calling thread sleeps until it's done. Keeps the last values if the
+  transaction fails.
 */
 void read_full_xyz()
 {
-	
-	int i;
 	uint8_t data[6];
 	
-	i2c_start();
-	i2c_read_setup(MMA_ADDR , REG_XHI);
-	
-	for( i=0;i<6;i++)	{
-		if(i==5)
-			data[i] = i2c_repeated_read(1);
-		else
-			data[i] = i2c_repeated_read(0);
-	}
+	if (i2c_read_burst(MMA_ADDR, REG_XHI, data, 6) != 0)
+		return;
 	
 	acc_X = (((int16_t) data[0])<<8) | data[1];
 	acc_Y = (((int16_t) data[2])<<8) | data[3];
 	acc_Z = (((int16_t) data[4])<<8) | data[5];
 }
 
+#if MMA_USE_DECIMATOR
+MMA_SAMPLE_T MMA_Filtered[MMA_FILT_RING_LEN];
+volatile uint32_t MMA_Filt_Count;
+
+/* CIC state per axis. Integrators wrap; the combs undo it, since the
+output's range (input range times 2^(order*log2 decim)) fits 32 bits. */
+static uint32_t CIC_Integ[MMA_CIC_ORDER][3], CIC_Comb[MMA_CIC_ORDER][3];
+static uint32_t CIC_Phase;
+
+int mma_decimate(const MMA_SAMPLE_T * s, uint32_t n)
+{
+	uint32_t i, k, a, v, prev;
+	int32_t in[3];
+	int16_t out[3];
+	int produced = 0;
+	MMA_SAMPLE_T * f;
+	
+	for (i=0; i<n; i++) {
+		in[0] = s[i].X;
+		in[1] = s[i].Y;
+		in[2] = s[i].Z;
+		for (a=0; a<3; a++) {
+			CIC_Integ[0][a] += (uint32_t) in[a];
+			for (k=1; k<MMA_CIC_ORDER; k++)
+				CIC_Integ[k][a] += CIC_Integ[k-1][a];
+		}
+		if (++CIC_Phase < (1UL << MMA_CIC_LOG2_DECIM))
+			continue;
+		CIC_Phase = 0;
+		for (a=0; a<3; a++) {
+			v = CIC_Integ[MMA_CIC_ORDER-1][a];
+			for (k=0; k<MMA_CIC_ORDER; k++) {
+				prev = CIC_Comb[k][a];
+				CIC_Comb[k][a] = v;
+				v -= prev;
+			}
+			out[a] = (int16_t) (((int32_t) v) >> (MMA_CIC_ORDER*MMA_CIC_LOG2_DECIM)); // Unity gain
+		}
+		f = &MMA_Filtered[MMA_Filt_Count % MMA_FILT_RING_LEN];
+		f->X = out[0];
+		f->Y = out[1];
+		f->Z = out[2];
+		MMA_Filt_Count++;
+		produced++;
+	}
+	if (produced) {
+		acc_X = out[0];
+		acc_Y = out[1];
+		acc_Z = out[2];
+	}
+	return produced;
+}
+#endif
+
+#if MMA_USE_FIFO
+/*
+  Waits for the FIFO watermark, then reads F_STATUS for the sample count
+  and drains that many X, Y, Z samples in one burst (the FIFO repeats
+  the six output registers). acc_X/Y/Z get the newest sample, unless
+  the decimator publishes them instead.
+*/
+int read_fifo_xyz(void)
+{
+	uint8_t status;
+	uint32_t i, n;
+	
+	MMA_TID = osThreadGetId();
+	if (osThreadFlagsWait(MMA_FLAG_FIFO, osFlagsWaitAny,
+		2*MMA_FIFO_WATERMARK*1000/MMA_FIFO_RATE_HZ) & osFlagsError)
+		MMA_Int_Timeouts++;
+	
+	if (i2c_read_burst(MMA_ADDR, REG_F_STATUS, &status, 1) != 0)
+		return -1;
+	if (status & 0x80)
+		MMA_Fifo_Overflows++; // Oldest samples were overwritten
+	n = status & 0x3f;
+	if (n == 0)
+		return 0;
+	if (i2c_read_burst(MMA_ADDR, REG_XHI, Fifo_Bytes, n*6) != 0)
+		return -1;
+	
+	for (i=0; i<n; i++) {
+		MMA_Fifo[i].X = (((int16_t) Fifo_Bytes[6*i])<<8) | Fifo_Bytes[6*i+1];
+		MMA_Fifo[i].Y = (((int16_t) Fifo_Bytes[6*i+2])<<8) | Fifo_Bytes[6*i+3];
+		MMA_Fifo[i].Z = (((int16_t) Fifo_Bytes[6*i+4])<<8) | Fifo_Bytes[6*i+5];
+	}
+#if !MMA_USE_DECIMATOR
+	acc_X = MMA_Fifo[n-1].X;
+	acc_Y = MMA_Fifo[n-1].Y;
+	acc_Z = MMA_Fifo[n-1].Z;
+#endif
+	return n;
+}
+#endif
 
 void read_xyz(void)
 {
@@ -133,7 +261,75 @@ float approx_atan2f(float y, float x) {
 	}		
 }
 
+#define CORDIC_ITERATIONS (16)
+// atan(2^-i) in degrees, Q16
+static const int32_t Atan_Q16[CORDIC_ITERATIONS] = {
+	2949120, 1740967, 919879, 466945, 234379, 117304, 58666, 29335,
+	14668, 7334, 3667, 1833, 917, 458, 229, 115
+};
+
+uint32_t isqrt32(uint32_t v)
+{
+	uint32_t r = 0, bit = 1UL << 30;
+	
+	while (bit > v)
+		bit >>= 2;
+	while (bit != 0) {
+		if (v >= r + bit) {
+			v -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+	return r;
+}
+
+int32_t atan2_fx(int32_t y, int32_t x)
+{
+	int32_t angle = 0, t;
+	uint32_t i;
+	
+	if ((x == 0) && (y == 0))
+		return 0; // undefined, but return 0 by convention
+	// Into the right half plane, so the rotations below converge
+	if (x < 0) {
+		t = x;
+		if (y >= 0) {
+			x = y;
+			y = -t;
+			angle = 90L << 16;
+		} else {
+			x = -y;
+			y = t;
+			angle = -(90L << 16);
+		}
+	}
+	// Headroom for the CORDIC gain (1.65) with inputs up to 2^16
+	x *= 4096;
+	y *= 4096;
+	for (i=0; i<CORDIC_ITERATIONS; i++) {
+		t = x;
+		if (y > 0) {
+			x += y >> i;
+			y -= t >> i;
+			angle += Atan_Q16[i];
+		} else {
+			x -= y >> i;
+			y += t >> i;
+			angle -= Atan_Q16[i];
+		}
+	}
+	return Shift_Right_Round(angle, 16 - ANGLE_FX_FRAC_BITS);
+}
 void convert_xyz_to_roll_pitch(void) {
+#if MMA_FIXED_ANGLES
+	int32_t y = acc_Y, z = acc_Z;
+	
+	roll_fx = atan2_fx(y, z);
+	pitch_fx = atan2_fx(acc_X, isqrt32((uint32_t) (y*y) + (uint32_t) (z*z)));
+#else
 /*
 	float ax = acc_X/COUNTS_PER_G,
 				ay = acc_Y/COUNTS_PER_G,
@@ -145,6 +341,9 @@ void convert_xyz_to_roll_pitch(void) {
 #if 0	
 	roll = atan2(ay, az)*180/M_PI;
 	pitch = atan2(ax, sqrt(ay*ay + az*az))*180/M_PI;
+#endif
+	roll_fx = (int32_t) (roll*ANGLE_FX_ONE);
+	pitch_fx = (int32_t) (pitch*ANGLE_FX_ONE);
 #endif
 }
 
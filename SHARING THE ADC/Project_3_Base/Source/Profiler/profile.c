@@ -1,5 +1,8 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <MKL25Z4.H>
+#include <cmsis_os2.h>
+#include <rtx_os.h>
 #include "timers.h"
 #include "region.h"
 #include "profile.h"
@@ -7,6 +10,12 @@
 volatile unsigned int adx_lost=0, num_lost=0; 
 volatile unsigned long profile_samples=0;
 unsigned char profiling_enabled = 0;
+unsigned char profile_table_sorted = 0; // The ISR's binary search needs it
+
+PROFILE_PAIR_T Profile_Pairs[PROFILE_PAIR_SLOTS];
+volatile unsigned Profile_Pairs_Full = 0;
+PROFILE_CALL_T Profile_Calls[PROFILE_CALL_SLOTS];
+volatile unsigned Profile_Calls_Full = 0;
 
 void Init_Profiling(void) {
 	unsigned i;
@@ -15,9 +24,23 @@ void Init_Profiling(void) {
   for (i=0; i<NumProfileRegions; i++) {
 	  RegionCount[i]=0;
   }
+	for (i=0; i<PROFILE_PAIR_SLOTS; i++) {
+		Profile_Pairs[i].Count = 0;
+	}
+	Profile_Pairs_Full = 0;
+	for (i=0; i<PROFILE_CALL_SLOTS; i++) {
+		Profile_Calls[i].Count = 0;
+	}
+	Profile_Calls_Full = 0;
+	// Check region.c was generated sorted, else profiling stays off
+	profile_table_sorted = 1;
+	for (i=1; i<NumProfileRegions; i++) {
+		if (RegionTable[i].Start < RegionTable[i-1].Start)
+			profile_table_sorted = 0;
+	}
 	
 	// Initialize and start timer
-	PIT_Init(SAMPLE_FREQ_HZ_TO_TICKS(10000));
+	PIT_Init(SAMPLE_FREQ_HZ_TO_TICKS(PROFILE_SAMPLE_FREQ_HZ));
 	PIT_Start();
 }
 
@@ -26,33 +49,241 @@ void Disable_Profiling(void) {
 }
 
 void Enable_Profiling(void) {
-  profiling_enabled = 1;
+  profiling_enabled = profile_table_sorted;
+}
+
+static void Heap_Swap(unsigned * h, unsigned a, unsigned b) {
+	unsigned t = h[a];
+
+	h[a] = h[b];
+	h[b] = t;
+}
+
+// Restore the min-heap (by count) below node i of the n entries in h
+static void Heap_Down(unsigned * h, unsigned i, unsigned n) {
+	unsigned c;
+
+	while ((c = 2*i + 1) < n) {
+		if ((c + 1 < n) && (RegionCount[h[c+1]] < RegionCount[h[c]]))
+			c++;
+		if (RegionCount[h[i]] <= RegionCount[h[c]])
+			break;
+		Heap_Swap(h, i, c);
+		i = c;
+	}
+}
+
+/* The n busiest sampled regions into top, busiest first, returns how many.
+A min-heap of the best n so far: O(regions * log n), no full sort. Counts
+can move while profiling runs, so near-ties may come out of order. */
+unsigned Profile_Top(unsigned * top, unsigned n) {
+	unsigned i, k = 0, c;
+
+	for (i = 0; i < NumProfileRegions; i++) {
+		if (RegionCount[i] == 0)
+			continue;
+		if (k < n) {
+			// Add at the bottom, sift up
+			top[k] = i;
+			for (c = k++; (c > 0) && (RegionCount[top[c]] < RegionCount[top[(c-1)/2]]); c = (c-1)/2)
+				Heap_Swap(top, c, (c-1)/2);
+		} else if ((n > 0) && (RegionCount[i] > RegionCount[top[0]])) {
+			top[0] = i; // Replace the least busy
+			Heap_Down(top, 0, n);
+		}
+	}
+	// Heap sort: moving the least busy to the end leaves the busiest first
+	for (i = k; i > 1; i--) {
+		Heap_Swap(top, 0, i-1);
+		Heap_Down(top, 0, i-1);
+	}
+	return k;
+}
+
+// Sampled regions into SortedRegions, busiest first. Returns how many
+unsigned Sort_Profile_Regions(void) {
+	return Profile_Top(SortedRegions, NumProfileRegions);
+}
+
+static void Put_U32(uint8_t * p, uint32_t v) {
+	p[0] = (uint8_t) v;
+	p[1] = (uint8_t) (v >> 8);
+	p[2] = (uint8_t) (v >> 16);
+	p[3] = (uint8_t) (v >> 24);
+}
+
+uint32_t Profile_Build_Frame(uint8_t * buf) {
+	static uint8_t seq = 0;
+	unsigned top[PROFILE_TOP_N], n, i;
+	uint32_t len;
+	uint8_t * p = buf, sum = 0;
+
+	n = Profile_Top(top, PROFILE_TOP_N);
+	*p++ = PROFILE_FRAME_SYNC;
+	*p++ = PROFILE_FRAME_TYPE;
+	*p++ = seq++;
+	*p++ = n;
+	Put_U32(p, profile_samples);
+	Put_U32(p+4, num_lost);
+	p += 8;
+	for (i = 0; i < n; i++) {
+		*p++ = (uint8_t) top[i];
+		*p++ = (uint8_t) (top[i] >> 8);
+		Put_U32(p, RegionCount[top[i]]);
+		p += 4;
+	}
+	len = p - buf;
+	for (i = 0; i < len; i++)
+		sum += buf[i];
+	buf[len] = sum;
+	return len + 1;
+}
+
+void Profile_Attribute(uint32_t ctx, unsigned region) {
+	unsigned n, slot;
+	PROFILE_PAIR_T * p;
+
+	// Thread ids are word aligned, drop the low bits before mixing
+	slot = (ctx >> 2) ^ (ctx >> 7) ^ (region * 0x9e37u);
+	for (n=0; n<PROFILE_PAIR_PROBES; n++, slot++) {
+		p = &Profile_Pairs[slot & (PROFILE_PAIR_SLOTS-1)];
+		if (p->Count == 0) {
+			p->Ctx = ctx;
+			p->Region = region;
+			p->Count = 1;
+			return;
+		}
+		if ((p->Ctx == ctx) && (p->Region == region)) {
+			p->Count++;
+			return;
+		}
+	}
+	Profile_Pairs_Full++;
+}
+
+// Free slots last. Insertion sort, the table is small
+void Sort_Profile_Pairs(void) {
+	unsigned int i, j;
+	PROFILE_PAIR_T t, * q;
+
+	for (i = 1; i < PROFILE_PAIR_SLOTS; i++) {
+		t = Profile_Pairs[i];
+		for (j = i; j > 0; j--) {
+			q = &Profile_Pairs[j-1];
+			if ((q->Count != 0) && ((t.Count == 0) || (q->Ctx < t.Ctx) ||
+				((q->Ctx == t.Ctx) && (q->Count >= t.Count))))
+				break;
+			Profile_Pairs[j] = *q;
+		}
+		Profile_Pairs[j] = t;
+	}
 }
 
-void Sort_Profile_Regions(void) {
-    unsigned int i, j, temp;
+unsigned Profile_Find_Region(uint32_t adx) {
+	unsigned s = 0, e = NumProfileRegions, i;
+
+	// Last region starting at or below adx, as in PIT_IRQHandler
+	while (s < e) {
+		i = (s + e) >> 1;
+		if (RegionTable[i].Start <= adx)
+			s = i + 1;
+		else
+			e = i;
+	}
+	if ((s > 0) && (adx <= RegionTable[s-1].End))
+		return s-1;
+	return PROFILE_REGION_LOST;
+}
+
+// A Thumb return address in the region table, just after a BL or BLX
+static int Profile_Is_Return(uint32_t adx) {
+	const uint16_t * h;
+
+	if (((adx & 1) == 0) || (NumProfileRegions == 0) ||
+		(adx < RegionTable[0].Start + 4) || (adx > RegionTable[NumProfileRegions-1].End))
+		return 0;
+	h = (const uint16_t *) (adx & ~1u); // Code, so safe to read below
+	if (((h[-2] & 0xf800) == 0xf000) && ((h[-1] & 0xd000) == 0xd000))
+		return 1; // BL
+	return (h[-1] & 0xff87) == 0x4780; // BLX Rm
+}
 
-    // Copy unsorted region numbers into table
-    for (i = 0; i < NumProfileRegions; i++) {
-        SortedRegions[i] = i;
-    }
-    // Sort those region numbers
-    for (i = 0; i < NumProfileRegions; ++i) {
-        for (j = i + 1; j < NumProfileRegions; ++j) {
-            if (RegionCount[SortedRegions[i]] < RegionCount[SortedRegions[j]]) {
-                temp = SortedRegions[i];
-                SortedRegions[i] = SortedRegions[j];
-                SortedRegions[j] = temp;
-            }
-        }
-    }
+static void Profile_Count_Call(unsigned caller, unsigned callee) {
+	unsigned n, slot;
+	PROFILE_CALL_T * p;
+
+	slot = (caller * 0x9e37u) ^ callee;
+	for (n=0; n<PROFILE_CALL_PROBES; n++, slot++) {
+		p = &Profile_Calls[slot & (PROFILE_CALL_SLOTS-1)];
+		if (p->Count == 0) {
+			p->Caller = caller;
+			p->Callee = callee;
+			p->Count = 1;
+			return;
+		}
+		if ((p->Caller == caller) && (p->Callee == callee)) {
+			p->Count++;
+			return;
+		}
+	}
+	Profile_Calls_Full++;
+}
+
+void Profile_Walk_Stack(uint32_t * frame, int on_psp, unsigned leaf) {
+	osRtxThread_t * th;
+	uint32_t * p, * end, adx, last = 0;
+	unsigned depth = 0, caller, callee = leaf;
+
+	// Top of the interrupted stack: the thread's own, else the initial MSP
+	if (on_psp) {
+		th = (osRtxThread_t *) osThreadGetId();
+		if (th == NULL)
+			return;
+		end = (uint32_t *) ((uint8_t *) th->stack_mem + th->stack_size);
+	} else {
+		end = *(uint32_t **) SCB->VTOR;
+	}
+	p = frame + 8 + ((frame[XPSR_OFFSET/4] >> 9) & 1); // Past the frame and its alignment pad
+	if (p + PROFILE_STACK_SCAN_WORDS < end)
+		end = p + PROFILE_STACK_SCAN_WORDS;
+
+	adx = frame[LR_OFFSET/4];
+	while (depth < PROFILE_STACK_DEPTH) {
+		// last: a leaf that pushed LR leaves the same address on the stack
+		if ((adx != last) && Profile_Is_Return(adx)) {
+			last = adx;
+			caller = Profile_Find_Region(adx);
+			if ((caller != PROFILE_REGION_LOST) && (caller != callee)) {
+				Profile_Count_Call(caller, callee);
+				callee = caller;
+				depth++;
+			}
+		}
+		if (p >= end)
+			break;
+		adx = *p++;
+	}
+}
+
+// Busiest first, free slots last. Insertion sort, the table is small
+void Sort_Profile_Calls(void) {
+	unsigned int i, j;
+	PROFILE_CALL_T t;
+
+	for (i = 1; i < PROFILE_CALL_SLOTS; i++) {
+		t = Profile_Calls[i];
+		for (j = i; (j > 0) && (Profile_Calls[j-1].Count < t.Count); j--)
+			Profile_Calls[j] = Profile_Calls[j-1];
+		Profile_Calls[j] = t;
+	}
 }
 
 void Print_Sorted_Profile(void) {
 #if 0
-	int i;
+	int i, n;
+	n = Sort_Profile_Regions();
 	printf("%d total samples, %d samples lost (last was 0x%x)\r\n", profile_samples, num_lost, adx_lost);
-	for (i=0; i<NumProfileRegions; i++) {
+	for (i=0; i<n; i++) {
 		if (RegionCount[SortedRegions[i]] > 0) // just print out sampled regions
 			printf("%d: \t%s\r\n", RegionCount[SortedRegions[i]], RegionTable[SortedRegions[i]].Name);
 	}
@@ -1,17 +1,93 @@
 #ifndef PROFILE_H
 #define PROFILE_H
 
+#include <stdint.h>
 #include "system_MKL25Z4.h"
 
-#define RET_ADX_OFFSET (0x18)
-#define CUR_FRAME_SIZE (8)  // 0 if var is initialized as first auto var 
+#define RET_ADX_OFFSET (0x18) // Stacked PC in the exception frame
+#define LR_OFFSET (0x14)      // Stacked LR
+#define XPSR_OFFSET (0x1c)    // Stacked xPSR
+#define CUR_FRAME_SIZE (8)  // 0 if var is initialized as first auto var. Only for samples on the main stack
 #define SAMPLE_FREQ_HZ_TO_TICKS(freq) ((SystemCoreClock/(2*freq))-1)
+#define PROFILE_SAMPLE_FREQ_HZ (10000) // Region lookup is a binary search, O(log regions) per sample
+
+/* Per-context attribution. Each sample also counts against its (context,
+region) pair in Profile_Pairs, a small hash table. The context is the
+RTX thread id that was running, or the exception number of an
+interrupted handler (below PROFILE_CTX_ISR_MASK+1; 0 is main before the
+kernel starts). Pairs that find no slot within PROFILE_PAIR_PROBES count
+in Profile_Pairs_Full. After Disable_Profiling, Sort_Profile_Pairs
+groups the table by context, busiest region first. */
+#define PROFILE_BY_THREAD (1)
+#define PROFILE_PAIR_SLOTS (64)   // Power of 2
+#define PROFILE_PAIR_PROBES (8)
+#define PROFILE_CTX_ISR_MASK (0x3f) // xPSR exception number
+#define PROFILE_REGION_LOST (0xffff) // Sample outside every region
+
+typedef struct {
+	uint32_t Ctx;     // osThreadId_t, or exception number
+	uint16_t Region;  // RegionTable index, or PROFILE_REGION_LOST
+	uint32_t Count;   // 0: free slot
+} PROFILE_PAIR_T;
+
+extern PROFILE_PAIR_T Profile_Pairs[PROFILE_PAIR_SLOTS];
+extern volatile unsigned Profile_Pairs_Full;
+
+/* Call-stack sampling. The M0+ code has no frame pointers, so after the
+leaf lookup the ISR scans up to PROFILE_STACK_SCAN_WORDS words of the
+interrupted stack, above the exception frame and below the stack's top,
+for return addresses: odd values inside RegionTable whose preceding
+instruction is a BL or BLX. The stacked LR is tried first, for leaves
+that haven't pushed it. Up to PROFILE_STACK_DEPTH of them are chained
+leaf outwards, and each (caller, callee) region pair counts in
+Profile_Calls, so a hot helper can be split by call site. A stale return
+address left in a dead part of a frame can still pass the checks, so
+treat low counts with suspicion. Costs up to a few hundred cycles per
+sample; lower PROFILE_SAMPLE_FREQ_HZ if that matters. */
+#define PROFILE_CALL_STACK (0)
+#define PROFILE_STACK_DEPTH (4)       // Caller levels above the leaf
+#define PROFILE_STACK_SCAN_WORDS (48)
+#define PROFILE_CALL_SLOTS (64)       // Power of 2
+#define PROFILE_CALL_PROBES (8)
+
+typedef struct {
+	uint16_t Caller;  // RegionTable indices
+	uint16_t Callee;
+	uint32_t Count;   // 0: free slot
+} PROFILE_CALL_T;
+
+extern PROFILE_CALL_T Profile_Calls[PROFILE_CALL_SLOTS];
+extern volatile unsigned Profile_Calls_Full;
+
+/* Snapshot export. Thread_Telemetry sends a frame every
+PROFILE_EXPORT_MS while profiling is enabled, between telemetry record
+runs on UART0. Scripts/profile_top.py shows it as a live top-N. Frame,
+little endian:
+  Sync (PROFILE_FRAME_SYNC), Type (PROFILE_FRAME_TYPE), Seq, N,
+  uint32 samples, uint32 samples lost,
+  N x {uint16 region index, uint32 count}, busiest first,
+  sum of all the bytes before it, mod 256 */
+#define PROFILE_EXPORT (1)  // Needs USE_TELEMETRY
+#define PROFILE_EXPORT_MS (1000)
+#define PROFILE_TOP_N (16)
+#define PROFILE_FRAME_SYNC (0x5A)
+#define PROFILE_FRAME_TYPE (0x50)
+#define PROFILE_FRAME_MAX (4 + 8 + 6*PROFILE_TOP_N + 1)
+
+extern unsigned char profiling_enabled;
 
 extern void Init_Profiling(void);
 
 extern void Disable_Profiling(void);
 extern void Enable_Profiling(void);
-extern void Sort_Profile_Regions(void);
+extern unsigned Sort_Profile_Regions(void);
+extern unsigned Profile_Top(unsigned * top, unsigned n);
+extern uint32_t Profile_Build_Frame(uint8_t * buf); // PROFILE_FRAME_MAX bytes, returns length
+extern void Profile_Attribute(uint32_t ctx, unsigned region); // PIT ISR
+extern void Sort_Profile_Pairs(void);
+extern unsigned Profile_Find_Region(uint32_t adx); // PROFILE_REGION_LOST if none
+extern void Profile_Walk_Stack(uint32_t * frame, int on_psp, unsigned leaf); // PIT ISR
+extern void Sort_Profile_Calls(void);
 
 extern void Print_Results(void);
 #endif
@@ -7,7 +7,7 @@ typedef struct {
 	char Name[24];
 } REGION_T;
 
-extern const REGION_T RegionTable[];
+extern const REGION_T RegionTable[]; // Sorted by Start (GetRegions -s)
 extern const unsigned NumProfileRegions;
 extern volatile unsigned RegionCount[];
 extern unsigned SortedRegions[];
@@ -0,0 +1,295 @@
+#include <MKL25Z4.H>
+#include <stdint.h>
+#include <cmsis_os2.h>
+#include "adc_server.h"
+#include "control.h"
+#include "HBLED.h"
+#include "debug.h"
+#include "irq_lat.h"
+#include "ram_code.h"
+
+static ADC_REQ_T ADC_Pool[ADC_POOL_SIZE];
+static ADC_REQ_T * Free_List;
+static ADC_REQ_T * Head[ADC_NUM_PRIO], * Tail[ADC_NUM_PRIO];
+static ADC_REQ_T * volatile Active; // Request holding the ADC between control samples
+static volatile uint8_t SW_Conv;    // 1 while a software conversion is running
+
+volatile uint32_t ADC_Deferred;
+osThreadId_t volatile ADC_SW_Owner;
+
+// Register images per channel, zero (Valid clear) means default settings
+typedef struct {
+	uint8_t CFG1, CFG2, SC3, Valid;
+	uint16_t Counts; // Conversion time in TPM0 counts
+} ADC_CHAN_CFG_T;
+
+#define ADC_CFG1_DEFAULT (ADC_CFG1_MODE(ADC_RES_16)) // Bus clock, no divider, short sample
+
+/* Conversion time (KL25 RM, 28.4.4.5) with ADCK = bus clock = TPM0 clock/2:
+ 5 ADCK + 5 bus cycles, plus per averaged sample 17/20/20/25 ADCK base
+ (8/12/10/16 bit) and 20/12/6/2 ADCK for long sample. */
+#define ADC_TPM_PER_ADCK (2)
+#define ADC_COUNTS(base, lst, n) (ADC_TPM_PER_ADCK*(5 + 5 + (n)*((base) + (lst))))
+#define ADC_COUNTS_DEFAULT ADC_COUNTS(25, 0, 1)
+
+static const uint8_t Base_ADCK[4] = {17, 20, 20, 25};
+static const uint8_t Long_ADCK[5] = {0, 20, 12, 6, 2};
+
+static ADC_CHAN_CFG_T Chan_Cfg[32];
+static ADC_CHAN_CFG_T Cur_Cfg; // What the ADC holds now
+
+int ADC_Set_Channel_Config(uint8_t channel, ADC_RES_E res, ADC_SAMPLE_E sample, ADC_AVG_E avg) {
+	ADC_CHAN_CFG_T c;
+	uint32_t n;
+
+	if (channel >= 32)
+		return -1;
+	c.CFG1 = ADC_CFG1_MODE(res);
+	c.CFG2 = 0;
+	if (sample != ADC_SAMPLE_SHORT) {
+		c.CFG1 |= ADC_CFG1_ADLSMP_MASK;
+		c.CFG2 = ADC_CFG2_ADLSTS(sample - ADC_SAMPLE_LONG_20);
+	}
+	c.SC3 = 0;
+	n = 1;
+	if (avg != ADC_AVG_NONE) {
+		c.SC3 = ADC_SC3_AVGE_MASK | ADC_SC3_AVGS(avg - ADC_AVG_4);
+		n = 4 << (avg - ADC_AVG_4);
+	}
+	n = ADC_COUNTS(Base_ADCK[res & 3], Long_ADCK[sample], n);
+	// Must fit in one PWM period (up-down count) after the control sample
+	if (n + ADC_GUARD_COUNTS + ADC_COUNTS_DEFAULT >= 2*PWM_PERIOD)
+		return -1;
+	c.Counts = n;
+	c.Valid = 1;
+	Chan_Cfg[channel] = c; // Picked up at the channel's next conversion
+	return 0;
+}
+
+// Would a conversion on this channel started now end before the guard band?
+RAM_CODE static int ADC_Fits(uint8_t channel) {
+	uint32_t n = Chan_Cfg[channel & ADC_SC1_ADCH_MASK].Counts;
+
+	if (n == 0)
+		n = ADC_COUNTS_DEFAULT;
+	if (Ctl_Timing_Elapsed() + n + ADC_GUARD_COUNTS < Ctl_Timing_Period())
+		return 1;
+	ADC_Deferred++;
+	return 0;
+}
+
+// Load the channel's settings into the ADC if they differ. ADC must be idle.
+RAM_CODE static void ADC_Apply_Config(uint8_t channel) {
+	ADC_CHAN_CFG_T c = Chan_Cfg[channel & ADC_SC1_ADCH_MASK];
+
+	if (!c.Valid) {
+		c.CFG1 = ADC_CFG1_DEFAULT; // CFG2 and SC3 are already 0
+		c.Counts = ADC_COUNTS_DEFAULT;
+	}
+	if (c.CFG1 != Cur_Cfg.CFG1)
+		ADC0->CFG1 = c.CFG1;
+	if (c.CFG2 != Cur_Cfg.CFG2)
+		ADC0->CFG2 = c.CFG2;
+	if (c.SC3 != Cur_Cfg.SC3)
+		ADC0->SC3 = c.SC3;
+	Cur_Cfg = c;
+}
+
+void ADC_Server_Init(void) {
+	int i;
+
+	Free_List = NULL;
+	for (i=0; i<ADC_POOL_SIZE; i++) {
+		ADC_Pool[i].Next = Free_List;
+		Free_List = &ADC_Pool[i];
+	}
+	for (i=0; i<ADC_NUM_PRIO; i++)
+		Head[i] = Tail[i] = NULL;
+	Active = NULL;
+	SW_Conv = 0;
+	// Force a full load of the control channel's settings
+	Cur_Cfg.CFG1 = Cur_Cfg.CFG2 = Cur_Cfg.SC3 = 0xff;
+	ADC_Apply_Config(ADC_SENSE_CHANNEL);
+}
+
+ADC_REQ_T * ADC_Req_Alloc(void) {
+	ADC_REQ_T * req;
+	uint32_t m;
+
+	m = __get_PRIMASK();
+	__disable_irq();
+	req = Free_List;
+	if (req != NULL)
+		Free_List = req->Next;
+	__set_PRIMASK(m);
+	if (req != NULL) {
+		req->Next = NULL;
+		req->Prio = ADC_PRIO_BACKGROUND;
+		req->Steps = NULL;
+		req->Num_Steps = 0;
+		req->TID = osThreadGetId();
+		req->Flag = ADC_FLAG_DONE;
+	}
+	return req;
+}
+
+void ADC_Req_Free(ADC_REQ_T * req) {
+	uint32_t m;
+
+	m = __get_PRIMASK();
+	__disable_irq();
+	req->Next = Free_List;
+	Free_List = req;
+	__set_PRIMASK(m);
+}
+
+void ADC_Submit(ADC_REQ_T * req) {
+	uint32_t m;
+	uint8_t p = req->Prio;
+
+	if (p >= ADC_NUM_PRIO)
+		p = req->Prio = ADC_PRIO_BACKGROUND;
+	req->Next = NULL;
+	req->Step = 0;
+	req->Wait = 0;
+	m = __get_PRIMASK();
+	__disable_irq();
+	if (Tail[p] == NULL)
+		Head[p] = req;
+	else
+		Tail[p]->Next = req;
+	Tail[p] = req;
+	__set_PRIMASK(m);
+}
+
+int ADC_Convert_Seq(ADC_STEP_T * steps, uint8_t num_steps, ADC_PRIO_E prio) {
+	ADC_REQ_T * req;
+
+	if (num_steps == 0)
+		return -1;
+	req = ADC_Req_Alloc();
+	if (req == NULL)
+		return -1;
+	req->Steps = steps;
+	req->Num_Steps = num_steps;
+	req->Prio = prio;
+	osThreadFlagsClear(req->Flag);
+	ADC_Submit(req);
+	osThreadFlagsWait(req->Flag, osFlagsWaitAny, osWaitForever);
+	ADC_Req_Free(req);
+	return 0;
+}
+
+// Called from ADC ISR only, so only thread-side submits need locking out
+RAM_CODE static ADC_REQ_T * ADC_Next_Request(void) {
+	ADC_REQ_T * req;
+	uint32_t m;
+	int p;
+
+	for (p=0; p<ADC_NUM_PRIO; p++) {
+		req = Head[p];
+		if (req != NULL) {
+			m = __get_PRIMASK();
+			__disable_irq();
+			Head[p] = req->Next;
+			if (Head[p] == NULL)
+				Tail[p] = NULL;
+			__set_PRIMASK(m);
+			return req;
+		}
+	}
+	return NULL;
+}
+
+// Prepare the request's current step, ISR context
+RAM_CODE static void ADC_Begin_Step(ADC_REQ_T * req) {
+	ADC_STEP_T * st;
+
+	if (req->Steps == NULL)
+		return;
+	st = &req->Steps[req->Step];
+	if (st->Setup != NULL)
+		st->Setup();
+	req->Wait = st->Settle;
+}
+
+#if USE_ADC_INTERRUPT
+RAM_CODE void ADC0_IRQHandler() {
+	ADC_REQ_T * req;
+	uint16_t res;
+	uint8_t ch;
+	int sw, start, done;
+
+	FPTB->PSOR = MASK(DBG_IRQ_ADC_POS);
+	req = Active;
+	sw = SW_Conv;
+	if (!sw) {
+#if USE_IRQ_LAT
+		IRQ_Lat_Enter(IRQ_LAT_ADC, (uint32_t) Ctl_Timing_Elapsed() << (CTL_TRIGGER_TPM->SC & TPM_SC_PS_MASK));
+#endif
+		// Hardware-triggered control sample
+#if USE_CTL_TIMING
+		Ctl_Timing_Entry();
+#endif
+		Control_HBLED();
+		// Squeeze software work in before the next control trigger
+		if (req == NULL) {
+			req = Active = ADC_Next_Request();
+			if (req != NULL)
+				ADC_Begin_Step(req);
+		} else if (req->Wait > 0) {
+			req->Wait--;
+		}
+		start = (req != NULL) && (req->Wait == 0);
+	} else {
+		SW_Conv = 0;
+		res = ADC0->R[0];
+		if (req->Steps == NULL) {
+			req->Result = res;
+			done = 1;
+		} else {
+			req->Steps[req->Step].Result = res;
+			done = (++req->Step >= req->Num_Steps);
+			if (!done)
+				ADC_Begin_Step(req);
+		}
+		if (done) {
+			Active = NULL;
+			osThreadFlagsSet(req->TID, req->Flag); // req may be freed after this
+			// Deadline check below decides if the next request fits this slot too
+			req = Active = ADC_Next_Request();
+			if (req != NULL)
+				ADC_Begin_Step(req);
+			start = (req != NULL) && (req->Wait == 0);
+		} else {
+			start = (req->Wait == 0); // No settling needed, run back-to-back
+		}
+	}
+
+	if (start) {
+		ch = (req->Steps == NULL) ? req->Channel : req->Steps[req->Step].Channel;
+		start = ADC_Fits(ch); // Else try again after the next control sample
+	}
+	if (start) {
+		SW_Conv = 1;
+		ADC_SW_Owner = req->TID;
+		ADC0->SC2 &= ~ADC_SC2_ADTRG_MASK;
+		ADC_Apply_Config(ch);
+		ADC0->SC1[0] = ADC_SC1_AIEN(1) | ADC_SC1_ADCH(ch); // start conversion
+	} else {
+		ADC_Apply_Config(ADC_SENSE_CHANNEL);
+		ADC0->SC2 |= ADC_SC2_ADTRG(1);
+		ADC0->SC1[0] = ADC_SC1_AIEN(1) | ADC_SC1_ADCH(ADC_SENSE_CHANNEL);
+#if USE_CTL_TIMING
+		// Overflow since the last control sample means its trigger was ignored
+		if (sw && (CTL_TRIGGER_TPM->SC & TPM_SC_TOF_MASK))
+			Ctl_Timing.Missed++;
+#endif
+	}
+#if USE_IRQ_LAT
+	if (!sw)
+		IRQ_Lat_Exit(IRQ_LAT_ADC);
+#endif
+	FPTB->PCOR = MASK(DBG_IRQ_ADC_POS);
+}
+#endif
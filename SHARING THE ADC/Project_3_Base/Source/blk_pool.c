@@ -0,0 +1,98 @@
+#include <MKL25Z4.H>
+#include <stdint.h>
+#include <stddef.h>
+#include "blk_pool.h"
+#include "LEDs.h"
+
+volatile BLK_POOL_STATS_T Blk_Pool_Stats = {BLK_POOL_BLOCKS, BLK_POOL_BLOCKS, 0, NULL};
+
+#if BLK_POOL_BLOCKS > 0
+// Words for alignment, so block contents can be read as structures
+static uint32_t Blk_Pool[BLK_POOL_BLOCKS][BLK_SIZE/4] __attribute__((section("BlkPool"), zero_init));
+static uint8_t Blk_Ref[BLK_POOL_BLOCKS];
+
+// Index of the block at blk, or BLK_POOL_BLOCKS if blk isn't one
+static uint32_t Blk_Index(void * blk) {
+	uint32_t ofs = (uint8_t *) blk - (uint8_t *) Blk_Pool;
+
+	if (((uint8_t *) blk < (uint8_t *) Blk_Pool) || (ofs % BLK_SIZE) || (ofs >= sizeof(Blk_Pool)))
+		return BLK_POOL_BLOCKS;
+	return ofs / BLK_SIZE;
+}
+#endif
+
+void * Blk_Alloc_Run(uint32_t n) {
+	void * blk = NULL;
+#if BLK_POOL_BLOCKS > 0
+	uint32_t m, i, run = 0;
+
+	m = __get_PRIMASK();
+	__disable_irq();
+	for (i = 0; (n > 0) && (i < BLK_POOL_BLOCKS); i++) {
+		run = Blk_Ref[i] ? 0 : run+1;
+		if (run == n) {
+			for (; run > 0; run--)
+				Blk_Ref[i+1-run] = 1;
+			blk = Blk_Pool[i+1-n];
+			Blk_Pool_Stats.Free -= n;
+			if (Blk_Pool_Stats.Free < Blk_Pool_Stats.Min_Free)
+				Blk_Pool_Stats.Min_Free = Blk_Pool_Stats.Free;
+			break;
+		}
+	}
+	if (blk == NULL)
+		Blk_Pool_Stats.Alloc_Fails++;
+	__set_PRIMASK(m);
+#endif
+	return blk;
+}
+
+void * Blk_Alloc(void) {
+	return Blk_Alloc_Run(1);
+}
+
+void * Blk_Claim(uint32_t n, const char * owner) {
+	void * blk = Blk_Alloc_Run(n);
+
+	if (blk == NULL) {
+		// BLK_POOL_BLOCKS doesn't count this owner's blocks
+		Blk_Pool_Stats.Fail_Owner = owner;
+		Control_RGB_LEDs(1, 0, 0);
+		while (1)
+			;
+	}
+	return blk;
+}
+
+void Blk_Retain(void * blk) {
+#if BLK_POOL_BLOCKS > 0
+	uint32_t m, i = Blk_Index(blk);
+
+	if (i == BLK_POOL_BLOCKS)
+		return;
+	m = __get_PRIMASK();
+	__disable_irq();
+	if (Blk_Ref[i] && (Blk_Ref[i] < UINT8_MAX))
+		Blk_Ref[i]++;
+	__set_PRIMASK(m);
+#endif
+}
+
+void Blk_Release(void * blk) {
+#if BLK_POOL_BLOCKS > 0
+	uint32_t m, i = Blk_Index(blk);
+
+	if (i == BLK_POOL_BLOCKS)
+		return;
+	m = __get_PRIMASK();
+	__disable_irq();
+	if (Blk_Ref[i] && (--Blk_Ref[i] == 0))
+		Blk_Pool_Stats.Free++;
+	__set_PRIMASK(m);
+#endif
+}
+
+void Blk_Release_Run(void * blk, uint32_t n) {
+	for (; n > 0; n--, blk = (uint8_t *) blk + BLK_SIZE)
+		Blk_Release(blk);
+}
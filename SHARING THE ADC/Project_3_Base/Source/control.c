@@ -16,10 +16,25 @@
 #include "FX.h"
 
 #include "MMA8451.h" 
-static int preconvType= 0;
-static int pending;
-
-int * dst;
+#include "adc_server.h"
+#include "step_test.h"
+#include "flash_profile.h"
+#include "telemetry.h"
+#include "ram_code.h"
+#include "boot_prof.h"
+
+#if USE_PIT_SETPOINT && USE_FLASH_PROFILE
+#error "USE_PIT_SETPOINT and USE_FLASH_PROFILE both need PIT channel 1"
+#endif
+#if (CTL_FILTER == CTL_FILT_IIR) && ((CTL_IIR_ALPHA <= 0) || (CTL_IIR_ALPHA > 32767))
+#error "CTL_IIR_ALPHA must be in (0, 1)"
+#endif
+#if (CTL_FILTER == CTL_FILT_MA) && (CTL_MA_TAPS != 2) && (CTL_MA_TAPS != 4)
+#error "CTL_MA_TAPS must be 2 or 4"
+#endif
+#if CTL_FILT_DELAY_Q8 > CTL_FILT_MAX_DELAY_Q8
+#error "Current sense filter delay is over CTL_FILT_MAX_DELAY_Q8"
+#endif
 
 volatile int g_enable_control=1;
 volatile int g_set_current=DEF_LED_CURRENT_MA; // Default starting LED current
@@ -27,14 +42,11 @@ volatile int g_peak_set_current=FLASH_CURRENT_MA; // Peak flash current
 volatile int measured_current;
 volatile int16_t g_duty_cycle=DEF_DUTY_CYCLE;  // global to give debugger access
 volatile int error;
-int n;
 volatile CTL_MODE_E control_mode=DEF_CONTROL_MODE;
 
 int32_t pGain_8 = PGAIN_8; // proportional gain numerator scaled by 2^8
 volatile int g_enable_flash=1;
-extern osMessageQueueId_t mid_MsgQueue;
-extern MSGQUEUE_OBJ_t msg;
-static int pos;
+volatile unsigned g_ctl_freq_div=HW_CTL_FREQ_DIV_FACTOR;
 
 SPid plantPID = {0, // dState
 	0, // iState
@@ -54,6 +66,83 @@ SPidFX plantPID_FX = {FL_TO_FX(0), // dState
 	D_GAIN_FX  // dGain
 };
 
+SPidFX32 plantPID_FX32 = {0, // dState
+	0, // iState
+	LIM_DUTY_CYCLE, // iMax
+	-LIM_DUTY_CYCLE // iMin
+};
+// UpdatePID_FX32's products only fit 32 bits within these (FX.h)
+FX_STATIC_ASSERT(FX_PID_GAIN_OK(P_GAIN_FX) && FX_PID_GAIN_OK(I_GAIN_FX) && FX_PID_GAIN_OK(D_GAIN_FX),
+	PID_FX32_gain_over_16);
+FX_STATIC_ASSERT(FX_PID_I_OK(LIM_DUTY_CYCLE, -LIM_DUTY_CYCLE), PID_FX32_iMax_over_2047);
+
+#if CTL_FILTER == CTL_FILT_IIR
+static int32_t Filt_State; // ADC code, Q15
+#elif CTL_FILTER == CTL_FILT_MA
+static uint16_t Filt_Taps[CTL_MA_TAPS];
+static uint32_t Filt_Sum;
+static uint8_t Filt_Idx;
+#endif
+static uint8_t Filt_Primed; // 0: load the state from the next sample
+
+// Filtered ADC code, see CTL_FILTER. Only from Control_HBLED
+static __inline uint16_t Ctl_Filter(uint16_t x) {
+#if CTL_FILTER == CTL_FILT_IIR
+	if (!Filt_Primed) {
+		Filt_State = (int32_t) x << 15;
+		Filt_Primed = 1;
+	}
+	Filt_State += ((int32_t) x - (Filt_State >> 15))*CTL_IIR_ALPHA; // |x - y| < 2^16, fits
+	return (uint16_t) (Filt_State >> 15);
+#elif CTL_FILTER == CTL_FILT_MA
+	int i;
+
+	if (!Filt_Primed) {
+		for (i=0; i<CTL_MA_TAPS; i++)
+			Filt_Taps[i] = x;
+		Filt_Sum = (uint32_t) x*CTL_MA_TAPS;
+		Filt_Primed = 1;
+	}
+	Filt_Sum += x - Filt_Taps[Filt_Idx];
+	Filt_Taps[Filt_Idx] = x;
+	Filt_Idx = (Filt_Idx + 1) & (CTL_MA_TAPS - 1);
+	return (uint16_t) (Filt_Sum >> ((CTL_MA_TAPS == 4) ? 2 : 1));
+#else
+	return x;
+#endif
+}
+
+/* Clear controller memory and restart from the default duty cycle. Call
+with interrupts masked or the control loop stopped. */
+void Control_Reset_State(void) {
+	Filt_Primed = 0;
+	plantPID.dState = plantPID.iState = 0;
+	plantPID_FX.dState = plantPID_FX.iState = 0;
+	plantPID_FX32.dState = plantPID_FX32.iState = 0;
+	g_duty_cycle = DEF_DUTY_CYCLE;
+}
+
+/* Stop the control loop with the LED off, e.g. around a flash erase that
+masks interrupts for many control periods (ftfa.h). Software conversions
+also finish in the ADC ISR, so they wait until Control_Resume. */
+void Control_Park(void) {
+	NVIC_DisableIRQ(ADC0_IRQn);
+	g_duty_cycle = 0;
+	PWM_Set_Value(TPM0, PWM_HBLED_CHANNEL, 0);
+#if USE_CTL_DEADLINE
+	Ctl_Deadline_Hold(1); // The parked time isn't missed samples
+#endif
+}
+
+// Restart a parked control loop from clean controller state
+void Control_Resume(void) {
+	Control_Reset_State();
+#if USE_CTL_DEADLINE
+	Ctl_Deadline_Hold(0);
+#endif
+	NVIC_EnableIRQ(ADC0_IRQn);
+}
+
 float UpdatePID(SPid * pid, float error, float position){
 	float pTerm, dTerm, iTerm;
 
@@ -72,11 +161,11 @@ float UpdatePID(SPid * pid, float error, float position){
 	return pTerm + iTerm - dTerm;
 }
 
-FX16_16 UpdatePID_FX(SPidFX * pid, FX16_16 error_FX, FX16_16 position_FX){
+RAM_CODE FX16_16 UpdatePID_FX(SPidFX * pid, FX16_16 error_FX, FX16_16 position_FX){
 	FX16_16 pTerm, dTerm, iTerm, diff, ret_val;
 
 	// calculate the proportional term
-	pTerm = Multiply_FX(pid->pGain, error_FX);
+	pTerm = Multiply_FX_Sat(pid->pGain, error_FX);
 
 	// calculate the integral state with appropriate limiting
 	pid->iState = Add_FX(pid->iState, error_FX);
@@ -85,9 +174,9 @@ FX16_16 UpdatePID_FX(SPidFX * pid, FX16_16 error_FX, FX16_16 position_FX){
 	else if (pid->iState < pid->iMin) 
 		pid->iState = pid->iMin;
 	
-	iTerm = Multiply_FX(pid->iGain, pid->iState); // calculate the integral term
+	iTerm = Multiply_FX_Sat(pid->iGain, pid->iState); // calculate the integral term
 	diff = Subtract_FX(position_FX, pid->dState);
-	dTerm = Multiply_FX(pid->dGain, diff);
+	dTerm = Multiply_FX_Sat(pid->dGain, diff);
 	pid->dState = position_FX;
 
 	ret_val = Add_FX(pTerm, iTerm);
@@ -95,11 +184,163 @@ FX16_16 UpdatePID_FX(SPidFX * pid, FX16_16 error_FX, FX16_16 position_FX){
 	return ret_val;
 }
 
-void Control_HBLED(void) {
+volatile CTL_TIMING_T Ctl_Timing;
+static uint16_t Entry_Count;
+
+void Ctl_Timing_Reset(void) {
+	int i;
+
+	Ctl_Timing.Entry_Min = Ctl_Timing.Lat_Min = 0xffff;
+	Ctl_Timing.Entry_Max = Ctl_Timing.Lat_Max = 0;
+	for (i=0; i<CTL_LAT_BUCKETS; i++)
+		Ctl_Timing.Hist[i] = 0;
+	Ctl_Timing.Samples = 0;
+	Ctl_Timing.Missed = 0;
+	Ctl_Timing.Captured = 0;
+}
+
+/* TPM0 runs up-down and overflows at the top (MOD to MOD-1), so count
+down from MOD first, then back up. Two reads tell the direction. TPM2
+counts up from zero at its overflow. */
+RAM_CODE uint16_t Ctl_Timing_Elapsed(void) {
+#if USE_SYNC_HW_CTL_FREQ_DIV
+	return TPM2->CNT;
+#else
+	uint32_t c1, c2;
+
+	c1 = TPM0->CNT;
+	c2 = TPM0->CNT;
+	if (c2 <= c1)
+		return TPM0->MOD - c2;
+	return TPM0->MOD + c2;
+#endif
+}
+
+uint32_t Ctl_Timing_Period(void) {
+#if USE_SYNC_HW_CTL_FREQ_DIV
+	return TPM2->MOD + 1;
+#else
+	return 2*TPM0->MOD;
+#endif
+}
+
+RAM_CODE void Ctl_Timing_Entry(void) {
+	uint16_t e;
+
+	e = Ctl_Timing_Elapsed();
+	CTL_TRIGGER_TPM->SC |= TPM_SC_TOF_MASK; // Lets the ADC server see an overflow it missed
+	Entry_Count = e;
+	if (e < Ctl_Timing.Entry_Min)
+		Ctl_Timing.Entry_Min = e;
+	if (e > Ctl_Timing.Entry_Max)
+		Ctl_Timing.Entry_Max = e;
+}
+
+RAM_CODE static void Ctl_Timing_Update(void) {
+	uint16_t lat;
+	uint32_t b;
+
+	lat = Ctl_Timing_Elapsed();
+	if (lat < Ctl_Timing.Lat_Min)
+		Ctl_Timing.Lat_Min = lat;
+	if (lat > Ctl_Timing.Lat_Max)
+		Ctl_Timing.Lat_Max = lat;
+	b = lat >> CTL_LAT_BUCKET_SHIFT;
+	if (b >= CTL_LAT_BUCKETS)
+		b = CTL_LAT_BUCKETS-1;
+	Ctl_Timing.Hist[b]++;
+	Ctl_Timing.Samples++;
+	if ((Ctl_Timing.Trigger != 0) && !Ctl_Timing.Captured && (lat >= Ctl_Timing.Trigger)) {
+		Ctl_Timing.Capture.Entry = Entry_Count;
+		Ctl_Timing.Capture.Latency = lat;
+		Ctl_Timing.Capture.Duty = g_duty_cycle;
+		Ctl_Timing.Capture.Current = measured_current;
+		Ctl_Timing.Capture.Sample = Ctl_Timing.Samples;
+		Ctl_Timing.Captured = 1;
+	}
+}
+
+volatile CTL_DEADLINE_T Ctl_Deadline;
+
+#if USE_CTL_DEADLINE
+static volatile uint8_t Deadline_Hold, Deadline_Resync;
+
+/* The first sample after a hold starts the gaps over, as the kernel
+count jumped by the time slept when it resumed. */
+void Ctl_Deadline_Hold(int hold) {
+	if (!hold)
+		Deadline_Resync = 1;
+	Deadline_Hold = hold;
+}
+
+/* Count the triggers since the previous control sample that didn't get
+one. Most samples only compare against 1.5 periods; dividing is for late
+ones. Returns 1 if the fail-safe should act. */
+RAM_CODE static int Ctl_Deadline_Check(void) {
+	static uint32_t last_time, last_period;
+#if USE_CTL_TIMING
+	static uint32_t last_sw_missed;
+	uint8_t sw_hit;
+#endif
+	uint32_t now, gap, period, missed;
+
+	if (Deadline_Hold) {
+		Ctl_Deadline.Held++;
+		return 0;
+	}
+	now = osKernelGetSysTimerCount();
+	period = Ctl_Timing_Period() << (CTL_TRIGGER_TPM->SC & TPM_SC_PS_MASK); // TPM runs at the core clock
+	gap = now - last_time;
+	last_time = now;
+#if USE_CTL_TIMING
+	sw_hit = Ctl_Timing.Missed != last_sw_missed;
+	last_sw_missed = Ctl_Timing.Missed;
+#endif
+	if ((Ctl_Deadline.Samples++ == 0) || (period != last_period) || Deadline_Resync) {
+		last_period = period; // First sample, the period changed in the gap, or after a hold
+		Deadline_Resync = 0;
+		return 0;
+	}
+	if (gap > Ctl_Deadline.Gap_Max)
+		Ctl_Deadline.Gap_Max = gap;
+	if (gap < period + period/2) {
+		Ctl_Deadline.Run = 0;
+		return 0;
+	}
+	missed = (gap + period/2)/period - 1;
+	Ctl_Deadline.Overruns += missed;
+	Ctl_Deadline.Run += missed;
+	if (Ctl_Deadline.Run > Ctl_Deadline.Run_Max)
+		Ctl_Deadline.Run_Max = Ctl_Deadline.Run;
+	Ctl_Deadline.Last.Gap = gap;
+	Ctl_Deadline.Last.Entry = Ctl_Timing_Elapsed();
+	Ctl_Deadline.Last.Thread = osThreadGetId();
+	Ctl_Deadline.Last.ADC_Owner = ADC_SW_Owner;
+#if USE_CTL_TIMING
+	Ctl_Deadline.Last.SW_Conv = sw_hit;
+#endif
+	return (CTL_FAILSAFE_MISSES > 0) && (Ctl_Deadline.Run >= CTL_FAILSAFE_MISSES);
+}
+#endif
+
+#if USE_BOOT_PROF
+static uint8_t Ctl_Started;
+#endif
+
+RAM_CODE void Control_HBLED(void) {
 	uint16_t res;
 	FX16_16 change_FX, error_FX;
 	
 	FPTB->PSOR = MASK(DBG_CONTROLLER_POS);
+#if USE_CTL_DEADLINE
+	if (Ctl_Deadline_Check()) {
+		// Too long without control: restart from no drive and clean controller state
+		Control_Reset_State();
+		g_duty_cycle = 0;
+		PWM_Set_Value(TPM0, PWM_HBLED_CHANNEL, 0);
+		Ctl_Deadline.Failsafe_Trips++;
+	}
+#endif
 	
 #if USE_ADC_INTERRUPT
 	// already completed conversion, so don't wait
@@ -107,9 +348,13 @@ void Control_HBLED(void) {
 	while (!(ADC0->SC1[0] & ADC_SC1_COCO_MASK))
 		; // wait until end of conversion
 #endif
-	res = ADC0->R[0];
+	res = Ctl_Filter(ADC0->R[0]);
 
-	measured_current = (res*1500)>>16; // Extra Credit: Make this code work: V_REF_MV*MA_SCALING_FACTOR)/(ADC_FULL_SCALE*R_SENSE)
+	measured_current = ADC_CODE_TO_MA(res);
+#if USE_FLASH_PROFILE
+	if (Flash_Profile_Active)
+		g_set_current = Flash_Profile_Current_mA(); // Follow the DMA-driven DAC
+#endif
 
 	switch (control_mode) {
 		case OpenLoop:
@@ -138,6 +383,10 @@ void Control_HBLED(void) {
 			change_FX = UpdatePID_FX(&plantPID_FX, error_FX, INT_TO_FX(measured_current));
 			g_duty_cycle += FX_TO_INT(change_FX);
 		break;
+		case PID_FX32:
+			g_duty_cycle += UpdatePID_FX32(&plantPID_FX32, g_set_current - measured_current, measured_current,
+				P_GAIN_FX, I_GAIN_FX, D_GAIN_FX);
+		break;
 		default:
 			break;
 	}
@@ -148,93 +397,23 @@ void Control_HBLED(void) {
 	else if (g_duty_cycle > LIM_DUTY_CYCLE)
 		g_duty_cycle = LIM_DUTY_CYCLE;
 	PWM_Set_Value(TPM0, PWM_HBLED_CHANNEL, g_duty_cycle);
-	FPTB->PCOR = MASK(DBG_CONTROLLER_POS);
-}
-
-#if USE_ADC_INTERRUPT
-void ADC0_IRQHandler() {
-	FPTB->PSOR = MASK(DBG_IRQ_ADC_POS);
-	//call ADC Server here..
-	switch(preconvType)
-	{
-		case 0:
-		{
-			//code to serve hardware trigger
-			Control_HBLED();
-			//check any conversion pending
-			//set pending to 1 if yes else zero.
-			n=osMessageQueueGetCount(mid_MsgQueue);
-		if(n>0)
-		{
-		pending=1;
-		}
-		else
-		{
-		pending=0;
-		}
-	
-	break;
-	}
-		case 1 :
-		{
-			//code to serve software trigger
-		//set value in result pointer
-			*msg.ResultPtr= ADC0->R[0];
-			msg.FlagNum = 1;
-			osThreadFlagsSet(msg.TID,msg.FlagNum);
-			
-		
-			//set the flagnum
-			//check any conversion pending
-		//set pending to 1 if yes else zer.
-		n=osMessageQueueGetCount(mid_MsgQueue);
-		if(n>0)
-		{
-		pending=1;
-		}
-		else
-		{
-		pending=0;
-		}
-			break;
-	
-}
-	
-}
-	
-if(pending==0)
-{
-	preconvType=0;
-	//code to initialise h/w trigger ADC
-	ADC0->SC2 |= ADC_SC2_ADTRG(1);
-	// Select triggering by TPM0 Overflow
-	SIM->SOPT7 = SIM_SOPT7_ADC0TRGSEL(8) | SIM_SOPT7_ADC0ALTTRGEN_MASK;
-	// Select input channel 
-	ADC0->SC1[0] &= ~ADC_SC1_ADCH_MASK;
-	ADC0->SC1[0] |= ADC_SC1_ADCH(ADC_SENSE_CHANNEL);
-
-}
-else
-{
-	preconvType=1;
-if ( (osMessageQueueGet(mid_MsgQueue, &msg, NULL, 0)) ==osOK  )
-{			
-
-		// Read inputs
-	ADC0->SC2 &= ~ADC_SC2_ADTRG_MASK;
-		ADC0->SC2 |= ADC_SC2_ADTRG(0);
-		ADC0->SC1[0] &= ~ADC_SC1_ADCH_MASK;
-		osThreadFlagsClear(msg.FlagNum);
-		ADC0->SC1[0] |= msg.ChannelNum; // start conversion on channel YU
-}
-
-	//code to initialise s/w trigger ADC
-	
-	
-}
-	FPTB->PCOR = MASK(DBG_IRQ_ADC_POS);
+#if USE_BOOT_PROF
+	if (!Ctl_Started) {
+		Ctl_Started = 1;
+		Boot_Mark("First control sample");
 	}
 #endif
+#if USE_CTL_TIMING
+	Ctl_Timing_Update();
+#endif
+#if USE_STEP_TEST
+	Step_Test_Sample(measured_current, g_duty_cycle);
+#endif
+#if USE_TELEMETRY
+	Telemetry_Sample(measured_current, g_duty_cycle, g_set_current - measured_current);
+#endif
+	FPTB->PCOR = MASK(DBG_CONTROLLER_POS);
+}
 
 
 
@@ -245,10 +424,14 @@ void Set_DAC(unsigned int code) {
 }
 
 void Set_DAC_mA(unsigned int current) {
-	unsigned int code = MA_TO_DAC_CODE(current);
-	// Force 16-bit write to DAC
-	uint16_t * dac0dat = (uint16_t *)&(DAC0->DAT[0].DATL);
-	*dac0dat = (uint16_t) code;
+	unsigned int code;
+
+	if (current > DAC_MAX_MA)
+		current = DAC_MAX_MA; // Else the product in MA_TO_DAC_CODE can wrap
+	code = MA_TO_DAC_CODE(current);
+	if (code >= DAC_RESOLUTION)
+		code = DAC_RESOLUTION-1;
+	Set_DAC(code);
 }
 
 void Init_DAC_HBLED(void) {
@@ -269,18 +452,40 @@ void Init_DAC_HBLED(void) {
 	Set_DAC(0);
 }
 
+/* Run the control loop every n-th PWM period. TPM2 picks up a new MOD at
+its next overflow, which stays in phase with TPM0. */
+void Control_Set_Freq_Div(unsigned n) {
+	if (n < 1)
+		n = 1;
+	else if (n > HW_CTL_FREQ_DIV_MAX)
+		n = HW_CTL_FREQ_DIV_MAX;
+	g_ctl_freq_div = n;
+#if USE_SYNC_HW_CTL_FREQ_DIV
+	TPM2_Set_Trigger_Period(2*PWM_PERIOD*n);
+#endif
+}
+
 void Init_ADC_HBLED(void) {
 	// Configure ADC to read Ch 8 (FPTB 0)
 	SIM->SCGC6 |= SIM_SCGC6_ADC0_MASK; 
-	ADC0->CFG1 = 0x0C; // 16 bit
-	//	ADC0->CFG2 = ADC_CFG2_ADLSTS(3);
+	// 16 bit, short sample: current sense must finish well inside a PWM period
+	ADC_Set_Channel_Config(ADC_SENSE_CHANNEL, ADC_RES_16, ADC_SAMPLE_SHORT, ADC_AVG_NONE);
 	ADC0->SC2 = ADC_SC2_REFSEL(0);
+	ADC_Server_Init(); // Loads the sense channel settings
+	Ctl_Timing_Reset();
 
 #if USE_ADC_HW_TRIGGER
 	// Enable hardware triggering of ADC
 	ADC0->SC2 |= ADC_SC2_ADTRG(1);
+#if USE_SYNC_HW_CTL_FREQ_DIV
+	// Select triggering by TPM2 Overflow, every g_ctl_freq_div TPM0 overflows
+	Timer_Claim(TMR_TPM2, "Control trigger");
+	TPM2_Init_Trigger(2*PWM_PERIOD*g_ctl_freq_div);
+	SIM->SOPT7 = SIM_SOPT7_ADC0TRGSEL(10) | SIM_SOPT7_ADC0ALTTRGEN_MASK;
+#else
 	// Select triggering by TPM0 Overflow
 	SIM->SOPT7 = SIM_SOPT7_ADC0TRGSEL(8) | SIM_SOPT7_ADC0ALTTRGEN_MASK;
+#endif
 	// Select input channel 
 	ADC0->SC1[0] &= ~ADC_SC1_ADCH_MASK;
 	ADC0->SC1[0] |= ADC_SC1_ADCH(ADC_SENSE_CHANNEL);
@@ -298,6 +503,19 @@ void Init_ADC_HBLED(void) {
 }
 
 void Update_Set_Current(void) {
+#if USE_FLASH_PROFILE
+	static int profile_peak = -1;
+
+	// DMA plays the flash; only follow enable and peak changes here
+	if (g_enable_flash) {
+		if (!Flash_Profile_Active || (g_peak_set_current != profile_peak)) {
+			profile_peak = g_peak_set_current;
+			Flash_Profile_Two_Level(profile_peak);
+		}
+	} else if (Flash_Profile_Active) {
+		Flash_Profile_Stop();
+	}
+#else
 	static int delay=FLASH_PERIOD;
 	int current;
 	
@@ -329,10 +547,18 @@ void Update_Set_Current(void) {
 		}
 #endif
 	}
+#endif // USE_FLASH_PROFILE
 }
 
 void Init_HBLED(void) {
 	Init_DAC_HBLED();
+#if USE_FLASH_PROFILE
+	Flash_Profile_Init();
+#endif
+#if USE_PIT_SETPOINT
+	PIT1_Init(PIT_SETPOINT_PERIOD_MS*PIT_TICKS_PER_MS - 1);
+	PIT1_Start();
+#endif
 	Init_ADC_HBLED();
 	
 	// Configure driver for buck converter
@@ -340,6 +566,7 @@ void Init_HBLED(void) {
 	SIM->SCGC5 |= SIM_SCGC5_PORTE_MASK;
 	PORTE->PCR[31]  &= PORT_PCR_MUX(7);
 	PORTE->PCR[31]  |= PORT_PCR_MUX(3);
+	Timer_Claim(TMR_TPM0, "HBLED PWM");
 	PWM_Init(TPM0, PWM_HBLED_CHANNEL, PWM_PERIOD, 0, 0, 0);
 	
 }
@@ -1,6 +1,7 @@
 #ifndef CONTROL_H
 #define CONTROL_H
 
+#include <cmsis_os2.h>
 #include "FX.h"
 
 // Control approach configuration
@@ -10,7 +11,8 @@
 #define USE_SYNC_HW_CTL_FREQ_DIV 	0
 
 #define SW_CTL_FREQ_DIV_FACTOR (4) // Software division in ISR
-#define HW_CTL_FREQ_DIV_CODE (0) // Not used, not supported
+#define HW_CTL_FREQ_DIV_FACTOR (4) // Default PWM periods per control sample, TPM2 triggers ADC
+#define HW_CTL_FREQ_DIV_MAX (32)   // TPM2 MOD is 16 bits: 32*2*PWM_PERIOD
 
 #if USE_ASYNC_SAMPLING
 #define 	USE_TPM0_INTERRUPT 0
@@ -36,10 +38,72 @@
 #define 	USE_ADC_INTERRUPT 1
 #endif
 
+// Timer whose overflow triggers the current sense conversion
+#if USE_SYNC_HW_CTL_FREQ_DIV
+#define CTL_TRIGGER_TPM (TPM2)
+#else
+#define CTL_TRIGGER_TPM (TPM0)
+#endif
+
+// Setpoint sequencing (Update_Set_Current) runs in the PIT channel 1 ISR
+// instead of Thread_Buck_Update_Setpoint. FLASH_PERIOD counts PIT periods.
+// PIT channel 1 also paces the DMA flash profile, so not with USE_FLASH_PROFILE.
+#define USE_PIT_SETPOINT (0)
+#define PIT_SETPOINT_PERIOD_MS (10)
+#define PIT_TICKS_PER_MS (24000)   // Bus clock
+
+// Control loop timing measurement, in TPM counts (48 MHz) since the
+// overflow that triggered the current sense conversion
+#define USE_CTL_TIMING (1)
+#define CTL_LAT_BUCKETS (16)
+#define CTL_LAT_BUCKET_SHIFT (6)  // 64 counts (1.33 us) per histogram bucket
+
+// Missed control deadlines. Each control sample compares the time since
+// the previous one with the trigger period; the triggers in between
+// found the ADC busy with a software conversion or the ISR held off.
+// The fail-safe zeroes the duty cycle and controller state once
+// CTL_FAILSAFE_MISSES triggers are missed in a row (0 = off). The time
+// base is the kernel's SysTick count, which stops while tickless idle
+// sleeps (Ctl_Deadline_Hold), so those samples aren't checked
+#define USE_CTL_DEADLINE (USE_ADC_HW_TRIGGER)
+#define CTL_FAILSAFE_MISSES (0)
+
+/* Current sense filter, between the ADC result and the controller.
+ CTL_FILT_NONE: raw samples.
+ CTL_FILT_IIR: first-order low-pass y += a*(x - y), a = CTL_IIR_ALPHA in
+   Q15. The state is the ADC code in Q15 (a 16-bit code still fits an
+   int32), one 32-bit multiply per sample. Group delay (1-a)/a samples.
+ CTL_FILT_MA: mean of the last CTL_MA_TAPS samples, running sum and a
+   shift. Group delay (taps-1)/2 samples.
+ CTL_FILT_CYCLES bounds the filter's cost in the ISR (Cortex-M0+, RAM
+ code, zero wait states) and CTL_FILT_DELAY_Q8 its group delay in control
+ samples, Q8. The build fails if the delay passes CTL_FILT_MAX_DELAY_Q8:
+ each sample of delay is phase lag at crossover, so raise the gains only
+ as far as the margin left after it allows. */
+#define CTL_FILT_NONE (0)
+#define CTL_FILT_IIR (1)
+#define CTL_FILT_MA (2)
+
+#define CTL_FILTER (CTL_FILT_NONE)
+#define CTL_IIR_ALPHA (16384)           // 0.5 in Q15, an integer for the #if checks
+#define CTL_MA_TAPS (4)                 // 2 or 4
+#define CTL_FILT_MAX_DELAY_Q8 (2*256)   // Two control samples
+
+#if CTL_FILTER == CTL_FILT_IIR
+#define CTL_FILT_CYCLES (16)
+#define CTL_FILT_DELAY_Q8 ((((32768L - CTL_IIR_ALPHA) << 8) + CTL_IIR_ALPHA - 1) / CTL_IIR_ALPHA)
+#elif CTL_FILTER == CTL_FILT_MA
+#define CTL_FILT_CYCLES (20)
+#define CTL_FILT_DELAY_Q8 (((CTL_MA_TAPS - 1) << 8) / 2)
+#else
+#define CTL_FILT_CYCLES (0)
+#define CTL_FILT_DELAY_Q8 (0)
+#endif
+
 // Control Parameters
-// default control mode: OpenLoop, BangBang, Incremental, PID, PID_FX
+// default control mode: OpenLoop, BangBang, Incremental, PID, PID_FX, PID_FX32
 //#define DEF_CONTROL_MODE (Incremental)
-#define DEF_CONTROL_MODE (PID_FX)
+#define DEF_CONTROL_MODE (PID_FX32)
 
 // Incremental controller: change amount
 #define INC_STEP (PWM_PERIOD/100)
@@ -77,18 +141,73 @@ typedef struct {
 	FX16_16 dState; // Last position input
 	FX16_16 iState; // Integrator state
 	FX16_16 iMax, iMin; // Maximum and minimum allowable integrator state
-	float pGain, // proportional gain
+	FX16_16 pGain, // proportional gain
 				iGain, // integral gain
 				dGain; // derivative gain
 } SPidFX;
 
-typedef enum {OpenLoop, BangBang, Incremental, Proportional, PID, PID_FX} CTL_MODE_E;
+typedef struct {
+	uint16_t Entry_Min, Entry_Max; // Trigger to ADC ISR entry
+	uint16_t Lat_Min, Lat_Max;     // Trigger to PWM_Set_Value
+	uint32_t Hist[CTL_LAT_BUCKETS]; // Latency, last bucket collects the rest
+	uint32_t Samples;
+	uint32_t Missed;    // Control samples lost to a software conversion
+	uint16_t Trigger;   // Capture first sample with latency >= Trigger, 0 = off
+	uint8_t Captured;
+	struct {
+		uint16_t Entry, Latency;
+		int16_t Duty;
+		int16_t Current;
+		uint32_t Sample;
+	} Capture;
+} CTL_TIMING_T;
+
+typedef struct {
+	uint32_t Samples;        // Control samples checked
+	uint32_t Overruns;       // Triggers with no control sample
+	uint32_t Run, Run_Max;   // Missed since the last on-time sample
+	uint32_t Gap_Max;        // Longest time between control samples, core clock cycles
+	uint32_t Failsafe_Trips;
+	uint32_t Held;           // Samples not checked, kernel clock stopped
+	struct {                 // Latest overrun
+		uint32_t Gap;          // Cycles
+		uint16_t Entry;        // TPM counts from this sample's trigger to the check
+		uint8_t SW_Conv;       // A software conversion ran over a trigger
+		osThreadId_t Thread;   // Interrupted by this (late) sample
+		osThreadId_t ADC_Owner; // Latest software conversion's thread
+	} Last;
+} CTL_DEADLINE_T;
+
+typedef enum {OpenLoop, BangBang, Incremental, Proportional, PID, PID_FX, PID_FX32} CTL_MODE_E;
 
 // Functions
 void Init_HBLED(void);
+void Control_Reset_State(void);
+void Control_Park(void);            // Control ISR off, no drive
+void Control_Resume(void);
+void Set_DAC(unsigned int code);
+void Set_DAC_mA(unsigned int current);
+void Control_HBLED(void);
+void Ctl_Timing_Reset(void);
+void Ctl_Timing_Entry(void);        // First thing in ADC ISR for a control sample
+uint16_t Ctl_Timing_Elapsed(void);  // TPM counts since last control trigger
+uint32_t Ctl_Timing_Period(void);   // TPM counts between control triggers
+void Control_Set_Freq_Div(unsigned n); // PWM periods per control sample
+void Ctl_Deadline_Hold(int hold);   // 1 before the kernel clock stops, 0 once it runs again
 void Update_Set_Current(void);
 
 // Shared global variables
 extern volatile int g_peak_set_current;
+extern volatile int g_set_current;
+extern volatile int g_enable_flash;
+extern volatile int measured_current;
+extern volatile int16_t g_duty_cycle;
+extern volatile CTL_MODE_E control_mode;
+extern int32_t pGain_8;
+extern SPid plantPID;
+extern SPidFX plantPID_FX;
+extern volatile unsigned g_ctl_freq_div;
+extern volatile CTL_TIMING_T Ctl_Timing;
+extern volatile CTL_DEADLINE_T Ctl_Deadline;
 
 #endif // #ifndef CONTROL_H
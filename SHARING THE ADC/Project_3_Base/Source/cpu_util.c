@@ -0,0 +1,76 @@
+#include <cmsis_os2.h>
+#include <rtx_os.h>
+#include "cpu_util.h"
+
+volatile uint32_t CPU_Idle_Count = 0;
+
+static osTimerId_t CPU_Util_Timer;
+static osRtxTimer_t CPU_Util_Timer_cb;
+static const osTimerAttr_t CPU_Util_Timer_attr = {
+	.name = "CPU_Util", .cb_mem = &CPU_Util_Timer_cb, .cb_size = sizeof(CPU_Util_Timer_cb)
+};
+static uint32_t Last_Count;
+static uint32_t Idle_Ref = CPU_UTIL_IDLE_PER_MS * CPU_UTIL_WINDOW_MS;
+static uint32_t Calibrated = CPU_UTIL_IDLE_PER_MS != 0;
+static volatile uint32_t Busy = 0, Peak = 0;
+static volatile uint8_t Calibrating = 0;
+
+static void CPU_Util_Window(void * arg) {
+	uint32_t count, delta;
+
+	(void) arg;
+	count = CPU_Idle_Count;
+	delta = count - Last_Count;	// Wraps correctly
+	Last_Count = count;
+
+	// Without a calibration, the most idle window seen is the reference
+	if (!Calibrated && (delta > Idle_Ref))
+		Idle_Ref = delta;
+	if (Idle_Ref == 0)
+		return;
+	if (delta >= Idle_Ref)
+		Busy = 0;
+	else
+		Busy = CPU_UTIL_FULL_SCALE -
+			(uint32_t) (((uint64_t) delta * CPU_UTIL_FULL_SCALE) / Idle_Ref);
+	if (Busy > Peak)
+		Peak = Busy;
+}
+
+void CPU_Util_Init(void) {
+	Last_Count = CPU_Idle_Count;
+	CPU_Util_Timer = osTimerNew(CPU_Util_Window, osTimerPeriodic, NULL, &CPU_Util_Timer_attr);
+	osTimerStart(CPU_Util_Timer, CPU_UTIL_WINDOW_MS*osKernelGetTickFreq()/1000);
+}
+
+void CPU_Util_Calibrate(void) {
+	uint32_t start;
+
+	Calibrating = 1; // The idle loop has to spin for this
+	start = CPU_Idle_Count;
+	osDelay(CPU_UTIL_WINDOW_MS*osKernelGetTickFreq()/1000);
+	Idle_Ref = CPU_Idle_Count - start;
+	Calibrated = 1;
+	Calibrating = 0;
+	Peak = 0;
+}
+
+uint32_t CPU_Util_Busy(void) {
+	return Busy;
+}
+
+uint32_t CPU_Util_Peak(void) {
+	return Peak;
+}
+
+uint32_t CPU_Util_Idle_Reference(void) {
+	return Idle_Ref;
+}
+
+int CPU_Util_Can_Sleep(void) {
+	return !Calibrating && (Idle_Ref != 0);
+}
+
+void CPU_Util_Slept(uint32_t us) {
+	CPU_Idle_Count += (uint32_t) (((uint64_t) us * Idle_Ref) / (CPU_UTIL_WINDOW_MS*1000UL));
+}
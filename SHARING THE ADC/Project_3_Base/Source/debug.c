@@ -1,7 +1,17 @@
 #include <MKL25Z4.H>
 #include "debug.h"
+#include "sd_audio.h"
+#include "sd_log.h"
+
+#if DBG_TRACE_MODE
+DBG_TRACE_T Dbg_Trace;
+#endif
 
 void Init_Debug_Signals(void) {
+#if DBG_TRACE_MODE
+	Dbg_Trace.Head = 0;
+	Dbg_Trace.Freq = osKernelGetSysTimerFreq();
+#endif
 	// Enable clock to port B
 	SIM->SCGC5 |= SIM_SCGC5_PORTB_MASK | SIM_SCGC5_PORTE_MASK;
 	
@@ -21,19 +31,25 @@ void Init_Debug_Signals(void) {
 	PORTB->PCR[DBG_7] &= ~PORT_PCR_MUX_MASK;          
 	PORTB->PCR[DBG_7] |= PORT_PCR_MUX(1);          
 
+#if !USE_SD_AUDIO && !USE_SD_LOG // PTE4 is the card's chip select then
 	PORTE->PCR[DBG_STRB] &= ~PORT_PCR_MUX_MASK;
 	PORTE->PCR[DBG_STRB] |= PORT_PCR_MUX(1);
+#endif
 	
 	
 	// Set ports to outputs
 	PTB->PDDR |= MASK(DBG_1) | MASK(DBG_4) | MASK(DBG_5) | MASK(DBG_6) | MASK(DBG_7);
 	PTB->PDDR |= MASK(DBG_2) | MASK(DBG_3);
 	
+#if !USE_SD_AUDIO && !USE_SD_LOG
 	PTE->PDDR |= MASK(DBG_STRB);
+#endif
 	
 	// Initial values are 0
 	PTB->PCOR = MASK(DBG_1) | MASK(DBG_4) | MASK(DBG_5) | MASK(DBG_6) | MASK(DBG_7);
 	PTB->PCOR = MASK(DBG_2) | MASK(DBG_3);
 	
+#if !USE_SD_AUDIO && !USE_SD_LOG
 	PTE->PCOR = MASK(DBG_STRB);
+#endif
 }	
@@ -1,17 +1,67 @@
 #include <MKL25Z4.H>
+#include <cmsis_os2.h>
+#include "delay.h"
+#include "boot_prof.h"
 
-void Delay (uint32_t dly) {
-  volatile uint32_t t;
+// Spin on SysTick as it is set up, for the kernel-less and ISR cases
+static void Delay_Spin_us(uint32_t us) {
+	uint32_t ctrl, per_us, period, last, now, elapsed = 0, cycles;
 
-	for (t=dly*10000; t>0; t--)
-		;
+	ctrl = SysTick->CTRL;
+	if (!(ctrl & SysTick_CTRL_ENABLE_Msk)) { // Free running at the core clock, as Boot_Prof_Init
+		SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+		SysTick->VAL = 0;
+		ctrl = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+		SysTick->CTRL = ctrl;
+	}
+#if USE_BOOT_PROF
+	if (ctrl & SysTick_CTRL_COUNTFLAG_Msk) // Reading CTRL cleared it
+		Boot_Prof_Wrapped = 1;
+#endif
+	per_us = SystemCoreClock/1000000;
+	if (!(ctrl & SysTick_CTRL_CLKSOURCE_Msk))
+		per_us /= 16; // Reference clock
+	period = SysTick->LOAD + 1;
+	cycles = us*per_us;
+	last = SysTick->VAL;
+	while (elapsed < cycles) {
+		now = SysTick->VAL;
+		elapsed += (now <= last) ? last - now : last + period - now;
+		last = now;
+	}
 }
 
-void ShortDelay (uint32_t dly) {
-  volatile uint32_t t;
+void Delay_us(uint32_t us) {
+	uint32_t start, per_us, per_tick, cycles, left, ticks;
 
-	for (t=dly; t>0; t--)
-		;
+	if ((osKernelGetState() != osKernelRunning) || __get_IPSR() || __get_PRIMASK()) {
+		Delay_Spin_us(us);
+		return;
+	}
+	start = osKernelGetSysTimerCount();
+	per_us = osKernelGetSysTimerFreq()/1000000;
+	per_tick = osKernelGetSysTimerFreq()/osKernelGetTickFreq();
+	cycles = us*per_us;
+	while ((left = cycles - (osKernelGetSysTimerCount() - start)) <= cycles) { // Wraps past 0 when done
+		ticks = left/per_tick;
+		if (ticks > 0)
+			osDelay(ticks); // Ends on the ticks-th tick boundary, not later than the target
+		else if (left > DELAY_YIELD_US*per_us)
+			osThreadYield();
+	}
+}
+
+// Delay(n) was a loop of "over n ms"; now it is n ms
+void Delay(uint32_t ms) {
+	while (ms > 1000) { // Keep us*per_us within 32 bits
+		Delay_us(1000000);
+		ms -= 1000;
+	}
+	Delay_us(ms*1000);
+}
+
+void Wait_ms(uint32_t ms) {
+	Delay(ms);
 }
 
 // *******************************ARM University Program Copyright  ARM Ltd 2013*************************************   
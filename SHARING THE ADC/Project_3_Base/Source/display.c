@@ -0,0 +1,212 @@
+#include <MKL25Z4.H>
+#include <stdint.h>
+#include <string.h>
+#include <cmsis_os2.h>
+#include "display.h"
+#include "LCD.h"
+#include "LCD_compositor.h"
+#include "gpio_defs.h"
+#include "debug.h"
+#include "threads.h"
+#include "boot_prof.h"
+
+osMessageQueueId_t Disp_MsgQ;
+volatile uint32_t Disp_Dropped, Disp_Coalesced, Disp_Frames_Late;
+
+static DISP_MSG_T Batch[DISP_MSGQ_LEN]; // This frame's commands, in drawing order
+static unsigned Batch_Len;
+#if USE_BOOT_PROF
+static uint8_t First_Frame;
+#endif
+
+static COLOR_T Default_Fg = {255, 255, 0}, Default_Bg = {0, 0, 0}; // As LCD_Text_Init
+
+static int Disp_Send(DISP_MSG_T * m) {
+	if (osMessageQueuePut(Disp_MsgQ, m, 0, 0) != osOK) {
+		Disp_Dropped++;
+		return -1;
+	}
+	return 0;
+}
+
+static int Disp_Send_Pts(uint8_t cmd, uint8_t arg, PT_T * p1, PT_T * p2, COLOR_T * color) {
+	DISP_MSG_T m;
+
+	m.Cmd = cmd;
+	m.Arg = arg;
+	if (color != NULL)
+		m.Color = *color;
+	m.U.Pts.X0 = p1->X;
+	m.U.Pts.Y0 = p1->Y;
+	m.U.Pts.X1 = p2->X;
+	m.U.Pts.Y1 = p2->Y;
+	return Disp_Send(&m);
+}
+
+int Disp_Text_RC(uint8_t row, uint8_t col, const char * str, COLOR_T * fg, COLOR_T * bg) {
+	DISP_MSG_T m;
+
+	m.Cmd = DISP_TEXT_RC;
+	m.Arg = row;
+	m.Color = (fg != NULL) ? *fg : Default_Fg;
+	m.U.Text.Col = col;
+	m.U.Text.Bg = (bg != NULL) ? *bg : Default_Bg;
+	strncpy(m.U.Text.Str, str, DISP_TEXT_LEN-1);
+	m.U.Text.Str[DISP_TEXT_LEN-1] = '\0';
+	return Disp_Send(&m);
+}
+
+int Disp_Fill_Rect(PT_T * p1, PT_T * p2, COLOR_T * color) {
+	return Disp_Send_Pts(DISP_RECT, 0, p1, p2, color);
+}
+
+int Disp_Line(PT_T * p1, PT_T * p2, COLOR_T * color) {
+	return Disp_Send_Pts(DISP_LINE, 0, p1, p2, color);
+}
+
+int Disp_Circle(PT_T * center, int radius, COLOR_T * color, int filled) {
+	PT_T r;
+
+	r.X = radius;
+	r.Y = 0;
+	return Disp_Send_Pts(DISP_CIRCLE, filled != 0, center, &r, color);
+}
+
+int Disp_Comp_Move_Rect(int id, PT_T * p1, PT_T * p2) {
+	return Disp_Send_Pts(DISP_COMP_MOVE, id, p1, p2, NULL);
+}
+
+int Disp_Comp_Set_Color(int id, COLOR_T * color) {
+	DISP_MSG_T m;
+
+	m.Cmd = DISP_COMP_COLOR;
+	m.Arg = id;
+	m.Color = *color;
+	return Disp_Send(&m);
+}
+
+/* Earlier command in the batch that m can overwrite, else NULL. Text can
+take the place of text for the same cell only if nothing drawn since
+could be under it (no shapes, no other text on that row), and only if it
+covers all the earlier text did. */
+static DISP_MSG_T * Disp_Find_Replaceable(DISP_MSG_T * m) {
+	int i;
+	DISP_MSG_T * b;
+
+	for (i=Batch_Len-1; i>=0; i--) {
+		b = &Batch[i];
+		switch (m->Cmd) {
+			case DISP_TEXT_RC:
+				if ((b->Cmd == DISP_COMP_MOVE) || (b->Cmd == DISP_COMP_COLOR))
+					break;
+				if (b->Cmd != DISP_TEXT_RC)
+					return NULL;
+				if (b->Arg != m->Arg)
+					break; // Rows don't overlap
+				if (b->U.Text.Col == m->U.Text.Col)
+					return (strlen(m->U.Text.Str) >= strlen(b->U.Text.Str)) ? b : NULL;
+				return NULL; // Other text on the row, may overlap
+			case DISP_COMP_MOVE:
+			case DISP_COMP_COLOR:
+				// Compositor state only, applied in order but drawn at the end of the frame
+				if ((b->Cmd == m->Cmd) && (b->Arg == m->Arg))
+					return b;
+				break;
+			default:
+				return NULL;
+		}
+	}
+	return NULL;
+}
+
+// Take this frame's commands off the queue
+static void Disp_Collect(void) {
+	DISP_MSG_T m, * b;
+
+	Batch_Len = 0;
+	while ((Batch_Len < DISP_MSGQ_LEN) && (osMessageQueueGet(Disp_MsgQ, &m, NULL, 0) == osOK)) {
+		b = Disp_Find_Replaceable(&m);
+		if (b != NULL) {
+			*b = m;
+			Disp_Coalesced++;
+		} else {
+			Batch[Batch_Len++] = m;
+		}
+	}
+}
+
+static void Disp_Draw(DISP_MSG_T * m) {
+	PT_T p1, p2;
+
+	p1.X = m->U.Pts.X0;
+	p1.Y = m->U.Pts.Y0;
+	p2.X = m->U.Pts.X1;
+	p2.Y = m->U.Pts.Y1;
+	switch (m->Cmd) {
+		case DISP_TEXT_RC:
+			LCD_Text_Set_Colors(&m->Color, &m->U.Text.Bg);
+			LCD_Text_PrintStr_RC(m->Arg, m->U.Text.Col, m->U.Text.Str);
+			break;
+		case DISP_RECT:
+			LCD_Fill_Rectangle(&p1, &p2, &m->Color);
+			LCD_Text_Invalidate_Rect(&p1, &p2);
+			break;
+		case DISP_LINE:
+			LCD_Draw_Line(&p1, &p2, &m->Color);
+			LCD_Text_Invalidate_Rect(&p1, &p2); // Text under the line gets repainted
+			break;
+		case DISP_CIRCLE:
+			LCD_Draw_Circle(&p1, m->U.Pts.X1, &m->Color, m->Arg);
+			p2.X = p1.X + m->U.Pts.X1;
+			p2.Y = p1.Y + m->U.Pts.X1;
+			p1.X = (p1.X > m->U.Pts.X1) ? p1.X - m->U.Pts.X1 : 0;
+			p1.Y = (p1.Y > m->U.Pts.X1) ? p1.Y - m->U.Pts.X1 : 0;
+			LCD_Text_Invalidate_Rect(&p1, &p2);
+			break;
+		case DISP_COMP_MOVE:
+			LCD_Comp_Move_Rect(m->Arg, &p1, &p2);
+			break;
+		case DISP_COMP_COLOR:
+			LCD_Comp_Set_Color(m->Arg, &m->Color);
+			break;
+		default:
+			break;
+	}
+}
+
+void Thread_Display(void * arg) {
+	uint32_t next, i;
+	int comp_changed;
+
+	Boot_Wait(BOOT_FLAG_LCD);
+	next = osKernelGetTickCount();
+	while (1) {
+		next += DISP_FRAME_MS;
+		if ((int32_t) (next - osKernelGetTickCount()) <= 0) {
+			// Last frame ran long, start the next one now
+			Disp_Frames_Late++;
+			next = osKernelGetTickCount();
+		} else {
+			osDelayUntil(next);
+		}
+		DEBUG_START(DBG_TDISPLAY_POS);
+		LCD_Refresh_Defer(); // Mono LCD sends the frame's changes once
+		Disp_Collect();
+		comp_changed = 0;
+		for (i=0; i<Batch_Len; i++) {
+			Disp_Draw(&Batch[i]);
+			if ((Batch[i].Cmd == DISP_COMP_MOVE) || (Batch[i].Cmd == DISP_COMP_COLOR))
+				comp_changed = 1;
+		}
+		if (comp_changed)
+			LCD_Comp_Render();
+		LCD_Refresh_Resume();
+		DEBUG_STOP(DBG_TDISPLAY_POS);
+#if USE_BOOT_PROF
+		if (!First_Frame && (Batch_Len > 0)) {
+			First_Frame = 1;
+			Boot_Mark("First frame");
+		}
+#endif
+	}
+}
@@ -0,0 +1,148 @@
+#include <MKL25Z4.H>
+#include <stdint.h>
+#include <stddef.h>
+#include "flash_profile.h"
+#include "control.h"
+#include "HBLED.h"
+#include "debug.h"
+#include "DMA.h"
+#include "timers.h"
+
+// DMA source tables, entry i is written at the i-th PIT1 expiry of a cycle
+static uint16_t Code[PROFILE_MAX_POINTS];    // DAC code of point i+1
+static uint32_t LD[PROFILE_MAX_POINTS];      // PIT1 LDVAL for point i+2
+static int16_t Code_mA[PROFILE_MAX_POINTS];  // mA matching Code[i]
+static uint32_t First_LD;                    // PIT1 LDVAL for point 0
+static unsigned Num_Points;
+static int8_t LD_Ch = -1;                    // Linked channel, writes PIT1 LDVAL
+
+volatile uint8_t Flash_Profile_Active;
+
+#define MS_TO_LDVAL(ms) ((uint32_t) (ms)*PROFILE_PIT_TICKS_PER_MS - 1)
+
+static void Flash_Profile_Cycle_Done(uint8_t ch, uint32_t dsr);
+
+int Flash_Profile_Init(void) {
+	Timer_Claim(TMR_PIT1, "Flash profile");
+	SIM->SCGC6 |= SIM_SCGC6_PIT_MASK;
+	PIT->MCR &= ~PIT_MCR_MDIS_MASK;
+	PIT->MCR |= PIT_MCR_FRZ_MASK;
+	PIT->CHANNEL[PROFILE_PIT_CH].TCTRL = 0; // Triggers DMA only, no interrupt
+	Flash_Profile_Active = 0;
+	Num_Points = 0;
+
+	// DAC channel needs its PIT pairing, the LDVAL channel can be any
+	if (DMA_Reserve(PROFILE_DMA_CH, "Flash profile", NULL, 0) != 0)
+		return -1;
+	LD_Ch = DMA_Alloc(DMA_PRIO_HIGH, "Flash profile LDVAL", Flash_Profile_Cycle_Done, 128);
+	if (LD_Ch < 0) {
+		DMA_Free(PROFILE_DMA_CH);
+		return -1;
+	}
+	return 0;
+}
+
+int Flash_Profile_Load(const PROFILE_POINT_T * points, unsigned num_points) {
+	unsigned i, j;
+
+	if ((num_points == 0) || (num_points > PROFILE_MAX_POINTS) || (LD_Ch < 0))
+		return -1;
+	for (i=0; i<num_points; i++) {
+		if (points[i].Duration_ms == 0)
+			return -1;
+	}
+	Flash_Profile_Stop();
+	for (i=0; i<num_points; i++) {
+		j = (i+1) % num_points;
+		Code[i] = MA_TO_DAC_CODE(MIN(points[j].mA, DAC_MAX_MA));
+		if (Code[i] > DAC_RESOLUTION-1)
+			Code[i] = DAC_RESOLUTION-1;
+		Code_mA[i] = points[j].mA;
+		LD[i] = MS_TO_LDVAL(points[(i+2) % num_points].Duration_ms);
+	}
+	First_LD = MS_TO_LDVAL(points[0].Duration_ms);
+	Num_Points = num_points;
+	return 0;
+}
+
+// Point both channels back at the start of their tables
+static void Flash_Profile_Rewind(void) {
+	DMA0->DMA[PROFILE_DMA_CH].DSR_BCR = DMA_DSR_BCR_DONE_MASK;
+	DMA0->DMA[LD_Ch].DSR_BCR = DMA_DSR_BCR_DONE_MASK;
+	DMA0->DMA[PROFILE_DMA_CH].SAR = DMA_SAR_SAR((uint32_t) Code);
+	DMA0->DMA[PROFILE_DMA_CH].DSR_BCR = DMA_DSR_BCR_BCR(Num_Points*2);
+	DMA0->DMA[LD_Ch].SAR = DMA_SAR_SAR((uint32_t) LD);
+	DMA0->DMA[LD_Ch].DSR_BCR = DMA_DSR_BCR_BCR(Num_Points*4);
+}
+
+void Flash_Profile_Start(void) {
+	if ((Num_Points == 0) || (LD_Ch < 0))
+		return;
+	Flash_Profile_Stop();
+
+	// Point 0 goes out now, the DMA takes over at the first expiry
+	Set_DAC(Code[Num_Points-1]);
+
+	// 16 bit codes into DAC0, one per PIT1 request, each linked to the LDVAL channel
+	DMA0->DMA[PROFILE_DMA_CH].DAR = DMA_DAR_DAR((uint32_t) (&(DAC0->DAT[0])));
+	DMA0->DMA[PROFILE_DMA_CH].DCR = DMA_DCR_SINC_MASK | DMA_DCR_SSIZE(2) | DMA_DCR_DSIZE(2) |
+		DMA_DCR_ERQ_MASK | DMA_DCR_CS_MASK | DMA_DCR_LINKCC(2) | DMA_DCR_LCH1(LD_Ch);
+	// 32 bit durations into PIT1 LDVAL, started by the link. Its done interrupt ends a cycle.
+	DMA0->DMA[LD_Ch].DAR = DMA_DAR_DAR((uint32_t) (&(PIT->CHANNEL[PROFILE_PIT_CH].LDVAL)));
+	DMA0->DMA[LD_Ch].DCR = DMA_DCR_EINT_MASK | DMA_DCR_SINC_MASK |
+		DMA_DCR_SSIZE(0) | DMA_DCR_DSIZE(0) | DMA_DCR_CS_MASK;
+	Flash_Profile_Rewind();
+
+	// Always-enabled source, gated by PIT1 (periodic trigger mode)
+	DMAMUX0->CHCFG[PROFILE_DMA_CH] = DMAMUX_CHCFG_SOURCE(60) | DMAMUX_CHCFG_TRIG_MASK;
+	DMAMUX0->CHCFG[PROFILE_DMA_CH] |= DMAMUX_CHCFG_ENBL_MASK;
+
+	Flash_Profile_Active = 1;
+	// Timer loads point 0's duration when enabled; the next reload uses point 1's
+	PIT->CHANNEL[PROFILE_PIT_CH].LDVAL = PIT_LDVAL_TSV(First_LD);
+	PIT->CHANNEL[PROFILE_PIT_CH].TCTRL = PIT_TCTRL_TEN_MASK;
+	PIT->CHANNEL[PROFILE_PIT_CH].LDVAL = PIT_LDVAL_TSV(LD[Num_Points-1]);
+}
+
+void Flash_Profile_Stop(void) {
+	if (LD_Ch < 0)
+		return;
+	PIT->CHANNEL[PROFILE_PIT_CH].TCTRL = 0;
+	DMAMUX0->CHCFG[PROFILE_DMA_CH] = 0;
+	DMA0->DMA[PROFILE_DMA_CH].DCR = 0;
+	DMA0->DMA[LD_Ch].DCR = 0;
+	DMA0->DMA[PROFILE_DMA_CH].DSR_BCR = DMA_DSR_BCR_DONE_MASK;
+	DMA0->DMA[LD_Ch].DSR_BCR = DMA_DSR_BCR_DONE_MASK;
+	Flash_Profile_Active = 0;
+}
+
+int Flash_Profile_Two_Level(int peak_mA) {
+	PROFILE_POINT_T p[3];
+
+	if (peak_mA < 0)
+		peak_mA = 0;
+	p[0].Duration_ms = PROFILE_PEAK_MS;
+	p[0].mA = peak_mA;
+	p[1].Duration_ms = PROFILE_TAIL_MS;
+	p[1].mA = peak_mA/4;
+	p[2].Duration_ms = PROFILE_OFF_MS;
+	p[2].mA = 0;
+	if (Flash_Profile_Load(p, 3) != 0)
+		return -1;
+	Flash_Profile_Start();
+	return 0;
+}
+
+// Control ISR context. SAR has already moved past the code in the DAC.
+int Flash_Profile_Current_mA(void) {
+	uint32_t i = (DMA0->DMA[PROFILE_DMA_CH].SAR - (uint32_t) Code) >> 1;
+
+	return Code_mA[(i == 0) ? Num_Points-1 : i-1];
+}
+
+// End of a profile cycle: both channels have finished their tables
+static void Flash_Profile_Cycle_Done(uint8_t ch, uint32_t dsr) {
+	FPTB->PSOR = MASK(DBG_IRQDMA_POS);
+	Flash_Profile_Rewind(); // Next PIT1 expiry is at least 1 ms away
+	FPTB->PCOR = MASK(DBG_IRQDMA_POS);
+}
@@ -0,0 +1,52 @@
+#include <stdint.h>
+#include "fmt.h"
+
+static const uint32_t Pow10[FMT_MAX_DECIMALS+1] = {1, 10, 100, 1000, 10000};
+
+// mag with a point before its last decimals digits, then sign and padding in front
+static char * Fmt_Digits(char * buf, uint32_t mag, int neg, unsigned decimals, unsigned width) {
+	char tmp[10 + FMT_MAX_DECIMALS + 1];
+	unsigned n = 0, len;
+
+	do {
+		tmp[n++] = '0' + mag % 10;
+		mag /= 10;
+	} while ((mag > 0) || (n <= decimals)); // A digit before the point, always
+	len = n + (decimals > 0) + (neg != 0);
+	for (; width > len; width--)
+		*buf++ = ' ';
+	if (neg)
+		*buf++ = '-';
+	while (n > 0) {
+		*buf++ = tmp[--n];
+		if ((n == decimals) && (n > 0))
+			*buf++ = '.';
+	}
+	*buf = '\0';
+	return buf;
+}
+
+char * Fmt_Str(char * buf, const char * s) {
+	while (*s != '\0')
+		*buf++ = *s++;
+	*buf = '\0';
+	return buf;
+}
+
+char * Fmt_Int(char * buf, int32_t v, unsigned width) {
+	uint32_t mag = (v < 0) ? -(uint32_t) v : (uint32_t) v;
+
+	return Fmt_Digits(buf, mag, v < 0, 0, width);
+}
+
+char * Fmt_Q(char * buf, int32_t v, unsigned frac_bits, unsigned decimals, unsigned width) {
+	uint32_t mag = (v < 0) ? -(uint32_t) v : (uint32_t) v;
+
+	if (decimals > FMT_MAX_DECIMALS)
+		decimals = FMT_MAX_DECIMALS;
+	if (frac_bits > 0)
+		mag = (uint32_t) (((uint64_t) mag*Pow10[decimals] + (1UL << (frac_bits-1))) >> frac_bits);
+	else
+		mag *= Pow10[decimals];
+	return Fmt_Digits(buf, mag, (v < 0) && (mag > 0), decimals, width); // No "-0.00"
+}
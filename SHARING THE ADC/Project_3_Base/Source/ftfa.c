@@ -0,0 +1,75 @@
+#include <MKL25Z4.H>
+#include <stdint.h>
+#include "ftfa.h"
+#include "control.h"
+#include "DMA.h"
+
+#define FTFA_CMD_PGM4 (0x06)  // Program longword
+#define FTFA_CMD_ERSSCR (0x09) // Erase flash sector
+
+#define FTFA_ERRORS (FTFA_FSTAT_RDCOLERR_MASK | FTFA_FSTAT_ACCERR_MASK | FTFA_FSTAT_FPVIOL_MASK)
+
+/* Start the command and wait for it, run from RAM (initialised data).
+Thumb code, r0 = &FTFA->FSTAT:
+	movs r1, #0x80    ; CCIF
+	strb r1, [r0]     ; Launch
+ 1: ldrb r2, [r0]
+	tst  r2, r1
+	beq  1b           ; Until complete
+	bx   lr */
+static uint16_t FTFA_Launch_Code[] = {0x2180, 0x7001, 0x7802, 0x420a, 0xd0fc, 0x4770};
+
+typedef void (*FTFA_LAUNCH_F)(volatile uint8_t * fstat);
+
+static int FTFA_Command(uint8_t cmd, uint32_t addr) {
+	uint32_t m;
+	FTFA_LAUNCH_F launch = (FTFA_LAUNCH_F) (((uint32_t) FTFA_Launch_Code) | 1);
+
+	while (!(FTFA->FSTAT & FTFA_FSTAT_CCIF_MASK))
+		;
+	FTFA->FSTAT = FTFA_ERRORS; // Write 1 to clear the last command's errors
+	FTFA->FCCOB0 = cmd;
+	FTFA->FCCOB1 = (uint8_t) (addr >> 16);
+	FTFA->FCCOB2 = (uint8_t) (addr >> 8);
+	FTFA->FCCOB3 = (uint8_t) addr;
+
+	m = __get_PRIMASK();
+	__disable_irq();
+	launch(&FTFA->FSTAT);
+	__set_PRIMASK(m);
+	return (FTFA->FSTAT & (FTFA_ERRORS | FTFA_FSTAT_MGSTAT0_MASK)) ? -1 : 0;
+}
+
+int FTFA_Erase_Sector(uint32_t addr) {
+	return FTFA_Command(FTFA_CMD_ERSSCR, addr & ~(FTFA_SECTOR_SIZE - 1));
+}
+
+int FTFA_Program(uint32_t addr, const uint32_t * data, uint32_t num_words) {
+	uint32_t w;
+
+	for (; num_words > 0; num_words--, addr += 4) {
+		w = *data++;
+		// Byte 4 holds the most significant byte, little endian in flash
+		FTFA->FCCOB4 = (uint8_t) (w >> 24);
+		FTFA->FCCOB5 = (uint8_t) (w >> 16);
+		FTFA->FCCOB6 = (uint8_t) (w >> 8);
+		FTFA->FCCOB7 = (uint8_t) w;
+		if (FTFA_Command(FTFA_CMD_PGM4, addr) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+int FTFA_Write_Record(uint32_t addr, const uint32_t * data, uint32_t num_words) {
+	uint32_t parked;
+	int r;
+
+	parked = DMA_Park();
+	Control_Park();
+	r = FTFA_Erase_Sector(addr);
+	if (r == 0)
+		r = FTFA_Program(addr, data, num_words);
+	Control_Resume();
+	DMA_Unpark(parked);
+	return r;
+}
@@ -0,0 +1,98 @@
+#include <MKL25Z4.H>
+#include <cmsis_os2.h>
+#include "irq_lat.h"
+
+volatile IRQ_LAT_T Irq_Lat[IRQ_LAT_NUM_SRC];
+volatile uint32_t Irq_Lat_Nest_Overflow;
+
+// Measured ISRs running now, outermost first
+static uint8_t Nest[IRQ_LAT_MAX_NEST];
+static uint32_t Nest_Depth;
+static uint32_t Last_Exit[IRQ_LAT_NUM_SRC]; // Sys timer count
+static uint8_t Exited; // Bit per source with a valid Last_Exit
+
+void IRQ_Lat_Reset(void) {
+	uint32_t s, b, m;
+
+	m = __get_PRIMASK();
+	__disable_irq();
+	for (s=0; s<IRQ_LAT_NUM_SRC; s++) {
+		Irq_Lat[s].Samples = 0;
+		Irq_Lat[s].Min = 0xffffffff;
+		Irq_Lat[s].Max = 0;
+		for (b=0; b<IRQ_LAT_BUCKETS; b++)
+			Irq_Lat[s].Hist[b] = 0;
+		Irq_Lat[s].Worst.Depth = 0;
+		Irq_Lat[s].Worst.Blockers = 0;
+	}
+	Irq_Lat_Nest_Overflow = 0;
+	Exited = 0;
+	__set_PRIMASK(m);
+}
+
+// floor(log2(cycles)), clamped to the histogram. No CLZ on the M0+
+static uint32_t IRQ_Lat_Bucket(uint32_t cycles) {
+	uint32_t b = 0;
+
+	if (cycles >= 1u << 8) {
+		cycles >>= 8;
+		b = 8;
+	}
+	if (cycles >= 1u << 4) {
+		cycles >>= 4;
+		b += 4;
+	}
+	while (cycles > 1) {
+		cycles >>= 1;
+		b++;
+	}
+	return (b < IRQ_LAT_BUCKETS) ? b : IRQ_LAT_BUCKETS-1;
+}
+
+void IRQ_Lat_Enter(IRQ_LAT_SRC_E src, uint32_t cycles) {
+	volatile IRQ_LAT_T * l = &Irq_Lat[src];
+	uint32_t now, trigger, m, i;
+	uint8_t blockers;
+
+	m = __get_PRIMASK();
+	__disable_irq();
+	now = osKernelGetSysTimerCount();
+	l->Samples++;
+	l->Hist[IRQ_Lat_Bucket(cycles)]++;
+	if ((l->Samples == 1) || (cycles < l->Min))
+		l->Min = cycles;
+	if (cycles > l->Max) {
+		l->Max = cycles;
+		l->Worst.Sample = l->Samples;
+		// Finished since the trigger, and not something this ISR preempted
+		trigger = now - cycles;
+		blockers = 0;
+		for (i=0; i<IRQ_LAT_NUM_SRC; i++) {
+			if ((i != src) && (Exited & (1u << i)) && ((int32_t) (Last_Exit[i] - trigger) > 0))
+				blockers |= 1u << i;
+		}
+		for (i=0; i<Nest_Depth; i++) {
+			blockers &= ~(1u << Nest[i]);
+			l->Worst.Preempted[i] = Nest[i];
+		}
+		l->Worst.Depth = Nest_Depth;
+		l->Worst.Blockers = blockers;
+	}
+	if (Nest_Depth < IRQ_LAT_MAX_NEST)
+		Nest[Nest_Depth++] = src;
+	else
+		Irq_Lat_Nest_Overflow++;
+	__set_PRIMASK(m);
+}
+
+void IRQ_Lat_Exit(IRQ_LAT_SRC_E src) {
+	uint32_t m;
+
+	m = __get_PRIMASK();
+	__disable_irq();
+	if ((Nest_Depth > 0) && (Nest[Nest_Depth-1] == src))
+		Nest_Depth--;
+	Last_Exit[src] = osKernelGetSysTimerCount();
+	Exited |= 1u << src;
+	__set_PRIMASK(m);
+}
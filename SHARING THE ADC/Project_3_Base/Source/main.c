@@ -12,6 +12,7 @@
 #include "LCD.h"
 #include "LCD_driver.h"
 #include "font.h"
+#include "LCD_benchmark.h"
 
 #include "LEDs.h"
 #include "timers.h"
@@ -23,6 +24,12 @@
 #include "profile.h"
 
 #include "control.h"
+#include "cpu_util.h"
+#include "stack_mon.h"
+#include "thread_stats.h"
+#include "irq_lat.h"
+#include "tickless.h"
+#include "boot_prof.h"
 
 
 /*----------------------------------------------------------------------------
@@ -30,43 +37,36 @@
  *----------------------------------------------------------------------------*/
 int main (void) {
 
+#if USE_BOOT_PROF
+	Boot_Prof_Init();
+#endif
 	Init_Debug_Signals();
+	IRQ_Lat_Reset();
 	Init_RGB_LEDs();
 	Control_RGB_LEDs(0,0,1);			
 	
 	Sound_Disable_Amp();
-	
-	LCD_Init();
-	LCD_Text_Init(1);
-	LCD_Erase();
-	
-	LCD_Erase();
-	LCD_Text_PrintStr_RC(0,0, "Test Code");
-
-#if 0
-	// LCD_TS_Calibrate();
-	LCD_TS_Test();
-#endif
-
-	LCD_Text_PrintStr_RC(1,0, "Accel...");
-	i2c_init();											// init I2C peripheral
-	if (!init_mma()) {							// init accelerometer
-		Control_RGB_LEDs(1,0,0);			// accel initialization failed, so turn on red error light
-		while (1)
-			;
-	}
-	LCD_Text_PrintStr_RC(1,9, "Done");
-
-	Delay(70);
-	LCD_Erase();
 
+	/* Only the control loop starts before the kernel. The LCD (with its
+	reset waits) and sound come up in Thread_Boot, and the accelerometer
+	in Thread_Read_Accelerometer, sleeping through their waits at the
+	same time (see threads.h). */
 	Init_HBLED();
-	
- 
-
+#if USE_BOOT_PROF
+	Boot_Mark("HBLED");
+#endif
 
 	osKernelInitialize();
+	CPU_Util_Init();
+	Stack_Mon_Init();
+	Thread_Stats_Init();
+#if USE_TICKLESS_IDLE
+	Tickless_Init();
+#endif
 	Create_OS_Objects();
+#if USE_BOOT_PROF
+	Boot_Kernel_Start();
+#endif
 	
 	osKernelStart();	
 }
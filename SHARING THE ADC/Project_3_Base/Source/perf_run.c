@@ -0,0 +1,130 @@
+#include <MKL25Z4.H>
+#include <cmsis_os2.h>
+#include "perf_run.h"
+#include "fmt.h"
+#include "control.h"
+#include "irq_lat.h"
+#include "cpu_util.h"
+#include "boot_prof.h"
+#include "LCD_benchmark.h"
+#include "threads.h"
+#include "tickless.h"
+
+char Perf_Record[PERF_REC_MAX];
+volatile uint32_t Perf_Record_Len;
+
+static char * Rec_End;   // Building position
+static uint32_t Rec_Metrics;
+static uint32_t Sleeps_Start; // Tickless_Stats.Sleeps at the window start
+
+static const char * const Irq_Lat_Names[IRQ_LAT_NUM_SRC] = {"adc", "pit0", "pit1", "dma_sound"};
+
+void Perf_Begin(const char * project) {
+	Perf_Record_Len = 0;
+	Rec_Metrics = 0;
+	Rec_End = Fmt_Str(Perf_Record, "PERF ");
+	Rec_End = Fmt_Int(Rec_End, PERF_REC_VERSION, 0);
+	Rec_End = Fmt_Str(Fmt_Str(Rec_End, " "), project);
+	Rec_End = Fmt_Str(Fmt_Str(Rec_End, " "), __DATE__ " " __TIME__ "\n");
+}
+
+// Dropped if the record is full, so END's count no longer matches
+void Perf_Metric(const char * name, int32_t value, const char * unit, char dir) {
+	char dir_str[2] = {dir, '\0'};
+
+	if (Rec_End + PERF_LINE_MAX + 16 > Perf_Record + PERF_REC_MAX) // Room for END too
+		return;
+	Rec_End = Fmt_Str(Fmt_Str(Rec_End, name), " ");
+	Rec_End = Fmt_Str(Fmt_Int(Rec_End, value, 0), " ");
+	Rec_End = Fmt_Str(Fmt_Str(Fmt_Str(Rec_End, unit), " "), dir_str);
+	Rec_End = Fmt_Str(Rec_End, "\n");
+	Rec_Metrics++;
+}
+
+void Perf_End(void) {
+	Rec_End = Fmt_Str(Rec_End, "END ");
+	Rec_End = Fmt_Str(Fmt_Int(Rec_End, Rec_Metrics, 0), "\n");
+	Perf_Record_Len = Rec_End - Perf_Record;
+}
+
+// Name from parts a.b, or a.b.c if c isn't 0
+static void Perf_Metric_Of(const char * a, const char * b, const char * c, int32_t value, const char * unit, char dir) {
+	char name[PERF_LINE_MAX/2], * p;
+
+	p = Fmt_Str(Fmt_Str(Fmt_Str(name, a), "."), b);
+	if (c)
+		Fmt_Str(Fmt_Str(p, "."), c);
+	Perf_Metric(name, value, unit, dir);
+}
+
+static void Perf_Window_Start(void) {
+	uint32_t m;
+
+	m = __get_PRIMASK();
+	__disable_irq();
+#if USE_CTL_TIMING
+	Ctl_Timing_Reset();
+#endif
+#if USE_CTL_DEADLINE
+	Ctl_Deadline.Overruns = 0;
+	Ctl_Deadline.Run_Max = 0;
+	Ctl_Deadline.Gap_Max = 0;
+	Ctl_Deadline.Held = 0;
+#endif
+#if USE_TICKLESS_IDLE
+	Sleeps_Start = Tickless_Stats.Sleeps;
+#endif
+	__set_PRIMASK(m);
+#if USE_IRQ_LAT
+	IRQ_Lat_Reset();
+#endif
+}
+
+static void Perf_Report(void) {
+	unsigned i;
+
+	Perf_Begin("P3");
+	for (i=0; i<LCD_BENCH_NUM_TESTS; i++)
+		if (LCD_Bench_Results[i].Name)
+			Perf_Metric_Of("lcd", LCD_Bench_Results[i].Name, 0, LCD_Bench_Results[i].us_Per_Op, "us", '-');
+#if USE_CTL_TIMING
+	Perf_Metric("ctl.entry_max", Ctl_Timing.Entry_Max, "tpm", '-');
+	Perf_Metric("ctl.lat_min", Ctl_Timing.Lat_Min, "tpm", '-');
+	Perf_Metric("ctl.lat_max", Ctl_Timing.Lat_Max, "tpm", '-');
+	Perf_Metric("ctl.missed", Ctl_Timing.Missed, "n", '-');
+	Perf_Metric("ctl.samples", Ctl_Timing.Samples, "n", '=');
+#endif
+#if USE_CTL_DEADLINE
+	Perf_Metric("ctl.overruns", Ctl_Deadline.Overruns, "n", '-');
+	Perf_Metric("ctl.gap_max", Ctl_Deadline.Gap_Max, "cyc", '-');
+	Perf_Metric("ctl.held", Ctl_Deadline.Held, "n", '=');
+#endif
+#if USE_TICKLESS_IDLE
+	Perf_Metric("idle.sleeps", Tickless_Stats.Sleeps - Sleeps_Start, "n", '=');
+#endif
+#if USE_IRQ_LAT
+	for (i=0; i<IRQ_LAT_NUM_SRC; i++) {
+		if (Irq_Lat[i].Samples == 0)
+			continue; // Source not in use in this build
+		Perf_Metric_Of("irq", Irq_Lat_Names[i], "min", Irq_Lat[i].Min, "cyc", '-');
+		Perf_Metric_Of("irq", Irq_Lat_Names[i], "max", Irq_Lat[i].Max, "cyc", '-');
+	}
+#endif
+	Perf_Metric("cpu.busy", CPU_Util_Busy(), "pm", '-');
+	Perf_Metric("cpu.peak", CPU_Util_Peak(), "pm", '-');
+#if USE_BOOT_PROF
+	if (Boot_Prof_Count > 0)
+		Perf_Metric("boot.last_mark", Boot_Prof[Boot_Prof_Count-1].us, "us", '-');
+#endif
+	Perf_End();
+}
+
+void Thread_Perf_Run(void * arg) {
+	(void) arg;
+	Boot_Wait(BOOT_FLAG_LCD); // LCD benchmark done
+	osDelay(PERF_RUN_SETTLE_MS*osKernelGetTickFreq()/1000);
+	Perf_Window_Start();
+	osDelay(PERF_RUN_WINDOW_MS*osKernelGetTickFreq()/1000);
+	Perf_Report();
+	osThreadExit();
+}
@@ -0,0 +1,185 @@
+#include <MKL25Z4.H>
+#include <stdint.h>
+#include <stddef.h>
+#include <cmsis_os2.h>
+#include "sd_audio.h"
+#include "sound.h"
+#include "misc.h"
+#include "sd_io.h"
+#include "spi_io.h"
+#include "blk_pool.h"
+
+#if USE_SD_AUDIO && !USE_SOUND
+#error "SD audio plays through the sound mixer, set USE_SOUND"
+#endif
+
+volatile uint8_t SD_Audio_Playing;
+volatile uint32_t SD_Audio_Underruns, SD_Audio_Read_Errors;
+
+static SD_DEV Dev;
+static SD_CTX Ctx;
+static osThreadId_t Reader_TID;
+
+static uint8_t * Ring[SD_AUDIO_RING_SECTORS]; // Pool blocks, the mixer releases each one it has used up
+static volatile uint32_t Sectors_In, Sectors_Out; // Free-running, In - Out sectors are ready
+static volatile uint8_t Clip_Read_Done;           // Last sector of the clip is in the ring
+static uint32_t Wr_Idx, Next_Sector, Sectors_Left; // Reader
+static uint32_t Rd_Idx, Rd_Ofs;                   // Mixer
+static uint16_t Volume;
+
+// Latest request, taken by the reader. Count 0 stops playback.
+static volatile uint8_t Req_Pending;
+static uint32_t Req_First, Req_Count;
+static uint16_t Req_Volume;
+
+static void SD_Audio_Request(uint32_t first_sector, uint32_t num_sectors, uint16_t volume) {
+	uint32_t m = __get_PRIMASK();
+
+	__disable_irq();
+	SD_Audio_Playing = 0; // Mixer lets go of the ring now
+	Req_First = first_sector;
+	Req_Count = num_sectors;
+	Req_Volume = volume;
+	Req_Pending = 1;
+	__set_PRIMASK(m);
+	if (Reader_TID != NULL)
+		osThreadFlagsSet(Reader_TID, SD_AUDIO_FLAG_WAKE);
+}
+
+int SD_Audio_Play(uint32_t first_sector, uint32_t num_sectors, uint16_t volume) {
+	if (num_sectors == 0)
+		return -1;
+	SD_Audio_Request(first_sector, num_sectors, volume);
+	return 0;
+}
+
+void SD_Audio_Stop(void) {
+	SD_Audio_Request(0, 0, 0);
+}
+
+void SD_Audio_Mix(int32_t * buf, uint32_t n) {
+	uint32_t i = 0, k;
+	const uint8_t * p;
+	int32_t s;
+
+	if (!SD_Audio_Playing)
+		return;
+	while (i < n) {
+		if (Sectors_In == Sectors_Out) {
+			if (Clip_Read_Done)
+				SD_Audio_Playing = 0; // End of clip
+			else
+				SD_Audio_Underruns++; // Card fell behind, rest of this buffer is silent
+			return;
+		}
+		p = &Ring[Rd_Idx][Rd_Ofs];
+		k = MIN(n - i, (SD_AUDIO_SECTOR_BYTES - Rd_Ofs)/SD_AUDIO_BYTES_PER_SAMPLE);
+		Rd_Ofs += k*SD_AUDIO_BYTES_PER_SAMPLE;
+		for (; k > 0; k--) {
+#if SD_AUDIO_BITS == 16
+			s = (int16_t) (p[0] | (p[1] << 8));
+			buf[i++] += (s*(int32_t) (Volume >> 1)) >> 19;
+			p += 2;
+#else
+			s = (int32_t) *p++ - 128;
+			buf[i++] += (s*(int32_t) Volume) >> 12;
+#endif
+		}
+		if (Rd_Ofs == SD_AUDIO_SECTOR_BYTES) {
+			// Sector used up, hand its block back to the reader
+			Blk_Release(Ring[Rd_Idx]);
+			Rd_Ofs = 0;
+			Rd_Idx = (Rd_Idx + 1) % SD_AUDIO_RING_SECTORS;
+			Sectors_Out++;
+			if (Reader_TID != NULL)
+				osThreadFlagsSet(Reader_TID, SD_AUDIO_FLAG_WAKE);
+		}
+	}
+}
+
+/* Run the FSM operation started in Ctx to completion. Higher priority
+threads preempt it as usual; the yield lets equal priority ones in too. */
+#define SD_AUDIO_RUN(call, res) do { unsigned steps_ = 0; \
+	do { res = call; \
+		if (++steps_ % SD_AUDIO_STEPS_PER_YIELD == 0) osThreadYield(); \
+	} while (Ctx.busy == 1); } while (0)
+
+static int SD_Audio_Card_Init(void) {
+	SDRESULTS res;
+
+	SPI_Init();
+	SD_AUDIO_RUN(SD_Init(&Dev, &Ctx), res);
+	return (res == SD_OK) ? 0 : -1;
+}
+
+static int SD_Audio_Read_Sector(uint8_t * dest, uint32_t sector) {
+	SDRESULTS res;
+
+	SD_AUDIO_RUN(SD_Read(&Dev, &Ctx, dest, sector, 0, SD_BLK_SIZE), res);
+	return (res == SD_OK) ? 0 : -1;
+}
+
+/* Reset the ring for the requested clip. The mixer can't be part way
+through a buffer (it has the higher priority), and masking keeps a newer
+request from slipping in between. */
+static void SD_Audio_Take_Request(void) {
+	uint32_t m = __get_PRIMASK();
+
+	__disable_irq();
+	Next_Sector = Req_First;
+	Sectors_Left = Req_Count;
+	Volume = Req_Volume;
+	Req_Pending = 0;
+	for (; Sectors_Out != Sectors_In; Sectors_Out++) {
+		Blk_Release(Ring[Rd_Idx]); // Rest of the previous clip
+		Rd_Idx = (Rd_Idx + 1) % SD_AUDIO_RING_SECTORS;
+	}
+	Sectors_In = Sectors_Out = 0;
+	Wr_Idx = Rd_Idx = Rd_Ofs = 0;
+	Clip_Read_Done = 0;
+	SD_Audio_Playing = (Sectors_Left > 0); // Underruns until the first sector is in
+	__set_PRIMASK(m);
+}
+
+// Clip can't be read, let the mixer play out what is in the ring
+static void SD_Audio_Abandon_Clip(void) {
+	SD_Audio_Read_Errors++;
+	Sectors_Left = 0;
+	Clip_Read_Done = 1;
+	Dev.mount = FALSE; // Start over with SD_Init for the next clip
+}
+
+void Thread_SD_Audio(void * arg) {
+	uint8_t * blk;
+
+	Reader_TID = osThreadGetId();
+	while (1) {
+		if (Req_Pending)
+			SD_Audio_Take_Request();
+		if ((Sectors_Left == 0) || (Sectors_In - Sectors_Out >= SD_AUDIO_RING_SECTORS)) {
+			// Idle or readahead full: wait for a request or for the mixer to free a sector
+			osThreadFlagsWait(SD_AUDIO_FLAG_WAKE, osFlagsWaitAny, osWaitForever);
+			continue;
+		}
+		if (!Dev.mount && (SD_Audio_Card_Init() != 0)) {
+			SD_Audio_Abandon_Clip();
+			continue;
+		}
+		blk = Blk_Alloc();
+		if (blk == NULL) {
+			osDelay(1); // Pool lent to someone else, not just to the ring
+			continue;
+		}
+		if (SD_Audio_Read_Sector(blk, Next_Sector) != 0) {
+			Blk_Release(blk);
+			SD_Audio_Abandon_Clip();
+			continue;
+		}
+		Ring[Wr_Idx] = blk;
+		Wr_Idx = (Wr_Idx + 1) % SD_AUDIO_RING_SECTORS;
+		Next_Sector++;
+		Sectors_In++; // Publish the sector, then say whether it was the last
+		if (--Sectors_Left == 0)
+			Clip_Read_Done = 1;
+	}
+}
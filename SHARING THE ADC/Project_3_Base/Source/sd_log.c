@@ -0,0 +1,280 @@
+#include <MKL25Z4.H>
+#include <stdint.h>
+#include <string.h>
+#include <cmsis_os2.h>
+#include "sd_log.h"
+#include "sd_audio.h"
+#include "telemetry.h"
+#include "control.h"
+#include "misc.h"
+#include "sd_io.h"
+#include "spi_io.h"
+#include "sd_crc.h"
+#include "blk_pool.h"
+
+#if USE_SD_LOG && USE_SD_AUDIO
+#error "SD audio and the SD log both need the card, pick one"
+#endif
+#if USE_SD_LOG && !USE_TELEMETRY
+#error "The SD log reads the telemetry ring, set USE_TELEMETRY"
+#endif
+
+volatile SD_LOG_STATUS_T SD_Log_Status;
+
+static SD_DEV Dev;
+static SD_CTX Ctx;
+static uint32_t Log_Sectors;   // Region size, clipped to the card
+static uint32_t Base_Seq;      // Seq of the region's first sector
+static uint32_t Last_Misses;   // Deadline overruns during the latest SD_LOG_RUN
+
+// Accelerometer samples, Thread_Read_Accelerometer to Thread_SD_Log
+static SD_LOG_ACCEL_T Accel_Ring[SD_LOG_ACCEL_RECS];
+static volatile uint32_t Accel_Head, Accel_Tail; // Free-running
+static uint8_t Accel_Seq;
+
+// Two batches of sector images, each a run of adjacent pool blocks that
+// SD_Write_Multi takes whole. Records go into batch Fill while the other
+// one is written.
+static uint8_t * Batch[2];
+static uint8_t Fill, Fill_Sector;  // Fill_Sector == SD_LOG_BATCH: batch is full
+static uint16_t Fill_Count;        // Records in that sector
+static uint8_t Collecting;
+
+#define SECTOR(b, k) (Batch[b] + (k)*SD_BLK_SIZE)
+
+void SD_Log_Accel(const MMA_SAMPLE_T * s, uint32_t n) {
+	SD_LOG_ACCEL_T * r;
+	uint32_t h = Accel_Head;
+
+	if (!SD_Log_Status.Ready)
+		return;
+	for (; n > 0; n--, s++) {
+		if (h - Accel_Tail >= SD_LOG_ACCEL_RECS) {
+			SD_Log_Status.Accel_Dropped++;
+		} else {
+			r = &Accel_Ring[h & (SD_LOG_ACCEL_RECS-1)];
+			r->Sync = SD_LOG_ACCEL_SYNC;
+			r->Seq = Accel_Seq;
+			r->X = s->X;
+			r->Y = s->Y;
+			r->Z = s->Z;
+			h++;
+		}
+		Accel_Seq++;
+	}
+	Accel_Head = h; // Publish after the records are complete
+}
+
+static uint8_t * Fill_Ptr(void) {
+	return SECTOR(Fill, Fill_Sector) + sizeof(SD_LOG_HDR_T) + Fill_Count*SD_LOG_REC_SIZE;
+}
+
+static void Close_Sector(void) {
+	((SD_LOG_HDR_T *) SECTOR(Fill, Fill_Sector))->Count = Fill_Count;
+	Fill_Count = 0;
+	Fill_Sector++;
+}
+
+static void Filled(uint32_t n) {
+	Fill_Count += n;
+	if (Fill_Count == SD_LOG_RECS_PER_SECTOR)
+		Close_Sector();
+}
+
+// Move waiting records into the batch being filled, as far as it has room
+static void SD_Log_Collect(void) {
+	uint32_t t, n;
+
+	if (!Collecting)
+		return;
+	while (Fill_Sector < SD_LOG_BATCH) {
+		t = Accel_Tail;
+		if (t != Accel_Head) {
+			memcpy(Fill_Ptr(), &Accel_Ring[t & (SD_LOG_ACCEL_RECS-1)], SD_LOG_REC_SIZE);
+			Accel_Tail = t+1;
+			Filled(1);
+			continue;
+		}
+		n = Telemetry_Log_Read((TELEM_REC_T *) Fill_Ptr(), SD_LOG_RECS_PER_SECTOR - Fill_Count);
+		if (n == 0)
+			break;
+		Filled(n);
+	}
+}
+
+/* Run the FSM operation started in Ctx to completion, refilling the
+batch every few steps. Higher priority threads preempt it as usual.
+Control deadline overruns in the meantime are charged to the card. */
+#define SD_LOG_RUN(call, res) do { unsigned steps_ = 0; \
+	uint32_t ovr_ = Ctl_Deadline.Overruns; \
+	do { res = call; \
+		if (++steps_ % SD_LOG_STEPS_PER_COLLECT == 0) SD_Log_Collect(); \
+	} while (Ctx.busy == 1); \
+	Last_Misses = Ctl_Deadline.Overruns - ovr_; \
+	SD_Log_Status.Card_Misses += Last_Misses; } while (0)
+
+static WORD Log_CRC(const uint8_t * sector) {
+	return SD_CRC16(0, sector, SD_BLK_SIZE - 2);
+}
+
+// 1 if the sector image belongs to the log at region index
+static int Sector_Valid(const uint8_t * sector, uint32_t index) {
+	const SD_LOG_HDR_T * h = (const SD_LOG_HDR_T *) sector;
+
+	if ((h->Magic != SD_LOG_MAGIC) || (h->Rec_Size != SD_LOG_REC_SIZE) ||
+		(Log_CRC(sector) != ((sector[SD_BLK_SIZE-2] << 8) | sector[SD_BLK_SIZE-1])))
+		return 0;
+	return (index == 0) || ((h->Session == SD_Log_Status.Session) && (h->Seq == Base_Seq + index));
+}
+
+static SDRESULTS SD_Log_Card_Init(void) {
+	SDRESULTS res;
+
+	SD_LOG_RUN(SD_Init(&Dev, &Ctx), res);
+	if (res != SD_OK)
+		return res;
+	if (Dev.last_sector < SD_LOG_FIRST_SECTOR)
+		return SD_PARERR;
+	Log_Sectors = MIN(SD_LOG_SECTORS, Dev.last_sector - SD_LOG_FIRST_SECTOR + 1);
+	return SD_OK;
+}
+
+// Continue the log on the card, or start a new one if there is none
+static SDRESULTS SD_Log_Find_Tail(void) {
+	uint8_t * sec = SECTOR(0, 0); // Batches are empty until logging starts
+	const SD_LOG_HDR_T * h = (const SD_LOG_HDR_T *) sec;
+	uint32_t lo, hi, mid;
+	SDRESULTS res;
+
+	SD_LOG_RUN(SD_Read(&Dev, &Ctx, sec, SD_LOG_FIRST_SECTOR, 0, SD_BLK_SIZE), res);
+	if (res != SD_OK)
+		return res;
+	if (!Sector_Valid(sec, 0)) {
+		SD_Log_Status.Session = osKernelGetSysTimerCount() | 1;
+		Base_Seq = 0;
+		SD_Log_Status.Tail = 0;
+#if SD_LOG_PRE_ERASE
+		// Only speeds up the writes, so log anyway if it fails
+		SD_LOG_RUN(SD_Erase(&Dev, &Ctx, SD_LOG_FIRST_SECTOR, SD_LOG_FIRST_SECTOR + Log_Sectors - 1), res);
+#endif
+		return SD_OK;
+	}
+	SD_Log_Status.Session = h->Session;
+	Base_Seq = h->Seq;
+	lo = 1; // Invariant: lo-1 is in the log, hi is not
+	hi = Log_Sectors;
+	while (lo < hi) {
+		mid = lo + (hi - lo)/2;
+		SD_LOG_RUN(SD_Read(&Dev, &Ctx, sec, SD_LOG_FIRST_SECTOR + mid, 0, SD_BLK_SIZE), res);
+		if (res != SD_OK)
+			return res;
+		if (Sector_Valid(sec, mid))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	SD_Log_Status.Tail = lo;
+	return SD_OK;
+}
+
+// Stamp headers and CRCs of the first n sectors of batch b and write them at the tail
+static SDRESULTS SD_Log_Write(uint8_t b, uint8_t n) {
+	SD_LOG_HDR_T * h;
+	uint32_t k, t0, ms;
+	WORD crc;
+	DWORD sector = SD_LOG_FIRST_SECTOR + SD_Log_Status.Tail;
+	SDRESULTS res;
+
+	for (k = 0; k < n; k++) {
+		h = (SD_LOG_HDR_T *) SECTOR(b, k);
+		h->Magic = SD_LOG_MAGIC;
+		h->Session = SD_Log_Status.Session;
+		h->Seq = Base_Seq + SD_Log_Status.Tail + k;
+		h->Rec_Size = SD_LOG_REC_SIZE;
+		crc = Log_CRC(SECTOR(b, k));
+		SECTOR(b, k)[SD_BLK_SIZE-2] = (uint8_t) (crc >> 8);
+		SECTOR(b, k)[SD_BLK_SIZE-1] = (uint8_t) crc;
+	}
+	t0 = osKernelGetTickCount();
+	if (n > 1)
+		SD_LOG_RUN(SD_Write_Multi(&Dev, &Ctx, SECTOR(b, 0), sector, n), res);
+	else
+		SD_LOG_RUN(SD_Write(&Dev, &Ctx, SECTOR(b, 0), sector), res);
+	ms = osKernelGetTickCount() - t0;
+	if (ms > SD_Log_Status.Write_Max_ms)
+		SD_Log_Status.Write_Max_ms = ms;
+	if (res == SD_OK) {
+		SD_Log_Status.Tail += n;
+		SD_Log_Status.Sectors += n;
+	}
+	return res;
+}
+
+// Time and deadline overruns, first record after each write
+static void SD_Log_Mark(void) {
+	SD_LOG_MARK_T m;
+
+	if (Fill_Sector == SD_LOG_BATCH)
+		return;
+	m.Sync = SD_LOG_MARK_SYNC;
+	m.Card_Misses = MIN(Last_Misses, 255);
+	m.Tick = (uint16_t) osKernelGetTickCount();
+	m.Overruns = Ctl_Deadline.Overruns;
+	memcpy(Fill_Ptr(), &m, SD_LOG_REC_SIZE);
+	Filled(1);
+}
+
+void Thread_SD_Log(void * arg) {
+	uint32_t next_sync;
+	uint8_t b, n;
+	SDRESULTS res;
+
+	Batch[0] = Blk_Claim(SD_LOG_BATCH, "SD log");
+	Batch[1] = Blk_Claim(SD_LOG_BATCH, "SD log");
+	SPI_Init();
+	while (((res = SD_Log_Card_Init()) != SD_OK) || ((res = SD_Log_Find_Tail()) != SD_OK)) {
+		SD_Log_Status.Error = res; // No card yet, or it can't be read
+		Dev.mount = FALSE;
+		osDelay(SD_LOG_RETRY_MS);
+	}
+	SD_Log_Status.Error = SD_OK;
+	Fill = Fill_Sector = Fill_Count = 0;
+	Telemetry_Log_Start();
+	Collecting = 1;
+	SD_Log_Status.Ready = 1;
+	next_sync = osKernelGetTickCount() + SD_LOG_SYNC_MS;
+	while (1) {
+		SD_Log_Collect();
+		if (Fill_Sector < SD_LOG_BATCH) {
+			if ((int32_t) (osKernelGetTickCount() - next_sync) < 0) {
+				osDelay(SD_LOG_PERIOD_MS);
+				continue;
+			}
+			// Don't let records wait longer, write what there is
+			if (Fill_Count > 0)
+				Close_Sector();
+			next_sync = osKernelGetTickCount() + SD_LOG_SYNC_MS;
+			if (Fill_Sector == 0)
+				continue;
+		}
+		b = Fill;
+		n = Fill_Sector;
+		if (SD_Log_Status.Tail + n > Log_Sectors) {
+			SD_Log_Status.Full = 1;
+			break;
+		}
+		// Collect fills the other batch while this one is written
+		Fill ^= 1;
+		Fill_Sector = Fill_Count = 0;
+		res = SD_Log_Write(b, n);
+		if (res != SD_OK) {
+			SD_Log_Status.Error = res;
+			break;
+		}
+		SD_Log_Mark();
+		next_sync = osKernelGetTickCount() + SD_LOG_SYNC_MS;
+	}
+	SD_Log_Status.Ready = 0;
+	Collecting = 0;
+	Telemetry_Log_Stop(); // Let go of the ring for the UART
+}
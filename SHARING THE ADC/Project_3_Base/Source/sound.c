@@ -11,12 +11,18 @@
 #include "DMA.h"
 #include "threads.h"
 #include "debug.h"
+#include "sd_audio.h"
+#include "FX.h"
+#include "blk_pool.h"
 
-int16_t SineTable[NUM_STEPS];
-uint16_t Waveform[2][NUM_WAVEFORM_SAMPLES];
+int16_t SineTable[NUM_STEPS+1]; // Q15, last entry repeats the first for interpolation
+uint16_t * Waveform[2];         // NUM_WAVEFORM_SAMPLES each, from the block pool
+static int32_t * Mix_Buffer;   // Voices accumulate here before conversion to DAC codes
 uint8_t write_buffer_num= 0; // Number of waveform buffer currently being written 
 
 VOICE_T Voice[NUM_VOICES];
+osMessageQueueId_t Sound_MsgQ;
+volatile uint32_t Sound_Voices_Stolen, Sound_Events_Dropped;
 
 void DAC_Init(void) {
   // Init DAC output
@@ -47,8 +53,9 @@ void SineTable_Init(void) {
 	unsigned n;
 	
 	for (n=0; n<NUM_STEPS; n++) {
-		SineTable[n] = (MAX_DAC_CODE/2)*sinf(n*(2*3.1415927/NUM_STEPS));
+		SineTable[n] = 32767*sinf(n*(2*3.1415927/NUM_STEPS));
 	}
+	SineTable[NUM_STEPS] = SineTable[0];
 }
 
 /* Fill waveform buffers with silence. */
@@ -72,20 +79,30 @@ void Init_Voices(void) {
 		Voice[i].Counter = 0;
 		Voice[i].CounterIncrement = 0;
 		Voice[i].Type = VW_UNINIT;
+		Voice[i].Tag = 0;
 	}
 }
 
 /* Initialize sound hardware, sine table, and waveform buffer. */
 void Sound_Init(void) {
+	int tmr;
+
 	SineTable_Init();	
+	Waveform[0] = Blk_Claim(BLK_COUNT(NUM_WAVEFORM_SAMPLES*2), "Waveform");
+	Waveform[1] = Blk_Claim(BLK_COUNT(NUM_WAVEFORM_SAMPLES*2), "Waveform");
+	Mix_Buffer = Blk_Claim(BLK_COUNT(NUM_WAVEFORM_SAMPLES*4), "Mix_Buffer");
 	Init_Waveform();
 	Init_Voices();
 	write_buffer_num = 0; // Start writing to waveform buffer 0
 	
 	DAC_Init();
 	DMA_Init();
-	TPM0_Init();
-	Configure_TPM0_for_DMA(AUDIO_SAMPLE_PERIOD_US); 
+	// Pace samples with a TPM nobody else uses, normally TPM2
+	tmr = Timer_Claim_Free_TPM("Audio");
+	if (tmr >= 0) {
+		Configure_TPM_for_DMA(Timer_TPM((TMR_E) tmr), AUDIO_SAMPLE_PERIOD_US); 
+		DMA_Set_Playback_Timer((TMR_E) tmr);
+	}
 
 	SIM->SOPT2 |= (SIM_SOPT2_TPMSRC(1) | SIM_SOPT2_PLLFLLSEL_MASK);
 
@@ -108,7 +125,7 @@ void Sound_Disable_Amp(void) {
 /* Simple audio test function using busy-waiting. */
 void Play_Tone(void) {
 	int i, d=MAX_DAC_CODE>>7, n;
-	int p[12] = {813, 1150, 813, 813, 813, 1150, 813, 813, 813, 813, 1150, 1150};
+	int p[12] = {81, 115, 81, 81, 81, 115, 81, 81, 81, 81, 115, 115}; // Half periods, us
 	int c[12] = {800, 283,  800, 800, 800, 283,  800, 800, 800, 800,  283, 283};
 	
 #if 0	
@@ -125,149 +142,250 @@ void Play_Tone(void) {
 		n = c[i];
 		while (n--) {
 			Play_Sound_Sample((MAX_DAC_CODE>>1)+d);
-			ShortDelay(p[i]);
+			Delay_us(p[i]);
 			Play_Sound_Sample((MAX_DAC_CODE>>1)-d);
-			ShortDelay(p[i]);
+			Delay_us(p[i]);
 		}
 		Delay(40);
 	}
 #endif
 }
 
-int16_t Sound_Generate_Next_Sample (VOICE_T *voice) {
-	uint16_t lfsr;
-	uint16_t bit;
-	int16_t sample;
-
-	switch (voice->Type) {
-		case VW_NOISE:
-			lfsr = voice->Counter;
-			// source code from http://en.wikipedia.org/wiki/Linear_feedback_shift_register
-			/* taps: 16 14 13 11; characteristic polynomial: x^16 + x^14 + x^13 + x^11 + 1 */
-			bit  = ((lfsr >> 0) ^ (lfsr >> 2) ^ (lfsr >> 3) ^ (lfsr >> 5) ) & 1;
-			lfsr =  (lfsr >> 1) | (bit << 15);
-			voice->Counter = lfsr;
-			sample = (lfsr >> 4) - (MAX_DAC_CODE/2); // scale to get 12-bit value
-			break;
-		case VW_SQUARE:
-			if (voice->Counter < voice->Period/2) {
-				sample = MAX_DAC_CODE/2 - 1;
-			} else {
-				sample = -MAX_DAC_CODE/2;
-			}
-			voice->Counter++;
-			if (voice->Counter == voice->Period) {
-				voice->Counter = 0;
-			}
-			break;
-		case VW_SINE:
-			sample = SineTable[((voice->Counter)/256)]; // & (NUM_STEPS-1)]; 
-			voice->Counter += voice->CounterIncrement;
-			if (voice->Counter > voice->Period * voice->CounterIncrement){
-				voice->Counter = 0;
-			}
-			break;
-		default:
-			sample = 0;
-			break;
+/* Block generators. Each adds n samples of one voice, scaled by a volume
+ramp, into the 32-bit mix buffer. vol is Q24 (Volume << 8), dvol its
+per-sample change. */
+static void Mix_Noise(VOICE_T * voice, int32_t * mix, uint32_t n, uint32_t vol, int32_t dvol) {
+	uint32_t lfsr = voice->Counter & 0xffff, bit, i;
+
+	for (i=0; i<n; i++) {
+		// source code from http://en.wikipedia.org/wiki/Linear_feedback_shift_register
+		/* taps: 16 14 13 11; characteristic polynomial: x^16 + x^14 + x^13 + x^11 + 1 */
+		bit  = ((lfsr >> 0) ^ (lfsr >> 2) ^ (lfsr >> 3) ^ (lfsr >> 5) ) & 1;
+		lfsr =  (lfsr >> 1) | (bit << 15);
+		mix[i] += (((int32_t) (lfsr >> 4) - (MAX_DAC_CODE/2))*(int32_t) (vol >> 8)) >> 16; // scale to get 12-bit value
+		vol += dvol;
+	}
+	voice->Counter = lfsr;
+}
+
+static void Mix_Square(VOICE_T * voice, int32_t * mix, uint32_t n, uint32_t vol, int32_t dvol) {
+	uint32_t c = voice->Counter, period = voice->Period, half = voice->Period/2, i;
+	int32_t v;
+
+	for (i=0; i<n; i++) {
+		v = vol >> 8;
+		mix[i] += (c < half) ? (((MAX_DAC_CODE/2 - 1)*v) >> 16) : ((-(MAX_DAC_CODE/2)*v) >> 16);
+		if (++c == period)
+			c = 0;
+		vol += dvol;
+	}
+	voice->Counter = c;
+}
+
+/* 32-bit phase accumulator: the top SINE_TABLE_BITS select the table entry and
+wrap for free, the next 16 bits interpolate towards the following entry. */
+#define SINE_IDX_SHIFT (32-SINE_TABLE_BITS)
+static void Mix_Sine(VOICE_T * voice, int32_t * mix, uint32_t n, uint32_t vol, int32_t dvol) {
+	uint32_t phase = voice->Counter, inc = voice->CounterIncrement, i, idx;
+	int32_t s;
+
+	for (i=0; i<n; i++) {
+		idx = phase >> SINE_IDX_SHIFT;
+		s = SineTable[idx];
+#if SINE_INTERPOLATE
+		s += ((SineTable[idx+1] - s)*(int32_t) ((phase >> (SINE_IDX_SHIFT-16)) & 0xffff)) >> 16;
+#endif
+		// Q15 sample times Q15 volume, scaled to +/- MAX_DAC_CODE/2
+		mix[i] += Multiply_Q15((Q15) s, (Q15) (vol >> 9)) >> 4;
+		phase += inc;
+		vol += dvol;
 	}
-	return sample;
+	voice->Counter = phase;
+}
+
+/* Volume after n samples of per-sample decay: Volume*((65536-Decay)/65536)^n,
+by squaring. Decay <= 0 leaves the volume unchanged. */
+static uint32_t Decayed_Volume(VOICE_T * voice, uint32_t n) {
+	uint32_t f, r = voice->Volume;
+
+	if (voice->Decay <= 0)
+		return r;
+	f = 65536 - voice->Decay; // < 65536, so f*f fits in 32 bits
+	while (n) {
+		if (n & 1)
+			r = (r*f) >> 16;
+		f = (f*f) >> 16;
+		n >>= 1;
+	}
+	return r;
 }
 
 void Play_Waveform_with_DMA(void) {
+#if USE_DOUBLE_BUFFER
+	// Runs until stopped, DMA ISR alternates between the two buffers
+	Configure_DMA_For_Playback(Waveform[0], Waveform[1], NUM_WAVEFORM_SAMPLES, DMA_PLAYBACK_FOREVER);
+#else
 	Configure_DMA_For_Playback(Waveform[0], Waveform[1], NUM_WAVEFORM_SAMPLES, 1);
+#endif
 	Start_DMA_Playback();
 }
 
- void Thread_Sound_Manager(void * arg) {
-	uint16_t lfsr=1234;
-	uint16_t bit;
-	
-	while (1) {
-#if 1
-		// make a new random sound periodically
-		DEBUG_START(DBG_TSNDMGR_POS);
-		Voice[0].Volume = 0xAFFF; 
-		Voice[0].Duration = 6000;
-		bit  = ((lfsr >> 0) ^ (lfsr >> 2) ^ (lfsr >> 3) ^ (lfsr >> 5) ) & 1;
-		lfsr =  (lfsr >> 1) | (bit << 15);
-#if 1
-		Voice[0].Period = FREQ_TO_PERIOD((lfsr & 0x03FF) + 40); 
-		Voice[0].Decay = 30;
-#else // fixed frequency
-		Voice[0].Period = FREQ_TO_PERIOD(1000); 
-		Voice[0].Decay = 90;
-#endif
-		Voice[0].Counter = 0; 
-		Voice[0].CounterIncrement = (NUM_STEPS*256)/Voice[0].Period; 
-		Voice[0].Type = VW_SINE;
-		PTB->PCOR = MASK(DBG_TSNDMGR_POS);
-#else
-		// TODO: convert to new API
-		os_evt_wait_and(EV_PLAYSOUND, osWaitForever); // wait for trigger
-		// Add code to initialize voices
+ int Sound_Note_On(VW_E type, uint16_t freq_hz, uint16_t volume, int16_t decay,
+	uint16_t duration_ms, uint8_t tag) {
+	SOUND_MSG_T m;
+
+	m.Event = SND_NOTE_ON;
+	m.Type = type;
+	m.Tag = tag;
+	m.Volume = volume;
+	m.Decay = decay;
+	m.Freq_Hz = freq_hz;
+	m.Duration_ms = duration_ms;
+	if (osMessageQueuePut(Sound_MsgQ, &m, 0, 0) != osOK) {
+		Sound_Events_Dropped++;
+		return -1;
+	}
+	return 0;
+}
+
+int Sound_Note_Off(uint8_t tag) {
+	SOUND_MSG_T m;
+
+	m.Event = SND_NOTE_OFF;
+	m.Tag = tag;
+	if (osMessageQueuePut(Sound_MsgQ, &m, 0, 0) != osOK) {
+		Sound_Events_Dropped++;
+		return -1;
+	}
+	return 0;
+}
+
+/* Free voice if there is one, else the quietest. Mixer thread only. */
+static VOICE_T * Voice_Alloc(void) {
+	VOICE_T * quietest = &Voice[0];
+	uint16_t v;
+
+	for (v=0; v<NUM_VOICES; v++) {
+		if (Voice[v].Duration == 0)
+			return &Voice[v];
+		if (Voice[v].Volume < quietest->Volume)
+			quietest = &Voice[v];
+	}
+	Sound_Voices_Stolen++;
+	return quietest;
+}
+
+/* Apply queued note events. Runs in the mixer thread between buffers, so
+voices never change under the mix loop. */
+static void Sound_Process_Events(void) {
+	SOUND_MSG_T m;
+	VOICE_T * voice;
+	uint16_t v;
+
+	while (osMessageQueueGet(Sound_MsgQ, &m, NULL, 0) == osOK) {
+		if (m.Event == SND_NOTE_OFF) {
+			for (v=0; v<NUM_VOICES; v++) {
+				if ((Voice[v].Duration > 0) && (Voice[v].Tag == m.Tag))
+					Voice[v].Decay = MAX(Voice[v].Decay, SOUND_RELEASE_DECAY);
+			}
+			continue;
+		}
+		if ((m.Freq_Hz == 0) || (m.Duration_ms == 0))
+			continue;
+		voice = Voice_Alloc();
+		voice->Type = (VW_E) m.Type;
+		voice->Tag = m.Tag;
+		voice->Volume = m.Volume;
+		voice->Decay = m.Decay;
+		voice->Period = FREQ_TO_PERIOD(m.Freq_Hz);
+		voice->CounterIncrement = FREQ_TO_PHASE_INC(m.Freq_Hz);
+		voice->Counter = (voice->Type == VW_NOISE) ? 0xACE1 : 0; // LFSR seed must be non-zero
+		voice->Duration = MS_TO_SAMPLES(m.Duration_ms);
+	}
+}
+
+ /* Mix the active voices into one buffer of DAC codes, a voice at a time. */
+static void Sound_Fill_Buffer(uint16_t * buf) {
+	uint32_t i, n, v0, v1;
+	int32_t sum, dvol;
+	uint16_t v;
+	VOICE_T * voice;
+
+	for (i=0; i<NUM_WAVEFORM_SAMPLES; i++)
+		Mix_Buffer[i] = 0;
+	for (v=0; v<NUM_VOICES; v++) {
+		voice = &Voice[v];
+		if (voice->Volume == 0)
+			voice->Duration = 0; // Decayed to silence, free the voice
+		if (voice->Duration == 0)
+			continue;
+		n = MIN(voice->Duration, NUM_WAVEFORM_SAMPLES);
+		// Exact decay at block ends, linear in between
+		v0 = voice->Volume;
+		v1 = Decayed_Volume(voice, n);
+		dvol = (((int32_t) v1 - (int32_t) v0) << 8)/(int32_t) n;
+		switch (voice->Type) {
+			case VW_NOISE:
+				Mix_Noise(voice, Mix_Buffer, n, v0 << 8, dvol);
+				break;
+			case VW_SQUARE:
+				Mix_Square(voice, Mix_Buffer, n, v0 << 8, dvol);
+				break;
+			case VW_SINE:
+				Mix_Sine(voice, Mix_Buffer, n, v0 << 8, dvol);
+				break;
+			default:
+				break;
+		}
+		voice->Volume = v1;
+		voice->Duration -= n;
+	}
+#if USE_SD_AUDIO
+	SD_Audio_Mix(Mix_Buffer, NUM_WAVEFORM_SAMPLES);
 #endif
+	for (i=0; i<NUM_WAVEFORM_SAMPLES; i++) {
+		sum = Mix_Buffer[i] + (MAX_DAC_CODE/2);
+		sum = MIN(sum, MAX_DAC_CODE-1);
+		sum = MAX(sum, 0);
+		buf[i] = sum; 
+	}
+}
 
-		osThreadFlagsSet(t_Refill_Sound_Buffer, EV_REFILL_SOUND_BUFFER);	
-		Play_Waveform_with_DMA();
-		DEBUG_STOP(DBG_TSNDMGR_POS);
-		osDelay(200);
+#if USE_DOUBLE_BUFFER
+/* Fill every free buffer, in playback order. The one playing stays full
+until the DMA ISR frees it. */
+static void Sound_Refill_Free_Buffers(void) {
+	while (!DMA_Buffer_Full[write_buffer_num]) {
+		Sound_Process_Events();
+		Sound_Fill_Buffer(Waveform[write_buffer_num]);
+		DMA_Buffer_Full[write_buffer_num] = 1;
+		write_buffer_num = 1 - write_buffer_num;
 	}
 }
+#endif
 
  void Thread_Refill_Sound_Buffer(void * arg) {
-	uint32_t i;
-	uint16_t v;
-	int32_t sum, sample;
+	Boot_Wait(BOOT_FLAG_SOUND); // Sound_Init runs in Thread_Boot
 #if USE_DOUBLE_BUFFER
-	uint8_t initialized = 0;
+	// Start with both buffers full, then play continuously a buffer behind the mixer
+	Sound_Refill_Free_Buffers();
+	Play_Waveform_with_DMA();
 #endif
-	 
 	while (1) {
+#if USE_DOUBLE_BUFFER
 		osThreadFlagsWait(EV_REFILL_SOUND_BUFFER, osFlagsWaitAny, osWaitForever); // wait for trigger
 		DEBUG_START(DBG_TREFILLSB_POS);
-		for (i=0; i<NUM_WAVEFORM_SAMPLES; i++) {
-			sum = 0;
-			for (v=0; v<NUM_VOICES; v++) {
-				if (Voice[v].Duration > 0) {
-					sample = Sound_Generate_Next_Sample(&(Voice[v]));
-					
-					sample = (sample*Voice[v].Volume)>>16;
-					sum += sample;
-					// update volume with decayed version
-					Voice[v].Volume = (Voice[v].Volume * (((uint32_t) 65536) - Voice[v].Decay)) >> 16; 
-					Voice[v].Duration--;
-				} 
-			}
-			sum = sum + (MAX_DAC_CODE/2);
-			sum = MIN(sum, MAX_DAC_CODE-1);
-			Waveform[write_buffer_num][i] = sum; 
-		}
-#if USE_DOUBLE_BUFFER
-		write_buffer_num = 1 - write_buffer_num;
-		if (!initialized) { // Fill up both buffers the first time
-			initialized = 1; 
-			for (i=0; i<NUM_WAVEFORM_SAMPLES; i++) {
-				sum = 0;
-				for (v=0; v<NUM_VOICES; v++) {
-					if (Voice[v].Duration > 0) {
-						sample = Sound_Generate_Next_Sample(&(Voice[v]));
-						
-						sample = (sample*Voice[v].Volume)>>16;
-						sum += sample;
-						// update volume with decayed version
-						Voice[v].Volume = (Voice[v].Volume * (((uint32_t) 65536) - Voice[v].Decay)) >> 16; 
-						Voice[v].Duration--;
-					} 
-				}
-				sum = sum + (MAX_DAC_CODE/2);
-				sum = MIN(sum, MAX_DAC_CODE-1);
-				Waveform[write_buffer_num][i] = sum; 
-			}
-			write_buffer_num = 1 - write_buffer_num;
-		}	
-#endif			
+		Sound_Refill_Free_Buffers();
 		DEBUG_STOP(DBG_TREFILLSB_POS);
+#else
+		// Single buffer: fill it, play it once, wait for it to finish
+		DEBUG_START(DBG_TREFILLSB_POS);
+		Sound_Process_Events();
+		Sound_Fill_Buffer(Waveform[write_buffer_num]);
+		Play_Waveform_with_DMA();
+		DEBUG_STOP(DBG_TREFILLSB_POS);
+		osDelay(SOUND_BUFFER_MS);
+#endif			
 	}
 }
 
@@ -289,7 +407,7 @@ const float startup_chord[] = {659.3, 493.9, 329.6, 246.9};
 			Voice[v].Period = FREQ_TO_PERIOD(startup_sound[n]); 
 			Voice[v].Decay = 20;
 			Voice[v].Counter = 0; 
-			Voice[v].CounterIncrement = (NUM_STEPS*256)/Voice[v].Period; 
+			Voice[v].CounterIncrement = FREQ_TO_PHASE_INC(startup_sound[n]); 
 			Voice[v].Type = VW_SINE;
 
 			Voice[1].Duration = 0;
@@ -304,7 +422,7 @@ const float startup_chord[] = {659.3, 493.9, 329.6, 246.9};
 				Voice[v].Period = FREQ_TO_PERIOD(startup_chord[v]); 
 				Voice[v].Decay = 5;
 				Voice[v].Counter = 0; 
-				Voice[v].CounterIncrement = (NUM_STEPS*256)/Voice[v].Period; 
+				Voice[v].CounterIncrement = FREQ_TO_PHASE_INC(startup_chord[v]); 
 				Voice[v].Type = VW_SINE;
 			}
 			n++;
@@ -0,0 +1,58 @@
+#include <cmsis_os2.h>
+#include <rtx_os.h>
+#include "stack_mon.h"
+
+STACK_MON_T Stack_Mon[STACK_MON_MAX_THREADS];
+volatile uint32_t Stack_Mon_Count = 0, Stack_Mon_Low = 0;
+
+static osTimerId_t Stack_Mon_Timer;
+static osRtxTimer_t Stack_Mon_Timer_cb;
+static const osTimerAttr_t Stack_Mon_Timer_attr = {
+	.name = "Stack_Mon", .cb_mem = &Stack_Mon_Timer_cb, .cb_size = sizeof(Stack_Mon_Timer_cb)
+};
+static osThreadId_t Ids[STACK_MON_MAX_THREADS]; // Static, the timer thread's stack is small
+
+// Entry for the thread, adding it if new. NULL if the table is full
+static STACK_MON_T * Stack_Mon_Entry(osThreadId_t id) {
+	uint32_t i;
+
+	for (i=0; i<Stack_Mon_Count; i++) {
+		if (Stack_Mon[i].Id == id)
+			return &Stack_Mon[i];
+	}
+	if (Stack_Mon_Count >= STACK_MON_MAX_THREADS)
+		return NULL;
+	Stack_Mon[i].Id = id;
+	Stack_Mon[i].Name = osThreadGetName(id);
+	Stack_Mon[i].Size = osThreadGetStackSize(id);
+	Stack_Mon[i].Min_Free = Stack_Mon[i].Size;
+	Stack_Mon_Count++;
+	return &Stack_Mon[i];
+}
+
+void Stack_Mon_Scan(void) {
+	uint32_t n, i, free;
+	STACK_MON_T * e;
+
+	n = osThreadEnumerate(Ids, STACK_MON_MAX_THREADS);
+	for (i=0; i<n; i++) {
+		e = Stack_Mon_Entry(Ids[i]);
+		if (e == NULL)
+			break;
+		free = osThreadGetStackSpace(Ids[i]); // Scans up to the first overwritten pattern word
+		if (free < e->Min_Free)
+			e->Min_Free = free;
+		if (free < STACK_MON_LOW_BYTES)
+			Stack_Mon_Low++;
+	}
+}
+
+static void Stack_Mon_Timer_CB(void * arg) {
+	(void) arg;
+	Stack_Mon_Scan();
+}
+
+void Stack_Mon_Init(void) {
+	Stack_Mon_Timer = osTimerNew(Stack_Mon_Timer_CB, osTimerPeriodic, NULL, &Stack_Mon_Timer_attr);
+	osTimerStart(Stack_Mon_Timer, STACK_MON_PERIOD_MS*osKernelGetTickFreq()/1000);
+}
@@ -0,0 +1,163 @@
+#include <MKL25Z4.H>
+#include <stdint.h>
+#include <cmsis_os2.h>
+#include "step_test.h"
+#include "control.h"
+#include "HBLED.h"
+#include "FX.h"
+#include "flash_profile.h"
+
+#define TPM_COUNTS_PER_US (48)
+
+// Gain sets scale the compiled-in gains; set 0 is the tuning as built
+static const float Step_Gain_Scale[STEP_NUM_GAIN_SETS] = {1.0f, 0.5f, 2.0f};
+
+static const CTL_MODE_E Step_Modes[STEP_NUM_MODES] = {
+	BangBang, Incremental, Proportional, PID, PID_FX, PID_FX32
+};
+
+volatile uint32_t Step_Decimation = 1;
+STEP_SAMPLE_T Step_Buffer[STEP_SAMPLES];
+STEP_RESULT_T Step_Results[STEP_NUM_MODES][STEP_NUM_GAIN_SETS];
+
+static volatile uint8_t Recording;
+static volatile uint32_t Index;
+static uint32_t Decim_Count;
+static osThreadId_t Test_TID;
+
+// Control ISR context
+void Step_Test_Sample(int current, int duty) {
+	if (!Recording)
+		return;
+	if (++Decim_Count < Step_Decimation)
+		return;
+	Decim_Count = 0;
+	Step_Buffer[Index].Current = current;
+	Step_Buffer[Index].Duty = duty;
+	if (++Index == STEP_PRE_SAMPLES) {
+		g_set_current = STEP_HIGH_MA;
+		Set_DAC_mA(STEP_HIGH_MA);
+	} else if (Index >= STEP_SAMPLES) {
+		Recording = 0;
+		osThreadFlagsSet(Test_TID, STEP_FLAG_DONE);
+	}
+}
+
+static void Step_Apply_Gains(int gain_set) {
+	float k = Step_Gain_Scale[gain_set];
+	FX16_16 k_FX = FL_TO_FX(k);
+
+	plantPID.pGain = P_GAIN_FL*k;
+	plantPID.iGain = I_GAIN_FL*k;
+	plantPID.dGain = D_GAIN_FL*k;
+	plantPID_FX.pGain = Multiply_FX_Sat(P_GAIN_FX, k_FX);
+	plantPID_FX.iGain = Multiply_FX_Sat(I_GAIN_FX, k_FX);
+	plantPID_FX.dGain = Multiply_FX_Sat(D_GAIN_FX, k_FX);
+	pGain_8 = (int32_t) (PGAIN_8*k);
+}
+
+static int32_t Step_Samples_To_us(int32_t n) {
+	return (int32_t) (((int64_t) n*Ctl_Timing_Period()*Step_Decimation)/TPM_COUNTS_PER_US);
+}
+
+static void Step_Analyze(STEP_RESULT_T * r) {
+	int32_t initial=0, final=0, delta, peak, band, lo, hi, c;
+	int32_t t10=-1, t90=-1, t_settle=STEP_PRE_SAMPLES;
+	uint32_t i, n_final = STEP_SAMPLES/8;
+
+	for (i=0; i<STEP_PRE_SAMPLES; i++)
+		initial += Step_Buffer[i].Current;
+	initial /= STEP_PRE_SAMPLES;
+	for (i=STEP_SAMPLES-n_final; i<STEP_SAMPLES; i++)
+		final += Step_Buffer[i].Current;
+	final /= (int32_t) n_final;
+	delta = final - initial;
+
+	r->SS_Error_mA = STEP_HIGH_MA - final;
+	r->Valid = 0;
+	r->Rise_us = r->Overshoot_10 = r->Settle_us = -1;
+	if (delta <= 0)
+		return;
+
+	lo = initial + delta/10;
+	hi = initial + (delta*9)/10;
+	band = (delta*STEP_BAND_PCT)/100;
+	if (band < 1)
+		band = 1;
+	peak = initial;
+	for (i=STEP_PRE_SAMPLES; i<STEP_SAMPLES; i++) {
+		c = Step_Buffer[i].Current;
+		if ((t10 < 0) && (c >= lo))
+			t10 = i;
+		if ((t90 < 0) && (c >= hi))
+			t90 = i;
+		if (c > peak)
+			peak = c;
+		if ((c > final + band) || (c < final - band))
+			t_settle = i+1;
+	}
+	if (t90 < 0)
+		return;
+	r->Valid = 1;
+	r->Rise_us = Step_Samples_To_us(t90 - t10);
+	r->Overshoot_10 = (peak > final) ? ((peak - final)*1000)/delta : 0;
+	r->Settle_us = Step_Samples_To_us(t_settle - STEP_PRE_SAMPLES);
+}
+
+int Step_Test_Run(int mode, int gain_set, STEP_RESULT_T * r) {
+	uint32_t flags;
+
+	if ((gain_set < 0) || (gain_set >= STEP_NUM_GAIN_SETS))
+		return -1;
+	Test_TID = osThreadGetId();
+	g_enable_flash = 0;
+#if USE_FLASH_PROFILE
+	Flash_Profile_Stop(); // Setpoint belongs to the test now
+#endif
+
+	// Settle at the low setpoint from a clean controller state
+	__disable_irq();
+	Recording = 0;
+	Step_Apply_Gains(gain_set);
+	control_mode = (CTL_MODE_E) mode;
+	Control_Reset_State();
+	g_set_current = STEP_LOW_MA;
+	__enable_irq();
+	Set_DAC_mA(STEP_LOW_MA);
+	osDelay(STEP_HOLD_MS);
+
+	osThreadFlagsClear(STEP_FLAG_DONE);
+	Index = 0;
+	Decim_Count = 0;
+	Recording = 1; // ISR applies the step after STEP_PRE_SAMPLES
+	flags = osThreadFlagsWait(STEP_FLAG_DONE, osFlagsWaitAny, 1000);
+	Recording = 0;
+	if (flags & osFlagsError)
+		return -1;
+
+	r->Mode = mode;
+	r->Gain_Set = gain_set;
+	Step_Analyze(r);
+	return 0;
+}
+
+void Step_Test_Run_All(void) {
+	int m, g, n;
+	CTL_MODE_E saved_mode = control_mode;
+
+	for (m=0; m<STEP_NUM_MODES; m++) {
+		// Only modes with run-time gains get more than one run
+		n = ((Step_Modes[m] == Proportional) || (Step_Modes[m] == PID) ||
+			(Step_Modes[m] == PID_FX)) ? STEP_NUM_GAIN_SETS : 1;
+		for (g=0; g<n; g++)
+			Step_Test_Run(Step_Modes[m], g, &Step_Results[m][g]);
+	}
+
+	// Back to normal operation
+	__disable_irq();
+	Step_Apply_Gains(0);
+	control_mode = saved_mode;
+	Control_Reset_State();
+	__enable_irq();
+	g_enable_flash = 1;
+}
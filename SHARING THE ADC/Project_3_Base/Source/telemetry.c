@@ -0,0 +1,145 @@
+#include <MKL25Z4.H>
+#include <stdint.h>
+#include <cmsis_os2.h>
+#include "telemetry.h"
+#include "DMA.h"
+#include "sd_log.h"
+
+TELEM_REC_T Telem_Buf[TELEM_BUF_RECS];
+volatile uint32_t Telem_Head, Telem_Tail;
+volatile uint32_t Telem_Decimation = TELEM_DECIMATION, Telem_Dropped;
+uint32_t Telem_Decim_Count;
+uint8_t Telem_Seq;
+
+static osThreadId_t Drain_TID;
+static int8_t Telem_Ch = -1;
+
+#if USE_SD_LOG
+/* Reader positions. Telem_Tail, which the producer checks, is the one
+further back of the readers that are running. */
+static uint32_t TX_Tail, Log_Tail;
+static uint8_t TX_On, Log_On;
+
+static void Telemetry_Release(void) {
+	int32_t lock = osKernelLock(); // Both readers are threads
+	uint32_t h = Telem_Head, tx, lg;
+
+	tx = TX_On ? TX_Tail : h;
+	lg = Log_On ? Log_Tail : h;
+	Telem_Tail = ((int32_t) (tx - lg) < 0) ? tx : lg;
+	osKernelRestoreLock(lock);
+}
+#endif
+
+#define TELEM_SBR ((TELEM_UART_CLK_HZ/(TELEM_UART_OSR+1) + TELEM_BAUD/2)/TELEM_BAUD)
+
+static void Telemetry_TX_Done(uint8_t ch, uint32_t dsr) {
+	osThreadFlagsSet(Drain_TID, TELEM_FLAG_TX);
+}
+
+int Telemetry_Init(void) {
+	Drain_TID = osThreadGetId();
+	// Bulk data, let everything else go first
+	Telem_Ch = DMA_Alloc(DMA_PRIO_LOW, "Telemetry", Telemetry_TX_Done, 192);
+	if (Telem_Ch < 0)
+		return -1;
+
+	// UART0 on PTA2 (TX), clocked from MCGPLLCLK/2 like the TPMs
+	SIM->SCGC4 |= SIM_SCGC4_UART0_MASK;
+	SIM->SCGC5 |= SIM_SCGC5_PORTA_MASK;
+	SIM->SOPT2 |= SIM_SOPT2_UART0SRC(1) | SIM_SOPT2_PLLFLLSEL_MASK;
+	PORTA->PCR[2] = PORT_PCR_MUX(2);
+
+	UART0->C2 = 0;
+	UART0->C4 = UART0_C4_OSR(TELEM_UART_OSR);
+	UART0->BDH = UART0_BDH_SBR(TELEM_SBR >> 8);
+	UART0->BDL = UART0_BDL_SBR(TELEM_SBR);
+	UART0->C1 = 0; // 8 data bits, no parity
+	UART0->C5 = UART0_C5_TDMAE_MASK; // TDRE requests DMA
+	UART0->C2 = UART0_C2_TE_MASK;
+
+	DMA0->DMA[Telem_Ch].DAR = DMA_DAR_DAR((uint32_t) (&(UART0->D)));
+#if USE_SD_LOG
+	TX_Tail = Telem_Tail;
+	TX_On = 1;
+#endif
+	return 0;
+}
+
+// Send len bytes from buf on the DMA channel, block until done
+static void Telemetry_TX(const void * buf, uint32_t len) {
+	osThreadFlagsClear(TELEM_FLAG_TX);
+	DMA0->DMA[Telem_Ch].DSR_BCR = DMA_DSR_BCR_DONE_MASK;
+	DMA0->DMA[Telem_Ch].SAR = DMA_SAR_SAR((uint32_t) buf);
+	DMA0->DMA[Telem_Ch].DSR_BCR = DMA_DSR_BCR_BCR(len);
+	// Bytes to UART0 D, one per TDRE request, stop and interrupt at the end
+	DMA0->DMA[Telem_Ch].DCR = DMA_DCR_EINT_MASK | DMA_DCR_ERQ_MASK | DMA_DCR_CS_MASK |
+		DMA_DCR_SINC_MASK | DMA_DCR_SSIZE(1) | DMA_DCR_DSIZE(1) | DMA_DCR_D_REQ_MASK;
+	DMAMUX0->CHCFG[Telem_Ch] = DMAMUX_CHCFG_SOURCE(3) | DMAMUX_CHCFG_ENBL_MASK; // UART0 transmit
+
+	osThreadFlagsWait(TELEM_FLAG_TX, osFlagsWaitAny, osWaitForever);
+	DMAMUX0->CHCFG[Telem_Ch] = 0;
+}
+
+uint32_t Telemetry_Drain(void) {
+#if USE_SD_LOG
+	uint32_t t = TX_Tail, n, slot;
+#else
+	uint32_t t = Telem_Tail, n, slot;
+#endif
+
+	n = Telem_Head - t;
+	if ((n == 0) || (Telem_Ch < 0))
+		return 0;
+	// One DMA transfer can't wrap, so send up to the end of the buffer
+	slot = t & (TELEM_BUF_RECS-1);
+	if (n > TELEM_BUF_RECS - slot)
+		n = TELEM_BUF_RECS - slot;
+
+	Telemetry_TX(&Telem_Buf[slot], n*sizeof(TELEM_REC_T));
+	// Slots go back to the producer only after they're sent
+#if USE_SD_LOG
+	TX_Tail = t + n;
+	Telemetry_Release();
+#else
+	Telem_Tail = t + n;
+#endif
+	return n;
+}
+
+int Telemetry_Send(const void * buf, uint32_t len) {
+	if ((Telem_Ch < 0) || (len == 0))
+		return -1;
+	Telemetry_TX(buf, len);
+	return 0;
+}
+
+#if USE_SD_LOG
+void Telemetry_Log_Start(void) {
+	int32_t lock = osKernelLock();
+
+	Log_Tail = Telem_Tail;
+	Log_On = 1;
+	osKernelRestoreLock(lock);
+}
+
+void Telemetry_Log_Stop(void) {
+	Log_On = 0;
+	Telemetry_Release();
+}
+
+uint32_t Telemetry_Log_Read(TELEM_REC_T * dest, uint32_t max) {
+	uint32_t t = Log_Tail, n, i;
+
+	n = Telem_Head - t;
+	if (n > max)
+		n = max;
+	for (i=0; i<n; i++)
+		dest[i] = Telem_Buf[(t+i) & (TELEM_BUF_RECS-1)];
+	if (n > 0) {
+		Log_Tail = t + n;
+		Telemetry_Release();
+	}
+	return n;
+}
+#endif
@@ -0,0 +1,148 @@
+#include <MKL25Z4.H>
+#include <cmsis_os2.h>
+#include <rtx_os.h>
+#include "thread_stats.h"
+
+THREAD_STATS_T Thread_Stats[THREAD_STATS_MAX_THREADS];
+volatile uint32_t Thread_Stats_Count = 0, Thread_Stats_Untracked = 0;
+THREAD_STATS_LOG_T Thread_Stats_Log[THREAD_STATS_LOG_LEN];
+volatile uint32_t Thread_Stats_Log_Head = 0;
+
+#if THREAD_STATS
+
+// Sums kept by the hooks, same index as Thread_Stats. Times in timer counts
+static struct {
+	uint32_t Run;
+	uint32_t Lat_Sum, Lat_Count, Lat_Max;
+	uint32_t Ready_Time;
+	uint8_t Ready;
+} Acc[THREAD_STATS_MAX_THREADS];
+
+static int Current = -1; // Entry of the running thread, -1 if untracked
+static uint32_t Last_Switch, Window_Start;
+
+static osTimerId_t Thread_Stats_Timer;
+static osRtxTimer_t Thread_Stats_Timer_cb;
+static const osTimerAttr_t Thread_Stats_Timer_attr = {
+	.name = "Thread_Stats", .cb_mem = &Thread_Stats_Timer_cb, .cb_size = sizeof(Thread_Stats_Timer_cb)
+};
+
+// Replace the library's weak EventRecorder stubs
+void EvrRtxThreadUnblocked(osThreadId_t thread_id, uint32_t ret_val);
+void EvrRtxThreadSwitched(osThreadId_t thread_id);
+
+// Index of the thread's entry, adding it if new. -1 if the table is full
+static int Thread_Stats_Index(osThreadId_t id) {
+	uint32_t i;
+
+	for (i=0; i<Thread_Stats_Count; i++) {
+		if (Thread_Stats[i].Id == id)
+			return i;
+	}
+	if (Thread_Stats_Count >= THREAD_STATS_MAX_THREADS) {
+		Thread_Stats_Untracked++;
+		return -1;
+	}
+	Thread_Stats[i].Id = id; // Name is filled in by the window timer
+	Thread_Stats_Count++;
+	return i;
+}
+
+static void Thread_Stats_Log_Event(uint32_t now, int index, uint8_t event) {
+	THREAD_STATS_LOG_T * r;
+
+	r = &Thread_Stats_Log[Thread_Stats_Log_Head % THREAD_STATS_LOG_LEN];
+	r->Time = now;
+	r->Thread = (index < 0) ? 0xff : index;
+	r->Event = event;
+	Thread_Stats_Log_Head++;
+}
+
+void EvrRtxThreadUnblocked(osThreadId_t thread_id, uint32_t ret_val) {
+	uint32_t now;
+	int i;
+
+	(void) ret_val;
+	now = osKernelGetSysTimerCount();
+	i = Thread_Stats_Index(thread_id);
+	if (i >= 0) {
+		Acc[i].Ready_Time = now;
+		Acc[i].Ready = 1;
+	}
+	Thread_Stats_Log_Event(now, i, THREAD_STATS_EV_READY);
+}
+
+void EvrRtxThreadSwitched(osThreadId_t thread_id) {
+	uint32_t now, lat;
+	int i;
+
+	now = osKernelGetSysTimerCount();
+	if (Current >= 0)
+		Acc[Current].Run += now - Last_Switch;
+	Last_Switch = now;
+	i = Thread_Stats_Index(thread_id);
+	if (i >= 0) {
+		Thread_Stats[i].Switches++;
+		if (Acc[i].Ready) { // Woken, not returning from preemption
+			lat = now - Acc[i].Ready_Time;
+			Acc[i].Lat_Sum += lat;
+			Acc[i].Lat_Count++;
+			if (lat > Acc[i].Lat_Max)
+				Acc[i].Lat_Max = lat;
+			Acc[i].Ready = 0;
+		}
+	}
+	Current = i;
+	Thread_Stats_Log_Event(now, i, THREAD_STATS_EV_SWITCH);
+}
+
+static void Thread_Stats_Window(void * arg) {
+	uint32_t now, window, run, lat_sum, lat_count, lat_max, freq, i, n;
+	THREAD_STATS_T * e;
+
+	(void) arg;
+	freq = osKernelGetSysTimerFreq();
+	__disable_irq();
+	now = osKernelGetSysTimerCount();
+	if (Current >= 0) // This timer thread, up to now
+		Acc[Current].Run += now - Last_Switch;
+	Last_Switch = now;
+	window = now - Window_Start;
+	Window_Start = now;
+	n = Thread_Stats_Count;
+	__enable_irq();
+	if (window == 0)
+		return;
+
+	for (i=0; i<n; i++) {
+		e = &Thread_Stats[i];
+		__disable_irq();
+		run = Acc[i].Run;
+		lat_sum = Acc[i].Lat_Sum;
+		lat_count = Acc[i].Lat_Count;
+		lat_max = Acc[i].Lat_Max;
+		Acc[i].Run = Acc[i].Lat_Sum = Acc[i].Lat_Count = 0;
+		__enable_irq();
+
+		if (e->Name == NULL)
+			e->Name = osThreadGetName(e->Id);
+		e->Load = (uint16_t) (((uint64_t) run * THREAD_STATS_FULL_SCALE) / window);
+		if (e->Load > e->Load_Peak)
+			e->Load_Peak = e->Load;
+		e->Lat_Avg_us = lat_count ? (uint32_t) (((uint64_t) lat_sum * 1000000) / lat_count / freq) : 0;
+		e->Lat_Max_us = (uint32_t) (((uint64_t) lat_max * 1000000) / freq);
+	}
+}
+
+void Thread_Stats_Init(void) {
+	Window_Start = Last_Switch = osKernelGetSysTimerCount();
+	Thread_Stats_Timer = osTimerNew(Thread_Stats_Window, osTimerPeriodic, NULL, &Thread_Stats_Timer_attr);
+	osTimerStart(Thread_Stats_Timer, THREAD_STATS_WINDOW_MS*osKernelGetTickFreq()/1000);
+}
+
+#else
+
+void Thread_Stats_Init(void) {
+}
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <cmsis_os2.h>
+#include <rtx_os.h>
 #include <MKL25Z4.h>
 
 #include "LCD.h"
@@ -14,54 +15,244 @@
 #include "gpio_defs.h"
 #include "debug.h"
 #include "control.h"
+#include "step_test.h"
+#include "telemetry.h"
+#include "profile.h"
+#include "sd_audio.h"
+#include "sd_log.h"
+#include "display.h"
+#include "fmt.h"
+#include "I2C.h"
+#include "LEDs.h"
+#include "boot_prof.h"
+#include "LCD_benchmark.h"
 
 #include "ST7789.h"
+#include "LCD_compositor.h"
 #include "T6963.h"
+#include "perf_run.h"
 
+void Thread_Boot(void * arg);
 void Thread_Read_TS(void * arg); // 
 void Thread_Read_Accelerometer(void * arg); // 
 void Thread_Update_Screen(void * arg); // 
-void Thread_Sound_Manager(void * arg); // 
 void Thread_Refill_Sound_Buffer(void * arg); //
 void Thread_Buck_Update_Setpoint(void * arg);
+void Thread_Telemetry(void * arg);
 
-osThreadId_t t_Read_TS, t_Read_Accelerometer, t_Sound_Manager, t_US, t_Refill_Sound_Buffer, t_BUS;
-osMessageQueueId_t mid_MsgQueue;
+osThreadId_t t_Read_TS, t_Read_Accelerometer, t_US, t_Refill_Sound_Buffer, t_BUS, t_Telemetry, t_SD_Audio, t_SD_Log, t_Display, t_Boot, t_Perf_Run;
+osEventFlagsId_t Boot_Flags;
 // Thread priority options: osPriority[RealTime|High|AboveNormal|Normal|BelowNormal|Low|Idle]
 
+/* Control blocks, stacks and queue storage are static, next to each
+object, so RAM use shows at link time and nothing comes from the RTX
+dynamic pool. Stacks are uint64_t for the 8 byte alignment RTX needs. */
+
+static osRtxEventFlags_t Boot_Flags_cb;
+const osEventFlagsAttr_t Boot_Flags_attr = {
+  .name = "Boot_Flags",
+  .cb_mem = &Boot_Flags_cb, .cb_size = sizeof(Boot_Flags_cb)
+};
+
+// Above the UI threads, so the LCD is up before they want it
+static osRtxThread_t Boot_tcb;
+static uint64_t Boot_stk[DEF_STK_SZ/8];
+const osThreadAttr_t Boot_attr = {
+  .name = "Boot",
+  .cb_mem = &Boot_tcb, .cb_size = sizeof(Boot_tcb),
+  .stack_mem = Boot_stk, .stack_size = sizeof(Boot_stk),
+  .priority = osPriorityAboveNormal
+};
+
+static osRtxThread_t Read_TS_tcb;
+static uint64_t Read_TS_stk[DEF_STK_SZ/8];
 const osThreadAttr_t Read_TS_attr = {
+  .name = "Read_TS",
+  .cb_mem = &Read_TS_tcb, .cb_size = sizeof(Read_TS_tcb),
+  .stack_mem = Read_TS_stk, .stack_size = sizeof(Read_TS_stk),
   .priority = osPriorityNormal            
 };
+
+#if MMA_FIXED_ANGLES
+#define READ_ACCEL_STK_BYTES READ_ACCEL_FX_STK_SZ
+#else
+#define READ_ACCEL_STK_BYTES READ_ACCEL_STK_SZ
+#endif
+static osRtxThread_t Read_Accelerometer_tcb;
+static uint64_t Read_Accelerometer_stk[READ_ACCEL_STK_BYTES/8];
 const osThreadAttr_t Read_Accelerometer_attr = {
-  .priority = osPriorityBelowNormal,      
-	.stack_size = READ_ACCEL_STK_SZ
+  .name = "Read_Accel",
+  .cb_mem = &Read_Accelerometer_tcb, .cb_size = sizeof(Read_Accelerometer_tcb),
+  .stack_mem = Read_Accelerometer_stk, .stack_size = sizeof(Read_Accelerometer_stk),
+  .priority = osPriorityBelowNormal
 };
+
+static osRtxThread_t Update_Screen_tcb;
+static uint64_t Update_Screen_stk[DEF_STK_SZ/8];
 const osThreadAttr_t Update_Screen_attr = {
+  .name = "Update_Screen",
+  .cb_mem = &Update_Screen_tcb, .cb_size = sizeof(Update_Screen_tcb),
+  .stack_mem = Update_Screen_stk, .stack_size = sizeof(Update_Screen_stk),
   .priority = osPriorityNormal            
 };
 
+#if !USE_PIT_SETPOINT || USE_STEP_TEST
+static osRtxThread_t BUS_tcb;
+static uint64_t BUS_stk[DEF_STK_SZ/8];
 const osThreadAttr_t BUS_attr = {
+  .name = "BUS",
+  .cb_mem = &BUS_tcb, .cb_size = sizeof(BUS_tcb),
+  .stack_mem = BUS_stk, .stack_size = sizeof(BUS_stk),
+  .priority = osPriorityAboveNormal            
+};
+#endif
+
+#if USE_TELEMETRY
+static osRtxThread_t Telemetry_tcb;
+static uint64_t Telemetry_stk[DEF_STK_SZ/8];
+const osThreadAttr_t Telemetry_attr = {
+  .name = "Telemetry",
+  .cb_mem = &Telemetry_tcb, .cb_size = sizeof(Telemetry_tcb),
+  .stack_mem = Telemetry_stk, .stack_size = sizeof(Telemetry_stk),
+  .priority = osPriorityLow            
+};
+#endif
+
+#if USE_SOUND
+static osRtxMessageQueue_t Sound_MsgQ_cb;
+static uint32_t Sound_MsgQ_mem[osRtxMessageQueueMemSize(SOUND_MSGQ_LEN, sizeof(SOUND_MSG_T))/4];
+const osMessageQueueAttr_t Sound_MsgQ_attr = {
+  .name = "Sound_MsgQ",
+  .cb_mem = &Sound_MsgQ_cb, .cb_size = sizeof(Sound_MsgQ_cb),
+  .mq_mem = Sound_MsgQ_mem, .mq_size = sizeof(Sound_MsgQ_mem)
+};
+
+// Above the UI threads so a burst of drawing can't starve playback
+static osRtxThread_t Refill_Sound_Buffer_tcb;
+static uint64_t Refill_Sound_Buffer_stk[DEF_STK_SZ/8];
+const osThreadAttr_t Refill_Sound_Buffer_attr = {
+  .name = "Refill_Sound",
+  .cb_mem = &Refill_Sound_Buffer_tcb, .cb_size = sizeof(Refill_Sound_Buffer_tcb),
+  .stack_mem = Refill_Sound_Buffer_stk, .stack_size = sizeof(Refill_Sound_Buffer_stk),
   .priority = osPriorityAboveNormal            
 };
+#endif
 
-osMutexId_t LCD_mutex;
+#if USE_SD_AUDIO
+// Card reads soak up idle time, readahead covers the wait for the UI threads
+static osRtxThread_t SD_Audio_tcb;
+static uint64_t SD_Audio_stk[DEF_STK_SZ/8];
+const osThreadAttr_t SD_Audio_attr = {
+  .name = "SD_Audio",
+  .cb_mem = &SD_Audio_tcb, .cb_size = sizeof(SD_Audio_tcb),
+  .stack_mem = SD_Audio_stk, .stack_size = sizeof(SD_Audio_stk),
+  .priority = osPriorityBelowNormal            
+};
+#endif
 
-const osMutexAttr_t LCD_mutex_attr = {
-  "LCD_mutex",     // human readable mutex name
-  osMutexPrioInherit    // attr_bits
+#if USE_SD_LOG
+// Background: the card gets what time is left, the rings cover its stalls
+static osRtxThread_t SD_Log_tcb;
+static uint64_t SD_Log_stk[DEF_STK_SZ/8];
+const osThreadAttr_t SD_Log_attr = {
+  .name = "SD_Log",
+  .cb_mem = &SD_Log_tcb, .cb_size = sizeof(SD_Log_tcb),
+  .stack_mem = SD_Log_stk, .stack_size = sizeof(SD_Log_stk),
+  .priority = osPriorityLow            
 };
+#endif
 
+static osRtxMessageQueue_t Disp_MsgQ_cb;
+static uint32_t Disp_MsgQ_mem[osRtxMessageQueueMemSize(DISP_MSGQ_LEN, sizeof(DISP_MSG_T))/4];
+const osMessageQueueAttr_t Disp_MsgQ_attr = {
+  .name = "Disp_MsgQ",
+  .cb_mem = &Disp_MsgQ_cb, .cb_size = sizeof(Disp_MsgQ_cb),
+  .mq_mem = Disp_MsgQ_mem, .mq_size = sizeof(Disp_MsgQ_mem)
+};
+
+// Owns the LCD. Below the threads feeding it, so drawing never holds them up
+static osRtxThread_t Display_tcb;
+static uint64_t Display_stk[DEF_STK_SZ/8];
+const osThreadAttr_t Display_attr = {
+  .name = "Display",
+  .cb_mem = &Display_tcb, .cb_size = sizeof(Display_tcb),
+  .stack_mem = Display_stk, .stack_size = sizeof(Display_stk),
+  .priority = osPriorityBelowNormal            
+};
+
+#if USE_PERF_RUN
+// Sleeps but for a reset and the report, high so the window is exact
+static osRtxThread_t Perf_Run_tcb;
+static uint64_t Perf_Run_stk[DEF_STK_SZ/8];
+const osThreadAttr_t Perf_Run_attr = {
+  .name = "Perf_Run",
+  .cb_mem = &Perf_Run_tcb, .cb_size = sizeof(Perf_Run_tcb),
+  .stack_mem = Perf_Run_stk, .stack_size = sizeof(Perf_Run_stk),
+  .priority = osPriorityHigh
+};
+#endif
 
 void Create_OS_Objects(void) {
-	LCD_mutex = osMutexNew(&LCD_mutex_attr);
-  mid_MsgQueue = osMessageQueueNew(4, sizeof(MSGQUEUE_OBJ_t), NULL);
+	Boot_Flags = osEventFlagsNew(&Boot_Flags_attr);
+	t_Boot = osThreadNew(Thread_Boot, NULL, &Boot_attr);
+	Disp_MsgQ = osMessageQueueNew(DISP_MSGQ_LEN, sizeof(DISP_MSG_T), &Disp_MsgQ_attr);
+	t_Display = osThreadNew(Thread_Display, NULL, &Display_attr);
 	t_Read_TS = osThreadNew(Thread_Read_TS, NULL, &Read_TS_attr);  
 	t_Read_Accelerometer = osThreadNew(Thread_Read_Accelerometer, NULL, &Read_Accelerometer_attr);
 	t_US = osThreadNew(Thread_Update_Screen, NULL, &Update_Screen_attr);
+#if !USE_PIT_SETPOINT || USE_STEP_TEST
 	t_BUS = osThreadNew(Thread_Buck_Update_Setpoint, NULL, &BUS_attr);
+#endif
+#if USE_TELEMETRY
+	t_Telemetry = osThreadNew(Thread_Telemetry, NULL, &Telemetry_attr);
+#endif
+#if USE_SOUND
+	Sound_MsgQ = osMessageQueueNew(SOUND_MSGQ_LEN, sizeof(SOUND_MSG_T), &Sound_MsgQ_attr);
+	t_Refill_Sound_Buffer = osThreadNew(Thread_Refill_Sound_Buffer, NULL, &Refill_Sound_Buffer_attr);
+#endif
+#if USE_SD_AUDIO
+	t_SD_Audio = osThreadNew(Thread_SD_Audio, NULL, &SD_Audio_attr);
+#endif
+#if USE_SD_LOG
+	t_SD_Log = osThreadNew(Thread_SD_Log, NULL, &SD_Log_attr);
+#endif
+#if USE_PERF_RUN
+	t_Perf_Run = osThreadNew(Thread_Perf_Run, NULL, &Perf_Run_attr);
+#endif
 	
 }
 
+void Boot_Wait(uint32_t flags) {
+	osEventFlagsWait(Boot_Flags, flags, osFlagsWaitAll | osFlagsNoClear, osWaitForever);
+}
+
+/* LCD then sound, in the order main used to run them: the backlight
+claims its TPM before audio pacing takes a free one. */
+void Thread_Boot(void * arg) {
+	LCD_Init();
+	LCD_TS_Init(); // Touch ADC channel settings and step table, converted through the ADC server
+	LCD_Text_Init(1);
+	LCD_Erase();
+#if USE_LCD_BENCHMARK
+	LCD_Benchmark_Run();
+	LCD_Benchmark_Show();
+	LCD_Erase();
+#elif USE_PERF_RUN
+	LCD_Benchmark_Run();
+#endif
+#if USE_BOOT_PROF
+	Boot_Mark("LCD");
+#endif
+	osEventFlagsSet(Boot_Flags, BOOT_FLAG_LCD);
+#if USE_SOUND
+	Sound_Init();
+#if USE_BOOT_PROF
+	Boot_Mark("Sound");
+#endif
+#endif
+	osEventFlagsSet(Boot_Flags, BOOT_FLAG_SOUND);
+}
+
 void Thread_Read_TS(void * arg) {
 	PT_T p, pp;
 	COLOR_T c;
@@ -70,11 +261,17 @@ void Thread_Read_TS(void * arg) {
 	c.G = 200;
 	c.B = 200;
 	
-	LCD_Text_PrintStr_RC(LCD_MAX_ROWS-2, 0, "Dim <--------> Bright");
+	Boot_Wait(BOOT_FLAG_LCD); // Calibration prompts go through the display server
+	if ((TS_CAL_IF_MISSING && !LCD_TS_Cal_Stored) || LCD_TS_Read(&p))
+		LCD_TS_Calibrate();
+	Disp_Text_RC(LCD_MAX_ROWS-2, 0, "Dim <--------> Bright", NULL, NULL);
 	
 	while (1) {
 		DEBUG_START(DBG_TREADTS_POS);
 		if (LCD_TS_Read(&p)) { 
+#if USE_SOUND
+			Sound_Note_On(VW_SQUARE, 2000, 0x3000, 400, 20, SOUND_TAG_CLICK); // Key click
+#endif
 			if (p.Y > ROW_TO_Y(LCD_MAX_ROWS-3)) { 
 				g_peak_set_current=p.X/2;
 			//	g_peak_set_current=20;
@@ -84,10 +281,7 @@ void Thread_Read_TS(void * arg) {
 				if ((pp.X == 0) && (pp.Y == 0)) {
 					pp = p;
 				}
-				osMutexAcquire(LCD_mutex, osWaitForever);
-				
-				LCD_Draw_Line(&p, &pp, &c);
-				osMutexRelease(LCD_mutex);
+				Disp_Line(&p, &pp, &c);
 				pp = p;
 			} 
 		} else {
@@ -101,24 +295,68 @@ void Thread_Read_TS(void * arg) {
 
  void Thread_Read_Accelerometer(void * arg) {
 	char buffer[16];
+#if MMA_USE_FIFO
+	int n;
+#endif
 	
+	i2c_init();
+	if (!init_mma()) {
+		Control_RGB_LEDs(1,0,0); // Red: no accelerometer, the rest keeps running
+		Disp_Text_RC(0, 0, "Accel init failed", NULL, NULL);
+		return;
+	}
+#if USE_BOOT_PROF
+	Boot_Mark("Accelerometer");
+#endif
 	while (1) {
+#if MMA_USE_FIFO
+		// Sleeps until the sensor's FIFO reaches its watermark
+		n = read_fifo_xyz();
+		if (n <= 0)
+			continue;
+#if MMA_USE_DECIMATOR
+		if (mma_decimate(MMA_Fifo, n) == 0)
+			continue; // No new filtered sample yet
+#endif
+		DEBUG_START(DBG_TREADACC_POS);
+#else
 		DEBUG_START(DBG_TREADACC_POS);
 	
 		read_full_xyz();
+#endif
 		convert_xyz_to_roll_pitch();
+#if USE_SD_LOG
+#if MMA_USE_FIFO && !MMA_USE_DECIMATOR
+		SD_Log_Accel(MMA_Fifo, n);
+#else
+		{
+			MMA_SAMPLE_T s;
+
+			s.X = acc_X;
+			s.Y = acc_Y;
+			s.Z = acc_Z;
+			SD_Log_Accel(&s, 1);
+		}
+#endif
+#endif
 
+#if MMA_FIXED_ANGLES
+		Fmt_Q(Fmt_Str(buffer, "Roll: "), roll_fx, ANGLE_FX_FRAC_BITS, 2, 6);
+		Disp_Text_RC(0, 0, buffer, NULL, NULL);
+
+		Fmt_Q(Fmt_Str(buffer, "Pitch: "), pitch_fx, ANGLE_FX_FRAC_BITS, 2, 6);
+		Disp_Text_RC(1, 0, buffer, NULL, NULL);
+#else
 		sprintf(buffer, "Roll: %6.2f", roll);
-		osMutexAcquire(LCD_mutex, osWaitForever);
-		LCD_Text_PrintStr_RC(0, 0, buffer);
-		osMutexRelease(LCD_mutex);
+		Disp_Text_RC(0, 0, buffer, NULL, NULL);
 
 		sprintf(buffer, "Pitch: %6.2f", pitch);
-		osMutexAcquire(LCD_mutex, osWaitForever);
-		LCD_Text_PrintStr_RC(1, 0, buffer);
-		osMutexRelease(LCD_mutex);
+		Disp_Text_RC(1, 0, buffer, NULL, NULL);
+#endif
 		DEBUG_STOP(DBG_TREADACC_POS);
+#if !MMA_USE_FIFO
 		osDelay(THREAD_READ_ACCELEROMETER_PERIOD_MS);
+#endif
 	}
 }
 
@@ -126,29 +364,31 @@ void Thread_Read_TS(void * arg) {
 	int16_t paddle_pos=LCD_WIDTH/2;
 	PT_T p1, p2;
 	COLOR_T paddle_color; 
-	char buffer[16]; 
+	char buffer[DISP_TEXT_LEN]; 
+	int outline, fill;
 	paddle_color.R = 100;
 	paddle_color.G = 10;
 	paddle_color.B = 100;
-	while (1) {
-		DEBUG_START(DBG_TUPDATESCR_POS);
-		sprintf(buffer, "Peak Current: %d     ", g_peak_set_current);	
 
-		osMutexAcquire(LCD_mutex, osWaitForever);
-			
-				LCD_Text_PrintStr_RC(LCD_MAX_ROWS-3, 0, buffer);
-				//sprintf();
-				osMutexRelease(LCD_mutex);
-		if ((roll < -2.0) || (roll > 2.0)) {
-			p1.X = paddle_pos;
-			p1.Y = PADDLE_Y_POS;
-			p2.X = p1.X + PADDLE_WIDTH;
-			p2.Y = p1.Y + PADDLE_HEIGHT;
-			osMutexAcquire(LCD_mutex, osWaitForever);
-			LCD_Fill_Rectangle(&p1, &p2, &black); 		
-			osMutexRelease(LCD_mutex);
-			
-			paddle_pos += roll;
+	Boot_Wait(BOOT_FLAG_LCD); // Display thread takes the paddle messages from then on
+	// Paddle is a white outline with a coloured fill, redrawn only where it changes
+	LCD_Comp_Init(&black);
+	p1.X = paddle_pos;
+	p1.Y = PADDLE_Y_POS;
+	p2.X = p1.X + PADDLE_WIDTH;
+	p2.Y = p1.Y + PADDLE_HEIGHT;
+	outline = LCD_Comp_Add_Rect(&p1, &p2, &white);
+	p1.X++;
+	p2.X--;
+	p1.Y++;
+	p2.Y--;
+	fill = LCD_Comp_Add_Rect(&p1, &p2, &paddle_color);
+	Disp_Comp_Set_Color(fill, &paddle_color); // Display thread renders once it hears about the paddle
+	while (1) {
+		Fmt_Int(Fmt_Str(buffer, "Peak Current: "), g_peak_set_current, 4);
+		Disp_Text_RC(LCD_MAX_ROWS-3, 0, buffer, NULL, NULL);
+		if ((roll_fx < -2*ANGLE_FX_ONE) || (roll_fx > 2*ANGLE_FX_ONE)) {
+			paddle_pos += roll_fx/ANGLE_FX_ONE;
 			paddle_pos = MAX(0, paddle_pos);
 			paddle_pos = MIN(paddle_pos, LCD_WIDTH-1-PADDLE_WIDTH);
 			
@@ -156,28 +396,58 @@ void Thread_Read_TS(void * arg) {
 			p1.Y = PADDLE_Y_POS;
 			p2.X = p1.X + PADDLE_WIDTH;
 			p2.Y = p1.Y + PADDLE_HEIGHT;
-			paddle_color.R = 150+5*roll;
-			paddle_color.G = 150-5*roll;
-			osMutexAcquire(LCD_mutex, osWaitForever);
-			LCD_Fill_Rectangle(&p1, &p2, &white); 		
+			paddle_color.R = 150 + 5*roll_fx/ANGLE_FX_ONE;
+			paddle_color.G = 150 - 5*roll_fx/ANGLE_FX_ONE;
+			Disp_Comp_Move_Rect(outline, &p1, &p2);
 			p1.X++;
 			p2.X--;
 			p1.Y++;
 			p2.Y--;
-			LCD_Fill_Rectangle(&p1, &p2, &paddle_color); 		
-			osMutexRelease(LCD_mutex);
+			Disp_Comp_Move_Rect(fill, &p1, &p2);
+			Disp_Comp_Set_Color(fill, &paddle_color);
 		}
-		
-		DEBUG_STOP(DBG_TUPDATESCR_POS);
 		osDelay(THREAD_UPDATE_SCREEN_PERIOD_MS);
 	}
 }
 
  void Thread_Buck_Update_Setpoint(void * arg) {
+#if USE_STEP_TEST
+	osDelay(1000); // Let the supply and the loop settle after reset
+	Step_Test_Run_All();
+#endif
+#if !USE_PIT_SETPOINT // Else PIT1 ISR sequences the setpoint, thread is only for the step test
 	while (1) {
 		osDelay(THREAD_BUS_PERIOD_MS);
 		Update_Set_Current();
 	}
+#endif
  }
  
- 
\ No newline at end of file
+void Thread_Telemetry(void * arg) {
+#if PROFILE_EXPORT
+	static uint8_t frame[PROFILE_FRAME_MAX];
+	uint32_t next_profile = osKernelGetTickCount() + PROFILE_EXPORT_MS;
+#endif
+#if USE_PERF_RUN
+	uint32_t next_perf = osKernelGetTickCount();
+#endif
+
+	if (Telemetry_Init() != 0)
+		return; // No DMA channel left
+	while (1) {
+#if PROFILE_EXPORT
+		if (profiling_enabled && ((int32_t) (osKernelGetTickCount() - next_profile) >= 0)) {
+			next_profile = osKernelGetTickCount() + PROFILE_EXPORT_MS;
+			Telemetry_Send(frame, Profile_Build_Frame(frame));
+		}
+#endif
+#if USE_PERF_RUN
+		if (Perf_Record_Len && ((int32_t) (osKernelGetTickCount() - next_perf) >= 0)) {
+			next_perf = osKernelGetTickCount() + PERF_RUN_REPEAT_MS;
+			Telemetry_Send(Perf_Record, Perf_Record_Len);
+		}
+#endif
+		if (Telemetry_Drain() == 0)
+			osDelay(THREAD_TELEMETRY_PERIOD_MS);
+	}
+}
@@ -0,0 +1,102 @@
+#include <MKL25Z4.H>
+#include <cmsis_os2.h>
+#include <rtx_os.h>
+#include "tickless.h"
+#include "timers.h"
+#include "cpu_util.h"
+#include "control.h"
+
+volatile TICKLESS_STATS_T Tickless_Stats;
+
+static uint8_t Tickless_On;
+static uint32_t Behind_us; // Real time the kernel hasn't been told about, under a tick
+static volatile uint8_t Fired; // LPTMR0 reached the compare, set by its ISR
+
+void Tickless_Init(void) {
+	if (Timer_Claim(TMR_LPTMR0, "Tickless idle") != 0)
+		return; // Idle keeps spinning
+	SIM->SCGC5 |= SIM_SCGC5_LPTMR_MASK;
+	LPTMR0->CSR = 0;
+	// OSCERCLK/8: 1 us per count. Keep OSCERCLK running in Stop mode too
+	OSC0->CR |= OSC_CR_ERCLKEN_MASK | OSC_CR_EREFSTEN_MASK;
+	LPTMR0->PSR = LPTMR_PSR_PCS(3) | LPTMR_PSR_PRESCALE(2);
+	NVIC_SetPriority(LPTMR0_IRQn, 3);
+	NVIC_ClearPendingIRQ(LPTMR0_IRQn);
+	NVIC_EnableIRQ(LPTMR0_IRQn);
+	Tickless_On = 1;
+}
+
+// Only here to end the WFI, Tickless_Idle does the rest
+void LPTMR0_IRQHandler(void) {
+	LPTMR0->CSR |= LPTMR_CSR_TCF_MASK; // Write 1 to clear, TEN and TIE stay set
+	Fired = 1;
+}
+
+static uint32_t LPTMR_Count(void) {
+	LPTMR0->CNR = 0; // Write latches the counter for reading
+	return LPTMR0->CNR;
+}
+
+void Tickless_Idle(void) {
+	uint32_t ticks, done_us, sleep_us, slept_us, late_us, n;
+
+	if (!Tickless_On)
+		return;
+	ticks = osKernelSuspend(); // SysTick is off from here
+	if (ticks < TICKLESS_MIN_TICKS) {
+		osKernelResume(0);
+		return;
+	}
+	if (ticks > TICKLESS_MAX_TICKS)
+		ticks = TICKLESS_MAX_TICKS;
+	// Part of the current tick already counted by SysTick, plus what the kernel is behind
+	done_us = (SysTick->LOAD - SysTick->VAL)/(SystemCoreClock/1000000) + Behind_us;
+	if (done_us >= 1000*ticks) { // Can't happen with ticks >= 2, but don't underflow
+		osKernelResume(0);
+		return;
+	}
+	sleep_us = 1000*ticks - done_us;
+#if USE_CTL_DEADLINE
+	Ctl_Deadline_Hold(1); // Its clock is the kernel's, stopped until osKernelResume
+#endif
+
+	LPTMR0->CSR = 0;
+	LPTMR0->CMR = sleep_us - 1; // TCF sets on the count after CMR
+	Fired = 0;
+	LPTMR0->CSR = LPTMR_CSR_TIE_MASK | LPTMR_CSR_TEN_MASK;
+	SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk; // Wait mode
+
+	/* RTX defers a thread switch an ISR asks for while suspended to
+	kernel.pendSV, so its handlers run here without losing the wake-up. */
+	__disable_irq();
+	while (!Fired && !(LPTMR0->CSR & LPTMR_CSR_TCF_MASK) && !osRtxInfo.kernel.pendSV) {
+		__DSB();
+		__WFI(); // Any pending interrupt ends it, masked or not
+		__enable_irq();
+		__disable_irq();
+	}
+	if (Fired || (LPTMR0->CSR & LPTMR_CSR_TCF_MASK)) {
+		late_us = LPTMR_Count(); // Counter restarted at the compare
+		slept_us = sleep_us + late_us;
+		if (late_us > Tickless_Stats.Max_Late_us)
+			Tickless_Stats.Max_Late_us = late_us;
+	} else {
+		slept_us = LPTMR_Count();
+		Tickless_Stats.Early++;
+	}
+	LPTMR0->CSR = 0; // Clears TCF too
+	NVIC_ClearPendingIRQ(LPTMR0_IRQn); // Compare hit after the loop, the ISR needn't run
+	SysTick->VAL = 0; // Ticks restart from a boundary, the rest goes in Behind_us
+	__enable_irq();
+
+	slept_us += done_us;
+	n = slept_us/1000;
+	Behind_us = slept_us - 1000*n;
+	Tickless_Stats.Sleeps++;
+	Tickless_Stats.Slept_ms += n;
+	osKernelResume(n);
+#if USE_CTL_DEADLINE
+	Ctl_Deadline_Hold(0);
+#endif
+	CPU_Util_Slept(slept_us - done_us);
+}
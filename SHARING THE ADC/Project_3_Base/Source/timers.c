@@ -5,16 +5,97 @@
 #include "debug.h"
 #include "HBLED.h"
 #include "control.h"
+#include "LEDs.h"
+#include <string.h>
+#include <cmsis_os2.h>
+#include "irq_lat.h"
+#include "ram_code.h"
 
 volatile unsigned PIT_interrupt_counter = 0;
 volatile unsigned LCD_update_requested = 0;
 unsigned int PC_val = 0;
 
 extern unsigned profile_samples;
-extern volatile char profiling_enabled;
 
 extern volatile unsigned int adx_lost, num_lost; 
 
+const char * volatile Timer_Owner[TMR_NUM];
+volatile uint32_t Timer_Conflicts;
+TIMER_CONFLICT_T Timer_Conflict;
+
+int Timer_Claim(TMR_E t, const char * owner) {
+	const char * cur;
+	uint32_t m;
+
+	if (t >= TMR_NUM)
+		return -1;
+	m = __get_PRIMASK();
+	__disable_irq();
+	cur = Timer_Owner[t];
+	if (cur == NULL)
+		Timer_Owner[t] = owner;
+	__set_PRIMASK(m);
+	if ((cur == NULL) || (strcmp(cur, owner) == 0))
+		return 0;
+
+	// Two subsystems want the same timer
+	Timer_Conflicts++;
+	Timer_Conflict.Timer = t;
+	Timer_Conflict.Owner = cur;
+	Timer_Conflict.Claimant = owner;
+	Control_RGB_LEDs(1, 0, 0);
+#if TIMER_CONFLICT_HALT
+	while (1)
+		;
+#else
+	return -1;
+#endif
+}
+
+int Timer_Claim_TPM(TPM_Type * TPM, const char * owner) {
+	int i;
+
+	for (i=TMR_TPM0; i<=TMR_TPM2; i++) {
+		if (Timer_TPM((TMR_E) i) == TPM)
+			return Timer_Claim((TMR_E) i, owner);
+	}
+	return -1;
+}
+
+int Timer_Claim_Free_TPM(const char * owner) {
+	uint32_t m;
+	int i;
+
+	// TPM0 last, it's the HBLED converter's
+	m = __get_PRIMASK();
+	__disable_irq();
+	for (i=TMR_TPM2; i>=TMR_TPM0; i--) {
+		if ((Timer_Owner[i] == NULL) || (strcmp(Timer_Owner[i], owner) == 0)) {
+			Timer_Owner[i] = owner;
+			break;
+		}
+	}
+	__set_PRIMASK(m);
+	if (i >= 0)
+		return i;
+	// None left: report against the converter's timer
+	Timer_Claim(TMR_TPM0, owner);
+	return -1;
+}
+
+TPM_Type * Timer_TPM(TMR_E t) {
+	switch (t) {
+		case TMR_TPM0:
+			return TPM0;
+		case TMR_TPM1:
+			return TPM1;
+		case TMR_TPM2:
+			return TPM2;
+		default:
+			return NULL;
+	}
+}
+
 void PWM_Init(TPM_Type * TPM, uint8_t channel_num, uint16_t period, uint16_t duty, 
 	uint8_t pos_polarity, uint8_t prescaler_code)
 {
@@ -64,7 +145,7 @@ void PWM_Init(TPM_Type * TPM, uint8_t channel_num, uint16_t period, uint16_t dut
 	TPM->SC |= TPM_SC_CMOD(1);
 }
 
-void PWM_Set_Value(TPM_Type * TPM, uint8_t channel_num, uint16_t value) {
+RAM_CODE void PWM_Set_Value(TPM_Type * TPM, uint8_t channel_num, uint16_t value) {
 	TPM->CONTROLS[channel_num].CnV = value;
 }
 
@@ -91,6 +172,7 @@ void TPM0_IRQHandler() {
 	FPTB->PCOR = MASK(DBG_IRQTPM_POS);
 }
 void PIT_Init(unsigned period) {
+	Timer_Claim(TMR_PIT0, "Profiler");
 	// Enable clock to PIT module
 	SIM->SCGC6 |= SIM_SCGC6_PIT_MASK;
 	
@@ -123,38 +205,101 @@ void PIT_Stop(void) {
 	PIT->CHANNEL[0].TCTRL &= ~PIT_TCTRL_TEN_MASK;
 }
 
+void PIT1_Init(unsigned period) {
+	Timer_Claim(TMR_PIT1, "Setpoint sequencer");
+	SIM->SCGC6 |= SIM_SCGC6_PIT_MASK;
+	PIT->MCR &= ~PIT_MCR_MDIS_MASK;
+	PIT->MCR |= PIT_MCR_FRZ_MASK;
+	
+	// Initialize PIT1 to count down from argument, no chaining, interrupts
+	PIT->CHANNEL[1].LDVAL = PIT_LDVAL_TSV(period);
+	PIT->CHANNEL[1].TCTRL = PIT_TCTRL_TIE_MASK;
+
+	NVIC_SetPriority(PIT_IRQn, 128); // 0, 64, 128 or 192
+	NVIC_ClearPendingIRQ(PIT_IRQn); 
+	NVIC_EnableIRQ(PIT_IRQn);	
+}
+
+void PIT1_Start(void) {
+	PIT->CHANNEL[1].TCTRL |= PIT_TCTRL_TEN_MASK;
+}
+
 void PIT_IRQHandler() {
 	unsigned int s, e;
   unsigned int i;
+	unsigned int * frame;
 	
 	// check to see which channel triggered interrupt 
 	if (PIT->CHANNEL[0].TFLG & PIT_TFLG_TIF_MASK) {
+#if USE_IRQ_LAT
+		// Counts down from LDVAL after the reload that triggered this, at the bus clock (half the core)
+		IRQ_Lat_Enter(IRQ_LAT_PIT0, 2*(PIT->CHANNEL[0].LDVAL - PIT->CHANNEL[0].CVAL));
+#endif
 		// clear status flag for timer channel 0
 		PIT->CHANNEL[0].TFLG &= PIT_TFLG_TIF_MASK;
 		
 		// Do ISR work
 		// Profiler
 		if (profiling_enabled > 0) {
-			PC_val = *((unsigned int *) (__current_sp()+CUR_FRAME_SIZE+RET_ADX_OFFSET));
+			/* Exception frame of the interrupted code. RTX threads run on the
+			process stack (EXC_RETURN bit 2); handlers, and main before the
+			kernel starts, on the main stack just above this handler's frame. */
+			if (__return_address() & 4)
+				frame = (unsigned int *) __get_PSP();
+			else
+				frame = (unsigned int *) (__current_sp()+CUR_FRAME_SIZE);
+			PC_val = frame[RET_ADX_OFFSET/4];
 			profile_samples++;
   	
-			/* look up function in table and increment counter  */
-			for (i=0; i<NumProfileRegions; i++) {
-				s = RegionTable[i].Start;
-				e = RegionTable[i].End;
-				if ((PC_val >= s) && (PC_val <= e)) {
-					RegionCount[i]++;
-					break; // break out of the for loop
-				}
+			/* look up function in table and increment counter. Table is sorted
+			by start address: binary search for the last region starting at or
+			below PC_val, in s. */
+			s = 0;
+			e = NumProfileRegions;
+			while (s < e) {
+				i = (s + e) >> 1;
+				if (RegionTable[i].Start <= PC_val)
+					s = i + 1;
+				else
+					e = i;
 			}
-			if (i == NumProfileRegions) {
+			if ((s > 0) && (PC_val <= RegionTable[s-1].End)) {
+				RegionCount[s-1]++;
+				s--;
+			} else {
 				adx_lost = PC_val;
 				num_lost++;
+				s = PROFILE_REGION_LOST;
 			}
+#if PROFILE_BY_THREAD
+			// Thread that was running, else the interrupted exception number
+			if (__return_address() & 4)
+				Profile_Attribute((unsigned int) osThreadGetId(), s);
+			else
+				Profile_Attribute(frame[XPSR_OFFSET/4] & PROFILE_CTX_ISR_MASK, s);
+#endif
+#if PROFILE_CALL_STACK
+			if (s != PROFILE_REGION_LOST)
+				Profile_Walk_Stack(frame, __return_address() & 4, s);
+#endif
 		}
-	} else if (PIT->CHANNEL[1].TFLG & PIT_TFLG_TIF_MASK) {
+#if USE_IRQ_LAT
+		IRQ_Lat_Exit(IRQ_LAT_PIT0);
+#endif
+	}
+	// Not else: a profiler sample must not delay the setpoint by a whole ISR
+	if (PIT->CHANNEL[1].TFLG & PIT_TFLG_TIF_MASK) {
+#if USE_IRQ_LAT
+		IRQ_Lat_Enter(IRQ_LAT_PIT1, 2*(PIT->CHANNEL[1].LDVAL - PIT->CHANNEL[1].CVAL));
+#endif
 		// clear status flag for timer channel 1
 		PIT->CHANNEL[1].TFLG &= PIT_TFLG_TIF_MASK;
+#if USE_PIT_SETPOINT
+		Update_Set_Current();
+#endif
+#if USE_IRQ_LAT
+		IRQ_Lat_Exit(IRQ_LAT_PIT1);
+#endif
 	} 
 }
 
@@ -166,21 +311,29 @@ void TPM0_Init(void) {
 	SIM->SOPT2 |= (SIM_SOPT2_TPMSRC(1) | SIM_SOPT2_PLLFLLSEL_MASK);
 }
 
-void Configure_TPM0_for_DMA(uint32_t period_us)
+void Configure_TPM_for_DMA(TPM_Type * TPM, uint32_t period_us)
 {
+	//turn on clock to TPM 
+	if (TPM == TPM0)
+		SIM->SCGC6 |= SIM_SCGC6_TPM0_MASK;
+	else if (TPM == TPM1)
+		SIM->SCGC6 |= SIM_SCGC6_TPM1_MASK;
+	else
+		SIM->SCGC6 |= SIM_SCGC6_TPM2_MASK;
+	SIM->SOPT2 |= (SIM_SOPT2_TPMSRC(1) | SIM_SOPT2_PLLFLLSEL_MASK);
 
 	// disable TPM
-	TPM0->SC = 0;
+	TPM->SC = 0;
 	
 	//load the counter and mod
-	TPM0->MOD = TPM_MOD_MOD(period_us*48);
+	TPM->MOD = TPM_MOD_MOD(period_us*48);
 
 	//set TPM to count up and divide by 1 prescaler and clock mode
-	TPM0->SC = (TPM_SC_DMA_MASK | TPM_SC_PS(0));
+	TPM->SC = (TPM_SC_DMA_MASK | TPM_SC_PS(0));
 	
 #if 0 // if using interrupt for debugging
 	// Enable TPM interrupts for debugging
-	TPM0->SC |= TPM_SC_TOIE_MASK;
+	TPM->SC |= TPM_SC_TOIE_MASK;
 
 	// Configure NVIC 
 	NVIC_SetPriority(TPM0_IRQn, 128); // 0, 64, 128 or 192
@@ -190,11 +343,35 @@ void Configure_TPM0_for_DMA(uint32_t period_us)
 
 }
 
+/* TPM2 as ADC trigger for hardware control frequency division. It counts
+up at the TPM0 clock and starts on a TPM0 overflow, so with a period of
+n TPM0 periods its overflow lands on every n-th TPM0 overflow. */
+void TPM2_Init_Trigger(uint32_t period) {
+	SIM->SCGC6 |= SIM_SCGC6_TPM2_MASK;
+	SIM->SOPT2 |= (SIM_SOPT2_TPMSRC(1) | SIM_SOPT2_PLLFLLSEL_MASK);
+
+	TPM2->SC = 0;
+	TPM2->CNT = 0;
+	TPM2->MOD = TPM_MOD_MOD(period-1);
+	// Start counting on TPM0 overflow trigger, keep running in debug
+	TPM2->CONF = TPM_CONF_TRGSEL(8) | TPM_CONF_CSOT_MASK | TPM_CONF_DBGMODE(3);
+	TPM2->SC = TPM_SC_PS(0) | TPM_SC_CMOD(1);
+}
+
+void TPM2_Set_Trigger_Period(uint32_t period) {
+	TPM2->MOD = TPM_MOD_MOD(period-1); // Takes effect at next overflow
+}
+
 void TPM0_Start(void) {
 // Enable counter
 	TPM0->SC |= TPM_SC_CMOD(1);
 }
 
+void TPM_Start(TPM_Type * TPM) {
+// Enable counter
+	TPM->SC |= TPM_SC_CMOD(1);
+}
+
 
 
 
@@ -0,0 +1,193 @@
+"""Compare a perf runner record (perf_run.h) with a stored baseline.
+
+Usage: python perf_compare.py <capture | port> [baseline] [options]
+
+The capture is anything holding the record: semihosting console output
+saved to a file, the sd_sim host build's output, or a raw telemetry UART
+capture (binary telemetry between the text lines is skipped). A name
+that can't be opened is taken as a serial port, which needs pyserial,
+and is read until a complete record arrives. The last complete record in
+the input is used.
+
+Options:
+  --save              write the record to baseline instead of comparing
+  --tol PCT           allowed worsening, percent of the baseline (default 5)
+  --tol NAME=PCT      the same for one metric, may be repeated
+  --abs N             allowed worsening in the metric's own units on top
+                      of the percentage, for values near zero (default 0)
+  --max NAME=N        the metric must not be above N, baseline or not; may
+                      be repeated (e.g. --max ctl.overruns=0)
+  --baud N            serial port speed (default 921600)
+  --timeout S         give up on a port after S seconds (default 60)
+
+Each metric line says whether lower (-) or higher (+) is better; = lines
+are shown but never fail. Exit status is 0 if nothing regressed, 1 if
+something did (or a --max limit failed), 2 if there is no usable record or the baseline is for a
+different project or record version.
+
+A record whose sd.leftover is 0, or whose sched.wake* and sched.late*
+metrics are all 0, was taken with the idle path never running. It is
+refused as a baseline (exit 2), and --save won't write it.
+"""
+import argparse
+import re
+import sys
+import time
+
+RECORD = re.compile(rb'PERF (\d+) (\S+) ([^\r\n]*)\r?\n((?:[^\r\n]*\r?\n)*?)END (\d+)\r?\n')
+METRIC = re.compile(r'^(\S+) (-?\d+) (\S+) ([-+=])$')
+
+
+def parse_records(data):
+    """Complete, well formed records in data, oldest first."""
+    records = []
+    for m in RECORD.finditer(data):
+        metrics = {}
+        order = []
+        ok = True
+        for line in m.group(4).decode('latin-1').splitlines():
+            mm = METRIC.match(line.strip())
+            if not mm:
+                ok = False
+                break
+            name = mm.group(1)
+            metrics[name] = (int(mm.group(2)), mm.group(3), mm.group(4))
+            order.append(name)
+        if ok and len(order) == int(m.group(5)):
+            records.append({'version': int(m.group(1)), 'project': m.group(2).decode('latin-1'),
+                            'build': m.group(3).decode('latin-1'), 'metrics': metrics,
+                            'order': order, 'text': m.group(0)})
+    return records
+
+
+def read_capture(src, baud, timeout):
+    try:
+        with open(src, 'rb') as f:
+            return f.read()
+    except OSError:
+        pass
+    import serial
+    port = serial.Serial(src, baud, timeout=1)
+    data = bytearray()
+    end = time.time() + timeout
+    while time.time() < end:
+        data += port.read(4096)
+        if RECORD.search(data):
+            break
+    return bytes(data)
+
+
+def tolerances(args):
+    default, per_metric = 5.0, {}
+    for t in args.tol or []:
+        if '=' in t:
+            name, pct = t.split('=', 1)
+            per_metric[name] = float(pct)
+        else:
+            default = float(t)
+    return default, per_metric
+
+
+def compare(base, new, default_tol, per_metric, abs_slack):
+    regressions = 0
+    print('%-24s %10s %10s %8s' % ('metric', 'baseline', 'now', 'change'))
+    for name in new['order']:
+        value, unit, direction = new['metrics'][name]
+        if name not in base['metrics']:
+            print('%-24s %10s %10d %8s  new' % (name, '-', value, ''))
+            continue
+        old = base['metrics'][name][0]
+        change = '%+.1f%%' % (100.0*(value - old)/old) if old else ('0' if value == old else 'n/a')
+        worse = (value - old) if direction == '-' else (old - value) if direction == '+' else 0
+        allowed = abs(old)*per_metric.get(name, default_tol)/100.0 + abs_slack
+        flag = ''
+        if worse > allowed:
+            flag = 'REGRESSION'
+            regressions += 1
+        elif worse < 0 and -worse > allowed:
+            flag = 'better'
+        print('%-24s %10d %10d %8s %s %s' % (name, old, value, change, unit, flag))
+    for name in base['order']:
+        if name not in new['metrics']:
+            print('%-24s %10d %10s %8s  missing' % (name, base['metrics'][name][0], '-', ''))
+    return regressions
+
+
+def idle_problems(rec):
+    """Why rec can't be a baseline: metrics showing the idle path never ran."""
+    problems = []
+    metrics = rec['metrics']
+    if 'sd.leftover' in metrics and metrics['sd.leftover'][0] == 0:
+        problems.append('sd.leftover is 0')
+    wakes = [n for n in metrics if n.startswith('sched.wake') or n.startswith('sched.late')]
+    if wakes and not any(metrics[n][0] for n in wakes):
+        problems.append('%s all 0' % ', '.join(wakes))
+    return problems
+
+
+def check_limits(new, limits):
+    failed = 0
+    for limit in limits or []:
+        name, top = limit.split('=', 1)
+        if name not in new['metrics']:
+            print('%-24s not in the record' % name)
+            failed += 1
+        elif new['metrics'][name][0] > float(top):
+            print('%-24s %10d  over the limit of %s' % (name, new['metrics'][name][0], top))
+            failed += 1
+    return failed
+
+
+def main():
+    parser = argparse.ArgumentParser(usage=__doc__)
+    parser.add_argument('capture')
+    parser.add_argument('baseline', nargs='?')
+    parser.add_argument('--save', action='store_true')
+    parser.add_argument('--tol', action='append')
+    parser.add_argument('--abs', type=float, default=0.0)
+    parser.add_argument('--max', action='append')
+    parser.add_argument('--baud', type=int, default=921600)
+    parser.add_argument('--timeout', type=float, default=60.0)
+    args = parser.parse_args()
+
+    records = parse_records(read_capture(args.capture, args.baud, args.timeout))
+    if not records:
+        print('no complete perf record in %s' % args.capture)
+        return 2
+    new = records[-1]
+    print('%s record v%d, built %s' % (new['project'], new['version'], new['build']))
+    over = check_limits(new, args.max)
+    if not args.baseline:
+        sys.stdout.write(new['text'].decode('latin-1'))
+        return 1 if over else 0
+    if args.save:
+        problems = idle_problems(new)
+        if problems:
+            print('not saved, idle path never ran: %s' % '; '.join(problems))
+            return 2
+        with open(args.baseline, 'wb') as f:
+            f.write(new['text'])
+        print('saved to %s' % args.baseline)
+        return 0
+    with open(args.baseline, 'rb') as f:
+        bases = parse_records(f.read())
+    if not bases:
+        print('no perf record in baseline %s' % args.baseline)
+        return 2
+    base = bases[-1]
+    problems = idle_problems(base)
+    if problems:
+        print('baseline %s is unusable, idle path never ran: %s' % (args.baseline, '; '.join(problems)))
+        return 2
+    if (base['project'], base['version']) != (new['project'], new['version']):
+        print('baseline is %s v%d, not comparable' % (base['project'], base['version']))
+        return 2
+    print('baseline built %s' % base['build'])
+    default_tol, per_metric = tolerances(args)
+    regressions = compare(base, new, default_tol, per_metric, args.abs)
+    print('%d regression%s' % (regressions, '' if regressions == 1 else 's'))
+    return 1 if regressions or over else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,17 @@
+#ifndef SD_CRC_H
+#define SD_CRC_H
+#include <integer.h>
+
+extern const BYTE SD_CRC7_Table[256];
+extern const WORD SD_CRC16_Table[256];
+
+// Fold one byte into a running CRC16 (CCITT, x^16+x^12+x^5+1, initial 0)
+#define SD_CRC16_STEP(crc, b) \
+	((WORD)(((crc) << 8) ^ SD_CRC16_Table[(((crc) >> 8) ^ (b)) & 0xFF]))
+
+// CRC7 of a command frame (x^7+x^3+1), not yet shifted or given its stop bit
+BYTE SD_CRC7(const BYTE * buf, WORD len);
+// CRC16 of a buffer, continuing from crc
+WORD SD_CRC16(WORD crc, const BYTE * buf, WORD len);
+
+#endif
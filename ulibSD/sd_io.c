@@ -0,0 +1,1357 @@
+/*
+ *  File: sd_io.c
+ *  Author: Nelson Lombardo
+ *  Year: 2015
+ *  e-mail: nelson.lombardo@gmail.com
+ *  License at the end of file.
+ */
+ 
+// Modified 2017 by Alex Dean (agdean@ncsu.edu) for teaching FSMs
+// - Removed support for PC development (_M_IX86)
+// - Split single-line loops & conditionals in source code for readability
+// - Fused loops in SD_Read 
+// _ Inlined __SD_Write_Block into SD_Write
+
+#include "sd_io.h"
+#include <MKL25Z4.h>
+#include "debug.h"
+#include "sd_crc.h"
+#if SD_IO_MODEL != SD_IO_FSM
+#include <cmsis_os2.h>
+#endif
+
+#if defined(SD_IO_TRACE) || defined(SD_IO_STATE_PROF)
+extern uint32_t SDS_Cycles(void);       /* Free-running time base of the SD server */
+#endif
+
+#ifdef SD_IO_TRACE
+
+SD_TRACE_REC SD_Trace[SD_IO_TRACE_SIZE];
+volatile DWORD SD_Trace_Count = 0;
+static SD_TRACE_REC *SD_Trace_Busy;     /* Write whose programming busy is deferred */
+static DWORD SD_Trace_Busy_Start;
+
+// Claim next ring record for command just sent
+static void __SD_Trace_Begin(SD_CTX *ctx, BYTE cmd, DWORD arg, BYTE r1)
+{
+    SD_TRACE_REC *t = &SD_Trace[SD_Trace_Count++ & (SD_IO_TRACE_SIZE - 1)];
+    
+    t->time = ctx->t_mark = SDS_Cycles();
+    t->arg = arg;
+    t->cmd = cmd & 0x3F;
+    t->r1 = r1;
+    t->token = t->data = t->busy = 0;
+    ctx->trace = t;
+}
+#define SD_TRACE_BEGIN(ctx, cmd, arg, r1) __SD_Trace_Begin(ctx, cmd, arg, r1)
+// Charge time since last mark to phase field of the current record
+#define SD_TRACE_MARK(ctx, field) do { DWORD now_ = SDS_Cycles(); \
+    ctx->trace->field += now_ - ctx->t_mark; ctx->t_mark = now_; } while (0)
+#define SD_TRACE_BUSY_DEFER(ctx) do { SD_Trace_Busy = ctx->trace; \
+    SD_Trace_Busy_Start = SDS_Cycles(); } while (0)
+#else
+#define SD_TRACE_BEGIN(ctx, cmd, arg, r1)
+#define SD_TRACE_MARK(ctx, field)
+#define SD_TRACE_BUSY_DEFER(ctx)
+#endif
+
+#ifdef SD_IO_INIT_TIME
+static DWORD __SD_Elapsed_us(DWORD since)
+{
+    return((osKernelGetSysTimerCount() - since)/(osKernelGetSysTimerFreq()/1000000));
+}
+#define SD_INIT_START(dev, ctx) do { ctx->t_init = osKernelGetSysTimerCount(); \
+    dev->init_time.op_cond_polls = 0; } while (0)
+// New try: phases of earlier tries are dropped
+#define SD_INIT_TRY(dev, ctx) do { ctx->t_phase = osKernelGetSysTimerCount(); \
+    dev->init_time.idle = dev->init_time.if_cond = dev->init_time.op_cond = dev->init_time.config = 0; \
+    dev->init_time.tries = ctx->tries; } while (0)
+// Charge time since last mark to phase field of dev->init_time
+#define SD_INIT_MARK(dev, ctx, field) do { dev->init_time.field = __SD_Elapsed_us(ctx->t_phase); \
+    ctx->t_phase = osKernelGetSysTimerCount(); } while (0)
+#define SD_INIT_POLL(dev) ((void) dev->init_time.op_cond_polls++)
+#define SD_INIT_DONE(dev, ctx) (dev->init_time.total = __SD_Elapsed_us(ctx->t_init))
+#else
+#define SD_INIT_START(dev, ctx)
+#define SD_INIT_TRY(dev, ctx)
+#define SD_INIT_MARK(dev, ctx, field)
+#define SD_INIT_POLL(dev) ((void) 0)
+#define SD_INIT_DONE(dev, ctx)
+#endif
+
+#if SD_IO_MODEL == SD_IO_FSM
+// One step per call, the caller repeats while ctx->busy
+#define SD_RUN(ctx, res, step) res = (step)
+#else
+// Whole operation per call: steps until done, sleeping whenever the card allows
+#define SD_RUN(ctx, res, step) do { res = (step); } while (__SD_Wait(ctx, &res))
+#endif
+
+/* Table-driven FSMs: a handler per state does one step and returns the next 
+   state, S0 to end the operation. __SD_Step is the one shared entry and exit. */
+typedef states (*SD_STATE_FN)(SD_DEV *dev, SD_CTX *ctx);
+
+typedef struct _SD_FSM {
+    const SD_STATE_FN *table;   /* Handler of each state, 0 if unused   */
+    BYTE dbg;                   /* Debug signal high during a step      */
+    BYTE id;                    /* Row in SD_State_Prof                 */
+} SD_FSM;
+
+#ifdef SD_IO_STATE_PROF
+SD_STATE_PROF SD_State_Prof[SD_FSM_COUNT][SD_NUM_STATES];
+#endif
+
+
+/* Results of SD functions */
+char SD_Errors[8][8] = {
+    "OK",      
+    "NOINIT",      /* 1: SD not initialized    */
+    "ERROR",       /* 2: Disk error            */
+    "PARERR",      /* 3: Invalid parameter     */
+    "BUSY",        /* 4: Programming busy      */
+    "REJECT",      /* 5: Reject data           */
+    "NORESP",      /* 6: No response           */
+    "CRCERR"       /* 7: Data block CRC error  */
+};
+
+/******************************************************************************
+ Private Methods Prototypes - Direct work with SD card
+******************************************************************************/
+
+/**
+    \brief Simple function to calculate power of two.
+    \param e Exponent.
+    \return Math function result.
+*/
+DWORD __SD_Power_Of_Two(BYTE e);
+
+/**
+     \brief Assert the SD card (SPI CS low).
+ */
+inline void __SD_Assert (void);
+
+/**
+    \brief Deassert the SD (SPI CS high).
+ */
+inline void __SD_Deassert (void);
+
+/**
+    \brief Change to max the speed transfer.
+    \param throttle
+ */
+void __SD_Speed_Transfer (BYTE throttle);
+
+/**
+    \brief Send SPI commands.
+    \param cmd Command to send.
+    \param arg Argument to send.
+    \return R1 response.
+ */
+BYTE __SD_Send_Cmd(BYTE cmd, DWORD arg);
+
+/**
+    \brief Get the total numbers of sectors in SD card.
+    \param dev Device descriptor.
+    \return Quantity of sectors. Zero if fail.
+ */
+DWORD __SD_Sectors (SD_DEV *dev);
+
+/**
+    \brief Save card parameters for a warm restart (SD_IO_WARM_RESTART).
+    \param dev Device descriptor, mounted.
+ */
+void __SD_Warm_Save (SD_DEV *dev);
+
+/**
+    \brief Resume with parameters saved before a reset if the card is still initialized.
+    \param dev Device descriptor.
+    \return TRUE if dev is mounted without full initialization.
+ */
+BOOL __SD_Warm_Resume (SD_DEV *dev);
+
+/**
+    \brief Lower the SPI clock after a transfer error (SD_IO_SPEED_STEP_DOWN).
+    \param dev Device descriptor.
+ */
+void __SD_Speed_Step_Down (SD_DEV *dev);
+
+/**
+    \brief One step of an operation: run the handler of ctx->state and move to the state
+    it returns. Back in S0 the operation is done with result ctx->res.
+    \param fsm Transition table of the operation.
+    \return SD_OK while busy, else the operation's result.
+ */
+static SDRESULTS __SD_Step(const SD_FSM *fsm, SD_DEV *dev, SD_CTX *ctx);
+
+/**
+    \brief Keep the parameters of a read for its later steps, at the start (S0) only.
+    \param blocks Number of consecutive blocks; 1 selects single block read (CMD17).
+    \param segs Segment list for SD_Read_Gather, else 0 to use dat/ofs/cnt.
+ */
+static void __SD_Read_Setup(SD_CTX *ctx, void *dat, DWORD sector, WORD ofs, WORD cnt, WORD blocks,
+	const SD_SEG *segs, BYTE nsegs);
+
+/**
+    \brief Keep the parameters of a write for its later steps, at the start (S0) only.
+    \param blocks Number of consecutive blocks; 1 selects single block write (CMD24).
+ */
+static void __SD_Write_Setup(SD_CTX *ctx, void *dat, DWORD sector, WORD blocks);
+
+/**
+    \brief Pause the next ACMD41/CMD1 poll for ctx->idle_ms (SD_IO_FAST_INIT).
+ */
+static void __SD_Init_Backoff(SD_CTX *ctx);
+
+#if SD_IO_MODEL != SD_IO_FSM
+/**
+    \brief Between two steps of an operation: sleep through a data phase
+    (SPI_Block_Wait) or the idle time the step asked for.
+    \param res Result of the step, SD_ERROR if the data phase timed out.
+    \return TRUE if the operation needs another step.
+ */
+static BOOL __SD_Wait(SD_CTX *ctx, SDRESULTS *res);
+#endif
+
+/**
+    \brief Poll busy left by a deferred write, one byte per call.
+    \param dev Device descriptor.
+    \return TRUE while card is still programming (and timeout not reached).
+ */
+BOOL __SD_Busy_Pending(SD_DEV *dev);
+
+/******************************************************************************
+ Private Methods - Direct work with SD card
+******************************************************************************/
+
+DWORD __SD_Power_Of_Two(BYTE e)
+{
+    DWORD partial = 1;
+    BYTE idx;
+    for(idx=0; idx!=e; idx++) partial *= 2;
+    return(partial);
+}
+
+inline void __SD_Assert(void){
+    SPI_CS_Low();
+}
+
+inline void __SD_Deassert(void){
+    SPI_CS_High();
+}
+
+void __SD_Speed_Transfer(BYTE throttle) {
+    if(throttle == HIGH) SPI_Freq_High();
+    else SPI_Freq_Low();
+}
+
+BYTE __SD_Send_Cmd(BYTE cmd, DWORD arg)
+{
+    BYTE crc, res;
+
+	// ACMD«n» is the command sequense of CMD55-CMD«n»
+    if(cmd & 0x80) {
+        cmd &= 0x7F;
+        res = __SD_Send_Cmd(CMD55, 0);
+        if (res > 1) 
+					return (res);
+    }
+
+    // Select the card
+    __SD_Deassert();
+    SPI_RW(0xFF);
+    __SD_Assert();
+    SPI_RW(0xFF);
+
+    // Send complete command set
+    SPI_RW(cmd);                        // Start and command index
+    SPI_RW((BYTE)(arg >> 24));          // Arg[31-24]
+    SPI_RW((BYTE)(arg >> 16));          // Arg[23-16]
+    SPI_RW((BYTE)(arg >> 8 ));          // Arg[15-08]
+    SPI_RW((BYTE)(arg >> 0 ));          // Arg[07-00]
+
+    // CRC?
+#ifdef SD_IO_CRC
+    {
+        BYTE frame[5];
+        frame[0] = cmd;
+        frame[1] = (BYTE)(arg >> 24);
+        frame[2] = (BYTE)(arg >> 16);
+        frame[3] = (BYTE)(arg >> 8);
+        frame[4] = (BYTE)(arg >> 0);
+        crc = (SD_CRC7(frame, 5) << 1) | 0x01;  // CRC and stop
+    }
+#else
+    crc = 0x01;                         // Dummy CRC and stop
+    if(cmd == CMD0) 
+			crc = 0x95;         // Valid CRC for CMD0(0)
+    if(cmd == CMD8) 
+			crc = 0x87;         // Valid CRC for CMD8(0x1AA)
+#endif
+    SPI_RW(crc);
+
+    // Skip the stuff byte following CMD12
+    if(cmd == CMD12)
+        SPI_RW(0xFF);
+
+    // Receive command response
+    // Wait for a valid response in timeout of 5 milliseconds
+    SPI_Timer_On(5);
+    do {
+        res = SPI_RW(0xFF);
+    } while((res & 0x80)&&(SPI_Timer_Status()==TRUE));
+    SPI_Timer_Off();
+		
+    // Return with the response value
+    return(res);
+}
+
+DWORD __SD_Sectors (SD_DEV *dev)
+{
+    BYTE csd[16];
+    BYTE idx;
+    DWORD ss = 0;
+    WORD C_SIZE = 0;
+    BYTE C_SIZE_MULT = 0;
+    BYTE READ_BL_LEN = 0;
+    if(__SD_Send_Cmd(CMD9, 0)==0) 
+    {
+        // Wait for response
+        while (SPI_RW(0xFF) == 0xFF);
+        for (idx=0; idx!=16; idx++) 
+					csd[idx] = SPI_RW(0xFF);
+        // Dummy CRC
+        SPI_RW(0xFF);
+        SPI_RW(0xFF);
+        SPI_Release();
+        // TRAN_SPEED [103:96]: time value (bits 6:3) x rate unit (bits 2:0)
+        {
+            static const BYTE tv[16] = {0,10,12,13,15,20,25,30,35,40,45,50,55,60,70,80};
+            static const DWORD unit[4] = {10000UL, 100000UL, 1000000UL, 10000000UL};
+            dev->tran_speed = ((csd[3] & 0x07) < 4) ? 
+                unit[csd[3] & 0x07] * tv[(csd[3] >> 3) & 0x0F] : 0;
+        }
+        if(dev->cardtype & SDCT_SD1)
+        {
+            ss = csd[0];
+            // READ_BL_LEN[83:80]: max. read data block length
+            READ_BL_LEN = (csd[5] & 0x0F);
+            // C_SIZE [73:62]
+            C_SIZE = (csd[6] & 0x03);
+            C_SIZE <<= 8;
+            C_SIZE |= (csd[7]);
+            C_SIZE <<= 2;
+            C_SIZE |= ((csd[8] >> 6) & 0x03);
+            // C_SIZE_MULT [49:47]
+            C_SIZE_MULT = (csd[9] & 0x03);
+            C_SIZE_MULT <<= 1;
+            C_SIZE_MULT |= ((csd[10] >> 7) & 0x01);
+        }
+        else if(dev->cardtype & SDCT_SD2)
+        {
+						// READ_BL_LEN = 9;
+            // C_SIZE [69:48]
+            C_SIZE = (csd[7] & 0x3F);
+            C_SIZE <<= 8;
+            C_SIZE |= (csd[8] & 0xFF);
+            C_SIZE <<= 8;
+            C_SIZE |= (csd[9] & 0xFF);
+            C_SIZE_MULT = 8; // AD changed
+        }
+        ss = (C_SIZE + 1);
+        ss *= __SD_Power_Of_Two(C_SIZE_MULT + 2);
+        ss *= __SD_Power_Of_Two(READ_BL_LEN);
+        // ss /= SD_BLK_SIZE; ?? Bug in original code?
+
+        return (ss);
+    } else return (0); // Error
+}
+
+void __SD_Speed_Step_Down (SD_DEV *dev)
+{
+#ifdef SD_IO_SPEED_STEP_DOWN
+    dev->spi_hz = SPI_Freq_Step_Down();
+    __SD_Warm_Save(dev);
+#endif
+}
+
+#ifdef SD_IO_WARM_RESTART
+static SD_WARM SD_Warm SD_NOINIT_RAM;
+static BOOL SD_Warm_Tried = FALSE;  /* Only the first SD_Init after reset may resume */
+
+static DWORD __SD_Warm_Check(const SD_WARM *w)
+{
+    return (w->magic ^ ((DWORD)w->cardtype << 24) ^ ((DWORD)w->addr_shift << 16) ^
+        w->last_sector ^ (w->tran_speed << 1) ^ (w->spi_hz << 2) ^ 0xA5A5A5A5UL);
+}
+#endif
+
+void __SD_Warm_Save (SD_DEV *dev)
+{
+#ifdef SD_IO_WARM_RESTART
+    SD_Warm.magic = SD_WARM_MAGIC;
+    SD_Warm.cardtype = dev->cardtype;
+    SD_Warm.addr_shift = dev->addr_shift;
+    SD_Warm.last_sector = dev->last_sector;
+    SD_Warm.tran_speed = dev->tran_speed;
+    SD_Warm.spi_hz = dev->spi_hz;
+    SD_Warm.check = __SD_Warm_Check(&SD_Warm);
+#endif
+}
+
+BOOL __SD_Warm_Resume (SD_DEV *dev)
+{
+#ifdef SD_IO_WARM_RESTART
+    BYTE r1, r2, idx;
+
+    if(SD_Warm_Tried)
+        return(FALSE);
+    SD_Warm_Tried = TRUE;
+    if((SD_Warm.magic != SD_WARM_MAGIC)||(SD_Warm.check != __SD_Warm_Check(&SD_Warm)))
+        return(FALSE);
+    SD_Warm.magic = 0; // Saved again once the card is known to be good
+    SPI_Init();
+    SPI_CS_High();
+    SPI_Freq_Limit(SD_Warm.spi_hz);
+    __SD_Speed_Transfer(HIGH);
+    // Let the card finish a data phase cut off by the reset
+    for(idx = 0; idx != 10; idx++)
+        SPI_RW(0xFF);
+    // R2: R1 then status byte. Idle bit set means the card was reset and needs full init.
+    r1 = __SD_Send_Cmd(CMD13, 0);
+    r2 = SPI_RW(0xFF);
+    SPI_Release();
+    if((r1 != 0)||(r2 != 0))
+        return(FALSE);
+    dev->cardtype = SD_Warm.cardtype;
+    dev->addr_shift = SD_Warm.addr_shift;
+    dev->last_sector = SD_Warm.last_sector;
+    dev->tran_speed = SD_Warm.tran_speed;
+    dev->spi_hz = SD_Warm.spi_hz;
+    dev->busy_pending = FALSE;
+    dev->mount = TRUE;
+    dev->debug.read = 0;
+    dev->debug.write = 0;
+    dev->debug.cache_hit = 0;
+    dev->debug.cache_miss = 0;
+    __SD_Warm_Save(dev);
+    return(TRUE);
+#else
+    return(FALSE);
+#endif
+}
+
+BOOL __SD_Busy_Pending(SD_DEV *dev)
+{
+    if(!dev->busy_pending)
+        return(FALSE);
+    // Timer was started when write finished
+    __SD_Assert();
+    if((SPI_RW(0xFF) == 0)&&(SPI_Timer_Status()==TRUE))
+        return(TRUE);
+    SPI_Timer_Off();
+    dev->busy_pending = FALSE;
+#ifdef SD_IO_TRACE
+    if(SD_Trace_Busy)
+        SD_Trace_Busy->busy += SDS_Cycles() - SD_Trace_Busy_Start;
+    SD_Trace_Busy = 0;
+#endif
+    return(FALSE);
+}
+
+#if SD_IO_MODEL != SD_IO_FSM
+static BOOL __SD_Wait(SD_CTX *ctx, SDRESULTS *res)
+{
+    if(!ctx->busy)
+        return(FALSE);
+#ifdef SPI_BLOCK
+    if((SPI_Block_Status()==TRUE)&&(SPI_Block_Wait(SD_IO_BLOCK_TIMEOUT_MS)==FALSE)) {
+        // Data phase never finished: give up, the card may need SD_Init
+        __SD_Deassert();
+        ctx->state = S0;
+        ctx->busy = 0;
+        *res = SD_ERROR;
+        return(FALSE);
+    }
+#endif
+    // Tick rounding would cut the first tick short
+    if(ctx->idle_ms)
+        osDelay((ctx->idle_ms*osKernelGetTickFreq() + 999)/1000 + 1);
+    return(TRUE);
+}
+#endif
+
+static void __SD_Init_Backoff(SD_CTX *ctx)
+{
+#ifdef SD_IO_FAST_INIT
+    // Card keeps initializing without clocks, so other work can run until the next poll
+    __SD_Deassert();
+    ctx->idle_ms = ctx->backoff_ms;
+    if(ctx->backoff_ms < SD_IO_BACKOFF_MAX_MS)
+        ctx->backoff_ms <<= 1;
+#endif
+}
+
+static void __SD_Read_Setup(SD_CTX *ctx, void *dat, DWORD sector, WORD ofs, WORD cnt, WORD blocks,
+	const SD_SEG *segs, BYTE nsegs)
+{
+	if(ctx->state != S0)
+		return;
+	ctx->pointer = (BYTE *) dat;
+	ctx->sector = sector;
+	ctx->ofs = ofs;
+	ctx->cnt = cnt;
+	ctx->blocks = blocks;
+	ctx->segs = segs;
+	ctx->nsegs = nsegs;
+}
+
+static void __SD_Write_Setup(SD_CTX *ctx, void *dat, DWORD sector, WORD blocks)
+{
+	if(ctx->state != S0)
+		return;
+	ctx->pointer = (BYTE *) dat;
+	ctx->sector = sector;
+	ctx->blocks = blocks;
+}
+
+static SDRESULTS __SD_Step(const SD_FSM *fsm, SD_DEV *dev, SD_CTX *ctx)
+{
+	states s = ctx->state;
+	SD_STATE_FN fn = fsm->table[s];
+#ifdef SD_IO_STATE_PROF
+	DWORD t0 = SDS_Cycles();
+	SD_STATE_PROF *p;
+#endif
+
+	DEBUG_START(fsm->dbg);
+	ctx->idle_ms = 0;
+	if(fn == 0)
+	{
+		// Corrupted context: end the operation
+		ctx->res = SD_ERROR;
+		ctx->state = S0;
+	}
+	else
+		ctx->state = fn(dev, ctx);
+	ctx->busy = (ctx->state != S0);
+#ifdef SD_IO_STATE_PROF
+	p = &SD_State_Prof[fsm->id][s];
+	t0 = SDS_Cycles() - t0;
+	p->calls++;
+	p->cycles += t0;
+	if(t0 > p->max)
+		p->max = t0;
+#endif
+	DEBUG_STOP(fsm->dbg);
+	return(ctx->busy ? SD_OK : ctx->res);
+}
+
+/* SD_Init states */
+
+static states __SD_Init_Start(SD_DEV *dev, SD_CTX *ctx)
+{
+	ctx->res = SD_OK;
+	if(__SD_Warm_Resume(dev)==TRUE)
+		return(S0); // Card kept its state across the reset: no CMD0..CSD sequence
+	SD_INIT_START(dev, ctx);
+	ctx->ct = 0;
+	ctx->tries = 0;
+	dev->busy_pending = FALSE;
+	return(S1);
+}
+
+static states __SD_Init_Try(SD_DEV *dev, SD_CTX *ctx)
+{
+	BYTE idx;
+
+	if((ctx->tries==SD_INIT_TRYS)||(ctx->ct))
+	{
+		ctx->tries = 0;
+		return(S14);
+	}
+	// Initialize SPI for use with the memory card
+	SPI_Init();
+	SPI_CS_High();
+	SPI_Freq_Low();
+	ctx->tries++;
+	SD_INIT_TRY(dev, ctx);
+	// 80 dummy clocks
+	for(idx = 0; idx != 10; idx++)
+		SPI_RW(0xFF);
+	return(S2);
+}
+
+static states __SD_Init_Power_Up(SD_DEV *dev, SD_CTX *ctx)
+{
+#ifdef SD_IO_FAST_INIT
+	// Only the spec's power-up time, the card has had power since reset
+	ctx->idle_ms = SD_IO_POWERUP_DELAY_MS;
+#else
+	ctx->idle_ms = 500;
+#endif
+	SPI_Timer_On(ctx->idle_ms);
+	return(S3);
+}
+
+static states __SD_Init_Power_Up_Wait(SD_DEV *dev, SD_CTX *ctx)
+{
+	if(SPI_Timer_Status()==TRUE)
+		return(S3);
+	SPI_Timer_Off();
+	SD_INIT_MARK(dev, ctx, power_up);
+	dev->mount = FALSE;
+	SPI_Timer_On(500);
+	return(S4);
+}
+
+static states __SD_Init_Go_Idle(SD_DEV *dev, SD_CTX *ctx)
+{
+	if((__SD_Send_Cmd(CMD0, 0) != 1)&&(SPI_Timer_Status()==TRUE))
+		return(S4);
+	SPI_Timer_Off();
+	return(S5);
+}
+
+static states __SD_Init_Idle(SD_DEV *dev, SD_CTX *ctx)
+{
+	// Idle state?
+	if(__SD_Send_Cmd(CMD0, 0) != 1)
+		return(S1);
+	SD_INIT_MARK(dev, ctx, idle);
+	return(S6);
+}
+
+static states __SD_Init_If_Cond(SD_DEV *dev, SD_CTX *ctx)
+{
+	// SD version 2?
+	if(__SD_Send_Cmd(CMD8, 0x1AA) == 1)
+	{
+		// Get trailing return value of R7 resp
+		ctx->idx = 0;
+		return(S7);
+	}
+	SD_INIT_MARK(dev, ctx, if_cond);
+	return(S11);
+}
+
+static states __SD_Init_R7(SD_DEV *dev, SD_CTX *ctx)
+{
+	if(ctx->idx < 4)
+	{
+		ctx->ocr[ctx->idx++] = SPI_RW(0xFF);
+		return(S7);
+	}
+	SD_INIT_MARK(dev, ctx, if_cond);
+	// VDD range of 2.7-3.6V is OK?
+	if((ctx->ocr[2] != 0x01)||(ctx->ocr[3] != 0xAA))
+		return(S1);
+	// Wait for leaving idle state (ACMD41 with HCS bit)...
+	SPI_Timer_On(1000);
+	ctx->backoff_ms = 1;
+	return(S8);
+}
+
+static states __SD_Init_Op_Cond_V2(SD_DEV *dev, SD_CTX *ctx)
+{
+	if((SPI_Timer_Status()==TRUE)&&(SD_INIT_POLL(dev), __SD_Send_Cmd(ACMD41, 1UL << 30)))
+	{
+		__SD_Init_Backoff(ctx);
+		return(S8);
+	}
+	SPI_Timer_Off();
+	SD_INIT_MARK(dev, ctx, op_cond);
+	return(S9);
+}
+
+static states __SD_Init_Read_OCR(SD_DEV *dev, SD_CTX *ctx)
+{
+	// CCS in the OCR?
+	// AGD: Delete SPI_Timer_Status call?
+	if((SPI_Timer_Status()==TRUE)&&(__SD_Send_Cmd(CMD58, 0) == 0))
+	{
+		ctx->idx = 0;
+		return(S10);
+	}
+	return(S1);
+}
+
+static states __SD_Init_OCR(SD_DEV *dev, SD_CTX *ctx)
+{
+	if(ctx->idx < 4)
+	{
+		ctx->ocr[ctx->idx++] = SPI_RW(0xFF);
+		return(S10);
+	}
+	// SD version 2
+	ctx->ct = (ctx->ocr[0] & 0x40) ? SDCT_SD2 | SDCT_BLOCK : SDCT_SD2;
+	return(S1);
+}
+
+static states __SD_Init_Op_Cond_Sel(SD_DEV *dev, SD_CTX *ctx)
+{
+	// SD version 1 or MMC?
+	if(__SD_Send_Cmd(ACMD41, 0) <= 1)
+	{
+		// SD version 1
+		ctx->ct = SDCT_SD1;
+		ctx->cmd = ACMD41;
+	} else {
+		// MMC version 3
+		ctx->ct = SDCT_MMC;
+		ctx->cmd = CMD1;
+	}
+	// Wait for leaving idle state
+	SPI_Timer_On(250);
+	ctx->backoff_ms = 1;
+	return(S12);
+}
+
+static states __SD_Init_Op_Cond_V1(SD_DEV *dev, SD_CTX *ctx)
+{
+	if((SPI_Timer_Status()==TRUE)&&(SD_INIT_POLL(dev), __SD_Send_Cmd(ctx->cmd, 0)))
+	{
+		__SD_Init_Backoff(ctx);
+		return(S12);
+	}
+	SPI_Timer_Off();
+	SD_INIT_MARK(dev, ctx, op_cond);
+	return(S13);
+}
+
+static states __SD_Init_Block_Len(SD_DEV *dev, SD_CTX *ctx)
+{
+	if(SPI_Timer_Status()==FALSE)
+		ctx->ct = 0;
+	if(__SD_Send_Cmd(CMD59, 0))
+		ctx->ct = 0;   // Deactivate CRC check (default)
+	if(__SD_Send_Cmd(CMD16, 512))
+		ctx->ct = 0;   // Set R/W block length to 512 bytes
+	return(S1);
+}
+
+static states __SD_Init_Finish(SD_DEV *dev, SD_CTX *ctx)
+{
+#ifdef SD_IO_CRC
+	// Turn on CRC checking of commands and data blocks
+	if(ctx->ct && __SD_Send_Cmd(CMD59, 1))
+		ctx->ct = 0;
+#endif
+	if(ctx->ct) {
+		dev->cardtype = ctx->ct;
+		dev->addr_shift = (ctx->ct & SDCT_BLOCK) ? 0 : 9;
+		dev->mount = TRUE;
+		dev->last_sector = __SD_Sectors(dev) - 1;
+		dev->debug.read = 0;
+		dev->debug.write = 0;
+		dev->debug.cache_hit = 0;
+		dev->debug.cache_miss = 0;
+		// Fastest clock the card allows (25 MHz if the CSD is unreadable)
+		dev->spi_hz = SPI_Freq_Limit(dev->tran_speed ? dev->tran_speed : 25000000UL);
+		__SD_Speed_Transfer(HIGH); // High speed transfer
+		__SD_Warm_Save(dev);
+	}
+	SPI_Release();
+	SD_INIT_MARK(dev, ctx, config);
+	SD_INIT_DONE(dev, ctx);
+	ctx->res = ctx->ct ? SD_OK : SD_NOINIT;
+	return(S0);
+}
+
+static const SD_STATE_FN SD_Init_States[SD_NUM_STATES] = {
+	[S0]  = __SD_Init_Start,
+	[S1]  = __SD_Init_Try,          // Next try, or S14 when done
+	[S2]  = __SD_Init_Power_Up,
+	[S3]  = __SD_Init_Power_Up_Wait,
+	[S4]  = __SD_Init_Go_Idle,      // CMD0 until idle or timeout
+	[S5]  = __SD_Init_Idle,
+	[S6]  = __SD_Init_If_Cond,      // CMD8: S7 for SD v2, else S11
+	[S7]  = __SD_Init_R7,
+	[S8]  = __SD_Init_Op_Cond_V2,   // ACMD41 with HCS until ready
+	[S9]  = __SD_Init_Read_OCR,     // CMD58
+	[S10] = __SD_Init_OCR,
+	[S11] = __SD_Init_Op_Cond_Sel,  // SD v1 or MMC
+	[S12] = __SD_Init_Op_Cond_V1,   // ACMD41 or CMD1 until ready
+	[S13] = __SD_Init_Block_Len,
+	[S14] = __SD_Init_Finish
+};
+static const SD_FSM SD_Init_FSM = {SD_Init_States, DBG_4, SD_FSM_INIT};
+
+/* SD_Read, SD_Read_Gather and SD_Read_Multi states */
+
+static BOOL __SD_Segs_Valid(const SD_SEG *segs, BYTE nsegs)
+{
+	WORD end = 0;
+	BYTE i;
+
+	if ((segs == 0) || (nsegs == 0))
+		return FALSE;
+	for (i = 0; i < nsegs; i++)
+	{
+		if ((segs[i].cnt == 0) || (segs[i].ofs < end) || (segs[i].dest == 0) ||
+			(segs[i].ofs + segs[i].cnt > SD_BLK_SIZE))
+			return FALSE;
+		end = segs[i].ofs + segs[i].cnt;
+	}
+	return TRUE;
+}
+
+static void __SD_Gather(SD_CTX *ctx)
+{
+	const SD_SEG *s = &ctx->segs[ctx->seg];
+
+	if ((ctx->seg < ctx->nsegs) && (ctx->idx >= s->ofs))
+	{
+		*ctx->pointer = ctx->data;
+		ctx->pointer++;
+		// Last byte of segment: continue in next segment's destination
+		if ((ctx->idx == s->ofs + s->cnt - 1) && (++ctx->seg < ctx->nsegs))
+			ctx->pointer = ctx->segs[ctx->seg].dest;
+	}
+}
+
+// Keep byte ctx->idx of the block if the caller asked for it
+static void __SD_Read_Store(SD_CTX *ctx)
+{
+	if (ctx->segs != 0)
+		__SD_Gather(ctx);
+	else if ((ctx->idx >= ctx->ofs) && (ctx->idx < ctx->ofs + ctx->cnt)) {
+		*ctx->pointer = ctx->data;
+		ctx->pointer++;
+	} // else discard bytes before and after data
+}
+
+static states __SD_Read_Start(SD_DEV *dev, SD_CTX *ctx)
+{
+	ctx->res = SD_PARERR;
+	if ((ctx->blocks == 0)||(ctx->sector + ctx->blocks - 1 > dev->last_sector)||
+		((ctx->segs == 0) ? (ctx->cnt == 0) : (__SD_Segs_Valid(ctx->segs, ctx->nsegs) == FALSE)))
+		return(S0);
+	ctx->res = SD_ERROR;
+	ctx->block_num = 0;
+	ctx->seg = 0;
+	if (ctx->segs != 0)
+		ctx->pointer = ctx->segs[0].dest;
+	return(S2);
+}
+
+static states __SD_Read_Cmd(SD_DEV *dev, SD_CTX *ctx)
+{
+	BYTE cmd = (ctx->blocks > 1) ? CMD18 : CMD17;
+
+#ifdef SD_IO_DEFERRED_BUSY
+	if (__SD_Busy_Pending(dev)==TRUE)
+		return(S2);
+#endif
+	// Byte address (sector * SD_BLK_SIZE) for SDSC, block address for SDHC or SDXC
+	ctx->data = __SD_Send_Cmd(cmd, ctx->sector << dev->addr_shift);
+	SD_TRACE_BEGIN(ctx, cmd, ctx->sector << dev->addr_shift, ctx->data);
+	if (ctx->data != 0)
+		return(S6);
+	SPI_Timer_On(100);
+	ctx->tkn = SPI_RW(0xFF);
+	return(S3);
+}
+
+static states __SD_Read_Token_Wait(SD_DEV *dev, SD_CTX *ctx)
+{
+	if ((ctx->tkn==0xFF)&&(SPI_Timer_Status()==TRUE))
+	{
+		ctx->tkn = SPI_RW(0xFF);
+		return(S3);
+	}
+	SPI_Timer_Off();
+	SD_TRACE_MARK(ctx, token);
+	return(S4);
+}
+
+static states __SD_Read_Token(SD_DEV *dev, SD_CTX *ctx)
+{
+	if (ctx->tkn != 0xFE)
+	{
+		__SD_Speed_Step_Down(dev);
+		return((ctx->blocks > 1) ? S8 : S6); // CMD18 must still be stopped
+	}
+#ifdef SPI_BLOCK
+	// Whole block: one DMA or interrupt transfer instead of 512 FSM passes
+	if ((ctx->ofs == 0) && (ctx->cnt == SD_BLK_SIZE) && SPI_Block_Start(ctx->pointer, 0, SD_BLK_SIZE))
+		return(S10);
+#endif
+	// AGD: Loop fusion to simplify FSM formation
+	ctx->idx = 0;
+	ctx->data = SPI_RW(0xff);
+#ifdef SD_IO_CRC
+	ctx->crc = SD_CRC16_STEP(0, ctx->data);
+#endif
+	__SD_Read_Store(ctx);
+	return(S5);
+}
+
+static states __SD_Read_Data(SD_DEV *dev, SD_CTX *ctx)
+{
+	if (++ctx->idx < SD_BLK_SIZE + 2)
+	{
+		ctx->data = SPI_RW(0xff);
+		__SD_Read_Store(ctx);
+#ifdef SD_IO_CRC
+		if (ctx->idx < SD_BLK_SIZE)
+			ctx->crc = SD_CRC16_STEP(ctx->crc, ctx->data);
+		else
+			ctx->crc_rx = (ctx->crc_rx << 8) | ctx->data;
+#endif
+		return(S5);
+	}
+	ctx->res = SD_OK;
+	SD_TRACE_MARK(ctx, data);
+#ifdef SD_IO_CRC
+	if (ctx->crc != ctx->crc_rx) {
+		// Caller can retry just this block
+		__SD_Speed_Step_Down(dev);
+		ctx->res = SD_CRCERR;
+		return((ctx->blocks > 1) ? S8 : S6);
+	}
+#endif
+	return((ctx->blocks > 1) ? S7 : S6);
+}
+
+static states __SD_Read_Next(SD_DEV *dev, SD_CTX *ctx)
+{
+	// Multi-block read: wait for next data token or stop the run
+	if (++ctx->block_num >= ctx->blocks)
+		return(S8);
+	ctx->res = SD_ERROR;
+	SPI_Timer_On(100);
+	ctx->tkn = SPI_RW(0xFF);
+	return(S3);
+}
+
+static states __SD_Read_Stop(SD_DEV *dev, SD_CTX *ctx)
+{
+	// Stop transmission, R1b response (card holds DO low while busy)
+	if (__SD_Send_Cmd(CMD12, 0) != 0)
+		ctx->res = SD_ERROR;
+	SPI_Timer_On(100);
+	ctx->data = SPI_RW(0xFF);
+	return(S9);
+}
+
+static states __SD_Read_Stop_Wait(SD_DEV *dev, SD_CTX *ctx)
+{
+	if ((ctx->data == 0)&&(SPI_Timer_Status()==TRUE))
+	{
+		ctx->data = SPI_RW(0xFF);
+		return(S9);
+	}
+	SPI_Timer_Off();
+	SD_TRACE_MARK(ctx, busy);
+	if (ctx->data == 0)
+		ctx->res = SD_BUSY;
+	return(S6);
+}
+
+#ifdef SPI_BLOCK
+static states __SD_Read_Block_Wait(SD_DEV *dev, SD_CTX *ctx)
+{
+	if (SPI_Block_Status()==TRUE)
+		return(S10);
+	// Data block done, S5 clocks in the CRC
+#ifdef SD_IO_CRC
+	ctx->crc = SD_CRC16(0, ctx->pointer, SD_BLK_SIZE);
+#endif
+	ctx->pointer += SD_BLK_SIZE;
+	ctx->idx = SD_BLK_SIZE - 1;
+	return(S5);
+}
+#endif
+
+static states __SD_Read_Done(SD_DEV *dev, SD_CTX *ctx)
+{
+	SPI_Release();
+	dev->debug.read++;
+	return(S0);
+}
+
+static const SD_STATE_FN SD_Read_States[SD_NUM_STATES] = {
+	[S0]  = __SD_Read_Start,
+	[S2]  = __SD_Read_Cmd,          // CMD17 or CMD18
+	[S3]  = __SD_Read_Token_Wait,
+	[S4]  = __SD_Read_Token,
+	[S5]  = __SD_Read_Data,         // One byte per step, then CRC
+	[S6]  = __SD_Read_Done,
+	[S7]  = __SD_Read_Next,         // CMD18: next block or S8
+	[S8]  = __SD_Read_Stop,         // CMD12
+	[S9]  = __SD_Read_Stop_Wait,
+#ifdef SPI_BLOCK
+	[S10] = __SD_Read_Block_Wait
+#endif
+};
+static const SD_FSM SD_Read_FSM = {SD_Read_States, DBG_2, SD_FSM_READ};
+
+/* SD_Write and SD_Write_Multi states */
+
+static states __SD_Write_Start(SD_DEV *dev, SD_CTX *ctx)
+{
+	if ((ctx->blocks == 0)||(ctx->sector + ctx->blocks - 1 > dev->last_sector))
+	{
+		ctx->res = SD_PARERR;
+		return(S0);
+	}
+	ctx->res = SD_OK;
+	ctx->block_num = 0;
+	return(S2);
+}
+
+static states __SD_Write_Cmd(SD_DEV *dev, SD_CTX *ctx)
+{
+	BYTE cmd = (ctx->blocks > 1) ? CMD25 : CMD24;
+
+#ifdef SD_IO_DEFERRED_BUSY
+	if (__SD_Busy_Pending(dev)==TRUE)
+		return(S2);
+#endif
+#ifdef SD_IO_WRITE_PRE_ERASE
+	// Pre-erase hint lets the card pipeline programming of the run
+	if ((ctx->blocks > 1)&&(dev->cardtype & SDCT_SDC))
+		__SD_Send_Cmd(ACMD23, ctx->blocks);
+#endif
+	// Byte address (sector * SD_BLK_SIZE) for SDSC, block address for SDHC or SDXC
+	ctx->data = __SD_Send_Cmd(cmd, ctx->sector << dev->addr_shift);
+	SD_TRACE_BEGIN(ctx, cmd, ctx->sector << dev->addr_shift, ctx->data);
+	if (ctx->data != 0)
+	{
+		ctx->res = SD_ERROR;
+		return(S0);
+	}
+	// Send token (0xFE single block, 0xFC each block of multi block write)
+	SPI_RW((ctx->blocks > 1) ? 0xFC : 0xFE);
+	ctx->idx = 0;
+	ctx->crc = 0;
+	return(S3);
+}
+
+static states __SD_Write_Data(SD_DEV *dev, SD_CTX *ctx)
+{
+#ifdef SPI_BLOCK
+	if ((ctx->idx == 0) && SPI_Block_Start(0, ctx->pointer, SD_BLK_SIZE))
+	{
+#ifdef SD_IO_CRC
+		ctx->crc = SD_CRC16(0, ctx->pointer, SD_BLK_SIZE);
+#endif
+		return(S9);
+	}
+#endif
+	if (ctx->idx != SD_BLK_SIZE)
+	{
+		ctx->data = ctx->pointer[ctx->idx];
+		SPI_RW(ctx->data);
+#ifdef SD_IO_CRC
+		ctx->crc = SD_CRC16_STEP(ctx->crc, ctx->data);
+#endif
+		ctx->idx++;
+		return(S3);
+	}
+#ifdef SD_IO_CRC
+	SPI_RW((BYTE)(ctx->crc >> 8));
+	SPI_RW((BYTE)(ctx->crc));
+#else
+	SPI_RW(0xFF);
+	SPI_RW(0xFF);
+#endif
+	ctx->data = SPI_RW(0xFF) & 0x1F;
+	SD_TRACE_MARK(ctx, data);
+	if (ctx->data != 0x05)
+	{
+		__SD_Speed_Step_Down(dev);
+		ctx->res = (ctx->data == 0x0B) ? SD_CRCERR : SD_REJECT;
+		return((ctx->blocks > 1) ? S7 : S0); // Stop the multi block write
+	}
+#ifdef SD_IO_DEFERRED_BUSY
+	if (ctx->blocks == 1)
+	{
+		// Data accepted: done, next command waits for end of programming
+		SPI_Timer_On(SD_IO_WRITE_TIMEOUT_WAIT);
+		dev->busy_pending = TRUE;
+		SD_TRACE_BUSY_DEFER(ctx);
+		dev->debug.write++;
+		return(S0);
+	}
+#endif
+	return(S4);
+}
+
+static states __SD_Write_Busy(SD_DEV *dev, SD_CTX *ctx)
+{
+	SPI_Timer_On(SD_IO_WRITE_TIMEOUT_WAIT);
+	ctx->data = SPI_RW(0xFF);
+	return(S5);
+}
+
+static states __SD_Write_Busy_Wait(SD_DEV *dev, SD_CTX *ctx)
+{
+	if ((ctx->data==0)&&(SPI_Timer_Status()==TRUE))
+	{
+		ctx->data = SPI_RW(0xFF);
+		return(S5);
+	}
+	SPI_Timer_Off();
+	SD_TRACE_MARK(ctx, busy);
+	dev->debug.write++;
+	return(S6);
+}
+
+static states __SD_Write_Next(SD_DEV *dev, SD_CTX *ctx)
+{
+	if (ctx->blocks == 1)
+	{
+		if (ctx->data==0)
+			ctx->res = SD_BUSY;
+		return(S0);
+	}
+	if (ctx->data==0)
+	{
+		ctx->res = SD_BUSY;
+		return(S7);
+	}
+	if (++ctx->block_num >= ctx->blocks)
+		return(S7);
+	// Next data block of the run
+	SPI_RW(0xFC);
+	ctx->pointer += SD_BLK_SIZE;
+	ctx->idx = 0;
+	ctx->crc = 0;
+	return(S3);
+}
+
+static states __SD_Write_Stop(SD_DEV *dev, SD_CTX *ctx)
+{
+	// Stop Tran token, then card programs the last block
+	SPI_RW(0xFD);
+	SPI_RW(0xFF);
+	SPI_Timer_On(SD_IO_WRITE_TIMEOUT_WAIT);
+#ifdef SD_IO_DEFERRED_BUSY
+	// Done, next command waits for end of programming
+	dev->busy_pending = TRUE;
+	SD_TRACE_BUSY_DEFER(ctx);
+	return(S0);
+#else
+	ctx->data = SPI_RW(0xFF);
+	return(S8);
+#endif
+}
+
+static states __SD_Write_Stop_Wait(SD_DEV *dev, SD_CTX *ctx)
+{
+	if ((ctx->data==0)&&(SPI_Timer_Status()==TRUE))
+	{
+		ctx->data = SPI_RW(0xFF);
+		return(S8);
+	}
+	SPI_Timer_Off();
+	SD_TRACE_MARK(ctx, busy);
+	if (ctx->data==0)
+		ctx->res = SD_BUSY;
+	return(S0);
+}
+
+#ifdef SPI_BLOCK
+static states __SD_Write_Block_Wait(SD_DEV *dev, SD_CTX *ctx)
+{
+	if (SPI_Block_Status()==TRUE)
+		return(S9);
+	// Data block sent, S3 finishes with CRC and data response
+	ctx->idx = SD_BLK_SIZE;
+	return(S3);
+}
+#endif
+
+static const SD_STATE_FN SD_Write_States[SD_NUM_STATES] = {
+	[S0]  = __SD_Write_Start,
+	[S2]  = __SD_Write_Cmd,         // CMD24 or CMD25 and data token
+	[S3]  = __SD_Write_Data,        // One byte per step, then CRC and data response
+	[S4]  = __SD_Write_Busy,
+	[S5]  = __SD_Write_Busy_Wait,
+	[S6]  = __SD_Write_Next,        // CMD25: next block or S7
+	[S7]  = __SD_Write_Stop,        // Stop Tran token
+	[S8]  = __SD_Write_Stop_Wait,
+#ifdef SPI_BLOCK
+	[S9]  = __SD_Write_Block_Wait
+#endif
+};
+static const SD_FSM SD_Write_FSM = {SD_Write_States, DBG_3, SD_FSM_WRITE};
+
+/* SD_Erase states */
+
+static states __SD_Erase_Start(SD_DEV *dev, SD_CTX *ctx)
+{
+	if ((ctx->sector > ctx->end)||(ctx->end > dev->last_sector)||!(dev->cardtype & SDCT_SDC))
+	{
+		ctx->res = SD_PARERR;
+		return(S0);
+	}
+	ctx->res = SD_ERROR;
+	return(S2);
+}
+
+static states __SD_Erase_Start_Cmd(SD_DEV *dev, SD_CTX *ctx)
+{
+#ifdef SD_IO_DEFERRED_BUSY
+	if (__SD_Busy_Pending(dev)==TRUE)
+		return(S2);
+#endif
+	// Mark range, byte addresses for SDSC like reads and writes
+	return((__SD_Send_Cmd(CMD32, ctx->sector << dev->addr_shift) != 0) ? S6 : S3);
+}
+
+static states __SD_Erase_End_Cmd(SD_DEV *dev, SD_CTX *ctx)
+{
+	return((__SD_Send_Cmd(CMD33, ctx->end << dev->addr_shift) != 0) ? S6 : S4);
+}
+
+static states __SD_Erase_Cmd(SD_DEV *dev, SD_CTX *ctx)
+{
+	// R1b: card holds DO low until erase is done
+	if (__SD_Send_Cmd(CMD38, 0) != 0)
+		return(S6);
+	SPI_Timer_On(SD_IO_ERASE_TIMEOUT_WAIT);
+	ctx->data = SPI_RW(0xFF);
+	return(S5);
+}
+
+static states __SD_Erase_Busy_Wait(SD_DEV *dev, SD_CTX *ctx)
+{
+	// One busy poll per step, so other tasks run during a long erase
+	if ((ctx->data == 0)&&(SPI_Timer_Status()==TRUE))
+	{
+		ctx->data = SPI_RW(0xFF);
+		return(S5);
+	}
+	SPI_Timer_Off();
+	ctx->res = (ctx->data == 0) ? SD_BUSY : SD_OK;
+	return(S6);
+}
+
+static states __SD_Erase_Done(SD_DEV *dev, SD_CTX *ctx)
+{
+	SPI_Release();
+	return(S0);
+}
+
+static const SD_STATE_FN SD_Erase_States[SD_NUM_STATES] = {
+	[S0]  = __SD_Erase_Start,
+	[S2]  = __SD_Erase_Start_Cmd,   // CMD32
+	[S3]  = __SD_Erase_End_Cmd,     // CMD33
+	[S4]  = __SD_Erase_Cmd,         // CMD38
+	[S5]  = __SD_Erase_Busy_Wait,
+	[S6]  = __SD_Erase_Done
+};
+static const SD_FSM SD_Erase_FSM = {SD_Erase_States, DBG_3, SD_FSM_ERASE};
+
+/******************************************************************************
+ Public Methods - Direct work with SD card
+******************************************************************************/
+SDRESULTS SD_Init(SD_DEV *dev, SD_CTX *ctx)
+{
+	SDRESULTS res;
+
+	SD_RUN(ctx, res, __SD_Step(&SD_Init_FSM, dev, ctx));
+	return(res);
+}
+
+SDRESULTS SD_Read(SD_DEV *dev, SD_CTX *ctx, void *dat, DWORD sector, WORD ofs, WORD cnt)
+{
+	SDRESULTS res;
+
+	__SD_Read_Setup(ctx, dat, sector, ofs, cnt, 1, 0, 0);
+	SD_RUN(ctx, res, __SD_Step(&SD_Read_FSM, dev, ctx));
+	return(res);
+}
+
+SDRESULTS SD_Read_Gather(SD_DEV *dev, SD_CTX *ctx, const SD_SEG *segs, BYTE nsegs, DWORD sector)
+{
+	SDRESULTS res;
+
+	// ofs/cnt are unused, cnt of 0 also keeps the whole-block transfer path off
+	__SD_Read_Setup(ctx, 0, sector, 0, 0, 1, segs, nsegs);
+	SD_RUN(ctx, res, __SD_Step(&SD_Read_FSM, dev, ctx));
+	return(res);
+}
+
+SDRESULTS SD_Read_Multi(SD_DEV *dev, SD_CTX *ctx, void *dat, DWORD sector, WORD count)
+{
+	SDRESULTS res;
+
+	__SD_Read_Setup(ctx, dat, sector, 0, SD_BLK_SIZE, count, 0, 0);
+	SD_RUN(ctx, res, __SD_Step(&SD_Read_FSM, dev, ctx));
+	return(res);
+}
+
+SDRESULTS SD_Write(SD_DEV *dev, SD_CTX *ctx, void *dat, DWORD sector)
+{
+	SDRESULTS res;
+
+	__SD_Write_Setup(ctx, dat, sector, 1);
+	SD_RUN(ctx, res, __SD_Step(&SD_Write_FSM, dev, ctx));
+	return(res);
+}
+
+SDRESULTS SD_Write_Multi(SD_DEV *dev, SD_CTX *ctx, void *dat, DWORD sector, WORD count)
+{
+	SDRESULTS res;
+
+	__SD_Write_Setup(ctx, dat, sector, count);
+	SD_RUN(ctx, res, __SD_Step(&SD_Write_FSM, dev, ctx));
+	return(res);
+}
+
+SDRESULTS SD_Erase(SD_DEV *dev, SD_CTX *ctx, DWORD start, DWORD end)
+{
+	SDRESULTS res;
+
+	if(ctx->state == S0)
+	{
+		ctx->sector = start;
+		ctx->end = end;
+	}
+	SD_RUN(ctx, res, __SD_Step(&SD_Erase_FSM, dev, ctx));
+	return(res);
+}
+
+SDRESULTS SD_Status(SD_DEV *dev)
+{
+    return(__SD_Send_Cmd(CMD0, 0) ? SD_OK : SD_NORESPONSE);
+}
+
+// «sd_io.c» is part of:
+/*----------------------------------------------------------------------------/
+/  ulibSD - Library for SD cards semantics            (C)Nelson Lombardo, 2015
+/-----------------------------------------------------------------------------/
+/ ulibSD library is a free software that opened under license policy of
+/ following conditions.
+/
+/ Copyright (C) 2015, ChaN, all right reserved.
+/
+/ 1. Redistributions of source code must retain the above copyright notice,
+/    this condition and the following disclaimer.
+/
+/ This software is provided by the copyright holder and contributors "AS IS"
+/ and any warranties related to this software are DISCLAIMED.
+/ The copyright owner or contributors be NOT LIABLE for any damages caused
+/ by use of this software.
+/----------------------------------------------------------------------------*/
+
+// Derived from Mister Chan works on FatFs code (http://elm-chan.org/fsw/ff/00index_e.html):
+/*----------------------------------------------------------------------------/
+/  FatFs - FAT file system module  R0.11                 (C)ChaN, 2015
+/-----------------------------------------------------------------------------/
+/ FatFs module is a free software that opened under license policy of
+/ following conditions.
+/
+/ Copyright (C) 2015, ChaN, all right reserved.
+/
+/ 1. Redistributions of source code must retain the above copyright notice,
+/    this condition and the following disclaimer.
+/
+/ This software is provided by the copyright holder and contributors "AS IS"
+/ and any warranties related to this software are DISCLAIMED.
+/ The copyright owner or contributors be NOT LIABLE for any damages caused
+/ by use of this software.
+/----------------------------------------------------------------------------*/
@@ -0,0 +1,335 @@
+/*
+ *  File: sd_io.h
+ *  Author: Nelson Lombardo
+ *  Year: 2015
+ *  e-mail: nelson.lombardo@gmail.com
+ *  License at the end of file.
+ */
+
+// Modified 2017 by Alex Dean (agdean@ncsu.edu) for teaching FSMs
+	
+
+#ifndef _SD_IO_H_
+#define _SD_IO_H_
+
+/*****************************************************************************/
+/* Configurations: switches are in the project's sd_config.h (via spi_io.h),  */
+/* these are defaults it may override                                        */
+/*****************************************************************************/
+#include "spi_io.h" /* Provide the low-level functions */
+
+#ifndef SD_IO_WRITE_TIMEOUT_WAIT
+#define SD_IO_WRITE_TIMEOUT_WAIT 250
+#endif
+#ifndef SD_IO_ERASE_TIMEOUT_WAIT
+#define SD_IO_ERASE_TIMEOUT_WAIT 30000  // ms, erase busy grows with range size
+#endif
+#ifndef SD_IO_TRACE_SIZE
+#define SD_IO_TRACE_SIZE 16     // Records in ring, power of two
+#endif
+#ifndef SD_IO_POWERUP_DELAY_MS
+#define SD_IO_POWERUP_DELAY_MS 1        // SD_IO_FAST_INIT: spec minimum is 1 ms
+#endif
+#ifndef SD_IO_BACKOFF_MAX_MS
+#define SD_IO_BACKOFF_MAX_MS 16         // SD_IO_FAST_INIT: longest pause between ACMD41 polls
+#endif
+#define SD_IO_BLOCK_TIMEOUT_MS 100      // RTX models: data phase must finish in this time
+
+#if !defined(SD_IO_MODEL) || ((SD_IO_MODEL != SD_IO_FSM) && (SD_IO_MODEL != SD_IO_RTX_IRQ) && (SD_IO_MODEL != SD_IO_RTX_DMA))
+#error "sd_config.h: SD_IO_MODEL must be SD_IO_FSM, SD_IO_RTX_IRQ or SD_IO_RTX_DMA"
+#endif
+#if defined(SD_IO_INIT_TIME) && (SD_IO_MODEL == SD_IO_FSM)
+#error "sd_config.h: SD_IO_INIT_TIME needs the RTX kernel timer of an RTX model"
+#endif
+/*****************************************************************************/
+
+/* Definitions of SD commands */
+#define CMD0    (0x40+0)        /* GO_IDLE_STATE            */
+#define CMD1    (0x40+1)        /* SEND_OP_COND (MMC)       */
+#define ACMD23  (0xC0+23)       /* SET_WR_BLK_ERASE_COUNT   */
+#define ACMD41  (0xC0+41)       /* SEND_OP_COND (SDC)       */
+#define CMD8    (0x40+8)        /* SEND_IF_COND             */
+#define CMD9    (0x40+9)        /* SEND_CSD                 */
+#define CMD12   (0x40+12)       /* STOP_TRANSMISSION        */
+#define CMD13   (0x40+13)       /* SEND_STATUS              */
+#define CMD16   (0x40+16)       /* SET_BLOCKLEN             */
+#define CMD17   (0x40+17)       /* READ_SINGLE_BLOCK        */
+#define CMD18   (0x40+18)       /* READ_MULTIPLE_BLOCK      */
+#define CMD24   (0x40+24)       /* WRITE_SINGLE_BLOCK       */
+#define CMD25   (0x40+25)       /* WRITE_MULTIPLE_BLOCK     */
+#define CMD32   (0x40+32)       /* ERASE_WR_BLK_START       */
+#define CMD33   (0x40+33)       /* ERASE_WR_BLK_END         */
+#define CMD38   (0x40+38)       /* ERASE                    */
+#define CMD42   (0x40+42)       /* LOCK_UNLOCK              */
+#define CMD55   (0x40+55)       /* APP_CMD                  */
+#define CMD58   (0x40+58)       /* READ_OCR                 */
+#define CMD59   (0x40+59)       /* CRC_ON_OFF               */
+
+#define SD_INIT_TRYS    0x03
+
+/* CardType */
+#define SDCT_MMC        0x01                    /* MMC version 3    */
+#define SDCT_SD1        0x02                    /* SD version 1     */
+#define SDCT_SD2        0x04                    /* SD version 2     */
+#define SDCT_SDC        (SDCT_SD1|SDCT_SD2)     /* SD               */
+#define SDCT_BLOCK      0x08                    /* Block addressing */
+
+#define SD_BLK_SIZE     512
+
+/* Results of SD functions */
+typedef enum {
+    SD_OK = 0,      /* 0: Function succeeded    */
+    SD_NOINIT,      /* 1: SD not initialized    */
+    SD_ERROR,       /* 2: Disk error            */
+    SD_PARERR,      /* 3: Invalid parameter     */
+    SD_BUSY,        /* 4: Programming busy      */
+    SD_REJECT,      /* 5: Reject data           */
+    SD_NORESPONSE,  /* 6: No response           */
+    SD_CRCERR       /* 7: Data block CRC error  */
+} SDRESULTS;
+
+typedef struct _DBG_COUNT {
+    WORD read;
+    WORD write;
+    WORD cache_hit;     /* Reads served by SD server sector cache   */
+    WORD cache_miss;
+} DBG_COUNT;
+
+
+/* Card parameters kept across resets in RAM the startup code leaves alone (SD_IO_WARM_RESTART).
+   Section NoInit goes to the UNINIT region of ulibSD.sct. If it is zeroed anyway, 
+   SD_Init just does a full init. */
+#if defined(__CC_ARM)
+#define SD_NOINIT_RAM __attribute__((section("NoInit"), zero_init))
+#else
+#define SD_NOINIT_RAM __attribute__((section(".noinit")))
+#endif
+
+typedef struct _SD_WARM {
+    DWORD magic;        /* SD_WARM_MAGIC when valid                 */
+    BYTE cardtype;
+    BYTE addr_shift;
+    DWORD last_sector;
+    DWORD tran_speed;
+    DWORD spi_hz;
+    DWORD check;        /* Guards against RAM contents after power-up */
+} SD_WARM;
+
+#define SD_WARM_MAGIC   0x5344574DUL    /* "SDWM" */
+
+/* Timing of one data command, times in core cycles (SDS_Cycles) */
+typedef struct _SD_TRACE_REC {
+    DWORD time;         /* Command sent                                  */
+    DWORD arg;
+    BYTE cmd;           /* Command index (17, 18, 24, 25)                */
+    BYTE r1;            /* R1 response                                   */
+    DWORD token;        /* Waiting for read data tokens                  */
+    DWORD data;         /* Data blocks, CRC and data responses           */
+    DWORD busy;         /* Card holding DO low: programming, CMD12 stop  */
+} SD_TRACE_REC;
+
+#ifdef SD_IO_TRACE
+extern SD_TRACE_REC SD_Trace[SD_IO_TRACE_SIZE];
+extern volatile DWORD SD_Trace_Count;   /* Records started, newest is SD_Trace[(SD_Trace_Count-1) % SIZE] */
+#endif
+
+/* Duration of each SD_Init phase in microseconds (last try only, except total) */
+typedef struct _INIT_TIME {
+    DWORD power_up;     /* Power-up delay and dummy clocks  */
+    DWORD idle;         /* CMD0                             */
+    DWORD if_cond;      /* CMD8                             */
+    DWORD op_cond;      /* ACMD41 or CMD1 until ready       */
+    DWORD config;       /* OCR, block length and CSD        */
+    DWORD total;        /* Whole SD_Init, all tries         */
+    WORD op_cond_polls; /* ACMD41 or CMD1 commands sent     */
+    BYTE tries;
+} INIT_TIME;
+
+/* SD device object */
+typedef struct _SD_DEV {
+    BOOL mount;
+    BYTE cardtype;
+    BYTE addr_shift;    /* Sector to command address: 0 block (SDHC/SDXC), 9 byte (SDSC) */
+    DWORD last_sector;
+    BOOL busy_pending;  /* Card may still be programming a deferred write */
+    DWORD tran_speed;   /* Max clock from CSD TRAN_SPEED, Hz */
+    DWORD spi_hz;       /* SPI clock in use after init, Hz */
+    DBG_COUNT debug;
+#ifdef SD_IO_INIT_TIME
+    INIT_TIME init_time;
+#endif
+} SD_DEV;
+
+typedef enum {S0,S1,S2,S3,S4,S5,S6,S7,S8,S9,S10,S11,S12,S13,S14,SD_NUM_STATES} states ;
+
+/* Cost of one FSM state, times in core cycles (SD_IO_STATE_PROF, needs SDS_Cycles) */
+typedef struct _SD_STATE_PROF {
+    DWORD calls;        /* Steps taken in this state                     */
+    DWORD cycles;       /* Total time of those steps                     */
+    DWORD max;          /* Longest step                                  */
+} SD_STATE_PROF;
+
+/* Rows of SD_State_Prof */
+enum {SD_FSM_INIT, SD_FSM_READ, SD_FSM_WRITE, SD_FSM_ERASE, SD_FSM_COUNT};
+
+#ifdef SD_IO_STATE_PROF
+extern SD_STATE_PROF SD_State_Prof[SD_FSM_COUNT][SD_NUM_STATES];  /* [SD_FSM_x][state] */
+#endif
+
+/* One segment of a gathered read: cnt bytes at ofs in the sector go to dest */
+typedef struct _SD_SEG {
+    WORD ofs;
+    WORD cnt;
+    BYTE *dest;
+} SD_SEG;
+
+/* Progress of one SD_Init/SD_Read/SD_Write operation, owned by caller.
+   Start with state = S0 (e.g. zero initialized). Call again with the same
+   context while busy == 1; state returns to S0 when operation is done.
+   Parameters are taken when an operation starts and kept here, later
+   calls only step on (sd_io.c has the state handler tables).
+   In the RTX models each call runs the operation to the end, so busy is 
+   always 0 on return and a caller's repeat loop runs once. */
+typedef struct _SD_CTX {
+    states state;       /* Next state of FSM                        */
+    int busy;           /* 1: operation in progress                 */
+    SDRESULTS res;      /* Result carried across states             */
+    BYTE *pointer;      /* Position in caller's data buffer         */
+    DWORD sector;       /* First sector (SD_Erase: start)           */
+    DWORD end;          /* SD_Erase: last sector                    */
+    WORD blocks;        /* Blocks in the run, 1 for single block    */
+    WORD ofs;           /* SD_Read: byte range kept from the block  */
+    WORD cnt;
+    WORD idx;           /* Byte index in block, R7/OCR byte index   */
+    WORD block_num;     /* Block index in multi-block run           */
+    WORD crc;           /* CRC16 computed over data block           */
+    WORD crc_rx;        /* CRC16 received after read data block     */
+    BYTE tkn;           /* Data token                               */
+    BYTE data;          /* Last byte received (data or busy line)   */
+    BYTE tries;         /* SD_Init: attempts so far                 */
+    BYTE ct;            /* SD_Init: detected card type              */
+    BYTE cmd;           /* SD_Init: ACMD41 or CMD1                  */
+    BYTE ocr[4];        /* SD_Init: R7/OCR response                 */
+    const SD_SEG *segs; /* SD_Read_Gather: segment list, else 0     */
+    BYTE nsegs;         /* SD_Read_Gather: number of segments       */
+    BYTE seg;           /* SD_Read_Gather: segment being filled     */
+    WORD idle_ms;       /* SD_Init: card needs no clocks for this long, caller may sleep before next call */
+    WORD backoff_ms;    /* SD_Init: next pause between ACMD41 polls */
+#ifdef SD_IO_INIT_TIME
+    DWORD t_init;       /* SD_Init: kernel timer at start           */
+    DWORD t_phase;      /* SD_Init: kernel timer at phase start     */
+#endif
+#ifdef SD_IO_TRACE
+    SD_TRACE_REC *trace;/* Record of command in progress            */
+    DWORD t_mark;       /* End of last traced phase                 */
+#endif
+} SD_CTX;
+/*******************************************************************************
+ * Public Methods - Direct work with SD card                                   *
+ ******************************************************************************/
+
+/**
+    \brief Initialization the SD card.
+    \return If all goes well returns SD_OK.
+ */
+SDRESULTS SD_Init (SD_DEV *dev, SD_CTX *ctx);
+
+/**
+    \brief Read a single block.
+    \param dest Pointer to the destination object to put data
+    \param sector Start sector number (internally is converted to byte address).
+    \param ofs Byte offset in the sector (0..511).
+    \param cnt Byte count (1..512).
+    \return If all goes well returns SD_OK.
+ */
+SDRESULTS SD_Read (SD_DEV *dev, SD_CTX *ctx, void *dat, DWORD sector, WORD ofs, WORD cnt);
+
+/**
+    \brief Read several byte ranges of a single block in one pass.
+    \param segs Segments in ascending, non-overlapping ofs order, each within
+    the sector. The list must stay valid until the read is done.
+    \param nsegs Number of segments (1..255).
+    \param sector Sector number (internally is converted to byte address).
+    \return If all goes well returns SD_OK.
+ */
+SDRESULTS SD_Read_Gather (SD_DEV *dev, SD_CTX *ctx, const SD_SEG *segs, BYTE nsegs, DWORD sector);
+
+/**
+    \brief Read consecutive blocks with one CMD18/CMD12 transaction.
+    \param dat Pointer to the destination object (count * 512 bytes).
+    \param sector Start sector number (internally is converted to byte address).
+    \param count Number of sectors to read (1..n).
+    \return If all goes well returns SD_OK.
+ */
+SDRESULTS SD_Read_Multi (SD_DEV *dev, SD_CTX *ctx, void *dat, DWORD sector, WORD count);
+
+/**
+    \brief Write a single block.
+    \param dat Data to write.
+    \param sector Sector number to write (internally is converted to byte address).
+    \return If all goes well returns SD_OK.
+ */
+SDRESULTS SD_Write (SD_DEV *dev, SD_CTX *ctx, void *dat, DWORD sector);
+
+/**
+    \brief Write consecutive blocks with one CMD25 transaction.
+    \param dat Data to write (count * 512 bytes).
+    \param sector Start sector number (internally is converted to byte address).
+    \param count Number of sectors to write (1..n).
+    \return If all goes well returns SD_OK.
+ */
+SDRESULTS SD_Write_Multi (SD_DEV *dev, SD_CTX *ctx, void *dat, DWORD sector, WORD count);
+
+/**
+    \brief Erase sectors start..end with CMD32/CMD33/CMD38 (SD cards only).
+    Erased sectors read as all 0x00 or all 0xFF, depending on the card.
+    Later writes into the range need no internal erase, so they program faster.
+    \param start First sector to erase.
+    \param end Last sector to erase (start..last_sector).
+    \return If all goes well returns SD_OK, SD_BUSY if the card is still busy at timeout.
+ */
+SDRESULTS SD_Erase (SD_DEV *dev, SD_CTX *ctx, DWORD start, DWORD end);
+
+/**
+    \brief Allows know status of SD card.
+    \return If all goes well returns SD_OK.
+*/
+SDRESULTS SD_Status (SD_DEV *dev);
+
+#endif
+
+// «sd_io.h» is part of:
+/*----------------------------------------------------------------------------/
+/  ulibSD - Library for SD cards semantics            (C)Nelson Lombardo, 2015
+/-----------------------------------------------------------------------------/
+/ ulibSD library is a free software that opened under license policy of
+/ following conditions.
+/
+/ Copyright (C) 2015, ChaN, all right reserved.
+/
+/ 1. Redistributions of source code must retain the above copyright notice,
+/    this condition and the following disclaimer.
+/
+/ This software is provided by the copyright holder and contributors "AS IS"
+/ and any warranties related to this software are DISCLAIMED.
+/ The copyright owner or contributors be NOT LIABLE for any damages caused
+/ by use of this software.
+/----------------------------------------------------------------------------*/
+
+// Derived from Mister Chan works on FatFs code (http://elm-chan.org/fsw/ff/00index_e.html):
+/*----------------------------------------------------------------------------/
+/  FatFs - FAT file system module  R0.11                 (C)ChaN, 2015
+/-----------------------------------------------------------------------------/
+/ FatFs module is a free software that opened under license policy of
+/ following conditions.
+/
+/ Copyright (C) 2015, ChaN, all right reserved.
+/
+/ 1. Redistributions of source code must retain the above copyright notice,
+/    this condition and the following disclaimer.
+/
+/ This software is provided by the copyright holder and contributors "AS IS"
+/ and any warranties related to this software are DISCLAIMED.
+/ The copyright owner or contributors be NOT LIABLE for any damages caused
+/ by use of this software.
+/----------------------------------------------------------------------------*/
@@ -0,0 +1,462 @@
+/*
+ *  File: spi_io.c.example
+ *  Author: Nelson Lombardo
+ *  Year: 2015
+ *  e-mail: nelson.lombardo@gmail.com
+ *  License at the end of file.
+ */
+ // Modified 2017 by Alex Dean (agdean@ncsu.edu) for teaching FSMs
+
+
+#include "spi_io.h"
+#include <MKL25Z4.h>
+#include <stddef.h>
+#include "debug.h"
+#if (SD_IO_MODEL != SD_IO_FSM) || (SPI_TIMER == SPI_TIMER_RTX)
+#include <cmsis_os2.h>
+#endif
+#if SPI_TIMER == SPI_TIMER_TIMEOUT
+#include "timeout.h"
+#endif
+#if (SPI_BLOCK == SPI_BLOCK_DMA) && (SPI_DMA_CH == SPI_DMA_SERVICE)
+#include "DMA.h"
+#endif
+
+#ifndef RAM_CODE
+#define RAM_CODE    // sd_config.h may put SPI_RW in RAM
+#endif
+
+#if SPI_BLOCK == SPI_BLOCK_DMA
+#if SPI_DMA_CH == SPI_DMA_SERVICE
+// DMA service channels of the data phase, -1 if none were free (polled data phase)
+static int8_t SPI_Rx_Ch = -1, SPI_Tx_Ch = -1;
+#else
+#define SPI_Rx_Ch (0)
+#define SPI_Tx_Ch (1)
+#endif
+#elif SPI_BLOCK == SPI_BLOCK_IRQ
+// Block transfer in progress, driven by SPI1_IRQHandler
+static BYTE * SPI_Rx_Ptr;
+static const BYTE * SPI_Tx_Ptr;
+static volatile WORD SPI_Count;       // Bytes left to receive
+#endif
+
+#ifdef SPI_BLOCK
+static volatile BOOL SPI_Busy = FALSE;  // Data phase started and not done
+#if SD_IO_MODEL != SD_IO_FSM
+static osThreadId_t SPI_Waiting_TID;    // Thread that started it
+#endif
+static void SPI_Block_Stop (void);
+#endif
+#if (SPI_BLOCK == SPI_BLOCK_DMA) && (SPI_DMA_CH == SPI_DMA_SERVICE) && (SD_IO_MODEL != SD_IO_FSM)
+static void SPI_DMA_Rx_Done (uint8_t ch, uint32_t dsr);
+#endif
+
+/******************************************************************************
+ Module Public Functions - Low level SPI control functions
+******************************************************************************/
+
+void SPI_Init (void) {
+
+    SIM->SCGC5 |= SIM_SCGC5_PORTE_MASK;
+    /*
+     *SPI1 Clock gate control. 1 clock enabled
+     */
+    SIM->SCGC4 |= SIM_SCGC4_SPI1_MASK;
+    /*
+     * Multiplexing pines
+     */
+    PORTE->PCR[4] = PORT_PCR_MUX(1) | PORT_PCR_DSE_MASK & (~PORT_PCR_SRE_MASK); 	//CS
+    PTE->PDDR |= 1 << 4; // Pin is configured as general-purpose output, for the GPIO function.
+
+    PORTE->PCR[2] = PORT_PCR_MUX(2) | PORT_PCR_DSE_MASK & (~PORT_PCR_SRE_MASK); 	// SCK
+    PORTE->PCR[1] = PORT_PCR_MUX(2) | PORT_PCR_DSE_MASK & (~PORT_PCR_SRE_MASK); 	// MOSI
+    PORTE->PCR[3] = PORT_PCR_MUX(2) | PORT_PCR_PE_MASK  | PORT_PCR_PS_MASK;			// MISO
+
+    /*
+     * Bit 7 SPIE   = 0 Disables receive and mode fault interrupts
+     * Bit 6 SPE    = 1 Enables the SPI system
+     * Bit 5 SPTIE  = 0 Disables SPI transmit interrupts
+     * Bit 4 MSTR   = 1 Sets the SPI module as a master SPI device
+     * Bit 3 CPOL   = 0 Configures SPI clock as active-high
+     * Bit 2 CPHA   = 0 First edge on SPSCK at start of first data transfer cycle
+     * Bit 1 SSOE   = 1 Determines SS pin function when mode fault enabled
+     * Bit 0 LSBFE  = 0 SPI serial data transfers start with most significant bit
+     */
+    SPI1->C1 = 0x50;
+    /*
+     * Bit 7 PMIE       = 0 SPI hardware match interrupt disabled
+     * Bit 6            = 0 Unimplemented
+     * Bit 5 TXDMAE     = 0 DMA request disabled
+     * Bit 4 MODFEN     = 1 In master mode, ~SS pin function is automatic ~SS output
+     * Bit 3 BIDIROE    = 0 SPI data I/O pin acts as input
+     * Bit 2 RXDMAE     = 0 DMA request disabled
+     * Bit 1 SPISWAI    = 0 SPI clocks operate in wait mode
+     * Bit 0 SPC0       = 0 uses separate pins for data input and output
+     */
+    SPI1->C2 = 0x00;
+
+    /*
+     * Bit 7    SPRF    = 0 Flag is set when receive data buffer is full
+     * Bit 6    SPMF    = 0 Flag is set when SPIx_M = receive data buffer
+     * Bit 5    SPTEF   = 0 Flag is set when transmit data buffer is empty
+     * Bit 4    MODF    = 0 Mode fault flag for master mode
+     * Bit 3:0          = 0 Reserved
+     */
+    SPI1->S = 0x00;
+
+#ifdef SPI_BLOCK
+    SPI_Busy = FALSE;
+#endif
+#if (SPI_BLOCK == SPI_BLOCK_DMA) && (SPI_DMA_CH == SPI_DMA_SERVICE)
+    // Both or neither: the data phase needs a receive and a transmit channel
+    if (SPI_Rx_Ch < 0) {
+#if SD_IO_MODEL == SD_IO_FSM
+        SPI_Rx_Ch = DMA_Alloc(DMA_PRIO_LOW, "SD SPI Rx", NULL, 0);
+#else
+        SPI_Rx_Ch = DMA_Alloc(DMA_PRIO_LOW, "SD SPI Rx", SPI_DMA_Rx_Done, SPI_IRQ_PRIO << 6);
+#endif
+        SPI_Tx_Ch = DMA_Alloc(DMA_PRIO_LOW, "SD SPI Tx", NULL, 0);
+        if ((SPI_Rx_Ch < 0) || (SPI_Tx_Ch < 0)) {
+            if (SPI_Rx_Ch >= 0)
+                DMA_Free(SPI_Rx_Ch);
+            if (SPI_Tx_Ch >= 0)
+                DMA_Free(SPI_Tx_Ch);
+            SPI_Rx_Ch = SPI_Tx_Ch = -1;
+        }
+    }
+#elif (SPI_BLOCK == SPI_BLOCK_DMA) && (SD_IO_MODEL != SD_IO_FSM)
+    NVIC_SetPriority(DMA0_IRQn, SPI_IRQ_PRIO);
+    NVIC_ClearPendingIRQ(DMA0_IRQn);
+    NVIC_EnableIRQ(DMA0_IRQn);
+#elif SPI_BLOCK == SPI_BLOCK_IRQ
+    NVIC_SetPriority(SPI1_IRQn, SPI_IRQ_PRIO);
+    NVIC_ClearPendingIRQ(SPI1_IRQn);
+    NVIC_EnableIRQ(SPI1_IRQn);
+#endif
+}
+
+RAM_CODE BYTE SPI_RW (BYTE d) {
+    while(!(SPI1->S & SPI_S_SPTEF_MASK))
+			;
+    SPI1->D = d;
+    while(!(SPI1->S & SPI_S_SPRF_MASK))
+			;
+    return((BYTE)(SPI1->D));
+}
+
+void SPI_Release (void) {
+    WORD idx;
+    for (idx=512; idx && (SPI_RW(0xFF)!=0xFF); idx--);
+}
+
+inline void SPI_CS_Low (void) {
+    PTE->PDOR &= ~(1 << 4); //CS LOW
+}
+
+inline void SPI_CS_High (void){
+    PTE->PDOR |= (1 << 4); //CS HIGH
+}
+
+static BYTE SPI_BR_High = 0x01;    // Until SPI_Freq_Limit is called
+
+static DWORD SPI_BR_Rate (BYTE br) {
+    return(SPI_BUS_CLOCK / ((((br >> 4) & 0x07) + 1) * (2UL << (br & 0x0F))));
+}
+
+// Fastest setting at or under hz, but above 'below' (0 = no lower bound)
+static BYTE SPI_BR_Best (DWORD hz, DWORD below) {
+    BYTE sppr, spr, br, best = 0x78;    // Slowest: /8 /512
+    DWORD rate;
+    for (spr = 0; spr <= 8; spr++) {
+        for (sppr = 0; sppr <= 7; sppr++) {
+            br = (sppr << 4) | spr;
+            rate = SPI_BR_Rate(br);
+            if ((rate <= hz) && (rate > below) && (rate > SPI_BR_Rate(best)))
+                best = br;
+        }
+    }
+    return(best);
+}
+
+inline void SPI_Freq_High (void) {
+		SPI1->BR = SPI_BR_High;
+}
+
+DWORD SPI_Freq_Limit (DWORD hz) {
+    SPI_BR_High = SPI_BR_Best(hz, 0);
+    return(SPI_BR_Rate(SPI_BR_High));
+}
+
+DWORD SPI_Freq_Step_Down (void) {
+    DWORD rate = SPI_BR_Rate(SPI_BR_High);
+    if (rate > SPI_FREQ_FLOOR) {
+        SPI_BR_High = SPI_BR_Best(rate - 1, SPI_FREQ_FLOOR - 1);
+        SPI1->BR = SPI_BR_High;
+        rate = SPI_BR_Rate(SPI_BR_High);
+    }
+    return(rate);
+}
+
+inline void SPI_Freq_Low (void) {
+    SPI1->BR = 0x44; // 48MHz / 160 = 300kHz
+}
+
+#if SPI_TIMER == SPI_TIMER_TIMEOUT
+// Timeout handle of the SD command/data waits, from the shared timeout service
+static TMO_ID SPI_Tmo = TMO_NONE;
+
+void SPI_Timer_On (WORD ms) {
+    if (SPI_Tmo == TMO_NONE)
+        SPI_Tmo = Timeout_Alloc();
+    Timeout_Start(SPI_Tmo, ms);
+}
+
+// Like the LPTMR flag it replaces, only an expiry reads as FALSE: a stopped timer doesn't time out
+inline BOOL SPI_Timer_Status (void) {
+    return ((Timeout_State(SPI_Tmo) != TMO_EXPIRED) ? TRUE : FALSE);
+}
+
+inline void SPI_Timer_Off (void) {
+    Timeout_Stop(SPI_Tmo);
+}
+#elif SPI_TIMER == SPI_TIMER_RTX
+// SD command/data waits run on the RTX kernel tick (1 ms) instead of LPTMR0
+static uint32_t SPI_Tmo_Start, SPI_Tmo_Ticks;
+static BOOL SPI_Tmo_Running = FALSE;
+
+void SPI_Timer_On (WORD ms) {
+    SPI_Tmo_Ticks = (ms*osKernelGetTickFreq() + 999)/1000;
+    SPI_Tmo_Start = osKernelGetTickCount();
+    SPI_Tmo_Running = TRUE;
+}
+
+// Only an expiry reads as FALSE: a stopped timer doesn't time out
+BOOL SPI_Timer_Status (void) {
+    if (SPI_Tmo_Running && (osKernelGetTickCount() - SPI_Tmo_Start > SPI_Tmo_Ticks))
+        return FALSE;
+    return TRUE;
+}
+
+inline void SPI_Timer_Off (void) {
+    SPI_Tmo_Running = FALSE;
+}
+#else
+void SPI_Timer_On (WORD ms) {
+    SIM->SCGC5 |= SIM_SCGC5_LPTMR_MASK; // Make sure clock is enabled
+    LPTMR0->CSR = 0;                    // Reset LPTMR settings
+    LPTMR0->CMR = ms;                   // Set compare value (in ms)
+    // Use 1kHz LPO with no prescaler
+    LPTMR0->PSR = LPTMR_PSR_PCS(1) | LPTMR_PSR_PBYP_MASK;
+    // Start the timer and wait for it to reach the compare value
+    LPTMR0->CSR = LPTMR_CSR_TEN_MASK;
+}
+
+inline BOOL SPI_Timer_Status (void) {
+    return (!(LPTMR0->CSR & LPTMR_CSR_TCF_MASK) ? TRUE : FALSE);
+}
+
+inline void SPI_Timer_Off (void) {
+    LPTMR0->CSR = 0;                    // Turn off timer
+}
+#endif
+
+#if SPI_BLOCK == SPI_BLOCK_DMA
+/*
+ * DMA data phase. The receive channel moves SPI1_D to memory on SPRF
+ * (DMAMUX source 18), the transmit channel feeds SPI1_D on SPTEF (source
+ * 19). Completion is taken from the receive channel, since its last byte
+ * arrives last. With SPI_DMA_SERVICE both are low priority channels from
+ * the DMA service, so audio playback is never held off by the card. In
+ * the RTX models the receive channel's interrupt wakes the thread.
+ */
+static const BYTE SPI_DMA_Dummy_Tx = 0xFF;
+static BYTE SPI_DMA_Dummy_Rx;
+
+BOOL SPI_Block_Start (BYTE *rx, const BYTE *tx, WORD len) {
+#if SPI_DMA_CH == SPI_DMA_SERVICE
+    if (SPI_Rx_Ch < 0)
+        return FALSE;
+#endif
+#if SD_IO_MODEL != SD_IO_FSM
+    SPI_Waiting_TID = osThreadGetId();
+    osThreadFlagsClear(SPI_FLAG_BLOCK_DONE);
+#endif
+    SPI_Busy = TRUE;
+    SIM->SCGC7 |= SIM_SCGC7_DMA_MASK;
+    SIM->SCGC6 |= SIM_SCGC6_DMAMUX_MASK;
+
+    // Disable DMA channels in order to allow changes
+    DMAMUX0->CHCFG[SPI_Rx_Ch] = 0;
+    DMAMUX0->CHCFG[SPI_Tx_Ch] = 0;
+    // Clear done flags and errors from previous transfer
+    DMA0->DMA[SPI_Rx_Ch].DSR_BCR = DMA_DSR_BCR_DONE_MASK;
+    DMA0->DMA[SPI_Tx_Ch].DSR_BCR = DMA_DSR_BCR_DONE_MASK;
+
+    // Receive: SPI1_D -> rx (or dummy), bytes, cycle steal
+    DMA0->DMA[SPI_Rx_Ch].SAR = DMA_SAR_SAR((uint32_t) &SPI1->D);
+    DMA0->DMA[SPI_Rx_Ch].DAR = DMA_DAR_DAR((uint32_t) (rx ? rx : &SPI_DMA_Dummy_Rx));
+    DMA0->DMA[SPI_Rx_Ch].DSR_BCR = DMA_DSR_BCR_BCR(len);
+    DMA0->DMA[SPI_Rx_Ch].DCR = DMA_DCR_ERQ_MASK | DMA_DCR_CS_MASK | DMA_DCR_D_REQ_MASK |
+                        DMA_DCR_SSIZE(1) | DMA_DCR_DSIZE(1) |
+#if SD_IO_MODEL != SD_IO_FSM
+                        DMA_DCR_EINT_MASK |
+#endif
+                        (rx ? DMA_DCR_DINC_MASK : 0);
+    // Transmit: tx (or 0xFF) -> SPI1_D
+    DMA0->DMA[SPI_Tx_Ch].SAR = DMA_SAR_SAR((uint32_t) (tx ? tx : &SPI_DMA_Dummy_Tx));
+    DMA0->DMA[SPI_Tx_Ch].DAR = DMA_DAR_DAR((uint32_t) &SPI1->D);
+    DMA0->DMA[SPI_Tx_Ch].DSR_BCR = DMA_DSR_BCR_BCR(len);
+    DMA0->DMA[SPI_Tx_Ch].DCR = DMA_DCR_ERQ_MASK | DMA_DCR_CS_MASK | DMA_DCR_D_REQ_MASK |
+                        DMA_DCR_SSIZE(1) | DMA_DCR_DSIZE(1) |
+                        (tx ? DMA_DCR_SINC_MASK : 0);
+
+    DMAMUX0->CHCFG[SPI_Rx_Ch] = DMAMUX_CHCFG_SOURCE(18) | DMAMUX_CHCFG_ENBL_MASK;
+    DMAMUX0->CHCFG[SPI_Tx_Ch] = DMAMUX_CHCFG_SOURCE(19) | DMAMUX_CHCFG_ENBL_MASK;
+
+    // RXDMAE first so no received byte is missed, then TXDMAE starts transfer
+    SPI1->C2 |= SPI_C2_RXDMAE_MASK;
+    SPI1->C2 |= SPI_C2_TXDMAE_MASK;
+    return TRUE;
+}
+
+// Return SPI1 to polled operation
+static void SPI_Block_Stop (void) {
+    SPI1->C2 &= ~(SPI_C2_TXDMAE_MASK | SPI_C2_RXDMAE_MASK);
+    DMAMUX0->CHCFG[SPI_Rx_Ch] = 0;
+    DMAMUX0->CHCFG[SPI_Tx_Ch] = 0;
+    SPI_Busy = FALSE;
+}
+
+BOOL SPI_Block_Status (void) {
+#if SD_IO_MODEL == SD_IO_FSM
+    // No interrupt: polling finds the end
+    if (SPI_Busy && (DMA0->DMA[SPI_Rx_Ch].DSR_BCR & DMA_DSR_BCR_DONE_MASK))
+        SPI_Block_Stop();
+#endif
+    return SPI_Busy;
+}
+
+#if SD_IO_MODEL != SD_IO_FSM
+#if SPI_DMA_CH == SPI_DMA_SERVICE
+// Called by the DMA service's ISR, which has already cleared DONE
+static void SPI_DMA_Rx_Done (uint8_t ch, uint32_t dsr) {
+    SPI_Block_Stop();
+    osThreadFlagsSet(SPI_Waiting_TID, SPI_FLAG_BLOCK_DONE);
+}
+#else
+void DMA0_IRQHandler (void) {
+    DMA0->DMA[SPI_Rx_Ch].DSR_BCR = DMA_DSR_BCR_DONE_MASK;
+    SPI_Block_Stop();
+    osThreadFlagsSet(SPI_Waiting_TID, SPI_FLAG_BLOCK_DONE);
+}
+#endif
+#endif
+
+#elif SPI_BLOCK == SPI_BLOCK_IRQ
+/*
+ * Interrupt data phase. SPI1_IRQHandler takes each byte on SPRF and sends
+ * the next, so the CPU is only busy for the ISR itself.
+ */
+BOOL SPI_Block_Start (BYTE *rx, const BYTE *tx, WORD len) {
+    SPI_Rx_Ptr = rx;
+    SPI_Tx_Ptr = tx;
+    SPI_Count = len;
+#if SD_IO_MODEL != SD_IO_FSM
+    SPI_Waiting_TID = osThreadGetId();
+    osThreadFlagsClear(SPI_FLAG_BLOCK_DONE);
+#endif
+    SPI_Busy = TRUE;
+
+    while(!(SPI1->S & SPI_S_SPTEF_MASK))
+        ;
+    // Discard stale received byte so the ISR does not fire early
+    if (SPI1->S & SPI_S_SPRF_MASK)
+        (void) SPI1->D;
+    SPI1->C1 |= SPI_C1_SPIE_MASK;
+    SPI1->D = tx ? *SPI_Tx_Ptr++ : 0xFF;	// ISR sends the rest
+    return TRUE;
+}
+
+static void SPI_Block_Stop (void) {
+    SPI1->C1 &= ~SPI_C1_SPIE_MASK;
+    SPI_Busy = FALSE;
+}
+
+BOOL SPI_Block_Status (void) {
+    return SPI_Busy;
+}
+
+void SPI1_IRQHandler (void) {
+    BYTE data;
+
+    if (SPI1->S & SPI_S_SPRF_MASK) {
+        // Reading D after S clears SPRF
+        data = (BYTE)(SPI1->D);
+        if (SPI_Rx_Ptr)
+            *SPI_Rx_Ptr++ = data;
+        if (--SPI_Count > 0) {
+            SPI1->D = SPI_Tx_Ptr ? *SPI_Tx_Ptr++ : 0xFF;
+        } else {
+            // Whole block done: one kernel call per block
+            SPI_Block_Stop();
+#if SD_IO_MODEL != SD_IO_FSM
+            osThreadFlagsSet(SPI_Waiting_TID, SPI_FLAG_BLOCK_DONE);
+#endif
+        }
+    }
+}
+#endif
+
+#if defined(SPI_BLOCK) && (SD_IO_MODEL != SD_IO_FSM)
+BOOL SPI_Block_Wait (WORD ms) {
+    uint32_t flags;
+
+    if (!SPI_Busy)
+        return TRUE;
+    flags = osThreadFlagsWait(SPI_FLAG_BLOCK_DONE, osFlagsWaitAny, (ms*osKernelGetTickFreq() + 999)/1000 + 1);
+    if (!(flags & osFlagsError) || !SPI_Busy)
+        return TRUE;
+    SPI_Block_Stop();
+    return FALSE;
+}
+#endif
+
+#ifdef SPI_DEBUG_OSC
+inline void SPI_Debug_Init(void)
+{
+    SIM->SCGC5 |= SIM_SCGC5_PORTA_MASK; // Port A enable
+    PORTA->PCR[12] = PORT_PCR_MUX(1) | PORT_PCR_PE_MASK  | PORT_PCR_PS_MASK;
+    PTA->PDDR |= (1 << 12); // Pin is configured as general-purpose output, for the GPIO function.
+    PTA->PDOR &= ~(1 << 12); // Off
+}
+inline void SPI_Debug_Mark(void)
+{
+    PTA->PDOR |= (1 << 12); // On
+    PTA->PDOR &= ~(1 << 12); // Off
+}
+#endif
+
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Nelson Lombardo
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
@@ -0,0 +1,174 @@
+/*
+ *  spi_io.h
+ *  Author: Nelson Lombardo (C) 2015
+ *  e-mail: nelson.lombardo@gmail.com
+ *  License at the end of file.
+ */
+ // Modified 2017 by Alex Dean (agdean@ncsu.edu) for teaching FSMs
+
+#ifndef _SPI_IO_H_
+#define _SPI_IO_H_
+
+#include "integer.h"        /* Type redefinition for portability */
+
+/******************************************************************************
+ Build variants, picked by the project's sd_config.h
+ *****************************************************************************/
+
+/* SD_IO_MODEL: how sd_io.c runs an operation */
+#define SD_IO_FSM           0   /* Cooperative: one step per call, caller repeats while ctx->busy */
+#define SD_IO_RTX_IRQ       1   /* Call blocks in an RTX thread, SPI1 interrupt moves data blocks */
+#define SD_IO_RTX_DMA       2   /* Call blocks in an RTX thread, DMA moves data blocks */
+
+/* SPI_TIMER: time base of SPI_Timer_On/Status/Off */
+#define SPI_TIMER_TIMEOUT   0   /* Own handle from the timeout service (timeout.h) */
+#define SPI_TIMER_RTX       1   /* RTX kernel tick */
+#define SPI_TIMER_LPTMR     2   /* LPTMR0 compare from the 1 kHz LPO */
+
+/* SPI_DMA_CH: channels of a DMA data phase */
+#define SPI_DMA_FIXED       0   /* DMA0 channels 0 (receive) and 1 (transmit) */
+#define SPI_DMA_SERVICE     1   /* Two low priority channels from the DMA service (DMA.h) */
+
+#include "sd_config.h"
+
+/* Data phase engine behind SPI_Block_*, undefined if blocks go through SPI_RW */
+#define SPI_BLOCK_DMA       1
+#define SPI_BLOCK_IRQ       2
+#if SD_IO_MODEL == SD_IO_RTX_IRQ
+#define SPI_BLOCK SPI_BLOCK_IRQ
+#elif (SD_IO_MODEL == SD_IO_RTX_DMA) || defined(SD_IO_USE_DMA)
+#define SPI_BLOCK SPI_BLOCK_DMA
+#endif
+
+#ifndef SPI_IRQ_PRIO
+#define SPI_IRQ_PRIO        2   /* NVIC priority of the data phase interrupt (RTX models) */
+#endif
+
+
+/******************************************************************************
+ Public methods
+ *****************************************************************************/
+
+/**
+    \brief Initialize SPI hardware
+ */
+void SPI_Init (void);
+
+/**
+    \brief Read/Write a single byte.
+    \param d Byte to send.
+    \return Byte that arrived.
+ */
+BYTE SPI_RW (BYTE d);
+
+/**
+    \brief Flush of SPI buffer.
+ */
+void SPI_Release (void);
+
+/**
+    \brief Selecting function in SPI terms, associated with SPI module.
+ */
+void SPI_CS_Low (void);
+
+/**
+    \brief Deselecting function in SPI terms, associated with SPI module.
+ */
+void SPI_CS_High (void);
+
+/**
+    \brief Setting frequency of SPI's clock to maximun possible.
+ */
+void SPI_Freq_High (void);
+
+/**
+    \brief Setting frequency of SPI's clock equal or lower than 400kHz.
+ */
+void SPI_Freq_Low (void);
+
+/* SPI1 baud rate = SPI_BUS_CLOCK / ((SPPR+1) * 2^(SPR+1)) */
+#define SPI_BUS_CLOCK   24000000UL
+#define SPI_FREQ_FLOOR  400000UL    /* Step down never goes below this */
+
+/**
+    \brief Pick the fastest prescaler/divider pair at or under hz for SPI_Freq_High.
+    \param hz Highest clock the card supports.
+    \return Resulting SPI clock in Hz.
+ */
+DWORD SPI_Freq_Limit (DWORD hz);
+
+/**
+    \brief Lower the SPI_Freq_High clock to the next slower setting.
+    \return Resulting SPI clock in Hz (unchanged at SPI_FREQ_FLOOR).
+ */
+DWORD SPI_Freq_Step_Down (void);
+
+/**
+    \brief Start a non-blocking timer (SPI_TIMER time base).
+    \param ms Milliseconds.
+ */
+void SPI_Timer_On (WORD ms);
+
+/**
+    \brief Check the status of non-blocking timer.
+    \return Status, TRUE if timeout is not reach yet.
+ */
+BOOL SPI_Timer_Status (void);
+
+/**
+    \brief Stop of non-blocking timer. Mandatory.
+ */
+void SPI_Timer_Off (void);
+
+/**
+    \brief Start a data phase of len bytes on SPI1, moved by the SPI_BLOCK engine.
+    \param rx Destination of received bytes, or 0 to discard them.
+    \param tx Source of bytes to send, or 0 to send 0xFF.
+    \param len Byte count (1..512).
+    \return TRUE if started, FALSE if SPI_Init got no DMA channels (use polled transfers).
+ */
+BOOL SPI_Block_Start (BYTE *rx, const BYTE *tx, WORD len);
+
+/**
+    \brief Check the status of the data phase.
+    \return Status, TRUE if transfer is not done yet.
+ */
+BOOL SPI_Block_Status (void);
+
+#if SD_IO_MODEL != SD_IO_FSM
+/* Thread flag reserved for the data phase, set by its interrupt for the thread that started it */
+#define SPI_FLAG_BLOCK_DONE (1UL << 30)
+
+/**
+    \brief Sleep until the data phase started by this thread is done.
+    \param ms Give up after this long and stop the transfer.
+    \return TRUE if all bytes were transferred before the timeout.
+ */
+BOOL SPI_Block_Wait (WORD ms);
+#endif
+
+#endif
+
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Nelson Lombardo
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
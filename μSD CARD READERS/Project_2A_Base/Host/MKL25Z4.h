@@ -0,0 +1,53 @@
+/*
+ * Host stand-in for the KL25Z device header, just enough for the SD driver,
+ * SD server, scheduler and tasks. Registers are plain variables and core 
+ * intrinsics advance simulated time (spi_io_sim.c).
+ */
+#ifndef HOST_MKL25Z4_H
+#define HOST_MKL25Z4_H
+#include <stdint.h>
+
+typedef struct {
+	volatile uint32_t PDOR, PSOR, PCOR, PTOR, PDIR, PDDR;
+} GPIO_Type;
+
+typedef struct {
+	volatile uint32_t CTRL, LOAD, VAL, CALIB;
+} SysTick_Type;
+
+typedef struct {
+	volatile uint32_t CPUID, ICSR;
+} SCB_Type;
+#define SCB_ICSR_PENDSTSET_Msk (1UL << 26)
+
+extern GPIO_Type Sim_GPIO[5];
+#define PTA (&Sim_GPIO[0])
+#define PTB (&Sim_GPIO[1])
+#define PTC (&Sim_GPIO[2])
+#define PTD (&Sim_GPIO[3])
+#define PTE (&Sim_GPIO[4])
+
+extern SysTick_Type Sim_SysTick;
+#define SysTick (&Sim_SysTick)
+extern SCB_Type Sim_SCB;
+#define SCB (&Sim_SCB)              // ICSR PENDSTSET: SysTick pending, masked
+
+extern uint32_t SystemCoreClock;
+uint32_t SysTick_Config(uint32_t ticks);
+void SysTick_Handler(void);
+
+typedef enum {SPI1_IRQn = 11, LPTMR0_IRQn = 28} IRQn_Type;
+#define NVIC_SetPriority(irq, prio)  ((void) 0)
+#define NVIC_ClearPendingIRQ(irq)    ((void) 0)
+#define NVIC_EnableIRQ(irq)          ((void) 0)
+#define NVIC_DisableIRQ(irq)         ((void) 0)
+
+void __disable_irq(void);
+void __enable_irq(void);
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+void __WFI(void);
+// Semihosting as the debugger would serve it, SYS_WRITE0 to stdout (host_main.c)
+int __semihost(int op, const void * arg);
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Host build of the SD driver, SD server, scheduler and tasks against the 
+ * simulated card of spi_io_sim.c. Runs the target's main for a given amount 
+ * of simulated time, then prints card, scheduler and benchmark statistics.
+ *
+ * Build from Project_2A_Base (USE_WFI_IDLE=1: makework would never advance 
+ * simulated time):
+ *   gcc -O2 -fgnu89-inline -IHost -ISource -I../../ulibSD -DUSE_WFI_IDLE=1 
+ *     -DUSE_SD_BENCH=1 -Dmain=Target_Main Host/host_main.c Host/spi_io_sim.c 
+ *     Source/main.c Source/SD_Server.c ../../ulibSD/sd_io.c ../../ulibSD/sd_crc.c 
+ *     Source/sd_cache.c Source/scheduler.c Source/sd_bench.c Source/load_gen.c 
+ *     Source/perf_run.c -o sd_sim
+ * (-DUSE_PERF_RUN=1 in place of -DUSE_SD_BENCH=1 also prints the perf record, 
+ * for Scripts/perf_compare.py at the top of the repo; -DSD_IO_STATE_PROF adds the time of each driver state)
+ * Run:
+ *   ./sd_sim [profile] [simulated ms]      profiles: fast (default), slow, stall
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <MKL25Z4.h>
+#include "sd_sim.h"
+#include "sd_bench.h"
+#include "sd_io.h"
+#include "scheduler.h"
+#include "LEDs.h"
+#include "debug.h"
+
+#undef main
+
+extern int Target_Main(void);
+extern volatile SCHED_STATS_T Sched_Stats;
+
+static unsigned int LED_Color = 0; // Last RGB code set by the tasks
+
+void Init_RGB_LEDs(void) {
+}
+
+void Control_RGB_LEDs(unsigned int red_on, unsigned int green_on, unsigned int blue_on) {
+	LED_Color = (red_on ? CODE_RED : 0) | (green_on ? CODE_GREEN : 0) | (blue_on ? CODE_BLUE : 0);
+}
+
+void Init_Debug_Signals(void) {
+}
+
+int __semihost(int op, const void * arg) {
+	if (op == 0x04) // SYS_WRITE0
+		fputs((const char *) arg, stdout);
+	return 0;
+}
+
+static void Print_Bench_Stats(const char * name, volatile SD_BENCH_STATS_T * s) {
+	int b;
+
+	printf("%-6s %6u req %8u B  min %6u  mean %6u  max %7u us  %6u KB/s\n", name, 
+		(unsigned) s->Count, (unsigned) s->Bytes, (unsigned) s->Min_us, (unsigned) s->Mean_us, 
+		(unsigned) s->Max_us, (unsigned) s->KBps);
+	printf("       hist (2^b us):");
+	for (b = 0; b < SD_BENCH_HIST_BINS; b++)
+		printf(" %u", (unsigned) s->Hist[b]);
+	printf("\n");
+}
+
+#ifdef SD_IO_STATE_PROF
+// Simulated time only passes on SPI transfers, so this is each state's bus time
+static void Print_State_Prof(void) {
+	static const char * fsm_name[SD_FSM_COUNT] = {"init", "read", "write", "erase"};
+	volatile SD_STATE_PROF * p;
+	int f, s;
+
+	for (f = 0; f < SD_FSM_COUNT; f++)
+		for (s = 0; s < SD_NUM_STATES; s++) {
+			p = &SD_State_Prof[f][s];
+			if (p->calls)
+				printf("state %-5s S%-2d %8u steps  mean %7.2f  max %7.2f us\n", fsm_name[f], s,
+					(unsigned) p->calls, (double) p->cycles / p->calls / (SIM_CORE_HZ / 1000000),
+					(double) p->max / (SIM_CORE_HZ / 1000000));
+		}
+}
+#endif
+
+void Sim_Finish(void) {
+	int i;
+
+	printf("profile %s, %.3f ms simulated\n", Sim_Profile()->Name, 
+		(double) Sim_Now() / (SIM_CORE_HZ / 1000));
+	printf("spi bytes %llu, blocks read %u, written %u (%u overwrites), card busy %.3f ms\n",
+		(unsigned long long) Sim_Stats.SPI_Bytes, (unsigned) Sim_Stats.Blocks_Read, 
+		(unsigned) Sim_Stats.Blocks_Written, (unsigned) Sim_Stats.Overwrites,
+		(double) Sim_Stats.Busy_Cycles / (SIM_CORE_HZ / 1000));
+	printf("commands:");
+	for (i = 0; i < 64; i++)
+		if (Sim_Stats.Cmds[i])
+			printf(" CMD%d=%u", i, (unsigned) Sim_Stats.Cmds[i]);
+	printf("\n");
+	printf("sched: sleeps %u (%u us), wakes %u, max wake %u us, late %u\n",
+		(unsigned) Sched_Stats.Sleeps, (unsigned) Sched_Stats.Sleep_us, (unsigned) Sched_Stats.Wakes,
+		(unsigned) Sched_Stats.Wake_Max_us, (unsigned) Sched_Stats.Late_Wakes);
+	printf("led code %u\n", LED_Color);
+	if (SD_Bench.Done) {
+		printf("bench: %u ms, error %d\n", (unsigned) SD_Bench.Elapsed_ms, (int) SD_Bench.Error);
+		Print_Bench_Stats("read", &SD_Bench.Read);
+		Print_Bench_Stats("write", &SD_Bench.Write);
+	}
+#ifdef SD_IO_STATE_PROF
+	Print_State_Prof();
+#endif
+	fflush(stdout);
+}
+
+int main(int argc, char * argv[]) {
+	if ((argc > 1) && !Sim_Select_Profile(argv[1])) {
+		fprintf(stderr, "unknown profile %s\n", argv[1]);
+		return 2;
+	}
+	Sim_Set_Limit_ms((argc > 2) ? (uint32_t) atoi(argv[2]) : 5000);
+	return Target_Main();
+}
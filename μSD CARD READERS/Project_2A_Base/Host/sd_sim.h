@@ -0,0 +1,49 @@
+#ifndef SD_SIM_H
+#define SD_SIM_H
+#include <stdint.h>
+
+// Simulated SD card behind the spi_io.h interface. Time advances by the SPI clock 
+// for each byte, plus small CPU costs for polls and interrupt masking.
+
+#define SIM_CORE_HZ          (48000000UL)
+#define SIM_CARD_SECTORS     (0x40000UL)   // 128 MB, SDHC
+#define SIM_CPU_CYCLES_BYTE  (20)          // Software cost of one SPI_RW
+#define SIM_CPU_CYCLES_POLL  (10)          // Timer status check, PRIMASK change
+
+// Card timing profile
+typedef struct {
+	const char * Name;
+	uint32_t Init_Polls;        // ACMD41 answers "idle" this often before ready
+	uint32_t Token_us;          // CMD17/18: command to first data token
+	uint32_t Block_Gap_us;      // CMD18: between data blocks
+	uint32_t Prog_us;           // Busy after each written block
+	uint32_t Overwrite_us;      // Extra busy if sector was not erased
+	uint32_t Stall_Every;       // Every n-th written block stalls (0: never)
+	uint32_t Stall_us;
+	uint32_t Erase_us;          // CMD38 busy, fixed part
+	uint32_t Erase_ns_sector;   // CMD38 busy per sector
+	uint8_t Tran_Speed;         // CSD TRAN_SPEED byte (0x32: 25 MHz)
+} SIM_PROFILE_T;
+
+typedef struct {
+	uint64_t SPI_Bytes;
+	uint32_t Cmds[64];          // Commands received by index
+	uint32_t Blocks_Read;
+	uint32_t Blocks_Written;
+	uint32_t Overwrites;        // Blocks written to sectors that were not erased
+	uint64_t Busy_Cycles;       // Card programming or erasing
+} SIM_STATS_T;
+
+extern SIM_STATS_T Sim_Stats;
+extern const SIM_PROFILE_T Sim_Profiles[];
+
+// Select profile by name, returns 0 if unknown
+int Sim_Select_Profile(const char * name);
+// End simulation after ms of simulated time, calling Sim_Finish
+void Sim_Set_Limit_ms(uint32_t ms);
+uint64_t Sim_Now(void);          // Simulated core cycles
+const SIM_PROFILE_T * Sim_Profile(void);
+// Provided by host main: report results, called once time limit is reached
+void Sim_Finish(void);
+
+#endif
@@ -0,0 +1,495 @@
+/*
+ * Host backend for spi_io.h: a simulated SDHC card in SPI mode, with timing
+ * from a selectable profile. Also provides the core stand-ins of MKL25Z4.h
+ * (SysTick, PRIMASK, WFI) on the same simulated clock.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <MKL25Z4.h>
+#include "spi_io.h"
+#include "sd_io.h"
+#include "sd_crc.h"
+#include "sd_sim.h"
+
+const SIM_PROFILE_T Sim_Profiles[] = {
+	// Name    Polls Token Gap  Prog  Over  Stall  Stall_us Erase  ns/sec TRAN
+	{"fast",   20,   100,  20,  250,  500,  0,     0,       2000,  50,    0x32},
+	{"slow",   200,  800,  150, 1500, 4000, 0,     0,       20000, 500,   0x32},
+	{"stall",  50,   300,  40,  600,  1500, 64,    100000,  5000,  100,   0x32},
+	{0}
+};
+
+SIM_STATS_T Sim_Stats;
+GPIO_Type Sim_GPIO[5];
+SysTick_Type Sim_SysTick = {0, SIM_CORE_HZ/1000 - 1, SIM_CORE_HZ/1000 - 1, 0};
+SCB_Type Sim_SCB;
+uint32_t SystemCoreClock = SIM_CORE_HZ;
+
+static const SIM_PROFILE_T * Prof = &Sim_Profiles[0];
+static uint64_t Now = 0;              // Core cycles
+static uint64_t Limit = 0;            // 0: run forever
+static uint32_t Tick_Phase = 0;       // Cycles into current SysTick period
+static int Tick_On = 0, Tick_Pending = 0;
+static uint32_t Primask = 0;
+static DWORD Spi_Hz = 300000, Spi_High_Hz = 12000000;
+
+#define US_TO_CYCLES(us) ((uint64_t) (us) * (SIM_CORE_HZ / 1000000))
+
+/******************************************************************************
+ Simulated time
+******************************************************************************/
+
+static void Sim_Advance(uint64_t cycles) {
+	uint32_t period, step;
+
+	while (cycles) {
+		period = Sim_SysTick.LOAD + 1;
+		step = (cycles < period - Tick_Phase) ? (uint32_t) cycles : period - Tick_Phase;
+		Now += step;
+		Tick_Phase += step;
+		cycles -= step;
+		if (Tick_Phase == period) {
+			Tick_Phase = 0;
+			Sim_SysTick.VAL = Sim_SysTick.LOAD;
+			if (Tick_On && !Primask)
+				SysTick_Handler();
+			else if (Tick_On) {
+				Tick_Pending = 1;
+				Sim_SCB.ICSR |= SCB_ICSR_PENDSTSET_Msk;
+			}
+		}
+	}
+	Sim_SysTick.VAL = Sim_SysTick.LOAD - Tick_Phase;
+	if (Limit && (Now >= Limit)) {
+		Limit = 0;
+		Sim_Finish();
+		exit(0);
+	}
+}
+
+uint64_t Sim_Now(void) {
+	return Now;
+}
+
+void Sim_Set_Limit_ms(uint32_t ms) {
+	Limit = Now + US_TO_CYCLES(ms * 1000ULL);
+}
+
+const SIM_PROFILE_T * Sim_Profile(void) {
+	return Prof;
+}
+
+int Sim_Select_Profile(const char * name) {
+	const SIM_PROFILE_T * p;
+
+	for (p = Sim_Profiles; p->Name; p++) {
+		if (!strcmp(p->Name, name)) {
+			Prof = p;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+uint32_t SysTick_Config(uint32_t ticks) {
+	Sim_SysTick.LOAD = ticks - 1;
+	Sim_SysTick.VAL = ticks - 1;
+	Tick_Phase = 0;
+	Tick_On = 1;
+	return 0;
+}
+
+static void Sim_Unmasked(void) {
+	if (Tick_Pending && !Primask) {
+		Tick_Pending = 0;
+		Sim_SCB.ICSR &= ~SCB_ICSR_PENDSTSET_Msk;
+		SysTick_Handler();
+	}
+}
+
+void __disable_irq(void) {
+	Primask = 1;
+	Sim_Advance(SIM_CPU_CYCLES_POLL);
+}
+
+void __enable_irq(void) {
+	Primask = 0;
+	Sim_Unmasked();
+	Sim_Advance(SIM_CPU_CYCLES_POLL);
+}
+
+uint32_t __get_PRIMASK(void) {
+	return Primask;
+}
+
+void __set_PRIMASK(uint32_t primask) {
+	Primask = primask;
+	Sim_Unmasked();
+}
+
+void __WFI(void) {
+	// SysTick is the only interrupt source, so sleep until the next tick
+	if (Tick_Pending)
+		return;
+	if (!Tick_On) { // Nothing could wake us
+		Sim_Finish();
+		exit(1);
+	}
+	Sim_Advance(Sim_SysTick.LOAD + 1 - Tick_Phase);
+}
+
+/******************************************************************************
+ Card model
+******************************************************************************/
+
+static uint8_t * Card_Data[SIM_CARD_SECTORS]; // 0: erased (reads as 0x00)
+
+static struct {
+	int Selected;
+	int Idle;                 // In idle state, ACMD41 not done
+	int App_Cmd;              // Last command was CMD55
+	uint32_t Polls_Left;
+	uint8_t Cmd[6];
+	int Cmd_Len;
+	uint8_t Out[SD_BLK_SIZE + 3];
+	int Out_Len, Out_Pos;
+	uint64_t Busy_Until;      // DO held low until then
+	// Reads
+	int Read_Active, Read_Multi;
+	DWORD Read_Sector;
+	uint64_t Token_At;        // 0: not scheduled yet
+	// Writes
+	int Write_Mode;           // 0 none, 1 CMD24, 2 CMD25
+	int Rx_Data;              // Receiving a data block
+	int Rx_Count;
+	uint8_t Rx[SD_BLK_SIZE + 2];
+	DWORD Write_Sector;
+	DWORD Erase_Start, Erase_End;
+} Card;
+
+static void Card_Respond(const uint8_t * bytes, int len) {
+	memcpy(Card.Out, bytes, len);
+	Card.Out_Len = len;
+	Card.Out_Pos = 0;
+}
+
+static void Card_Busy(uint32_t us) {
+	Card.Busy_Until = Now + US_TO_CYCLES(us);
+	Sim_Stats.Busy_Cycles += US_TO_CYCLES(us);
+}
+
+static void Card_Load_Block(void) {
+	WORD crc;
+
+	Card.Out[0] = 0xFE;
+	if (Card_Data[Card.Read_Sector])
+		memcpy(Card.Out + 1, Card_Data[Card.Read_Sector], SD_BLK_SIZE);
+	else
+		memset(Card.Out + 1, 0, SD_BLK_SIZE);
+	crc = SD_CRC16(0, Card.Out + 1, SD_BLK_SIZE);
+	Card.Out[SD_BLK_SIZE + 1] = (uint8_t) (crc >> 8);
+	Card.Out[SD_BLK_SIZE + 2] = (uint8_t) crc;
+	Card.Out_Len = SD_BLK_SIZE + 3;
+	Card.Out_Pos = 0;
+	Sim_Stats.Blocks_Read++;
+	if (Card.Read_Multi && (Card.Read_Sector + 1 < SIM_CARD_SECTORS)) {
+		Card.Read_Sector++;
+		Card.Token_At = 0;
+	} else {
+		Card.Read_Active = 0;
+	}
+}
+
+static uint8_t Card_Out(void) {
+	if (Card.Out_Pos < Card.Out_Len)
+		return Card.Out[Card.Out_Pos++];
+	if (Now < Card.Busy_Until)
+		return 0x00;
+	if (Card.Read_Active) {
+		if (Card.Token_At == 0)
+			Card.Token_At = Now + US_TO_CYCLES(Prof->Block_Gap_us);
+		if (Now >= Card.Token_At) {
+			Card_Load_Block();
+			return Card.Out[Card.Out_Pos++];
+		}
+	}
+	return 0xFF;
+}
+
+static void Card_Write_Block(void) {
+	static const uint8_t accepted = 0xE5;
+	static uint32_t written = 0;
+	uint32_t us = Prof->Prog_us;
+
+	if (Card_Data[Card.Write_Sector]) {
+		us += Prof->Overwrite_us;
+		Sim_Stats.Overwrites++;
+	} else {
+		Card_Data[Card.Write_Sector] = malloc(SD_BLK_SIZE);
+	}
+	memcpy(Card_Data[Card.Write_Sector], Card.Rx, SD_BLK_SIZE);
+	if (Prof->Stall_Every && (++written % Prof->Stall_Every == 0))
+		us += Prof->Stall_us;
+	Card_Respond(&accepted, 1);
+	Card_Busy(us);
+	Sim_Stats.Blocks_Written++;
+	Card.Rx_Data = 0;
+	if (Card.Write_Mode == 1)
+		Card.Write_Mode = 0;
+	else
+		Card.Write_Sector++;
+}
+
+static void Card_Erase(void) {
+	DWORD s;
+
+	for (s = Card.Erase_Start; (s <= Card.Erase_End) && (s < SIM_CARD_SECTORS); s++) {
+		free(Card_Data[s]);
+		Card_Data[s] = 0;
+	}
+	Card_Busy(Prof->Erase_us +
+		(uint32_t) (((uint64_t) (Card.Erase_End - Card.Erase_Start + 1) * Prof->Erase_ns_sector) / 1000));
+}
+
+static void Card_Command(void) {
+	BYTE idx = Card.Cmd[0] & 0x3F;
+	DWORD arg = ((DWORD) Card.Cmd[1] << 24) | ((DWORD) Card.Cmd[2] << 16) |
+		((DWORD) Card.Cmd[3] << 8) | Card.Cmd[4];
+	int app = Card.App_Cmd;
+	uint8_t r[24], r1;
+	// CSD 2.0: TRAN_SPEED in byte 3, C_SIZE in bytes 7..9
+	uint8_t csd[16] = {0x40, 0x0E, 0x00, 0x32, 0x5B, 0x59, 0x00, 0x00,
+		0x00, 0x00, 0x7F, 0x80, 0x0A, 0x40, 0x00, 0x01};
+	WORD crc;
+
+	Sim_Stats.Cmds[idx]++;
+	Card.App_Cmd = 0;
+	r1 = Card.Idle ? 0x01 : 0x00;
+	r[0] = 0xFF; // Ncr
+	r[1] = r1;
+	switch (idx) {
+		case 0:
+			Card.Idle = 1;
+			Card.Polls_Left = Prof->Init_Polls;
+			Card.Read_Active = Card.Write_Mode = Card.Rx_Data = 0;
+			r[1] = 0x01;
+			Card_Respond(r, 2);
+			break;
+		case 8: // R7, echo voltage and check pattern
+			r[2] = 0x00;
+			r[3] = 0x00;
+			r[4] = (uint8_t) ((arg >> 8) & 0x0F);
+			r[5] = (uint8_t) arg;
+			Card_Respond(r, 6);
+			break;
+		case 9:
+			csd[3] = Prof->Tran_Speed;
+			csd[7] = (uint8_t) (((SIM_CARD_SECTORS / 1024 - 1) >> 16) & 0x3F);
+			csd[8] = (uint8_t) ((SIM_CARD_SECTORS / 1024 - 1) >> 8);
+			csd[9] = (uint8_t) (SIM_CARD_SECTORS / 1024 - 1);
+			r[2] = 0xFE;
+			memcpy(r + 3, csd, 16);
+			crc = SD_CRC16(0, csd, 16);
+			r[19] = (uint8_t) (crc >> 8);
+			r[20] = (uint8_t) crc;
+			Card_Respond(r, 21);
+			break;
+		case 12:
+			Card.Read_Active = 0;
+			r[0] = 0xFF; // Stuff byte
+			r[1] = 0xFF;
+			r[2] = r1;
+			Card_Respond(r, 3);
+			break;
+		case 13: // R2
+			r[2] = 0x00;
+			Card_Respond(r, 3);
+			break;
+		case 17:
+		case 18:
+			if (Card.Idle || (arg >= SIM_CARD_SECTORS)) {
+				r[1] = r1 | 0x40; // Parameter error
+				Card_Respond(r, 2);
+				break;
+			}
+			Card.Read_Active = 1;
+			Card.Read_Multi = (idx == 18);
+			Card.Read_Sector = arg;
+			Card.Token_At = Now + US_TO_CYCLES(Prof->Token_us);
+			Card_Respond(r, 2);
+			break;
+		case 24:
+		case 25:
+			if (Card.Idle || (arg >= SIM_CARD_SECTORS)) {
+				r[1] = r1 | 0x40;
+				Card_Respond(r, 2);
+				break;
+			}
+			Card.Write_Mode = (idx == 24) ? 1 : 2;
+			Card.Write_Sector = arg;
+			Card_Respond(r, 2);
+			break;
+		case 32:
+			Card.Erase_Start = arg;
+			Card_Respond(r, 2);
+			break;
+		case 33:
+			Card.Erase_End = arg;
+			Card_Respond(r, 2);
+			break;
+		case 38:
+			Card_Respond(r, 2);
+			Card_Erase();
+			break;
+		case 41:
+			if (!app) {
+				r[1] = r1 | 0x04; // Illegal command
+			} else if (Card.Polls_Left) {
+				Card.Polls_Left--;
+			} else {
+				Card.Idle = 0;
+				r[1] = 0x00;
+			}
+			Card_Respond(r, 2);
+			break;
+		case 55:
+			Card.App_Cmd = 1;
+			Card_Respond(r, 2);
+			break;
+		case 58: // OCR with CCS set: block addressing
+			r[2] = 0xC0;
+			r[3] = 0xFF;
+			r[4] = 0x80;
+			r[5] = 0x00;
+			Card_Respond(r, 6);
+			break;
+		case 16:
+		case 23:
+		case 59:
+			Card_Respond(r, 2);
+			break;
+		default:
+			r[1] = r1 | 0x04;
+			Card_Respond(r, 2);
+			break;
+	}
+}
+
+static void Card_In(BYTE d) {
+	if (Card.Rx_Data) { // Data block and CRC of a write
+		Card.Rx[Card.Rx_Count++] = d;
+		if (Card.Rx_Count == SD_BLK_SIZE + 2)
+			Card_Write_Block();
+		return;
+	}
+	if (Card.Write_Mode && (Card.Cmd_Len == 0)) {
+		if (Now < Card.Busy_Until)
+			return;
+		if (((d == 0xFE) && (Card.Write_Mode == 1)) || ((d == 0xFC) && (Card.Write_Mode == 2))) {
+			Card.Rx_Data = 1;
+			Card.Rx_Count = 0;
+			return;
+		}
+		if ((d == 0xFD) && (Card.Write_Mode == 2)) { // Stop Tran
+			Card.Write_Mode = 0;
+			Card_Busy(Prof->Prog_us / 4);
+			return;
+		}
+	}
+	if ((Card.Cmd_Len == 0) && ((d & 0xC0) != 0x40))
+		return;
+	Card.Cmd[Card.Cmd_Len++] = d;
+	if (Card.Cmd_Len == 6) {
+		Card.Cmd_Len = 0;
+		Card_Command();
+	}
+}
+
+/******************************************************************************
+ spi_io.h interface
+******************************************************************************/
+
+void SPI_Init (void) {
+}
+
+BYTE SPI_RW (BYTE d) {
+	BYTE r = 0xFF;
+
+	Sim_Advance(8ULL * SIM_CORE_HZ / Spi_Hz + SIM_CPU_CYCLES_BYTE);
+	Sim_Stats.SPI_Bytes++;
+	if (Card.Selected) {
+		r = Card_Out();
+		Card_In(d);
+	}
+	return r;
+}
+
+void SPI_Release (void) {
+	WORD idx;
+	for (idx=512; idx && (SPI_RW(0xFF)!=0xFF); idx--);
+}
+
+void SPI_CS_Low (void) {
+	Card.Selected = 1;
+}
+
+void SPI_CS_High (void) {
+	Card.Selected = 0;
+	Card.Cmd_Len = 0;
+}
+
+void SPI_Freq_High (void) {
+	Spi_Hz = Spi_High_Hz;
+}
+
+void SPI_Freq_Low (void) {
+	Spi_Hz = 300000;
+}
+
+// Same ladder as SPI1 with SPPR = 0: bus clock / 2^(SPR+1)
+DWORD SPI_Freq_Limit (DWORD hz) {
+	for (Spi_High_Hz = SPI_BUS_CLOCK / 2; (Spi_High_Hz > hz) && (Spi_High_Hz > SPI_FREQ_FLOOR); )
+		Spi_High_Hz /= 2;
+	return(Spi_High_Hz);
+}
+
+DWORD SPI_Freq_Step_Down (void) {
+	if (Spi_High_Hz / 2 >= SPI_FREQ_FLOOR)
+		Spi_High_Hz /= 2;
+	return(Spi_High_Hz);
+}
+
+static uint64_t Timer_End = UINT64_MAX;
+
+void SPI_Timer_On (WORD ms) {
+	Timer_End = Now + US_TO_CYCLES(ms * 1000UL);
+}
+
+BOOL SPI_Timer_Status (void) {
+	Sim_Advance(SIM_CPU_CYCLES_POLL);
+	return ((Now < Timer_End) ? TRUE : FALSE);
+}
+
+// As on target, a stopped timer never reads as expired
+void SPI_Timer_Off (void) {
+	Timer_End = UINT64_MAX;
+}
+
+// No DMA engine: move the bytes at once, so the transfer is done when Status is checked
+BOOL SPI_Block_Start (BYTE *rx, const BYTE *tx, WORD len) {
+	WORD i;
+	BYTE b;
+
+	for (i = 0; i < len; i++) {
+		b = SPI_RW(tx ? tx[i] : 0xFF);
+		if (rx)
+			rx[i] = b;
+	}
+	return TRUE;
+}
+
+BOOL SPI_Block_Status (void) {
+	return FALSE;
+}
@@ -6,106 +6,479 @@
  */ 
 
 #include <MKL25Z4.h>
+#include <string.h>
 #include "sd_server.h"
 #include "spi_io.h"
 #include "sd_io.h"
+#include "sd_cache.h"
 #include "debug.h"
+#include "scheduler.h"
 
-SDS_TD_T g_trans = {REQ_NONE, 0, (uint8_t * ) 0, 0, STAT_IDLE, SD_OK};
+// Ring of queued transactions, owned by requesting tasks
+static SDS_TD_T * SDS_Queue[SDS_QUEUE_SIZE];
+static uint8_t SDS_Q_Head = 0, SDS_Q_Tail = 0, SDS_Q_Count = 0;
 
 // Determines next state after S_IDLE based on request type
 // Entries must be in order of declaration in SDSTD_T Request field
-SDS_STATE_T Req_to_State[] = {S_IDLE, S_INIT, S_READ, S_WRITE};
+SDS_STATE_T Req_to_State[] = {S_IDLE, S_INIT, S_READ, S_WRITE, S_READ_MULTI, S_WRITE_MULTI, S_IDLE, 
+	S_ERASE};
+
+volatile uint32_t SDS_Time_ms = 0;
+static uint32_t SDS_Ready_Mask = 0; // Scheduler bit of Task_SD_Server
+static uint32_t Wake_Time, Wake_Mask; // SDS_Wake_After, Wake_Mask 0 when not set
+
+// Write-back buffer holds one run of WB_Count sectors starting at WB_Start
+#if SDS_USE_WRITE_BACK
+static uint8_t WB_Data[SDS_WB_SECTORS][SD_BLK_SIZE];
+#endif
+static SD_DEV * WB_Device;
+static DWORD WB_Start;
+static WORD WB_Count = 0;
+static uint32_t WB_Time;            // SDS_Time_ms when first sector was buffered
+static SDRESULTS WB_Result = SD_OK; // First flush error, reported by REQ_FLUSH
+
+// Sequential read detector and prefetch buffer
+#if SDS_RA_TRIGGER > 0
+static uint8_t RA_Data[SDS_RA_SECTORS][SD_BLK_SIZE];
+#endif
+static SD_DEV * RA_Device;
+static DWORD RA_Next;     // Sector after the last one read
+static WORD RA_Run = 0;   // Consecutive sectors read so far
+static DWORD RA_Start;    // Run being prefetched
+static WORD RA_Count;
+
+void SysTick_Handler(void) {
+	SDS_Time_ms++;
+	if ((WB_Count > 0) && (SDS_Time_ms - WB_Time == SDS_WB_FLUSH_MS))
+		Sched_Set_Ready(SDS_Ready_Mask); // Time to flush write-back buffer
+	if (Wake_Mask && (SDS_Time_ms == Wake_Time)) {
+		Sched_Set_Ready(Wake_Mask);
+		Wake_Mask = 0;
+	}
+}
+
+void SDS_Wake_After(uint32_t ms, uint32_t mask) {
+	uint32_t primask = __get_PRIMASK();
+	
+	__disable_irq();
+	Wake_Time = SDS_Time_ms + (ms ? ms : 1);
+	Wake_Mask = mask;
+	__set_PRIMASK(primask);
+}
+
+void SDS_Init(uint32_t ready_mask) {
+	SDS_Ready_Mask = ready_mask;
+	SysTick_Config(SystemCoreClock/1000); // 1 ms
+}
+
+/* Free running core clock cycle count, from SysTick and SDS_Time_ms.
+With interrupts masked (e.g. straight after WFI) SysTick may have
+reloaded without its handler counting the ms yet: it is pending, so
+count that ms here and take VAL from after the reload. */
+uint32_t SDS_Cycles(void) {
+	uint32_t ms, val, pending;
+	
+	do { // Retry if SysTick wrapped while reading
+		ms = SDS_Time_ms;
+		val = SysTick->VAL;
+		pending = (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) ? 1 : 0;
+		if (pending)
+			val = SysTick->VAL;
+	} while (ms != SDS_Time_ms);
+	return (ms + pending)*(SysTick->LOAD + 1) + (SysTick->LOAD - val);
+}
+
+#define US_TO_CYCLES(us) ((us)*(SystemCoreClock/1000000))
+
+uint32_t SDS_Quantum = SDS_QUANTUM_N;
+static uint32_t Quantum_Left;
+static uint32_t Quantum_Start;
+
+void Quantum_Begin(void) {
+	Quantum_Left = SDS_Quantum;
+	Quantum_Start = SDS_Cycles();
+}
+
+// Returns 1 if FSM may take another step in this call
+int Quantum_Remaining(void) {
+#if SDS_QUANTUM_MODE == SDS_QUANTUM_TIME
+	return (SDS_Cycles() - Quantum_Start) < US_TO_CYCLES(SDS_QUANTUM_US);
+#else
+	return --Quantum_Left > 0;
+#endif
+}
+
+// Adapt quantum to time used by other tasks since the server last ran
+void Quantum_Adapt(uint32_t other_cycles) {
+#if SDS_QUANTUM_MODE == SDS_QUANTUM_ADAPTIVE
+	if (other_cycles < US_TO_CYCLES(SDS_SLACK_US)) {
+		if (SDS_Quantum < SDS_QUANTUM_MAX)
+			SDS_Quantum *= 2;
+	} else if (SDS_Quantum > SDS_QUANTUM_MIN) {
+		SDS_Quantum /= 2;
+	}
+#endif
+}
 
 void Update_Trans(SDS_TD_T * t, SDRESULTS res) {
 	t->ErrorCode = res;
 	t->Status = STAT_IDLE;
 	t->Request = REQ_NONE; // Erase request code
+	// Notify requester
+	if (t->Event_Flags)
+		*(t->Event_Flags) |= t->Event_Mask;
+	if (t->Callback)
+		t->Callback(t);
+}
+
+// Returns 1 if sector can be added to write-back buffer
+int WB_Can_Merge(SD_DEV * dev, DWORD sector) {
+#if SDS_USE_WRITE_BACK
+	if (sector > dev->last_sector)
+		return 0; // Let SD_Write report parameter error
+	if (WB_Count == 0)
+		return 1;
+	return ((dev == WB_Device) && (sector >= WB_Start) && 
+		(sector <= WB_Start + WB_Count) && (sector - WB_Start < SDS_WB_SECTORS));
+#else
+	return 0;
+#endif
+}
+
+// Copy sector into write-back buffer, returns 1 if done
+int WB_Write(SD_DEV * dev, DWORD sector, uint8_t * src) {
+#if SDS_USE_WRITE_BACK
+	DWORD idx;
+	
+	if (!WB_Can_Merge(dev, sector))
+		return 0;
+	if (WB_Count == 0) {
+		WB_Device = dev;
+		WB_Start = sector;
+		WB_Time = SDS_Time_ms;
+	}
+	idx = sector - WB_Start;
+	memcpy(WB_Data[idx], src, SD_BLK_SIZE);
+	if (idx == WB_Count) // Extends run, else overwrites buffered sector
+		WB_Count++;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+// Copy sector from write-back buffer to dest, returns 1 if it was buffered
+int WB_Read(SD_DEV * dev, DWORD sector, uint8_t * dest) {
+#if SDS_USE_WRITE_BACK
+	if ((WB_Count > 0) && (dev == WB_Device) && (sector >= WB_Start) && 
+		(sector - WB_Start < WB_Count)) {
+		memcpy(dest, WB_Data[sector - WB_Start], SD_BLK_SIZE);
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+// Returns 1 if request t must wait until write-back buffer is flushed
+int WB_Flush_Needed(SDS_TD_T * t) {
+	if (WB_Count == 0)
+		return 0;
+	switch (t->Request) {
+		case REQ_READ: // Served from buffer or card, both are current
+			return 0;
+		case REQ_WRITE:
+			return !WB_Can_Merge(t->Device, t->Sector);
+		default: // Keeps order of flush, init and multi-block requests
+			return 1;
+	}
+}
+
+// Track read of count sectors starting at sector for sequential access
+void RA_Observe(SD_DEV * dev, DWORD sector, WORD count) {
+	if ((dev == RA_Device) && (sector == RA_Next))
+		RA_Run += count;
+	else
+		RA_Run = count;
+	RA_Device = dev;
+	RA_Next = sector + count;
+}
+
+// Returns 1 and sets RA_Start, RA_Count if sectors ahead of the run should be prefetched
+int RA_Needed(void) {
+#if SDS_RA_TRIGGER > 0
+	DWORD end;
+	
+	// Buffered writes are newer than the card, so don't cache card data then
+	if ((RA_Run < SDS_RA_TRIGGER) || (WB_Count > 0) || (RA_Next > RA_Device->last_sector))
+		return 0;
+	end = RA_Next + SDS_RA_SECTORS;
+	if (end > RA_Device->last_sector + 1)
+		end = RA_Device->last_sector + 1;
+	for (RA_Start = RA_Next; (RA_Start < end) && SD_Cache_Contains(RA_Device, RA_Start); RA_Start++)
+		;
+	for (RA_Count = 0; (RA_Start + RA_Count < end) && 
+		!SD_Cache_Contains(RA_Device, RA_Start + RA_Count); RA_Count++)
+		;
+	return RA_Count > 0;
+#else
+	return 0;
+#endif
+}
+
+int SDS_Enqueue(SDS_TD_T * t) {
+	if (SDS_Q_Count == SDS_QUEUE_SIZE)
+		return 0; // Full, requester must try again later
+	t->Status = STAT_QUEUED;
+	SDS_Queue[SDS_Q_Tail] = t;
+	SDS_Q_Tail = (SDS_Q_Tail + 1) % SDS_QUEUE_SIZE;
+	SDS_Q_Count++;
+	Sched_Set_Ready(SDS_Ready_Mask);
+	return 1;
+}
+
+// Card operations of the server states: one driver step, and the completion
+// once the driver is done. The SD_CTX carries the operation between steps.
+static SDRESULTS Op_Init(SDS_TD_T * t, SD_CTX * ctx) {
+	return SD_Init(t->Device, ctx);
+}
+
+static SDRESULTS Op_Read(SDS_TD_T * t, SD_CTX * ctx) {
+	return SD_Read(t->Device, ctx, t->Data, t->Sector, 0, 512);
+}
+
+static SDRESULTS Op_Write(SDS_TD_T * t, SD_CTX * ctx) {
+	return SD_Write(t->Device, ctx, t->Data, t->Sector);
+}
+
+static SDRESULTS Op_Read_Multi(SDS_TD_T * t, SD_CTX * ctx) {
+	return SD_Read_Multi(t->Device, ctx, t->Data, t->Sector, t->Count);
+}
+
+static SDRESULTS Op_Write_Multi(SDS_TD_T * t, SD_CTX * ctx) {
+	return SD_Write_Multi(t->Device, ctx, t->Data, t->Sector, t->Count);
+}
+
+static SDRESULTS Op_Erase(SDS_TD_T * t, SD_CTX * ctx) {
+	return SD_Erase(t->Device, ctx, t->Sector, t->End_Sector);
+}
+
+static void Done_Trans(SDS_TD_T * req, SDS_TD_T * t, SDRESULTS res) {
+	Update_Trans(req, res);
 }
 
+static void Done_Read(SDS_TD_T * req, SDS_TD_T * t, SDRESULTS res) {
+	if (res == SD_OK)
+		SD_Cache_Fill(t->Device, t->Sector, t->Data);
+	Update_Trans(req, res);
+}
+
+#if SDS_USE_WRITE_BACK
+static SDRESULTS Op_Flush(SDS_TD_T * t, SD_CTX * ctx) {
+	return SD_Write_Multi(WB_Device, ctx, WB_Data, WB_Start, WB_Count);
+}
+
+static void Done_Flush(SDS_TD_T * req, SDS_TD_T * t, SDRESULTS res) {
+	if ((res != SD_OK) && (WB_Result == SD_OK))
+		WB_Result = res;
+	WB_Count = 0;
+}
+#endif
+
+#if SDS_RA_TRIGGER > 0
+static SDRESULTS Op_Readahead(SDS_TD_T * t, SD_CTX * ctx) {
+	return SD_Read_Multi(RA_Device, ctx, RA_Data, RA_Start, RA_Count);
+}
+
+static void Done_Readahead(SDS_TD_T * req, SDS_TD_T * t, SDRESULTS res) {
+	WORD i;
+	
+	if (res == SD_OK) {
+		for (i = 0; i < RA_Count; i++)
+			SD_Cache_Fill(RA_Device, RA_Start + i, RA_Data[i]);
+	} else {
+		RA_Run = 0; // Don't retry until the next sequential run
+	}
+}
+#endif
+
+// Indexed by server state, no Step for S_IDLE and S_ERROR
+static const SDS_OP_T SDS_Ops[S_ERROR + 1] = {
+	[S_INIT]        = {Op_Init, Done_Trans, DBG_4},
+	[S_READ]        = {Op_Read, Done_Read, DBG_2},
+	[S_WRITE]       = {Op_Write, Done_Trans, DBG_3},
+	[S_READ_MULTI]  = {Op_Read_Multi, Done_Trans, DBG_2},
+	[S_WRITE_MULTI] = {Op_Write_Multi, Done_Trans, DBG_3},
+#if SDS_USE_WRITE_BACK
+	[S_FLUSH]       = {Op_Flush, Done_Flush, DBG_3},
+#endif
+#if SDS_RA_TRIGGER > 0
+	[S_READAHEAD]   = {Op_Readahead, Done_Readahead, DBG_2},
+#endif
+	[S_ERASE]       = {Op_Erase, Done_Trans, DBG_3}
+};
+
 void Task_SD_Server(void) {
 	static SDS_STATE_T next_state = S_IDLE;
+	// Requester's transaction object, updated with results when done
+	static SDS_TD_T * cur_req;
 	// Local copy of transaction data, improves robustness
 	static SDS_TD_T cur_trans;
+	// Progress of SD operation for current transaction
+	static SD_CTX ctx;
 	static SDRESULTS res;
+	static uint32_t exit_cycles;
+	const SDS_OP_T * op;
 
+	Quantum_Adapt(SDS_Cycles() - exit_cycles);
+	Quantum_Begin();
 	switch (next_state) {
 		case S_IDLE:
-				if (g_trans.Request != REQ_NONE) {
-					cur_trans = g_trans; // Copy transaction request
-					if (cur_trans.Request <= REQ_WRITE) {
+				if ((SDS_Q_Count > 0) && WB_Flush_Needed(SDS_Queue[SDS_Q_Head])) {
+					next_state = S_FLUSH; // Request stays queued until buffered data is on card
+				} else if (SDS_Q_Count > 0) {
+					cur_req = SDS_Queue[SDS_Q_Head];
+					SDS_Q_Head = (SDS_Q_Head + 1) % SDS_QUEUE_SIZE;
+					SDS_Q_Count--;
+					cur_trans = *cur_req; // Copy transaction request
+					if (cur_trans.Request == REQ_READ)
+						RA_Observe(cur_trans.Device, cur_trans.Sector, 1);
+					else if (cur_trans.Request == REQ_READ_MULTI)
+						RA_Observe(cur_trans.Device, cur_trans.Sector, cur_trans.Count);
+					else if ((cur_trans.Request == REQ_INIT) || (cur_trans.Request == REQ_ERASE))
+						RA_Run = 0;
+					if ((cur_trans.Request == REQ_READ) && 
+						WB_Read(cur_trans.Device, cur_trans.Sector, cur_trans.Data)) {
+						Update_Trans(cur_req, SD_OK); // Newest data is in write-back buffer
+					} else if ((cur_trans.Request == REQ_READ) && 
+						SD_Cache_Lookup(cur_trans.Device, cur_trans.Sector, cur_trans.Data)) {
+						Update_Trans(cur_req, SD_OK); // Cache hit, done without SPI
+					} else if ((cur_trans.Request == REQ_WRITE) && 
+						WB_Write(cur_trans.Device, cur_trans.Sector, cur_trans.Data)) {
+						SD_Cache_Invalidate(cur_trans.Device, cur_trans.Sector, 1);
+						Update_Trans(cur_req, SD_OK); // Buffered, card is written later
+						if (WB_Count >= SDS_WB_FLUSH_THRESHOLD)
+							next_state = S_FLUSH;
+					} else if (cur_trans.Request == REQ_FLUSH) {
+						Update_Trans(cur_req, WB_Result); // Buffer is empty here
+						WB_Result = SD_OK;
+					} else if (((cur_trans.Request != REQ_NONE) && (cur_trans.Request <= REQ_WRITE_MULTI)) ||
+						(cur_trans.Request == REQ_ERASE)) {
+						// Cached copies become stale on write, erase or (re)initialization
+						if ((cur_trans.Request == REQ_INIT) || (cur_trans.Request == REQ_ERASE))
+							SD_Cache_Invalidate_Dev(cur_trans.Device);
+						else if (cur_trans.Request == REQ_WRITE)
+							SD_Cache_Invalidate(cur_trans.Device, cur_trans.Sector, 1);
+						else if (cur_trans.Request == REQ_WRITE_MULTI)
+							SD_Cache_Invalidate(cur_trans.Device, cur_trans.Sector, cur_trans.Count);
 						next_state = Req_to_State[cur_trans.Request];
-						g_trans.Status = STAT_BUSY; 
+						cur_req->Status = STAT_BUSY; 
 					} else { // parameter error
-						g_trans.Status = STAT_IDLE;
-						g_trans.Request = REQ_NONE; // Erase request
-						g_trans.ErrorCode = SD_PARERR; 
+						Update_Trans(cur_req, SD_PARERR);
 						next_state = S_IDLE; // Stay in idle state
 					}
+				} else if ((WB_Count > 0) && (SDS_Time_ms - WB_Time >= SDS_WB_FLUSH_MS)) {
+					next_state = S_FLUSH; // Oldest buffered data has waited long enough
+				} else if (RA_Needed()) {
+					next_state = S_READAHEAD; // Client is busy with the current sector
 				}
 			break;
-		case S_INIT:
-			DEBUG_START(DBG_4);
-			res = SD_Init(cur_trans.Device);
-			
-		if(*instatus==1)
-		{
-			next_state=S_INIT;
-		}
-		else
-		{	
-		next_state = S_IDLE;
-	  
-		}	
-		if(next_state == S_IDLE)
-		{
-		Update_Trans(&g_trans, res);
-		}
-		DEBUG_STOP(DBG_4);
-			break;
-		case S_READ:
-			DEBUG_START(DBG_2);
-			res = SD_Read(cur_trans.Device, cur_trans.Data, cur_trans.Sector, 0, 512);
-			
-		if(*rstatus==1)
-		{
-			next_state=S_READ;
-		}
-		else
-		{
-			next_state = S_IDLE;
-			//Update_Trans(&g_trans, res);
-		}
-		if(next_state == S_IDLE)
-		{
-		Update_Trans(&g_trans, res);
-		}
-		DEBUG_STOP(DBG_2);
-			break;
-		case S_WRITE:
-			DEBUG_START(DBG_3);
-			res = SD_Write(cur_trans.Device, cur_trans.Data, cur_trans.Sector);
-			 
-		if(*status==1)
-		{
-			next_state=S_WRITE;
-		}
-		else
-		{
-			next_state = S_IDLE;
-		//Update_Trans(&g_trans, res);	
-		}
-		if(next_state == S_IDLE)
-		{
-		Update_Trans(&g_trans, res);
-		}
-		DEBUG_STOP(DBG_3);
-		break;
 		case S_ERROR:
 			while (1)
 				;	// Optional: Add your code to handle the error here
 			break;
-		default:
+		default: // Card operation in progress, a slice of driver steps per run
+			op = &SDS_Ops[next_state];
+			if (op->Step == 0) {
+				next_state = S_ERROR;
+				break;
+			}
+			DEBUG_START(op->Dbg);
+			do {
+				res = op->Step(&cur_trans, &ctx);
+			} while ((ctx.busy==1) && Quantum_Remaining());
+			if (ctx.busy==0) {
+				next_state = S_IDLE;
+				op->Done(cur_req, &cur_trans, res);
+			}
+			DEBUG_STOP(op->Dbg);
 			break;
 	}
+	// Stay ready while there is work, else wait for SDS_Enqueue or flush timer
+	if ((next_state != S_IDLE) || (SDS_Q_Count > 0) || RA_Needed())
+		Sched_Set_Ready(SDS_Ready_Mask);
+	exit_cycles = SDS_Cycles();
+}
+
+// Queue read into buffer i if it wants one. Returns 0 if it still wants one (queue full).
+static int Stream_Issue(SDS_STREAM_T * s, int i) {
+	SDS_TD_T * t = &s->Trans[i];
+
+	if (s->State[i] != STREAM_WANT)
+		return 1;
+	if (s->Next_Sector >= s->End_Sector) {
+		s->State[i] = STREAM_EMPTY;
+		return 1;
+	}
+	t->Request = REQ_READ;
+	t->Sector = s->Next_Sector;
+	t->Count = 1;
+	if (!SDS_Enqueue(t))
+		return 0;
+	s->State[i] = STREAM_READ;
+	s->Next_Sector++;
+	return 1;
+}
+
+// Issue in buffer order so sectors arrive in order
+static void Stream_Issue_All(SDS_STREAM_T * s) {
+	if (Stream_Issue(s, s->Client))
+		Stream_Issue(s, s->Client ^ 1);
+}
+
+void SDS_Stream_Start(SDS_STREAM_T * s, SD_DEV * dev, uint32_t sector, uint32_t count,
+	uint8_t * buf_a, uint8_t * buf_b, void (*callback)(SDS_TD_T * t)) {
+	int i;
+	
+	for (i = 0; i < 2; i++) {
+		s->Trans[i].Request = REQ_NONE;
+		s->Trans[i].Device = dev;
+		s->Trans[i].Status = STAT_IDLE;
+		s->Trans[i].ErrorCode = SD_OK;
+		s->Trans[i].Callback = callback;
+		s->Trans[i].Event_Flags = 0;
+		s->Trans[i].Event_Mask = 0;
+		s->State[i] = STREAM_WANT;
+	}
+	s->Trans[0].Data = buf_a;
+	s->Trans[1].Data = buf_b;
+	s->Next_Sector = sector;
+	s->End_Sector = sector + count;
+	s->Client = 0;
+	Stream_Issue_All(s);
+}
+
+uint8_t * SDS_Stream_Get(SDS_STREAM_T * s, SDRESULTS * res) {
+	SDS_TD_T * t = &s->Trans[s->Client];
+
+	Stream_Issue_All(s);
+	if ((s->State[s->Client] == STREAM_READ) && (t->Status == STAT_IDLE) && 
+		(t->Request == REQ_NONE))
+		s->State[s->Client] = STREAM_HELD;
+	if (s->State[s->Client] != STREAM_HELD)
+		return 0;
+	*res = t->ErrorCode;
+	return t->Data;
+}
+
+void SDS_Stream_Release(SDS_STREAM_T * s) {
+	if (s->State[s->Client] != STREAM_HELD)
+		return;
+	s->State[s->Client] = STREAM_WANT;
+	s->Client ^= 1;
+	Stream_Issue_All(s);
+}
+
+int SDS_Stream_Done(SDS_STREAM_T * s) {
+	Stream_Issue_All(s);
+	return (s->State[0] == STREAM_EMPTY) && (s->State[1] == STREAM_EMPTY);
 }
@@ -0,0 +1,128 @@
+/*
+ * Synthetic load: background bursts from the idle function, optional periodic task.
+ */
+
+#include <MKL25Z4.h>
+#include "load_gen.h"
+#include "sd_server.h"
+#include "scheduler.h"
+
+volatile LOAD_GEN_CFG_T Load_Gen_Cfg = {LOAD_GEN_TARGET_PCT, LOAD_GEN_PERIOD_MS, 
+	LOAD_GEN_ON_MS, LOAD_GEN_OFF_MS, LOAD_GEN_MEM_BYTES, LOAD_GEN_PERIODIC_WORK_US, 
+	LOAD_GEN_DEADLINE_US};
+volatile LOAD_GEN_STATS_T Load_Gen_Stats;
+
+static uint32_t Next_Burst;   // SDS_Cycles of next burst's release
+static uint32_t Pattern_ms;   // Time into the on/off pattern
+static uint32_t Mem_Src[LOAD_GEN_MEM_MAX/4], Mem_Dst[LOAD_GEN_MEM_MAX/4];
+
+#define CYCLES_TO_US(c) ((c)/(SystemCoreClock/1000000))
+#define US_TO_CYCLES(us) ((us)*(SystemCoreClock/1000000))
+
+// One step of the Nilakantha series for pi, restarted once it converges
+static void Load_Work_Unit(void) {
+	static int n=2;
+	static double my_pi=3.0;
+	double term, prev_pi;
+	uint32_t i, words;
+	
+	term = 4.0/(n*(n+1.0)*(n+2.0));
+	if (n&4) { // is multiple of four
+		term = -term;
+	}
+	prev_pi = my_pi;
+	my_pi += term;
+	if (my_pi != prev_pi) {
+		n += 2;
+	} else {
+		n = 2;
+		my_pi = 3.0;
+	}
+	words = Load_Gen_Cfg.Mem_Bytes/4;
+	if (words > LOAD_GEN_MEM_MAX/4)
+		words = LOAD_GEN_MEM_MAX/4;
+	for (i = 0; i < words; i++)
+		((volatile uint32_t *) Mem_Dst)[i] = ((volatile uint32_t *) Mem_Src)[i] + i;
+	Load_Gen_Stats.Mem_Bytes += words*4;
+}
+
+// Work until us have passed, returns the time taken
+static uint32_t Load_Burn(uint32_t us) {
+	uint32_t start = SDS_Cycles();
+	
+	do {
+		Load_Work_Unit();
+	} while (SDS_Cycles() - start < US_TO_CYCLES(us));
+	return CYCLES_TO_US(SDS_Cycles() - start);
+}
+
+void Load_Gen_Idle(void) {
+	uint32_t now, period, cycle;
+	
+	if ((Load_Gen_Cfg.Target_pct == 0) || (Load_Gen_Cfg.Period_ms == 0))
+		return;
+	now = SDS_Cycles();
+	if ((int32_t) (now - Next_Burst) < 0)
+		return;
+	period = US_TO_CYCLES(Load_Gen_Cfg.Period_ms*1000);
+	Next_Burst += period;
+	if ((int32_t) (now - Next_Burst) >= 0) { // Fell a whole period behind
+		Load_Gen_Stats.Dropped++;
+		Next_Burst = now + period;
+	}
+	cycle = Load_Gen_Cfg.On_ms + Load_Gen_Cfg.Off_ms;
+	Pattern_ms = (Pattern_ms + Load_Gen_Cfg.Period_ms) % (cycle ? cycle : 1);
+	if (Load_Gen_Cfg.Off_ms && (Pattern_ms >= Load_Gen_Cfg.On_ms))
+		return; // Off phase
+	Load_Gen_Stats.Bursts++;
+	Load_Gen_Stats.Busy_us += Load_Burn(Load_Gen_Cfg.Period_ms*10*Load_Gen_Cfg.Target_pct);
+}
+
+#if USE_LOAD_GEN_PERIODIC
+static uint32_t Periodic_Mask;
+static volatile uint32_t Release_Cycles;
+static volatile uint8_t Periodic_Pending;
+
+void PIT_IRQHandler(void) {
+	PIT_TFLG0 = PIT_TFLG_TIF_MASK;
+	if (Periodic_Pending)
+		Load_Gen_Stats.Misses++; // Previous release never finished
+	Release_Cycles = SDS_Cycles();
+	Periodic_Pending = 1;
+	Load_Gen_Stats.Releases++;
+	Sched_Set_Ready(Periodic_Mask);
+}
+
+static void Task_Load_Periodic(void) {
+	uint32_t us;
+	
+	if (!Periodic_Pending)
+		return;
+	Load_Burn(Load_Gen_Cfg.Periodic_Work_us);
+	us = CYCLES_TO_US(SDS_Cycles() - Release_Cycles);
+	Load_Gen_Stats.Last_Response_us = us;
+	if (us > Load_Gen_Stats.Max_Response_us)
+		Load_Gen_Stats.Max_Response_us = us;
+	if (us > Load_Gen_Cfg.Deadline_us)
+		Load_Gen_Stats.Misses++;
+	Periodic_Pending = 0;
+}
+#endif
+
+void Load_Gen_Init(uint8_t priority) {
+	Next_Burst = SDS_Cycles();
+	Pattern_ms = 0;
+#if USE_LOAD_GEN_PERIODIC
+	Periodic_Mask = Sched_Add_Task(Task_Load_Periodic, priority);
+	SIM_SCGC6 |= SIM_SCGC6_PIT_MASK;
+	PIT_MCR = 0;                        // Enable module, run in debug mode
+	PIT_LDVAL0 = (SystemCoreClock/2/1000)*LOAD_GEN_PERIODIC_MS - 1; // Bus clock
+	PIT_TFLG0 = PIT_TFLG_TIF_MASK;
+	NVIC_SetPriority(PIT_IRQn, 2);
+	NVIC_ClearPendingIRQ(PIT_IRQn);
+	NVIC_EnableIRQ(PIT_IRQn);
+	PIT_TCTRL0 = PIT_TCTRL_TIE_MASK | PIT_TCTRL_TEN_MASK;
+#else
+	(void) priority;
+#endif
+}
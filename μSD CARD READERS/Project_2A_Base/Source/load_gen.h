@@ -0,0 +1,55 @@
+#ifndef LOAD_GEN_H
+#define LOAD_GEN_H
+#include <stdint.h>
+
+// Synthetic CPU load for benchmarking the SD server under contention.
+// Background load: the idle function burns Target_pct of every Period_ms in one 
+// run-to-completion burst, so a task made ready meanwhile waits for the burst to end.
+// Bursts only come during On_ms of every On_ms+Off_ms (Off_ms 0: always). A burst 
+// more than a period late is dropped, not caught up. Each unit of work is a 
+// floating point series step plus, if Mem_Bytes, a copy of that many bytes.
+// Periodic task (USE_LOAD_GEN_PERIODIC): PIT channel 0 releases a task above the SD
+// server every Periodic_ms, which burns Periodic_Work_us and must finish within 
+// Deadline_us of its release.
+// Load_Gen_Cfg may be changed with the debugger while running.
+
+#define USE_LOAD_GEN_PERIODIC (0)
+
+#define LOAD_GEN_TARGET_PCT   (0)     // 0: no background load
+#define LOAD_GEN_PERIOD_MS    (10)
+#define LOAD_GEN_ON_MS        (1000)
+#define LOAD_GEN_OFF_MS       (0)
+#define LOAD_GEN_MEM_BYTES    (0)     // Up to LOAD_GEN_MEM_MAX
+#define LOAD_GEN_MEM_MAX      (1024)
+#define LOAD_GEN_PERIODIC_MS  (5)
+#define LOAD_GEN_PERIODIC_WORK_US (200)
+#define LOAD_GEN_DEADLINE_US  (1000)
+
+typedef struct {
+	uint32_t Target_pct;
+	uint32_t Period_ms;
+	uint32_t On_ms, Off_ms;
+	uint32_t Mem_Bytes;
+	uint32_t Periodic_Work_us;
+	uint32_t Deadline_us;
+} LOAD_GEN_CFG_T;
+
+typedef struct {
+	uint32_t Bursts;
+	uint32_t Dropped;         // Bursts more than a period late
+	uint32_t Busy_us;         // In bursts
+	uint32_t Mem_Bytes;       // Copied, wraps
+	uint32_t Releases;        // Periodic task
+	uint32_t Misses;          // Finished after Deadline_us, or released again before finishing
+	uint32_t Last_Response_us, Max_Response_us;
+} LOAD_GEN_STATS_T;
+
+extern volatile LOAD_GEN_CFG_T Load_Gen_Cfg;
+extern volatile LOAD_GEN_STATS_T Load_Gen_Stats;
+
+// Call after SDS_Init. Adds the periodic task at priority if enabled.
+void Load_Gen_Init(uint8_t priority);
+// Background load, call from the scheduler's idle function
+void Load_Gen_Idle(void);
+
+#endif
@@ -5,64 +5,79 @@
 #include "sd_server.h"
 #include "LEDs.h"
 #include "debug.h"
+#include "sd_bench.h"
+#include "scheduler.h"
+#include "load_gen.h"
+#include "perf_run.h"
 
 #define NUM_SECTORS_TO_READ (100)
+#ifndef USE_SD_BENCH
+#define USE_SD_BENCH (USE_PERF_RUN) // 1: run Task_Bench_SD instead of Task_Test_SD
+#endif
+#ifndef USE_WFI_IDLE
+#define USE_WFI_IDLE (0)      // 1: sleep when no task is ready instead of running Task_Makework
+#endif
 
 static SD_DEV dev[1];          // SD device descriptor
 static uint8_t buffer[512];    // Buffer for SD read or write data
+static uint8_t buffer_b[512];  // Second buffer for streaming reads
 
+// Task priorities, 0 is highest. Task_Makework only runs when no task is ready.
+#define PRIO_LOAD_PERIODIC (0)
+#define PRIO_SD_SERVER (1)
+#define PRIO_TEST_SD   (2)
+
+static uint32_t Test_SD_Mask;   // Scheduler bit of Task_Test_SD (or Task_Bench_SD)
+static int Test_SD_Waiting = 0; // Task_Test_SD need not run until its transaction is done
+
+// Called by SD server when test_trans is done
+static void Test_SD_Done(SDS_TD_T * t) {
+	Test_SD_Waiting = 0;
+	Sched_Set_Ready(Test_SD_Mask);
+}
+
+static SDS_TD_T test_trans = {REQ_NONE, 0, (uint8_t * ) 0, 0, 1, STAT_IDLE, SD_OK, 
+	Test_SD_Done, 0, 0};
+static SDS_STREAM_T test_stream; // Reads NUM_SECTORS_TO_READ sectors into buffer and buffer_b
+
+// Idle function: counts passes for the benchmark's leftover CPU figure, runs background load
 void Task_Makework(){
-	static int n=2;
-	static int done = 0;
-	static double my_pi=3.0;
-	double term, prev_pi=0.0;
-	
-	// set task debug bit
-	
-	// Nilakantha Series to approximate pi
-	if (!done) {
-		term = 4.0/(n*(n+1.0)*(n+2.0));
-		if (n&4) { // is multiple of four
-			term = -term;
-		}
-		prev_pi = my_pi;
-		my_pi += term;
-		if (my_pi != prev_pi) {
-			n += 2;
-		} else {
-			// Done with approximating pi
-			done = 1; 
-		}
-	}	
-	// clear task debug bit
+	SD_Bench_Idle_Work++;
+	Load_Gen_Idle();
 }
 
 void Task_Test_SD(void) {
 	// Write test data to given block (sector_num) in flash. 
 	// Read it back, compute simple checksum to confirm it is correct.
 	static enum {S_INIT, S_INIT_WAIT, S_TEST_READ, S_TEST_READ_WAIT, 
-		S_TEST_WRITE, S_TEST_WRITE_WAIT, S_TEST_VERIFY, S_TEST_VERIFY_WAIT,
+		S_TEST_WRITE, S_TEST_WRITE_WAIT, S_TEST_FLUSH, S_TEST_FLUSH_WAIT, 
+		S_TEST_VERIFY, S_TEST_VERIFY_WAIT,
 		S_ERROR} next_state = S_INIT;
 	static int i;
-	static DWORD sector_num = 0, read_sector_count=0; 
+	static DWORD sector_num = 0; 
 	static uint32_t sum=0;
+	uint8_t * data;
+	SDRESULTS res;
 	//	static char err_color_code = 0; // xxxxxRGB
 	
 	switch (next_state) {
 		case S_INIT:
-			// wait until SD server is idle
-			if (g_trans.Status == STAT_IDLE) {
+			// wait until transaction object is idle
+			if (test_trans.Status == STAT_IDLE) {
 				// Common settings for all transactions for this task
-				g_trans.Device = dev;
-				g_trans.Data = buffer;
+				test_trans.Device = dev;
+				test_trans.Data = buffer;
 				// request SD card initialization
-				g_trans.Request = REQ_INIT;
-				next_state = S_INIT_WAIT;
+				test_trans.Request = REQ_INIT;
+				if (SDS_Enqueue(&test_trans)) {
+					next_state = S_INIT_WAIT;
+					Test_SD_Waiting = 1;
+				}
 			}
 			break;
 		case S_INIT_WAIT:
-			if ((g_trans.Status == STAT_IDLE) && (g_trans.Request == REQ_NONE)) {
-				if (g_trans.ErrorCode == SD_OK) {
+			if ((test_trans.Status == STAT_IDLE) && (test_trans.Request == REQ_NONE)) {
+				if (test_trans.ErrorCode == SD_OK) {
 					Control_RGB_LEDs(0, 1, 1); // Cyan: initialized OK
 					next_state = S_TEST_READ;
 				} else {
@@ -71,36 +86,34 @@ void Task_Test_SD(void) {
 			} // else keep waiting in this state, since server not done
 			break;
 		case S_TEST_READ:
-			// wait until SD server is idle
-			if (g_trans.Status == STAT_IDLE) {
-				// erase buffer
-				for (i=0; i<SD_BLK_SIZE; i++)
-					buffer[i] = 0;
-				// request SD card read
-				g_trans.Sector = sector_num;
-				g_trans.Request = REQ_READ;				
-				next_state = S_TEST_READ_WAIT;
-			}
+			// stream sectors, server fills one buffer while the other is checksummed
+			SDS_Stream_Start(&test_stream, dev, sector_num, NUM_SECTORS_TO_READ, 
+				buffer, buffer_b, Test_SD_Done);
+			sum = 0;
+			next_state = S_TEST_READ_WAIT;
 			break;
 		case S_TEST_READ_WAIT:
-			if ((g_trans.Status == STAT_IDLE) && (g_trans.Request == REQ_NONE)) {
-				if (g_trans.ErrorCode == SD_OK) { // Read was OK
+			data = SDS_Stream_Get(&test_stream, &res);
+			if (data) {
+				if (res == SD_OK) { // Read was OK
 					Control_RGB_LEDs(0, 0, 1); // Blue: Read OK
-					if (++read_sector_count < NUM_SECTORS_TO_READ) {
-						next_state = S_TEST_READ;
-					} else {
-						next_state = S_TEST_WRITE;
-						read_sector_count = 0;
-						sector_num++; // Advance to next sector
-					}
+					for (i = 0; i < SD_BLK_SIZE; i++)
+						sum += data[i];
+					SDS_Stream_Release(&test_stream);
 				} else {
 					next_state = S_ERROR;
 				}
-			} // else keep waiting in this state, since server not done
+			} else if (SDS_Stream_Done(&test_stream)) {
+				next_state = S_TEST_WRITE;
+				sector_num++; // Advance to next sector
+			} else {
+				// Wait for server unless the read is still to be queued
+				Test_SD_Waiting = (test_stream.State[test_stream.Client] == STREAM_READ);
+			}
 			break;
 		case S_TEST_WRITE:
-			// wait until SD server is idle
-			if (g_trans.Status == STAT_IDLE) {
+			// wait until transaction object is idle
+			if (test_trans.Status == STAT_IDLE) {
 				// Initialize data buffer
 				for (i=0; i<SD_BLK_SIZE; i++)
 					buffer[i] = 0;
@@ -109,15 +122,37 @@ void Task_Test_SD(void) {
 				*(uint64_t *)(&buffer[508]) = 0xACE0FC0D;
 				// Write the data into given sector
 				// request SD card write
-				g_trans.Sector = sector_num;
-				g_trans.Request = REQ_WRITE;				
-				next_state = S_TEST_WRITE_WAIT;
+				test_trans.Sector = sector_num;
+				test_trans.Request = REQ_WRITE;
+				if (SDS_Enqueue(&test_trans)) {
+					next_state = S_TEST_WRITE_WAIT;
+					Test_SD_Waiting = 1;
+				}
 			}
 			break;
 		case S_TEST_WRITE_WAIT:			
-			if ((g_trans.Status == STAT_IDLE) && (g_trans.Request == REQ_NONE)) {
-				if (g_trans.ErrorCode == SD_OK) {
+			if ((test_trans.Status == STAT_IDLE) && (test_trans.Request == REQ_NONE)) {
+				if (test_trans.ErrorCode == SD_OK) {
 					Control_RGB_LEDs(1, 0, 1); // Magenta: Wrote OK
+					next_state = S_TEST_FLUSH;
+				} else {
+					next_state = S_ERROR;
+				}
+			} // else keep waiting in this state, since server not done
+			break;
+		case S_TEST_FLUSH:
+			// Make sure data is on card (not just in write-back buffer) before verifying it
+			if (test_trans.Status == STAT_IDLE) {
+				test_trans.Request = REQ_FLUSH;
+				if (SDS_Enqueue(&test_trans)) {
+					next_state = S_TEST_FLUSH_WAIT;
+					Test_SD_Waiting = 1;
+				}
+			}
+			break;
+		case S_TEST_FLUSH_WAIT:
+			if ((test_trans.Status == STAT_IDLE) && (test_trans.Request == REQ_NONE)) {
+				if (test_trans.ErrorCode == SD_OK) {
 					next_state = S_TEST_VERIFY;
 				} else {
 					next_state = S_ERROR;
@@ -125,20 +160,23 @@ void Task_Test_SD(void) {
 			} // else keep waiting in this state, since server not done
 			break;
 		case S_TEST_VERIFY:
-			// wait until SD server is idle
-			if (g_trans.Status == STAT_IDLE) {
+			// wait until transaction object is idle
+			if (test_trans.Status == STAT_IDLE) {
 				// erase buffer
 				for (i=0; i<SD_BLK_SIZE; i++)
 					buffer[i] = 0;
 				// request SD card read
-				g_trans.Sector = sector_num;
-				g_trans.Request = REQ_READ;				
-				next_state = S_TEST_VERIFY_WAIT;
+				test_trans.Sector = sector_num;
+				test_trans.Request = REQ_READ;
+				if (SDS_Enqueue(&test_trans)) {
+					next_state = S_TEST_VERIFY_WAIT;
+					Test_SD_Waiting = 1;
+				}
 			}
 			break;
 		case S_TEST_VERIFY_WAIT:
-			if ((g_trans.Status == STAT_IDLE) && (g_trans.Request == REQ_NONE)) {
-				if (g_trans.ErrorCode == SD_OK) { // Read was OK
+			if ((test_trans.Status == STAT_IDLE) && (test_trans.Request == REQ_NONE)) {
+				if (test_trans.ErrorCode == SD_OK) { // Read was OK
 					Control_RGB_LEDs(0, 0, 1); // Blue: Read OK
 					for (i = 0, sum = 0; i < SD_BLK_SIZE; i++)
 						sum += buffer[i];			
@@ -159,15 +197,42 @@ void Task_Test_SD(void) {
 				;
 			break;
 	}
+	if (!Test_SD_Waiting) // Else Test_SD_Done makes task ready
+		Sched_Set_Ready(Test_SD_Mask);
 	// clear task debug bit
 }
 
-void Scheduler(void) {
-	while (1) {
-		Task_SD_Server();
-		Task_Test_SD();
-		Task_Makework();
+#if USE_SD_BENCH
+// Benchmark, readied by the SD server's completions (see Task_Bench_SD)
+void Task_Bench(void) {
+#if USE_PERF_RUN
+	static int reported = 0;
+#endif
+	
+	Task_Bench_SD();
+#if USE_PERF_RUN
+	if (SD_Bench.Done && !reported) {
+		reported = 1;
+		Perf_Run_Report();
 	}
+#endif
+}
+#endif
+
+void Scheduler(void) {
+	SDS_Init(Sched_Add_Task(Task_SD_Server, PRIO_SD_SERVER));
+	Load_Gen_Init(PRIO_LOAD_PERIODIC);
+#if USE_SD_BENCH
+	Test_SD_Mask = Sched_Add_Task(Task_Bench, PRIO_TEST_SD);
+	SD_Bench_Init(Test_SD_Mask);
+#else
+	Test_SD_Mask = Sched_Add_Task(Task_Test_SD, PRIO_TEST_SD);
+#endif
+#if USE_WFI_IDLE
+	Sched_Run(0);
+#else
+	Sched_Run(Task_Makework);
+#endif
 }
 
 int main(void) {
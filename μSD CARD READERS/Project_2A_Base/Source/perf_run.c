@@ -0,0 +1,84 @@
+/*
+ * Performance regression record: benchmark results as text, out over semihosting.
+ */
+
+#include <MKL25Z4.h>
+#include "perf_run.h"
+#include "sd_bench.h"
+#include "scheduler.h"
+
+char Perf_Record[PERF_REC_MAX];
+uint32_t Perf_Record_Len = 0;
+
+static char * Rec_End;         // Building position
+static uint32_t Rec_Metrics;
+
+static char * Perf_Put_Str(char * p, const char * s) {
+	while (*s)
+		*p++ = *s++;
+	*p = '\0';
+	return p;
+}
+
+static char * Perf_Put_Int(char * p, int32_t v) {
+	char tmp[11];
+	uint32_t mag = (v < 0) ? -(uint32_t) v : (uint32_t) v;
+	int n = 0;
+	
+	do {
+		tmp[n++] = '0' + mag % 10;
+		mag /= 10;
+	} while (mag);
+	if (v < 0)
+		*p++ = '-';
+	while (n)
+		*p++ = tmp[--n];
+	*p = '\0';
+	return p;
+}
+
+void Perf_Begin(const char * project) {
+	Perf_Record_Len = 0;
+	Rec_Metrics = 0;
+	Rec_End = Perf_Put_Str(Perf_Record, "PERF ");
+	Rec_End = Perf_Put_Int(Rec_End, PERF_REC_VERSION);
+	Rec_End = Perf_Put_Str(Perf_Put_Str(Rec_End, " "), project);
+	Rec_End = Perf_Put_Str(Rec_End, " " __DATE__ " " __TIME__ "\n");
+}
+
+// Dropped if the record is full, so END's count no longer matches
+void Perf_Metric(const char * name, int32_t value, const char * unit, char dir) {
+	char dir_str[2] = {dir, '\0'};
+	
+	if (Rec_End + PERF_LINE_MAX + 16 > Perf_Record + PERF_REC_MAX) // Room for END too
+		return;
+	Rec_End = Perf_Put_Str(Perf_Put_Str(Rec_End, name), " ");
+	Rec_End = Perf_Put_Str(Perf_Put_Int(Rec_End, value), " ");
+	Rec_End = Perf_Put_Str(Perf_Put_Str(Perf_Put_Str(Rec_End, unit), " "), dir_str);
+	Rec_End = Perf_Put_Str(Rec_End, "\n");
+	Rec_Metrics++;
+}
+
+void Perf_End(void) {
+	Rec_End = Perf_Put_Str(Rec_End, "END ");
+	Rec_End = Perf_Put_Str(Perf_Put_Int(Rec_End, Rec_Metrics), "\n");
+	Perf_Record_Len = Rec_End - Perf_Record;
+	__semihost(SYS_WRITE0, Perf_Record); // Halts here without a debugger attached
+}
+
+void Perf_Run_Report(void) {
+	Perf_Begin("P2A");
+	Perf_Metric("sd.error", SD_Bench.Error, "code", '-');
+	Perf_Metric("sd.read.kbps", SD_Bench.Read.KBps, "KB/s", '+');
+	Perf_Metric("sd.read.mean", SD_Bench.Read.Mean_us, "us", '-');
+	Perf_Metric("sd.read.max", SD_Bench.Read.Max_us, "us", '-');
+	Perf_Metric("sd.write.kbps", SD_Bench.Write.KBps, "KB/s", '+');
+	Perf_Metric("sd.write.mean", SD_Bench.Write.Mean_us, "us", '-');
+	Perf_Metric("sd.write.max", SD_Bench.Write.Max_us, "us", '-');
+	Perf_Metric("sd.elapsed", SD_Bench.Elapsed_ms, "ms", '-');
+	Perf_Metric("sd.leftover", SD_Bench.Leftover_pm, "pm", '+');
+	Perf_Metric("sched.wakes", Sched_Stats.Wakes, "n", '=');
+	Perf_Metric("sched.wake_max", Sched_Stats.Wake_Max_us, "us", '-');
+	Perf_Metric("sched.late_wakes", Sched_Stats.Late_Wakes, "n", '-');
+	Perf_End();
+}
@@ -0,0 +1,34 @@
+#ifndef PERF_RUN_H
+#define PERF_RUN_H
+#include <stdint.h>
+
+// Performance regression runner. A build with USE_PERF_RUN runs the SD benchmark
+// (sd_bench.h) and then writes its results once over semihosting (SYS_WRITE0) as a
+// text record, version PERF_REC_VERSION:
+//   PERF <version> <project> <build date and time>
+//   <metric> <value> <unit> <dir>     dir: - lower is better, + higher is better,
+//                                     = for information only
+//   END <number of metric lines>
+// The record also stays in Perf_Record. Scripts/perf_compare.py (top of the repo)
+// compares it with a stored baseline (Host/perf_baseline_fast.txt). Metric names
+// stay fixed; a changed meaning gets a new version.
+
+#ifndef USE_PERF_RUN
+#define USE_PERF_RUN (0)
+#endif
+
+#define PERF_REC_VERSION (2)
+#define PERF_REC_MAX     (1024)
+#define PERF_LINE_MAX    (64)      // Longest metric line
+#define SYS_WRITE0       (0x04)    // Semihosting operation: write a string
+
+extern char Perf_Record[PERF_REC_MAX];
+extern uint32_t Perf_Record_Len;  // 0 until the record is complete
+
+void Perf_Begin(const char * project);
+void Perf_Metric(const char * name, int32_t value, const char * unit, char dir);
+void Perf_End(void);              // Completes the record and writes it out
+// Record SD_Bench and the scheduler statistics, call once SD_Bench.Done
+void Perf_Run_Report(void);
+
+#endif
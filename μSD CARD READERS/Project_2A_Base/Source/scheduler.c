@@ -0,0 +1,93 @@
+/*
+ * Priority-based cooperative scheduler with ready masks.
+ */
+
+#include <MKL25Z4.h>
+#include "scheduler.h"
+#include "sd_server.h"
+
+typedef struct {
+	SCHED_TASK_FN_T Fn;
+	uint32_t Mask;
+	uint8_t Priority;
+} SCHED_TASK_T;
+
+// Kept sorted by priority, so first ready entry is the one to run
+static SCHED_TASK_T Sched_Tasks[SCHED_MAX_TASKS];
+static uint8_t Sched_Num_Tasks = 0;
+volatile uint32_t Sched_Ready = 0;
+volatile SCHED_STATS_T Sched_Stats;
+
+#define CYCLES_TO_US(c) ((c)/(SystemCoreClock/1000000))
+
+uint32_t Sched_Add_Task(SCHED_TASK_FN_T fn, uint8_t priority) {
+	int i;
+	uint32_t mask;
+	
+	if (Sched_Num_Tasks == SCHED_MAX_TASKS)
+		return 0;
+	mask = 1UL << Sched_Num_Tasks;
+	for (i = Sched_Num_Tasks; (i > 0) && (Sched_Tasks[i-1].Priority > priority); i--)
+		Sched_Tasks[i] = Sched_Tasks[i-1];
+	Sched_Tasks[i].Fn = fn;
+	Sched_Tasks[i].Mask = mask;
+	Sched_Tasks[i].Priority = priority;
+	Sched_Num_Tasks++;
+	Sched_Set_Ready(mask);
+	return mask;
+}
+
+void Sched_Set_Ready(uint32_t mask) {
+	uint32_t primask = __get_PRIMASK();
+	
+	__disable_irq();
+	Sched_Ready |= mask;
+	__set_PRIMASK(primask);
+}
+
+// Sleep until an interrupt, then let it run. Returns cycle count at WFI exit.
+static uint32_t Sched_Sleep(void) {
+	uint32_t start, wake;
+	
+	__disable_irq();
+	if (Sched_Ready) { // Made ready since dispatcher looked
+		__enable_irq();
+		return 0;
+	}
+	start = SDS_Cycles();
+	__WFI(); // Wakes on pending interrupt even with PRIMASK set
+	wake = SDS_Cycles();
+	__enable_irq(); // ISR runs here
+	Sched_Stats.Sleeps++;
+	Sched_Stats.Sleep_us += CYCLES_TO_US(wake - start);
+	return wake;
+}
+
+void Sched_Run(SCHED_TASK_FN_T idle_fn) {
+	int i;
+	uint32_t wake = 0, us;
+	
+	while (1) {
+		for (i = 0; (i < Sched_Num_Tasks) && !(Sched_Ready & Sched_Tasks[i].Mask); i++)
+			;
+		if (i < Sched_Num_Tasks) {
+			__disable_irq();
+			Sched_Ready &= ~Sched_Tasks[i].Mask;
+			__enable_irq();
+			if (wake) { // First dispatch after sleeping
+				us = CYCLES_TO_US(SDS_Cycles() - wake);
+				Sched_Stats.Wakes++;
+				if (us > Sched_Stats.Wake_Max_us)
+					Sched_Stats.Wake_Max_us = us;
+				if (us > SCHED_WAKE_BOUND_US)
+					Sched_Stats.Late_Wakes++;
+				wake = 0;
+			}
+			Sched_Tasks[i].Fn();
+		} else if (idle_fn) {
+			idle_fn();
+		} else {
+			wake = Sched_Sleep();
+		}
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#include <stdint.h>
+
+// Run-to-completion scheduler. Each task owns one ready bit. The dispatcher
+// clears the bit and runs the highest priority ready task, then looks again.
+// A task stays runnable only if someone (itself, another task or an ISR) sets its bit.
+
+#define SCHED_MAX_TASKS (8)
+#define SCHED_WAKE_BOUND_US (20)  // Wake-ups slower than this count as Late_Wakes
+
+// Low-power idle statistics, times from SDS_Cycles
+typedef struct {
+	uint32_t Sleeps;          // WFI executions
+	uint32_t Sleep_us;        // Total time asleep
+	uint32_t Wakes;           // Sleeps ended by a task becoming ready
+	uint32_t Wake_Max_us;     // Longest time from WFI exit to dispatch
+	uint32_t Late_Wakes;      // Wakes over SCHED_WAKE_BOUND_US
+} SCHED_STATS_T;
+
+typedef void (*SCHED_TASK_FN_T)(void);
+
+// Register fn with priority (0 is highest), returns its ready mask (0 if table full).
+// Task starts ready.
+uint32_t Sched_Add_Task(SCHED_TASK_FN_T fn, uint8_t priority);
+// Mark tasks in mask ready, safe to call from ISRs
+void Sched_Set_Ready(uint32_t mask);
+// Dispatch forever, calls idle_fn whenever no task is ready. If idle_fn is 0 the CPU
+// sleeps (WFI) until an interrupt instead; SysTick bounds each sleep to 1 ms.
+void Sched_Run(SCHED_TASK_FN_T idle_fn);
+
+extern volatile uint32_t Sched_Ready;
+extern volatile SCHED_STATS_T Sched_Stats;
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * SD throughput and latency benchmark, runs in place of Task_Test_SD.
+ * Phases: init, idle baseline, reads, writes (with final flush). Results in SD_Bench.
+ */
+
+#include <MKL25Z4.h>
+#include "sd_bench.h"
+#include "sd_server.h"
+#include "LEDs.h"
+#include "scheduler.h"
+
+volatile SD_BENCH_T SD_Bench;
+volatile uint32_t SD_Bench_Idle_Work = 0;
+
+static SD_DEV bench_dev[1];
+static uint8_t bench_buffer[SD_BENCH_BLOCKS][SD_BLK_SIZE];
+static volatile uint32_t Bench_Events = 0;
+#define EV_BENCH_DONE (1UL << 0)
+static uint32_t Bench_Mask;     // Scheduler bit of the task running Task_Bench_SD
+
+// Called by SD server when bench_trans is done
+static void Bench_Done(SDS_TD_T * t) {
+	Sched_Set_Ready(Bench_Mask);
+}
+
+static SDS_TD_T bench_trans = {REQ_NONE, 0, (uint8_t * ) 0, 0, SD_BENCH_BLOCKS, STAT_IDLE, SD_OK, 
+	Bench_Done, &Bench_Events, EV_BENCH_DONE};
+
+// Idle measure: makework passes, or us asleep with USE_WFI_IDLE. Only one of them grows.
+static uint32_t Bench_Idle(void) {
+	return SD_Bench_Idle_Work + Sched_Stats.Sleep_us;
+}
+
+#define CYCLES_TO_US(c) ((c)/(SystemCoreClock/1000000))
+
+void SD_Bench_Sample(volatile SD_BENCH_STATS_T * s, uint32_t bytes, uint32_t us) {
+	uint32_t b;
+	
+	if ((s->Count == 0) || (us < s->Min_us))
+		s->Min_us = us;
+	if (us > s->Max_us)
+		s->Max_us = us;
+	s->Count++;
+	s->Bytes += bytes;
+	s->Total_us += us;
+	for (b = 0; (b < SD_BENCH_HIST_BINS - 1) && (us >> (b + 1)); b++)
+		;
+	s->Hist[b]++;
+}
+
+static void Bench_Stats_Finish(volatile SD_BENCH_STATS_T * s) {
+	if (s->Count)
+		s->Mean_us = s->Total_us / s->Count;
+	if (s->Total_us)
+		s->KBps = (uint32_t) (((uint64_t) s->Bytes * 1000000) / 1024 / s->Total_us);
+}
+
+void SD_Bench_Finish(void) {
+	Bench_Stats_Finish(&SD_Bench.Read);
+	Bench_Stats_Finish(&SD_Bench.Write);
+	if (SD_Bench.Baseline_Idle)
+		SD_Bench.Leftover_pm = (SD_Bench.Run_Idle * 1000) / SD_Bench.Baseline_Idle;
+	SD_Bench.Done = 1;
+}
+
+// Sector for next request of the phase
+static DWORD Bench_Sector(uint32_t n) {
+	static uint32_t seed = 12345;
+	
+	if (SD_BENCH_PATTERN == SD_BENCH_SEQUENTIAL)
+		return SD_BENCH_START + (n * SD_BENCH_BLOCKS) % SD_BENCH_SPAN;
+	seed = seed * 1103515245 + 12345; // LCG, same sequence every run
+	return SD_BENCH_START + ((seed >> 8) % (SD_BENCH_SPAN / SD_BENCH_BLOCKS)) * SD_BENCH_BLOCKS;
+}
+
+static int Bench_Is_Write(int phase_write) {
+	static uint32_t seed = 54321;
+	
+	if (SD_BENCH_PATTERN != SD_BENCH_MIXED)
+		return phase_write;
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 8) % 100) < SD_BENCH_WRITE_PCT;
+}
+
+static int Bench_Issue(SDS_REQ_T req, DWORD sector) {
+	bench_trans.Request = req;
+	bench_trans.Sector = sector;
+	Bench_Events &= ~EV_BENCH_DONE;
+	return SDS_Enqueue(&bench_trans);
+}
+
+void SD_Bench_Init(uint32_t ready_mask) {
+	Bench_Mask = ready_mask;
+}
+
+void Task_Bench_SD(void) {
+	static enum {B_INIT, B_INIT_WAIT, B_BASELINE, B_ISSUE, B_WAIT, B_PACE, B_FLUSH, B_FLUSH_WAIT, B_DONE} 
+		next_state = B_INIT;
+	static uint32_t start_cycles, phase_start_ms, idle_start, n;
+	static int phase_write, is_write;
+	uint32_t us;
+	
+	switch (next_state) {
+		case B_INIT:
+			if (bench_trans.Status == STAT_IDLE) {
+				bench_trans.Device = bench_dev;
+				bench_trans.Data = bench_buffer[0];
+				if (Bench_Issue(REQ_INIT, 0))
+					next_state = B_INIT_WAIT;
+			}
+			break;
+		case B_INIT_WAIT:
+			if (Bench_Events & EV_BENCH_DONE) {
+				if (bench_trans.ErrorCode != SD_OK) {
+					SD_Bench.Error = bench_trans.ErrorCode;
+					next_state = B_DONE;
+				} else {
+					Control_RGB_LEDs(0, 1, 1); // Cyan: initialized OK
+					phase_start_ms = SDS_Time_ms;
+					idle_start = Bench_Idle();
+					SDS_Wake_After(SD_BENCH_BASELINE_MS, Bench_Mask);
+					next_state = B_BASELINE;
+				}
+			}
+			break;
+		case B_BASELINE:
+			if (SDS_Time_ms - phase_start_ms >= SD_BENCH_BASELINE_MS) {
+				SD_Bench.Baseline_Idle = (Bench_Idle() - idle_start) / SD_BENCH_BASELINE_MS;
+				phase_start_ms = SDS_Time_ms;
+				idle_start = Bench_Idle();
+				phase_write = 0;
+				n = 0;
+				next_state = B_ISSUE;
+			}
+			break;
+		case B_ISSUE:
+			is_write = Bench_Is_Write(phase_write);
+			if (is_write)
+				Control_RGB_LEDs(1, 0, 1); // Magenta: writing
+			else
+				Control_RGB_LEDs(0, 0, 1); // Blue: reading
+			start_cycles = SDS_Cycles();
+			if (Bench_Issue((SD_BENCH_BLOCKS == 1) ? (is_write ? REQ_WRITE : REQ_READ) : 
+				(is_write ? REQ_WRITE_MULTI : REQ_READ_MULTI), Bench_Sector(n)))
+				next_state = B_WAIT;
+			break;
+		case B_WAIT:
+			if (Bench_Events & EV_BENCH_DONE) {
+				us = CYCLES_TO_US(SDS_Cycles() - start_cycles);
+				if (bench_trans.ErrorCode != SD_OK) {
+					SD_Bench.Error = bench_trans.ErrorCode;
+					next_state = B_DONE;
+					break;
+				}
+				SD_Bench_Sample(is_write ? &SD_Bench.Write : &SD_Bench.Read, 
+					SD_BENCH_BLOCKS * SD_BLK_SIZE, us);
+				if (++n < SD_BENCH_REQUESTS) {
+					next_state = B_PACE;
+				} else if (!phase_write && (SD_BENCH_PATTERN != SD_BENCH_MIXED)) {
+					phase_write = 1; // Reads done, now same pattern of writes
+					n = 0;
+					next_state = B_PACE;
+				} else {
+					next_state = B_FLUSH;
+				}
+			}
+			break;
+		case B_PACE:
+			next_state = B_ISSUE; // Gap is over
+			break;
+		case B_FLUSH:
+			// Buffered writes count toward write time once they reach the card
+			start_cycles = SDS_Cycles();
+			if (Bench_Issue(REQ_FLUSH, 0))
+				next_state = B_FLUSH_WAIT;
+			break;
+		case B_FLUSH_WAIT:
+			if (Bench_Events & EV_BENCH_DONE) {
+				SD_Bench.Write.Total_us += CYCLES_TO_US(SDS_Cycles() - start_cycles);
+				SD_Bench.Error = bench_trans.ErrorCode;
+				SD_Bench.Elapsed_ms = SDS_Time_ms - phase_start_ms;
+				if (SD_Bench.Elapsed_ms)
+					SD_Bench.Run_Idle = (Bench_Idle() - idle_start) / SD_Bench.Elapsed_ms;
+				SD_Bench_Finish();
+				Control_RGB_LEDs(1, 1, 1); // White: benchmark finished
+				next_state = B_DONE;
+			}
+			break;
+		default:
+		case B_DONE:
+			if (SD_Bench.Error != SD_OK)
+				Control_RGB_LEDs(1, 0, 0);
+			break;
+	}
+	/* Waits end with Bench_Done or SDS_Wake_After, and B_DONE has nothing
+	left to do. The rest have work now, or retry a full queue. */
+	if ((next_state == B_PACE) && SD_BENCH_GAP_MS)
+		SDS_Wake_After(SD_BENCH_GAP_MS, Bench_Mask);
+	else if ((next_state == B_INIT) || (next_state == B_ISSUE) || (next_state == B_PACE) || 
+		(next_state == B_FLUSH))
+		Sched_Set_Ready(Bench_Mask);
+}
@@ -0,0 +1,58 @@
+#ifndef SD_BENCH_H
+#define SD_BENCH_H
+#include <integer.h>
+#include "sd_io.h"
+
+// Access patterns
+#define SD_BENCH_SEQUENTIAL (0)
+#define SD_BENCH_RANDOM     (1)
+#define SD_BENCH_MIXED      (2)   // Random sectors, SD_BENCH_WRITE_PCT of requests write
+
+// Benchmark configuration. Sectors from SD_BENCH_START to SD_BENCH_START+SD_BENCH_SPAN-1 are overwritten!
+#define SD_BENCH_PATTERN     SD_BENCH_SEQUENTIAL
+#define SD_BENCH_BLOCKS      (4)     // Sectors per request, 1 uses single-block requests
+#define SD_BENCH_REQUESTS    (256)   // Requests per phase
+#define SD_BENCH_WRITE_PCT   (30)
+#define SD_BENCH_START       (0x10000UL)
+#define SD_BENCH_SPAN        (0x1000UL)
+#define SD_BENCH_BASELINE_MS (1000)  // Makework rate measured while card is idle
+#define SD_BENCH_GAP_MS      (1)     // Pause after each request (SysTick ms, so up to 1 ms less).
+                                     // 0: back to back, no idle time as the server polls the card
+#define SD_BENCH_HIST_BINS   (16)    // Bin b counts latencies of 2^b..2^(b+1)-1 us
+
+typedef struct {
+	uint32_t Count;      // Requests
+	uint32_t Bytes;
+	uint32_t Total_us;   // Time spent in requests of this type
+	uint32_t Min_us, Mean_us, Max_us;
+	uint32_t KBps;       // Bytes/1024 per second of Total_us
+	uint32_t Hist[SD_BENCH_HIST_BINS];
+} SD_BENCH_STATS_T;
+
+// Read with debugger once Done is 1
+typedef struct {
+	SD_BENCH_STATS_T Read, Write;
+	uint32_t Elapsed_ms;     // Wall time of read and write phases
+	uint32_t Baseline_Idle;  // Idle work per ms with card idle
+	uint32_t Run_Idle;       // Idle work per ms during the phases
+	uint32_t Leftover_pm;    // Run_Idle/Baseline_Idle in 0.1% steps
+	SDRESULTS Error;
+	int Done;
+} SD_BENCH_T;
+
+extern volatile SD_BENCH_T SD_Bench;
+// Incremented by makework once per pass
+extern volatile uint32_t SD_Bench_Idle_Work;
+// With USE_WFI_IDLE the time asleep (Sched_Stats.Sleep_us) stands in for it
+
+// Record one request of bytes taking us
+void SD_Bench_Sample(volatile SD_BENCH_STATS_T * s, uint32_t bytes, uint32_t us);
+// Compute means, throughput and leftover CPU from accumulated values
+void SD_Bench_Finish(void);
+
+// Task_Bench_SD runs as the scheduler task with ready_mask. It readies itself
+// only when it has work, so the idle function (or sleep) gets the rest.
+void SD_Bench_Init(uint32_t ready_mask);
+void Task_Bench_SD(void);
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * LRU sector cache used by SD server in front of SD_Read.
+ * Fully associative, tagged by device and sector.
+ */
+
+#include <string.h>
+#include "sd_cache.h"
+
+#if SD_CACHE_WAYS > 0
+
+typedef struct {
+	SD_DEV * Device; // 0: entry is free
+	DWORD Sector;
+	DWORD Last_Use;  // Value of SD_Cache_Clock at last hit or fill
+	uint8_t Data[SD_BLK_SIZE];
+} SD_CACHE_ENTRY_T;
+
+static SD_CACHE_ENTRY_T SD_Cache[SD_CACHE_WAYS];
+static DWORD SD_Cache_Clock = 0;
+
+int SD_Cache_Lookup(SD_DEV * dev, DWORD sector, uint8_t * dest) {
+	int i;
+	
+	for (i = 0; i < SD_CACHE_WAYS; i++) {
+		if ((SD_Cache[i].Device == dev) && (SD_Cache[i].Sector == sector)) {
+			memcpy(dest, SD_Cache[i].Data, SD_BLK_SIZE);
+			SD_Cache[i].Last_Use = ++SD_Cache_Clock;
+			dev->debug.cache_hit++;
+			return 1;
+		}
+	}
+	dev->debug.cache_miss++;
+	return 0;
+}
+
+int SD_Cache_Contains(SD_DEV * dev, DWORD sector) {
+	int i;
+	
+	for (i = 0; i < SD_CACHE_WAYS; i++) {
+		if ((SD_Cache[i].Device == dev) && (SD_Cache[i].Sector == sector))
+			return 1;
+	}
+	return 0;
+}
+
+void SD_Cache_Fill(SD_DEV * dev, DWORD sector, uint8_t * src) {
+	int i, victim = 0;
+	
+	for (i = 0; i < SD_CACHE_WAYS; i++) {
+		if ((SD_Cache[i].Device == dev) && (SD_Cache[i].Sector == sector)) {
+			victim = i; // Already cached, refresh it
+			break;
+		}
+		if (SD_Cache[i].Device == 0) {
+			victim = i; // Free entry, but keep looking for a match
+		} else if ((SD_Cache[victim].Device != 0) && 
+			(SD_Cache[i].Last_Use < SD_Cache[victim].Last_Use)) {
+			victim = i;
+		}
+	}
+	SD_Cache[victim].Device = dev;
+	SD_Cache[victim].Sector = sector;
+	SD_Cache[victim].Last_Use = ++SD_Cache_Clock;
+	memcpy(SD_Cache[victim].Data, src, SD_BLK_SIZE);
+}
+
+void SD_Cache_Invalidate(SD_DEV * dev, DWORD sector, WORD count) {
+	int i;
+	
+	for (i = 0; i < SD_CACHE_WAYS; i++) {
+		if ((SD_Cache[i].Device == dev) && (SD_Cache[i].Sector >= sector) &&
+			(SD_Cache[i].Sector - sector < count))
+			SD_Cache[i].Device = 0;
+	}
+}
+
+void SD_Cache_Invalidate_Dev(SD_DEV * dev) {
+	int i;
+	
+	for (i = 0; i < SD_CACHE_WAYS; i++) {
+		if (SD_Cache[i].Device == dev)
+			SD_Cache[i].Device = 0;
+	}
+}
+
+#else // No cache: every lookup misses
+
+int SD_Cache_Lookup(SD_DEV * dev, DWORD sector, uint8_t * dest) {
+	return 0;
+}
+
+int SD_Cache_Contains(SD_DEV * dev, DWORD sector) {
+	return 0;
+}
+
+void SD_Cache_Fill(SD_DEV * dev, DWORD sector, uint8_t * src) {
+}
+
+void SD_Cache_Invalidate(SD_DEV * dev, DWORD sector, WORD count) {
+}
+
+void SD_Cache_Invalidate_Dev(SD_DEV * dev) {
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef SD_CACHE_H
+#define SD_CACHE_H
+#include <integer.h>
+#include "sd_io.h"
+
+// Number of cached sectors (ways), 0 removes the cache
+#define SD_CACHE_WAYS (4)
+
+// Copy sector to dest and return 1 if cached, else return 0
+int SD_Cache_Lookup(SD_DEV * dev, DWORD sector, uint8_t * dest);
+// Return 1 if sector is cached, without copying or counting a hit
+int SD_Cache_Contains(SD_DEV * dev, DWORD sector);
+// Load sector data into cache, replacing least recently used entry
+void SD_Cache_Fill(SD_DEV * dev, DWORD sector, uint8_t * src);
+// Drop count sectors starting at sector (e.g. when they are written)
+void SD_Cache_Invalidate(SD_DEV * dev, DWORD sector, WORD count);
+// Drop all sectors of dev (e.g. when card is initialized)
+void SD_Cache_Invalidate_Dev(SD_DEV * dev);
+
+#endif
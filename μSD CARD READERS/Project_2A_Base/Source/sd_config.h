@@ -0,0 +1,26 @@
+#ifndef SD_CONFIG_H
+#define SD_CONFIG_H
+
+/*
+ Build of the shared ulibSD driver (..\..\ulibSD) for this project: the
+ cooperative FSM, stepped by the SD server task, with the SPI timer on
+ the timeout service and the data phase on DMA0 channels 0 and 1.
+*/
+#define SD_IO_MODEL SD_IO_FSM
+#define SPI_TIMER   SPI_TIMER_TIMEOUT
+#define SPI_DMA_CH  SPI_DMA_FIXED
+
+#define SD_IO_WRITE
+#define SD_IO_WRITE_PRE_ERASE   // Send ACMD23 before multi-block writes
+#define SD_IO_USE_DMA           // Move 512 byte data phase with SPI1 DMA
+#define SD_IO_DEFERRED_BUSY     // Finish write when data is accepted, wait for busy before next command
+#define SD_IO_SPEED_STEP_DOWN   // Lower the SPI clock after a data token, reject or CRC error
+// #define SD_IO_CRC            // CMD59 on: send real CRC7/CRC16, check CRC16 of read blocks
+#define SD_IO_WARM_RESTART      // After a reset without power loss, first SD_Init resumes with CMD13
+// #define SD_IO_FAST_INIT      // Spec power-up delay, ctx->idle_ms pauses between ACMD41 polls
+
+// #define SD_IO_DBG_COUNT
+// #define SD_IO_TRACE          // Ring of per-command timing records in SD_Trace
+// #define SD_IO_STATE_PROF     // Steps and cycles of each driver FSM state in SD_State_Prof
+
+#endif // SD_CONFIG_H
@@ -0,0 +1,267 @@
+/*
+ * Append-only batched telemetry log on raw SD sectors, written through the SD server.
+ */
+
+#include <MKL25Z4.h>
+#include <string.h>
+#include "sd_log.h"
+#include "sd_server.h"
+#include "sd_crc.h"
+#include "scheduler.h"
+
+volatile SD_LOG_STATUS_T SD_Log_Status;
+
+// Two batches: one is filled by SD_Log_Append while the other is written
+static uint8_t Log_Buf[2][SD_LOG_BATCH][SD_BLK_SIZE];
+static volatile uint8_t Fill_Buf = 0;       // Batch being filled
+static volatile uint8_t Fill_Sector = 0;    // Sector being filled in that batch
+static volatile uint16_t Fill_Count = 0;    // Records in that sector
+static volatile uint8_t Full_Sectors[2];    // Sectors waiting to be written, 0: batch is free
+static uint8_t Next_Write = 0;              // Batch to write next, the one filled first
+
+static SD_DEV * Log_Dev;
+static DWORD Log_First, Log_Sectors;
+static uint32_t Log_Ready_Mask;
+static uint32_t Base_Seq;                   // Seq of region's first sector
+static DWORD Probe_Lo, Probe_Hi, Probe;     // Binary search for tail
+static volatile int Log_Done_Flag = 0;
+
+static enum {L_OFF, L_START, L_WAIT_FIRST, L_ERASE, L_WAIT_ERASE, L_PROBE, L_WAIT_PROBE, 
+	L_RUN, L_WAIT_WRITE, L_STOP} 
+	Log_State = L_OFF;
+
+static void Log_Done(SDS_TD_T * t) {
+	Log_Done_Flag = 1;
+	Sched_Set_Ready(Log_Ready_Mask);
+}
+
+static SDS_TD_T log_trans = {REQ_NONE, 0, (uint8_t * ) 0, 0, 1, STAT_IDLE, SD_OK, 
+	Log_Done, 0, 0};
+
+static int Log_Issue(SDS_REQ_T req, DWORD index, uint8_t * data, uint16_t count) {
+	log_trans.Request = req;
+	log_trans.Device = Log_Dev;
+	log_trans.Sector = Log_First + index;
+	log_trans.Data = data;
+	log_trans.Count = count;
+	log_trans.End_Sector = Log_First + Log_Sectors - 1; // For REQ_ERASE
+	Log_Done_Flag = 0;
+	return SDS_Enqueue(&log_trans);
+}
+
+static WORD Log_CRC(const uint8_t * sector) {
+	return SD_CRC16(0, sector, SD_BLK_SIZE - 2);
+}
+
+// Returns 1 if sector image belongs to the log at region index
+static int Log_Sector_Valid(const uint8_t * sector, DWORD index) {
+	const SD_LOG_HDR_T * h = (const SD_LOG_HDR_T *) sector;
+	
+	if ((h->Magic != SD_LOG_MAGIC) || (h->Rec_Size != SD_LOG_RECORD_SIZE) ||
+		(Log_CRC(sector) != ((sector[SD_BLK_SIZE-2] << 8) | sector[SD_BLK_SIZE-1])))
+		return 0;
+	return (index == 0) || ((h->Session == SD_Log_Status.Session) && (h->Seq == Base_Seq + index));
+}
+
+void SD_Log_Init(uint32_t ready_mask, SD_DEV * dev, DWORD first, DWORD sectors) {
+	Log_Ready_Mask = ready_mask;
+	Log_Dev = dev;
+	Log_First = first;
+	Log_Sectors = sectors;
+	memset((void *) &SD_Log_Status, 0, sizeof(SD_Log_Status));
+	Log_State = L_START;
+	Sched_Set_Ready(Log_Ready_Mask);
+}
+
+// Finish current sector, call with interrupts masked
+static void Log_Close_Sector(void) {
+	uint8_t other = Fill_Buf ^ 1;
+	
+	((SD_LOG_HDR_T *) Log_Buf[Fill_Buf][Fill_Sector])->Count = Fill_Count;
+	Fill_Count = 0;
+	if (++Fill_Sector == SD_LOG_BATCH) {
+		Full_Sectors[Fill_Buf] = SD_LOG_BATCH;
+		Fill_Sector = 0;
+		if (Full_Sectors[other] == 0)
+			Fill_Buf = other; // Else appends are dropped until other batch is written
+		Sched_Set_Ready(Log_Ready_Mask);
+	}
+}
+
+int SD_Log_Append(const void * rec) {
+	uint32_t primask = __get_PRIMASK();
+	int done = 0;
+	
+	__disable_irq();
+	if (SD_Log_Status.Ready && (Full_Sectors[Fill_Buf] == 0)) {
+		memcpy(Log_Buf[Fill_Buf][Fill_Sector] + sizeof(SD_LOG_HDR_T) + 
+			Fill_Count * SD_LOG_RECORD_SIZE, rec, SD_LOG_RECORD_SIZE);
+		if (++Fill_Count == SD_LOG_RECS_PER_SECTOR)
+			Log_Close_Sector();
+		done = 1;
+	} else {
+		SD_Log_Status.Dropped++;
+	}
+	__set_PRIMASK(primask);
+	return done;
+}
+
+void SD_Log_Sync(void) {
+	uint32_t primask = __get_PRIMASK();
+	uint8_t other;
+	
+	__disable_irq();
+	if (Full_Sectors[Fill_Buf] == 0) {
+		if (Fill_Count > 0)
+			Log_Close_Sector();
+		if ((Fill_Sector > 0) && (Full_Sectors[Fill_Buf] == 0)) {
+			// Write the sectors closed so far as a short batch
+			other = Fill_Buf ^ 1;
+			Full_Sectors[Fill_Buf] = Fill_Sector;
+			Fill_Sector = 0;
+			if (Full_Sectors[other] == 0)
+				Fill_Buf = other;
+			Sched_Set_Ready(Log_Ready_Mask);
+		}
+	}
+	__set_PRIMASK(primask);
+}
+
+void Task_SD_Log(void) {
+	uint8_t n, k;
+	SD_LOG_HDR_T * h;
+	WORD crc;
+	
+	switch (Log_State) {
+		case L_START:
+			// Batches are empty before Ready, so borrow one as a read buffer
+			if ((log_trans.Status == STAT_IDLE) && Log_Issue(REQ_READ, 0, Log_Buf[0][0], 1))
+				Log_State = L_WAIT_FIRST;
+			else
+				Sched_Set_Ready(Log_Ready_Mask);
+			break;
+		case L_WAIT_FIRST:
+			if (!Log_Done_Flag)
+				break;
+			if (log_trans.ErrorCode != SD_OK) {
+				SD_Log_Status.Error = log_trans.ErrorCode;
+				Log_State = L_STOP;
+			} else if (Log_Sector_Valid(Log_Buf[0][0], 0)) {
+				h = (SD_LOG_HDR_T *) Log_Buf[0][0];
+				SD_Log_Status.Session = h->Session;
+				Base_Seq = h->Seq;
+				Probe_Lo = 1; // Invariant: Probe_Lo-1 is valid, Probe_Hi is not
+				Probe_Hi = Log_Sectors;
+				Log_State = L_PROBE;
+				Sched_Set_Ready(Log_Ready_Mask);
+			} else { // No log yet, start a new session
+				SD_Log_Status.Session = SDS_Cycles() | 1;
+				Base_Seq = 0;
+				Probe_Lo = 0;
+				Probe_Hi = 0;
+				Log_State = SD_LOG_PRE_ERASE ? L_ERASE : L_PROBE;
+				Sched_Set_Ready(Log_Ready_Mask);
+			}
+			break;
+		case L_ERASE:
+			if (Log_Issue(REQ_ERASE, 0, 0, 0))
+				Log_State = L_WAIT_ERASE;
+			else
+				Sched_Set_Ready(Log_Ready_Mask);
+			break;
+		case L_WAIT_ERASE:
+			// Erase only speeds up writes, so start logging even if it failed
+			if (!Log_Done_Flag)
+				break;
+			Log_State = L_PROBE;
+			Sched_Set_Ready(Log_Ready_Mask);
+			break;
+		case L_PROBE:
+			if (Probe_Lo < Probe_Hi) {
+				Probe = (Probe_Lo + Probe_Hi) / 2;
+				if (Log_Issue(REQ_READ, Probe, Log_Buf[0][0], 1))
+					Log_State = L_WAIT_PROBE;
+				else
+					Sched_Set_Ready(Log_Ready_Mask);
+			} else {
+				SD_Log_Status.Tail = Probe_Lo;
+				SD_Log_Status.Next_Seq = Base_Seq + Probe_Lo;
+				Fill_Buf = Fill_Sector = Fill_Count = 0;
+				Full_Sectors[0] = Full_Sectors[1] = 0;
+				Next_Write = 0;
+				SD_Log_Status.Ready = 1;
+				Log_State = L_RUN;
+			}
+			break;
+		case L_WAIT_PROBE:
+			if (!Log_Done_Flag)
+				break;
+			if (log_trans.ErrorCode != SD_OK) {
+				SD_Log_Status.Error = log_trans.ErrorCode;
+				Log_State = L_STOP;
+				break;
+			}
+			if (Log_Sector_Valid(Log_Buf[0][0], Probe))
+				Probe_Lo = Probe + 1;
+			else
+				Probe_Hi = Probe;
+			Log_State = L_PROBE;
+			Sched_Set_Ready(Log_Ready_Mask);
+			break;
+		case L_RUN:
+			n = Full_Sectors[Next_Write];
+			if (n == 0)
+				break; // Woken again when a batch fills
+			if (SD_Log_Status.Tail + n > Log_Sectors) {
+				SD_Log_Status.Full = 1;
+				SD_Log_Status.Ready = 0;
+				Log_State = L_STOP;
+				break;
+			}
+			// Stamp headers and CRCs, records were stored by SD_Log_Append
+			for (k = 0; k < n; k++) {
+				h = (SD_LOG_HDR_T *) Log_Buf[Next_Write][k];
+				h->Magic = SD_LOG_MAGIC;
+				h->Session = SD_Log_Status.Session;
+				h->Seq = SD_Log_Status.Next_Seq + k;
+				h->Rec_Size = SD_LOG_RECORD_SIZE;
+				crc = Log_CRC(Log_Buf[Next_Write][k]);
+				Log_Buf[Next_Write][k][SD_BLK_SIZE-2] = (uint8_t) (crc >> 8);
+				Log_Buf[Next_Write][k][SD_BLK_SIZE-1] = (uint8_t) crc;
+			}
+			if (Log_Issue((n > 1) ? REQ_WRITE_MULTI : REQ_WRITE, SD_Log_Status.Tail, 
+				Log_Buf[Next_Write][0], n))
+				Log_State = L_WAIT_WRITE;
+			else
+				Sched_Set_Ready(Log_Ready_Mask); // Queue full, try again
+			break;
+		case L_WAIT_WRITE:
+			if (!Log_Done_Flag)
+				break;
+			if (log_trans.ErrorCode != SD_OK) {
+				SD_Log_Status.Error = log_trans.ErrorCode;
+				SD_Log_Status.Ready = 0;
+				Log_State = L_STOP;
+				break;
+			}
+			n = Full_Sectors[Next_Write];
+			SD_Log_Status.Tail += n;
+			SD_Log_Status.Next_Seq += n;
+			__disable_irq();
+			Full_Sectors[Next_Write] = 0;
+			if (Full_Sectors[Fill_Buf]) { // Filled up while waiting, continue in freed batch
+				Fill_Buf = Next_Write;
+				Fill_Sector = 0;
+				Fill_Count = 0;
+			}
+			__enable_irq();
+			Next_Write ^= 1;
+			Log_State = L_RUN;
+			Sched_Set_Ready(Log_Ready_Mask);
+			break;
+		default:
+		case L_OFF:
+		case L_STOP:
+			break;
+	}
+}
@@ -0,0 +1,52 @@
+#ifndef SD_LOG_H
+#define SD_LOG_H
+#include <integer.h>
+#include "sd_io.h"
+
+/*
+ Append-only telemetry log on a raw sector region of the card.
+ Fixed size records are packed into 512 byte sector images in RAM. Each sector 
+ carries a header (session, sequence number, record count) and a CRC16 in its 
+ last two bytes. Full sectors go to the SD server SD_LOG_BATCH at a time as one 
+ REQ_WRITE_MULTI. At start, the tail of an existing log is found by binary 
+ search: a sector is part of the log if it has the session of the first sector 
+ and sequence number (first sector's + index).
+*/
+
+#define SD_LOG_RECORD_SIZE (16)   // Bytes per record
+#define SD_LOG_BATCH       (2)    // Sectors per write request, two batches are buffered
+#define SD_LOG_MAGIC       (0x31474F4CUL) // "LOG1"
+#define SD_LOG_PRE_ERASE   (1)    // 1: erase region when starting a new log, speeds up later writes
+
+typedef struct {
+	uint32_t Magic;
+	uint32_t Session;   // Same in all sectors of one log
+	uint32_t Seq;       // Increases by one per sector
+	uint16_t Count;     // Records in this sector
+	uint16_t Rec_Size;
+} SD_LOG_HDR_T;
+
+#define SD_LOG_RECS_PER_SECTOR ((SD_BLK_SIZE - sizeof(SD_LOG_HDR_T) - 2) / SD_LOG_RECORD_SIZE)
+
+typedef struct {
+	int Ready;          // Tail found, appending allowed
+	DWORD Tail;         // Index in region of next sector to write
+	uint32_t Session;
+	uint32_t Next_Seq;
+	uint32_t Dropped;   // Records refused because both batches were full
+	SDRESULTS Error;    // First write error, logging stops
+	int Full;           // End of region reached
+} SD_LOG_STATUS_T;
+
+extern volatile SD_LOG_STATUS_T SD_Log_Status;
+
+// Use sectors first..first+sectors-1 of dev; card must already be initialized.
+// ready_mask is Task_SD_Log's scheduler bit.
+void SD_Log_Init(uint32_t ready_mask, SD_DEV * dev, DWORD first, DWORD sectors);
+// Copy one SD_LOG_RECORD_SIZE record into log, safe from ISRs. Returns 0 if dropped.
+int SD_Log_Append(const void * rec);
+// Close the partly filled sector so it is written with the next batch
+void SD_Log_Sync(void);
+void Task_SD_Log(void);
+
+#endif
@@ -4,33 +4,127 @@
 #include "sd_io.h"
 
 // request types
-typedef enum {REQ_NONE, REQ_INIT, REQ_READ, REQ_WRITE} SDS_REQ_T;
+typedef enum {REQ_NONE, REQ_INIT, REQ_READ, REQ_WRITE, REQ_READ_MULTI, REQ_WRITE_MULTI, REQ_FLUSH, 
+	REQ_ERASE} SDS_REQ_T;
 // status and results
-typedef enum {STAT_IDLE, STAT_BUSY} SDS_STATUS_T;
+typedef enum {STAT_IDLE, STAT_BUSY, STAT_QUEUED} SDS_STATUS_T;
+
+// Depth of request queue (pending transactions, not counting active one)
+#define SDS_QUEUE_SIZE (4)
+
+// Write-back buffer: REQ_WRITE completes once its data is copied into the buffer.
+// Contiguous sectors are merged and written to card with one multi-block write.
+#define SDS_USE_WRITE_BACK (1)
+#define SDS_WB_SECTORS (4)            // Capacity of buffer in sectors
+#define SDS_WB_FLUSH_THRESHOLD (4)    // Flush when this many sectors are buffered
+#define SDS_WB_FLUSH_MS (50)          // Flush when oldest buffered data is this old
+
+// Readahead: after SDS_RA_TRIGGER reads of consecutive sectors, the idle server
+// prefetches the next SDS_RA_SECTORS sectors into the sector cache.
+#define SDS_RA_TRIGGER (2)            // 0 disables readahead
+#define SDS_RA_SECTORS (2)            // Keep below SD_CACHE_WAYS
+
+// Work quantum: how much SD FSM work one Task_SD_Server call may do before yielding
+#define SDS_QUANTUM_STEPS    (0)      // Fixed number of FSM steps (about one byte each)
+#define SDS_QUANTUM_TIME     (1)      // Time budget of SDS_QUANTUM_US
+#define SDS_QUANTUM_ADAPTIVE (2)      // Steps grow while other tasks leave slack, shrink when they don't
+#define SDS_QUANTUM_MODE     SDS_QUANTUM_STEPS
+#define SDS_QUANTUM_N        (1)      // Steps for SDS_QUANTUM_STEPS, 1 gives one byte per call
+#define SDS_QUANTUM_US       (50)
+#define SDS_QUANTUM_MIN      (1)      // Limits for SDS_QUANTUM_ADAPTIVE
+#define SDS_QUANTUM_MAX      (256)
+#define SDS_SLACK_US         (20)     // Other tasks using less than this between calls have slack
+
+extern volatile uint32_t SDS_Time_ms; // Time base for write-back flush timer
+extern uint32_t SDS_Quantum;          // Current quantum in steps (SDS_QUANTUM_STEPS, _ADAPTIVE)
 	
-typedef struct { // SD Server Transaction Data
+typedef struct _SDS_TD_T { // SD Server Transaction Data
 	SDS_REQ_T Request;
 	SD_DEV * Device;
 	uint8_t * Data;
 	uint32_t Sector;
+	uint16_t Count; // Number of sectors for REQ_READ_MULTI and REQ_WRITE_MULTI
 	SDS_STATUS_T Status;
 	SDRESULTS ErrorCode;
+	// Optional completion notification, set to 0 if unused
+	void (*Callback)(struct _SDS_TD_T * t); // Called by server when transaction is done
+	volatile uint32_t * Event_Flags;         // Event_Mask is ORed into *Event_Flags when done
+	uint32_t Event_Mask;
+	uint32_t End_Sector; // Last sector for REQ_ERASE (from Sector)
 } SDS_TD_T ;
 
+// Ping-pong streaming read of consecutive sectors: the server fills one buffer while
+// the client processes the other, and they swap when the client releases its buffer.
+typedef enum {STREAM_EMPTY, STREAM_WANT, STREAM_READ, STREAM_HELD} SDS_STREAM_BUF_T;
+
+typedef struct {
+	SDS_TD_T Trans[2];           // One transaction per buffer
+	SDS_STREAM_BUF_T State[2];
+	uint32_t Next_Sector;        // Next sector to request
+	uint32_t End_Sector;         // One past last sector of stream
+	uint8_t Client;              // Buffer the client gets next
+} SDS_STREAM_T;
+
 // States for SD Server FSM
-typedef enum {S_IDLE, S_INIT, S_READ, S_WRITE, S_ERROR} SDS_STATE_T; 
+typedef enum {S_IDLE, S_INIT, S_READ, S_WRITE, S_READ_MULTI, S_WRITE_MULTI, S_FLUSH, S_READAHEAD, S_ERASE, S_ERROR} SDS_STATE_T; 
 
-extern SDS_TD_T g_trans; // Transaction request object
+// Card operation run by the server in one of its states (SD_Server.c SDS_Ops)
+typedef struct {
+	SDRESULTS (* Step)(SDS_TD_T * t, SD_CTX * ctx);          // One SD driver step
+	void (* Done)(SDS_TD_T * req, SDS_TD_T * t, SDRESULTS res); // Driver finished with res
+	uint8_t Dbg;                                             // Debug signal high while stepping
+} SDS_OP_T;
 
+// Returns 1 if transaction t was queued, 0 if queue is full
+int SDS_Enqueue(SDS_TD_T * t);
+
+// Start SysTick time base used by SD server. ready_mask is Task_SD_Server's scheduler bit,
+// set whenever the server has work.
+void SDS_Init(uint32_t ready_mask);
+// Make the tasks in mask ready from SysTick ms from now, one timer shared by all
+void SDS_Wake_After(uint32_t ms, uint32_t mask);
+// Core clock cycles since SDS_Init, wraps after 2^32 cycles
+uint32_t SDS_Cycles(void);
 void Task_SD_Server(void);
 
+// Start streaming count sectors from sector into buf_a and buf_b (SD_BLK_SIZE bytes each).
+// callback (may be 0) is called in the server's context whenever a buffer is filled.
+void SDS_Stream_Start(SDS_STREAM_T * s, SD_DEV * dev, uint32_t sector, uint32_t count,
+	uint8_t * buf_a, uint8_t * buf_b, void (*callback)(SDS_TD_T * t));
+// Returns next filled buffer in sector order, or 0 if it is not filled yet. 
+// *res gets the read's result. Keeps returning the same buffer until released.
+uint8_t * SDS_Stream_Get(SDS_STREAM_T * s, SDRESULTS * res);
+// Client is done with buffer from SDS_Stream_Get, server may refill it
+void SDS_Stream_Release(SDS_STREAM_T * s);
+// Returns 1 once all sectors were returned and released
+int SDS_Stream_Done(SDS_STREAM_T * s);
+
 /*
 To request service...
-1. Requesting task R waits until Status == STAT_IDLE and Request == REQ_NONE
-2. R sets up transaction information Device,Data,Sector. 
-3. R requests requests transaction by setting Request to REQ_INIT, REQ_READ, or REQ_WRITE.
-4. (Let other tasks run. When server accepts and copies request, it sets Request=REQ_NONE and Status to STAT_BUSY 
-5. R determines transaction is done by polling for g_trans.Status==STAT_IDLE and g_trans.Request==REQ_NONE
+1. Requesting task R owns one or more SDS_TD_T objects. It may reuse one once its Status == STAT_IDLE.
+2. R sets up transaction information Device,Data,Sector (and Count for REQ_READ_MULTI/REQ_WRITE_MULTI, Data must hold Count*512 bytes). 
+3. R sets Request to REQ_INIT, REQ_READ, REQ_WRITE, REQ_READ_MULTI, REQ_WRITE_MULTI, REQ_FLUSH 
+   or REQ_ERASE (Sector..End_Sector) and calls SDS_Enqueue.
+   If it returns 0 the queue is full, so try again later. Otherwise Status is now STAT_QUEUED, 
+   and R can fill in and queue another transaction object without waiting.
+4. (Let other tasks run. When server starts the transaction it sets Status to STAT_BUSY.) 
+5. R determines transaction is done by polling for Status==STAT_IDLE and Request==REQ_NONE, then checks ErrorCode.
+   Instead of polling, R can set Callback and/or Event_Flags/Event_Mask, and then it need not run until notified.
+   Both happen after Status and ErrorCode are updated. Callback runs in the server's context, so keep it short.
+
+With write-back enabled a REQ_WRITE may finish before its data reaches the card. Errors from 
+writing buffered data are reported by the next REQ_FLUSH, which finishes after all buffered data is written.
+
+With readahead enabled, a sequential reader finds the next sectors already cached while it 
+processes the current one. A request arriving during a prefetch waits for it to finish.
+
+REQ_ERASE pre-conditions a region (e.g. a log) so later writes there program faster. 
+The erase itself may take a long time; the server polls the busy card one byte per call, 
+so queue it when the card would be idle anyway.
+
+For a streaming read, R calls SDS_Stream_Start, then repeatedly SDS_Stream_Get until it returns
+a buffer, processes it and calls SDS_Stream_Release, until SDS_Stream_Done. Two queue slots 
+are used, and a read that finds the queue full is retried by the next SDS_Stream_Get.
 
 */
 
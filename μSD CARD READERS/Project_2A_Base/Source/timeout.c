@@ -0,0 +1,133 @@
+/*
+ * Multi-instance timeout service, hashed timer wheel on the LPTMR0 tick.
+ */
+
+#include <MKL25Z4.h>
+#include "timeout.h"
+
+typedef struct {
+	uint32_t Rounds;              // Trips around the wheel left before expiry
+	int8_t Next;                  // Next timeout in same slot, TMO_NONE ends list
+	int8_t Slot;                  // Slot holding this timeout while running
+	uint8_t Used;                 // Handle allocated
+	volatile TMO_STATE_T State;
+} TMO_T;
+
+static TMO_T Tmo[TMO_MAX];
+static int8_t Wheel[TMO_WHEEL_SLOTS]; // Head of each slot's list
+static volatile uint32_t Tmo_Ticks = 0;
+static int Tmo_Started = 0;
+
+// Remove id from its slot's list, call with interrupts masked
+static void Tmo_Unlink(TMO_ID id) {
+	int8_t * p = &Wheel[Tmo[id].Slot];
+	
+	while (*p != TMO_NONE) {
+		if (*p == id) {
+			*p = Tmo[id].Next;
+			return;
+		}
+		p = &Tmo[*p].Next;
+	}
+}
+
+void Timeout_Init(void) {
+	int i;
+	
+	if (Tmo_Started)
+		return;
+	for (i = 0; i < TMO_WHEEL_SLOTS; i++)
+		Wheel[i] = TMO_NONE;
+	for (i = 0; i < TMO_MAX; i++) {
+		Tmo[i].Used = 0;
+		Tmo[i].State = TMO_IDLE;
+	}
+	SIM_SCGC5 |= SIM_SCGC5_LPTMR_MASK;  // Make sure clock is enabled
+	LPTMR0_CSR = 0;                     // Reset LPTMR settings
+	LPTMR0_CMR = TMO_TICK_MS - 1;       // Period is CMR+1 counts
+	// Use 1kHz LPO with no prescaler
+	LPTMR0_PSR = LPTMR_PSR_PCS(1) | LPTMR_PSR_PBYP_MASK;
+	NVIC_SetPriority(LPTMR0_IRQn, 2);
+	NVIC_ClearPendingIRQ(LPTMR0_IRQn);
+	NVIC_EnableIRQ(LPTMR0_IRQn);
+	// Counter resets on compare (TFC = 0), so this interrupts every tick
+	LPTMR0_CSR = LPTMR_CSR_TIE_MASK | LPTMR_CSR_TEN_MASK;
+	Tmo_Started = 1;
+}
+
+TMO_ID Timeout_Alloc(void) {
+	TMO_ID i;
+	uint32_t primask = __get_PRIMASK();
+	
+	Timeout_Init();
+	__disable_irq();
+	for (i = 0; i < TMO_MAX; i++) {
+		if (!Tmo[i].Used) {
+			Tmo[i].Used = 1;
+			Tmo[i].State = TMO_IDLE;
+			__set_PRIMASK(primask);
+			return i;
+		}
+	}
+	__set_PRIMASK(primask);
+	return TMO_NONE;
+}
+
+void Timeout_Start(TMO_ID id, uint32_t ms) {
+	uint32_t ticks = (ms + TMO_TICK_MS - 1) / TMO_TICK_MS;
+	uint32_t primask = __get_PRIMASK();
+	
+	if (ticks == 0)
+		ticks = 1;
+	__disable_irq();
+	if (Tmo[id].State == TMO_RUNNING)
+		Tmo_Unlink(id);
+	// Slot is visited after ((ticks-1) % SLOTS) + 1 ticks, then every SLOTS ticks
+	Tmo[id].Slot = (Tmo_Ticks + ticks) & (TMO_WHEEL_SLOTS - 1);
+	Tmo[id].Rounds = (ticks - 1) / TMO_WHEEL_SLOTS;
+	Tmo[id].Next = Wheel[Tmo[id].Slot];
+	Wheel[Tmo[id].Slot] = id;
+	Tmo[id].State = TMO_RUNNING;
+	__set_PRIMASK(primask);
+}
+
+int Timeout_Running(TMO_ID id) {
+	return Tmo[id].State == TMO_RUNNING;
+}
+
+TMO_STATE_T Timeout_State(TMO_ID id) {
+	return Tmo[id].State;
+}
+
+void Timeout_Stop(TMO_ID id) {
+	uint32_t primask = __get_PRIMASK();
+	
+	__disable_irq();
+	if (Tmo[id].State == TMO_RUNNING)
+		Tmo_Unlink(id);
+	Tmo[id].State = TMO_IDLE;
+	__set_PRIMASK(primask);
+}
+
+uint32_t Timeout_Now(void) {
+	return Tmo_Ticks;
+}
+
+void LPTMR0_IRQHandler(void) {
+	int8_t * p;
+	TMO_ID id;
+	
+	LPTMR0_CSR |= LPTMR_CSR_TCF_MASK;   // Write 1 to clear flag
+	Tmo_Ticks++;
+	p = &Wheel[Tmo_Ticks & (TMO_WHEEL_SLOTS - 1)];
+	while (*p != TMO_NONE) {
+		id = *p;
+		if (Tmo[id].Rounds == 0) {
+			*p = Tmo[id].Next;              // Unlink, p now points to next
+			Tmo[id].State = TMO_EXPIRED;
+		} else {
+			Tmo[id].Rounds--;
+			p = &Tmo[id].Next;
+		}
+	}
+}
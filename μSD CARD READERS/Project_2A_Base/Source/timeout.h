@@ -0,0 +1,32 @@
+#ifndef TIMEOUT_H
+#define TIMEOUT_H
+#include <stdint.h>
+
+// Software timeouts on one hardware tick (LPTMR0 from the 1 kHz LPO).
+// Each client allocates its own handle, so concurrent waits don't disturb each other.
+// Running timeouts sit in a hashed wheel: the tick ISR only looks at the timeouts 
+// in one slot, each of which expires after its remaining Rounds trips around the wheel.
+
+#define TMO_MAX         (8)    // Handles available
+#define TMO_WHEEL_SLOTS (16)   // Power of two
+#define TMO_TICK_MS     (1)
+
+typedef int8_t TMO_ID;         // Handle, TMO_NONE if allocation failed
+#define TMO_NONE        (-1)
+
+typedef enum {TMO_IDLE, TMO_RUNNING, TMO_EXPIRED} TMO_STATE_T;
+
+// Start tick interrupt, safe to call more than once
+void Timeout_Init(void);
+// Get a handle, TMO_NONE if all are in use
+TMO_ID Timeout_Alloc(void);
+// (Re)start timeout id to expire in ms milliseconds (at least one tick)
+void Timeout_Start(TMO_ID id, uint32_t ms);
+// Returns 1 while timeout id is running, 0 once expired or stopped
+int Timeout_Running(TMO_ID id);
+TMO_STATE_T Timeout_State(TMO_ID id);
+void Timeout_Stop(TMO_ID id);
+// Ticks since Timeout_Init, shared time base for other modules
+uint32_t Timeout_Now(void);
+
+#endif
@@ -29,15 +29,19 @@
 #include "rtx_os.h"
 #include <MKL25Z4.h>
 #include "debug.h"
-
-extern uint32_t idle_counter;
+#include "cpu_util.h"
+#include "tickless.h"
 
 // OS Idle Thread
 __WEAK __NO_RETURN void osRtxIdleThread (void *argument) {
   (void)argument;
 DEBUG_START(DBG_7);
   for (;;) {
-		idle_counter++;
+#if USE_TICKLESS_IDLE
+		if (CPU_Util_Can_Sleep())
+			Tickless_Idle(); // Returns once a thread is ready, or the tick can't be spared
+#endif
+		CPU_Idle_Count++;
 		DEBUG_TOGGLE(DBG_7);
 	}
 	DEBUG_START(DBG_7);
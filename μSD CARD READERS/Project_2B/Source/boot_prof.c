@@ -0,0 +1,47 @@
+#include <MKL25Z4.h>
+#include <cmsis_os2.h>
+#include "boot_prof.h"
+
+BOOT_MARK_T Boot_Prof[BOOT_PROF_MAX_MARKS];
+volatile uint32_t Boot_Prof_Count;
+volatile uint8_t Boot_Prof_Wrapped;
+
+static uint32_t Kernel_Base_us; // Boot time at osKernelStart
+
+void Boot_Prof_Init(void) {
+	Boot_Prof_Count = 0;
+	Boot_Prof_Wrapped = 0;
+	SysTick->CTRL = 0;
+	SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+	SysTick->VAL = 0;
+	SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk; // Core clock, no interrupt
+}
+
+static uint32_t Boot_Now_us(void) {
+	uint32_t per_us = SystemCoreClock/1000000;
+
+	if (osKernelGetState() == osKernelRunning)
+		return Kernel_Base_us + osKernelGetSysTimerCount()/per_us;
+	if (SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk)
+		Boot_Prof_Wrapped = 1;
+	return (SysTick_LOAD_RELOAD_Msk - SysTick->VAL)/per_us;
+}
+
+void Boot_Mark(const char * name) {
+	uint32_t m, n;
+
+	m = __get_PRIMASK();
+	__disable_irq();
+	n = Boot_Prof_Count;
+	if (n < BOOT_PROF_MAX_MARKS) {
+		Boot_Prof[n].Name = name;
+		Boot_Prof[n].us = Boot_Now_us();
+		Boot_Prof_Count = n+1;
+	}
+	__set_PRIMASK(m);
+}
+
+void Boot_Kernel_Start(void) {
+	Boot_Mark("Kernel start");
+	Kernel_Base_us = Boot_Now_us();
+}
@@ -0,0 +1,35 @@
+#ifndef CPU_UTIL_H
+#define CPU_UTIL_H
+
+#include <stdint.h>
+
+/*
+ CPU utilization meter. The RTX idle thread increments CPU_Idle_Count;
+ a periodic OS timer compares the count in each window against the
+ count a fully idle CPU reaches (the idle reference).
+
+ Idle reference comes from, in order of precedence:
+  - CPU_Util_Calibrate(), called while all other threads are blocked
+  - CPU_UTIL_IDLE_PER_MS, measured once on the board (0 = unknown)
+  - the largest count seen in any window so far
+
+ A tickless idle sleep (tickless.h) adds the passes the idle loop would
+ have made meanwhile. It needs a reference to convert with, and must not
+ run while CPU_Util_Calibrate measures one.
+*/
+
+#define CPU_UTIL_WINDOW_MS    (1000)   // Measurement window
+#define CPU_UTIL_IDLE_PER_MS  (0)      // Idle loop passes per ms, 0 = self calibrate
+#define CPU_UTIL_FULL_SCALE   (1000)   // Busy is reported in 0.1% steps
+
+extern volatile uint32_t CPU_Idle_Count;
+
+void CPU_Util_Init(void);                // Call after osKernelInitialize
+void CPU_Util_Calibrate(void);           // Blocks caller for one window
+uint32_t CPU_Util_Busy(void);            // Busy time of last window, 0..CPU_UTIL_FULL_SCALE
+uint32_t CPU_Util_Peak(void);            // Highest busy value seen since init
+uint32_t CPU_Util_Idle_Reference(void);  // Idle passes per window in use
+int CPU_Util_Can_Sleep(void);            // Idle thread may sleep instead of counting
+void CPU_Util_Slept(uint32_t us);        // Idle thread slept for us
+
+#endif // CPU_UTIL_H
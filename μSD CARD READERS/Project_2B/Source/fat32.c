@@ -0,0 +1,219 @@
+#include <string.h>
+#include "fat32.h"
+#include "sd_shared.h"
+
+#define FAT_EOC       (0x0FFFFFF8UL)  // This and above end a cluster chain
+#define LD_WORD(p)    ((WORD)(p)[0] | ((WORD)(p)[1] << 8))
+#define LD_DWORD(p)   ((DWORD)LD_WORD(p) | ((DWORD)LD_WORD((p)+2) << 16))
+
+// Returns 1 if buf holds a FAT32 boot sector
+static int FAT_Is_VBR(const BYTE *buf) {
+	return (LD_WORD(buf + 510) == 0xAA55) && (LD_WORD(buf + 11) == SD_BLK_SIZE) &&
+		(buf[13] != 0) && (LD_WORD(buf + 22) == 0) && (LD_DWORD(buf + 36) != 0) &&
+		(memcmp(buf + 82, "FAT32", 5) == 0);
+}
+
+FAT_RESULT FAT_Mount(FAT_VOL *vol, SD_DEV *dev) {
+	DWORD base = 0;
+	int i;
+	
+	vol->dev = dev;
+	if (SD_Shared_Read(dev, vol->buf, 0, 0, SD_BLK_SIZE) != SD_OK)
+		return FAT_DISK_ERR;
+	if (!FAT_Is_VBR(vol->buf)) {
+		// Partitioned card: use first FAT32 partition of MBR
+		if (LD_WORD(vol->buf + 510) != 0xAA55)
+			return FAT_NO_FS;
+		for (i = 0; i < 4; i++) {
+			BYTE type = vol->buf[446 + 16*i + 4];
+			if ((type == 0x0B) || (type == 0x0C)) {
+				base = LD_DWORD(vol->buf + 446 + 16*i + 8);
+				break;
+			}
+		}
+		if ((i == 4) || (SD_Shared_Read(dev, vol->buf, base, 0, SD_BLK_SIZE) != SD_OK))
+			return (i == 4) ? FAT_NO_FS : FAT_DISK_ERR;
+		if (!FAT_Is_VBR(vol->buf))
+			return FAT_NO_FS;
+	}
+	vol->sec_per_clus = vol->buf[13];
+	vol->fat_start = base + LD_WORD(vol->buf + 14);
+	vol->data_start = vol->fat_start + vol->buf[16] * LD_DWORD(vol->buf + 36);
+	vol->root_cluster = LD_DWORD(vol->buf + 44);
+	for (i = 0; i < FAT_CACHE_SECTORS; i++) {
+		vol->cache_sector[i] = 0; // FAT never starts at sector 0, so 0 marks entry free
+		vol->cache_use[i] = 0;
+	}
+	vol->cache_clock = 0;
+	return FAT_OK;
+}
+
+// Next cluster in chain, through FAT sector cache. Returns 0 on disk error.
+static DWORD FAT_Next(FAT_VOL *vol, DWORD cluster) {
+	DWORD sector = vol->fat_start + cluster / (SD_BLK_SIZE / 4);
+	int i, victim = 0;
+	
+	for (i = 0; i < FAT_CACHE_SECTORS; i++) {
+		if (vol->cache_sector[i] == sector)
+			break;
+		if (vol->cache_use[i] < vol->cache_use[victim])
+			victim = i;
+	}
+	if (i == FAT_CACHE_SECTORS) { // Miss, replace least recently used
+		i = victim;
+		vol->cache_sector[i] = 0;
+		if (SD_Shared_Read(vol->dev, vol->cache[i], sector, 0, SD_BLK_SIZE) != SD_OK)
+			return 0;
+		vol->cache_sector[i] = sector;
+	}
+	vol->cache_use[i] = ++vol->cache_clock;
+	return LD_DWORD(vol->cache[i] + (cluster % (SD_BLK_SIZE / 4)) * 4) & 0x0FFFFFFFUL;
+}
+
+// Fill extent list starting with cluster, the file's cluster number index
+static FAT_RESULT FAT_Load_Extents(FAT_FILE *file, DWORD cluster, DWORD index) {
+	FAT_VOL *vol = file->vol;
+	DWORD next;
+	
+	file->first_index = index;
+	file->num_extents = 0;
+	while ((cluster >= 2) && (cluster < FAT_EOC) && (file->num_extents < FAT_MAX_EXTENTS)) {
+		file->extent[file->num_extents].cluster = cluster;
+		file->extent[file->num_extents].count = 1;
+		// Extend run while chain is contiguous
+		while ((next = FAT_Next(vol, cluster)) == cluster + 1) {
+			cluster = next;
+			file->extent[file->num_extents].count++;
+		}
+		if (next == 0)
+			return FAT_DISK_ERR;
+		file->num_extents++;
+		cluster = next;
+	}
+	file->next_cluster = cluster;
+	return FAT_OK;
+}
+
+// Convert "name.ext" to padded 8.3 directory form
+static void FAT_Dir_Name(const char *name, char *dir) {
+	int i = 0;
+	
+	memset(dir, ' ', 11);
+	while (*name && (*name != '.') && (i < 8))
+		dir[i++] = *name++;
+	while (*name && (*name != '.'))
+		name++;
+	if (*name == '.')
+		name++;
+	for (i = 8; *name && (i < 11); i++)
+		dir[i] = *name++;
+	for (i = 0; i < 11; i++)
+		if ((dir[i] >= 'a') && (dir[i] <= 'z'))
+			dir[i] -= 'a' - 'A';
+}
+
+FAT_RESULT FAT_Open(FAT_VOL *vol, FAT_FILE *file, const char *name) {
+	char dir_name[11];
+	DWORD cluster = vol->root_cluster, sector;
+	BYTE s, *e;
+	
+	FAT_Dir_Name(name, dir_name);
+	while ((cluster >= 2) && (cluster < FAT_EOC)) {
+		for (s = 0; s < vol->sec_per_clus; s++) {
+			sector = vol->data_start + (cluster - 2) * vol->sec_per_clus + s;
+			if (SD_Shared_Read(vol->dev, vol->buf, sector, 0, SD_BLK_SIZE) != SD_OK)
+				return FAT_DISK_ERR;
+			for (e = vol->buf; e < vol->buf + SD_BLK_SIZE; e += 32) {
+				if (e[0] == 0x00)
+					return FAT_NOT_FOUND; // End of directory
+				// Skip deleted, long name, volume label and directory entries
+				if ((e[0] == 0xE5) || (e[11] & 0x18) || (memcmp(e, dir_name, 11) != 0))
+					continue;
+				file->vol = vol;
+				file->size = LD_DWORD(e + 28);
+				file->pos = 0;
+				file->start_cluster = ((DWORD) LD_WORD(e + 20) << 16) | LD_WORD(e + 26);
+				return FAT_Load_Extents(file, file->start_cluster, 0);
+			}
+		}
+		if ((cluster = FAT_Next(vol, cluster)) == 0)
+			return FAT_DISK_ERR;
+	}
+	return FAT_NOT_FOUND;
+}
+
+void FAT_Seek(FAT_FILE *file, DWORD pos) {
+	file->pos = (pos > file->size) ? file->size : pos;
+}
+
+// Find sector holding file->pos and number of contiguous sectors from there
+static FAT_RESULT FAT_Map(FAT_FILE *file, DWORD *sector, DWORD *run) {
+	FAT_VOL *vol = file->vol;
+	DWORD index = file->pos / (SD_BLK_SIZE * vol->sec_per_clus);
+	DWORD first;
+	FAT_RESULT res;
+	BYTE i;
+	
+	if (index < file->first_index) { // Seek back before extents held
+		res = FAT_Load_Extents(file, file->start_cluster, 0);
+		if (res != FAT_OK)
+			return res;
+	}
+	for (;;) {
+		first = file->first_index;
+		for (i = 0; i < file->num_extents; i++) {
+			if (index < first + file->extent[i].count) {
+				*sector = vol->data_start + (file->extent[i].cluster - 2 + index - first) * 
+					vol->sec_per_clus + (file->pos / SD_BLK_SIZE) % vol->sec_per_clus;
+				*run = (first + file->extent[i].count - index) * vol->sec_per_clus - 
+					(file->pos / SD_BLK_SIZE) % vol->sec_per_clus;
+				return FAT_OK;
+			}
+			first += file->extent[i].count;
+		}
+		// Past last extent held, load the next ones
+		if ((file->next_cluster < 2) || (file->next_cluster >= FAT_EOC))
+			return FAT_BAD_CHAIN;
+		res = FAT_Load_Extents(file, file->next_cluster, first);
+		if (res != FAT_OK)
+			return res;
+	}
+}
+
+FAT_RESULT FAT_Read(FAT_FILE *file, void *dat, DWORD len, DWORD *read_len) {
+	BYTE *p = (BYTE *) dat;
+	DWORD sector, run, ofs, n;
+	FAT_RESULT res;
+	
+	*read_len = 0;
+	if (len > file->size - file->pos)
+		len = file->size - file->pos;
+	while (len > 0) {
+		res = FAT_Map(file, &sector, &run);
+		if (res != FAT_OK)
+			return res;
+		ofs = file->pos % SD_BLK_SIZE;
+		if ((ofs == 0) && (len >= SD_BLK_SIZE)) {
+			// Whole sectors straight into caller's buffer, multi-sector reads of SD_SHARED_CHUNK
+			n = len / SD_BLK_SIZE;
+			if (n > run)
+				n = run;
+			if (n > 0xFFFF)
+				n = 0xFFFF;
+			if (SD_Shared_Read_Multi(file->vol->dev, p, sector, (WORD) n) != SD_OK)
+				return FAT_DISK_ERR;
+			n *= SD_BLK_SIZE;
+		} else {
+			n = SD_BLK_SIZE - ofs;
+			if (n > len)
+				n = len;
+			if (SD_Shared_Read(file->vol->dev, p, sector, (WORD) ofs, (WORD) n) != SD_OK)
+				return FAT_DISK_ERR;
+		}
+		p += n;
+		len -= n;
+		file->pos += n;
+		*read_len += n;
+	}
+	return FAT_OK;
+}
@@ -0,0 +1,61 @@
+#ifndef FAT32_H
+#define FAT32_H
+
+#include "sd_io.h"
+
+/*
+ Read-mostly FAT32 access on top of sd_shared. Files are found by 8.3 name in
+ the root directory. An open file keeps a list of extents (runs of contiguous
+ clusters), so sequential reads become multi-sector reads without consulting
+ the FAT for every cluster. FAT sectors used most recently are cached.
+*/
+
+#define FAT_CACHE_SECTORS (2)   // FAT sectors cached per volume
+#define FAT_MAX_EXTENTS   (8)   // Extents held per open file, refilled when passed
+
+typedef enum {
+	FAT_OK = 0,
+	FAT_DISK_ERR,    // SD read failed
+	FAT_NO_FS,       // No FAT32 volume found
+	FAT_NOT_FOUND,   // No such file
+	FAT_BAD_CHAIN    // Cluster chain shorter than file size
+} FAT_RESULT;
+
+typedef struct {
+	SD_DEV *dev;
+	DWORD fat_start;        // First sector of FAT
+	DWORD data_start;       // Sector of cluster 2
+	DWORD root_cluster;
+	BYTE sec_per_clus;
+	// FAT sector cache
+	DWORD cache_sector[FAT_CACHE_SECTORS];
+	DWORD cache_use[FAT_CACHE_SECTORS];
+	DWORD cache_clock;
+	BYTE cache[FAT_CACHE_SECTORS][SD_BLK_SIZE];
+	BYTE buf[SD_BLK_SIZE];  // Directory and partial sector reads
+} FAT_VOL;
+
+typedef struct {
+	DWORD cluster;          // First cluster of run
+	DWORD count;            // Clusters in run
+} FAT_EXTENT;
+
+typedef struct {
+	FAT_VOL *vol;
+	DWORD size;             // Bytes
+	DWORD pos;              // Read position
+	DWORD start_cluster;
+	DWORD first_index;      // File cluster index of extent[0]
+	DWORD next_cluster;     // Cluster after last extent (>= 0x0FFFFFF8 if none)
+	BYTE num_extents;
+	FAT_EXTENT extent[FAT_MAX_EXTENTS];
+} FAT_FILE;
+
+FAT_RESULT FAT_Mount(FAT_VOL *vol, SD_DEV *dev);
+// name is "NAME.EXT", case insensitive
+FAT_RESULT FAT_Open(FAT_VOL *vol, FAT_FILE *file, const char *name);
+// Read up to len bytes at file->pos, *read_len is bytes actually read (0 at end of file)
+FAT_RESULT FAT_Read(FAT_FILE *file, void *dat, DWORD len, DWORD *read_len);
+void FAT_Seek(FAT_FILE *file, DWORD pos);
+
+#endif // FAT32_H
@@ -0,0 +1,128 @@
+#include <MKL25Z4.h>
+#include <cmsis_os2.h>
+#include <rtx_os.h>
+#include "load_gen.h"
+
+volatile LOAD_GEN_CFG_T Load_Gen_Cfg = {LOAD_GEN_TARGET_PCT, LOAD_GEN_PERIOD_MS,
+	LOAD_GEN_ON_MS, LOAD_GEN_OFF_MS, LOAD_GEN_MEM_BYTES, LOAD_GEN_PERIODIC_MS,
+	LOAD_GEN_PERIODIC_WORK_US, LOAD_GEN_DEADLINE_US};
+volatile LOAD_GEN_STATS_T Load_Gen_Stats;
+
+static uint32_t Mem_Src[LOAD_GEN_MEM_MAX/4], Mem_Dst[LOAD_GEN_MEM_MAX/4];
+
+#define MS_TO_TICKS(ms) (((ms)*osKernelGetTickFreq() + 999)/1000)
+
+// One step of the Nilakantha series for pi, restarted once it converges
+static void Load_Work_Unit(void) {
+	static int n=2;
+	static double my_pi=3.0;
+	double term, prev_pi;
+	uint32_t i, words;
+
+	term = 4.0/(n*(n+1.0)*(n+2.0));
+	if (n&4) { // is multiple of four
+		term = -term;
+	}
+	prev_pi = my_pi;
+	my_pi += term;
+	if (my_pi != prev_pi) {
+		n += 2;
+	} else {
+		n = 2;
+		my_pi = 3.0;
+	}
+	words = Load_Gen_Cfg.Mem_Bytes/4;
+	if (words > LOAD_GEN_MEM_MAX/4)
+		words = LOAD_GEN_MEM_MAX/4;
+	for (i = 0; i < words; i++)
+		((volatile uint32_t *) Mem_Dst)[i] = ((volatile uint32_t *) Mem_Src)[i] + i;
+	Load_Gen_Stats.Mem_Bytes += words*4;
+}
+
+// Work until us have passed, returns the time taken
+static uint32_t Load_Burn(uint32_t us) {
+	uint32_t per_us = osKernelGetSysTimerFreq()/1000000;
+	uint32_t start = osKernelGetSysTimerCount();
+
+	do {
+		Load_Work_Unit();
+	} while (osKernelGetSysTimerCount() - start < us*per_us);
+	return (osKernelGetSysTimerCount() - start)/per_us;
+}
+
+#if USE_LOAD_GEN
+static osRtxThread_t Load_tcb;
+static uint64_t Load_stk[LOAD_GEN_STK_SZ/8];
+static const osThreadAttr_t Load_attr = {
+	.name = "Load",
+	.cb_mem = &Load_tcb, .cb_size = sizeof(Load_tcb),
+	.stack_mem = Load_stk, .stack_size = sizeof(Load_stk),
+	.priority = LOAD_GEN_PRIO
+};
+
+static void Thread_Load(void * arg) {
+	uint32_t next, pattern_ms = 0, cycle, period;
+
+	(void) arg;
+	next = osKernelGetTickCount();
+	while (1) {
+		period = Load_Gen_Cfg.Period_ms ? Load_Gen_Cfg.Period_ms : 1;
+		cycle = Load_Gen_Cfg.On_ms + Load_Gen_Cfg.Off_ms;
+		pattern_ms = (pattern_ms + period) % (cycle ? cycle : 1);
+		if (Load_Gen_Cfg.Target_pct && (!Load_Gen_Cfg.Off_ms || (pattern_ms < Load_Gen_Cfg.On_ms))) {
+			Load_Gen_Stats.Bursts++;
+			Load_Gen_Stats.Busy_us += Load_Burn(period*10*Load_Gen_Cfg.Target_pct);
+		}
+		next += MS_TO_TICKS(period);
+		if ((int32_t) (osKernelGetTickCount() - next) >= (int32_t) MS_TO_TICKS(period)) { // Missed a whole period
+			Load_Gen_Stats.Dropped++;
+			next = osKernelGetTickCount();
+		}
+		osDelayUntil(next);
+	}
+}
+#endif
+
+#if USE_LOAD_GEN_PERIODIC
+static osRtxThread_t Periodic_tcb;
+static uint64_t Periodic_stk[LOAD_GEN_STK_SZ/8];
+static const osThreadAttr_t Periodic_attr = {
+	.name = "Load_Periodic",
+	.cb_mem = &Periodic_tcb, .cb_size = sizeof(Periodic_tcb),
+	.stack_mem = Periodic_stk, .stack_size = sizeof(Periodic_stk),
+	.priority = LOAD_GEN_PERIODIC_PRIO
+};
+
+static void Thread_Load_Periodic(void * arg) {
+	uint32_t next, per_us, per_tick, us;
+
+	(void) arg;
+	per_us = osKernelGetSysTimerFreq()/1000000;
+	per_tick = osKernelGetSysTimerFreq()/osKernelGetTickFreq();
+	next = osKernelGetTickCount();
+	while (1) {
+		next += MS_TO_TICKS(Load_Gen_Cfg.Periodic_ms ? Load_Gen_Cfg.Periodic_ms : 1);
+		osDelayUntil(next);
+		Load_Gen_Stats.Releases++;
+		Load_Burn(Load_Gen_Cfg.Periodic_Work_us);
+		// The system timer is the tick count times per_tick plus SysTick's progress
+		us = (osKernelGetSysTimerCount() - next*per_tick)/per_us;
+		Load_Gen_Stats.Last_Response_us = us;
+		if (us > Load_Gen_Stats.Max_Response_us)
+			Load_Gen_Stats.Max_Response_us = us;
+		if (us > Load_Gen_Cfg.Deadline_us)
+			Load_Gen_Stats.Misses++;
+		if ((int32_t) (osKernelGetTickCount() - next) > 0) // Overran into later releases
+			next = osKernelGetTickCount();
+	}
+}
+#endif
+
+void Load_Gen_Init(void) {
+#if USE_LOAD_GEN
+	osThreadNew(Thread_Load, NULL, &Load_attr);
+#endif
+#if USE_LOAD_GEN_PERIODIC
+	osThreadNew(Thread_Load_Periodic, NULL, &Periodic_attr);
+#endif
+}
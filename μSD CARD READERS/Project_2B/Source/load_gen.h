@@ -0,0 +1,68 @@
+#ifndef LOAD_GEN_H
+#define LOAD_GEN_H
+
+#include <stdint.h>
+#include "cmsis_os2.h"
+
+/*
+ Synthetic CPU load for benchmarking SD and other latencies under
+ contention.
+
+ Background thread: burns Target_pct of every Period_ms in one burst,
+ then sleeps until the next period with osDelayUntil. Bursts only come
+ during On_ms of every On_ms+Off_ms (Off_ms 0: always). A burst is
+ timed in wall clock, so preemption by higher priority threads eats into
+ it, as it would for a real background job; one that ends more than a
+ period late drops the missed periods instead of catching up. Each unit
+ of work is a floating point series step plus, if Mem_Bytes, a copy of
+ that many bytes.
+
+ Periodic thread (USE_LOAD_GEN_PERIODIC): released every Periodic_ms
+ above the SD server, burns Periodic_Work_us and must finish within
+ Deadline_us of its release tick.
+
+ Load_Gen_Cfg may be changed with the debugger while running.
+*/
+
+#define USE_LOAD_GEN          (0)
+#define USE_LOAD_GEN_PERIODIC (0)
+
+#define LOAD_GEN_PRIO         (osPriorityNormal)  // Same as Test_SD
+#define LOAD_GEN_PERIODIC_PRIO (osPriorityHigh)   // Above the SD server
+#define LOAD_GEN_TARGET_PCT   (30)
+#define LOAD_GEN_PERIOD_MS    (10)
+#define LOAD_GEN_ON_MS        (1000)
+#define LOAD_GEN_OFF_MS       (0)
+#define LOAD_GEN_MEM_BYTES    (0)     // Up to LOAD_GEN_MEM_MAX
+#define LOAD_GEN_MEM_MAX      (1024)
+#define LOAD_GEN_PERIODIC_MS  (5)
+#define LOAD_GEN_PERIODIC_WORK_US (200)
+#define LOAD_GEN_DEADLINE_US  (1000)
+#define LOAD_GEN_STK_SZ       (256)
+
+typedef struct {
+	uint32_t Target_pct;
+	uint32_t Period_ms;
+	uint32_t On_ms, Off_ms;
+	uint32_t Mem_Bytes;
+	uint32_t Periodic_ms;
+	uint32_t Periodic_Work_us;
+	uint32_t Deadline_us;
+} LOAD_GEN_CFG_T;
+
+typedef struct {
+	uint32_t Bursts;
+	uint32_t Dropped;         // Periods skipped after a late burst
+	uint32_t Busy_us;         // In bursts, including preemption
+	uint32_t Mem_Bytes;       // Copied, wraps
+	uint32_t Releases;        // Periodic thread
+	uint32_t Misses;          // Finished after Deadline_us
+	uint32_t Last_Response_us, Max_Response_us;
+} LOAD_GEN_STATS_T;
+
+extern volatile LOAD_GEN_CFG_T Load_Gen_Cfg;
+extern volatile LOAD_GEN_STATS_T Load_Gen_Stats;
+
+void Load_Gen_Init(void);  // Call after osKernelInitialize, creates the enabled threads
+
+#endif // LOAD_GEN_H
@@ -5,47 +5,37 @@
 #include "LEDs.h"
 #include "debug.h"
 #include "cmsis_os2.h"
+#include "rtx_os.h"
+#include "cpu_util.h"
+#include "sd_bench.h"
+#include "sd_shared.h"
+#include "sd_server.h"
+#include "tickless.h"
+#include "boot_prof.h"
+#include "load_gen.h"
+#include "perf_run.h"
 
 #define NUM_SECTORS_TO_READ (100)
+#define USE_SD_BENCH (USE_PERF_RUN) // 1: run Thread_Bench_SD instead of Thread_Test_SD
 
 SD_DEV dev[1];          // SD device descriptor
 uint8_t buffer[512];    // Buffer for SD read or write data
-osThreadId_t tid_Makework;
 osThreadId_t tid_testSD;
+
+// Static control block and stack, nothing from the RTX dynamic pool
+#define TEST_SD_STK_SZ (256) // As OS_STACK_SIZE
+static osRtxThread_t testSD_tcb;
+static uint64_t testSD_stk[TEST_SD_STK_SZ/8];
+const osThreadAttr_t testSD_attr = {
+	.name = "Test_SD",
+	.cb_mem = &testSD_tcb, .cb_size = sizeof(testSD_tcb),
+	.stack_mem = testSD_stk, .stack_size = sizeof(testSD_stk)
+};
 uint32_t tick_freq;
 uint32_t idle_before=0;
 uint32_t idle_after=0;
 uint32_t time_diff=0;
- uint32_t idle_counter=0;
-uint32_t init_before=0;
-uint32_t init_after=0;
-uint32_t init_time_diff=0;
-void Thread_Makework(){
-	while(1)
-	{
-	static int n=2;
-	static int done = 0;
-	static double my_pi=3.0;
-	double term, prev_pi=0.0;
-	
-	// Nilakantha Series to approximate pi
-	if (!done) {
-		term = 4.0/(n*(n+1.0)*(n+2.0));
-		if (n&4) { // is multiple of four
-			term = -term;
-		}
-		prev_pi = my_pi;
-		my_pi += term;
-		if (my_pi != prev_pi) {
-			n += 2;
-		} else {
-			// Done with approximating pi
-			done = 1; 
-		}
-	}	
-}
-}
-
+uint32_t init_time_diff=0;      // us, phases in dev[0].init_time
 void Error_Handler(void) {
 	Control_RGB_LEDs(1, 0, 0); // Light red LED
 	while (1)
@@ -68,20 +58,36 @@ void Thread_Test_SD(void) {
 	DWORD sector_num = 0, read_sector_count=0; 
 	uint32_t sum=0;
 	SDRESULTS res;
+	static SDS_TD_T init_td; // Zeroed, so idle
 	//	static char err_color_code = 0; // xxxxxRGB
-	init_before = idle_counter;
-	if (SD_Init(dev) != SD_OK) {
+
+	/* Card power-up through the SD server while the CPU meter calibrates:
+	the init sleeps between ACMD41 polls, so the window stays nearly idle
+	(the polls read as a fraction of a percent) and the card's wait for
+	its supply no longer comes on top of the calibration. */
+	init_td.Request = SDS_INIT;
+	init_td.Device = dev;
+	init_td.Flags = SDS_FLAG_DONE;
+	if (SDS_Submit(&init_td, osWaitForever) != 0)
+		Error_Handler();
+	CPU_Util_Calibrate();
+#if USE_BOOT_PROF
+	Boot_Mark("CPU meter calibrated");
+#endif
+	if (SDS_Wait(&init_td, osWaitForever) != SD_OK) {
 		Error_Handler(); // Initialization error
 	}
-init_after = idle_counter;
-	init_time_diff = init_after - init_before;
+#if USE_BOOT_PROF
+	Boot_Mark("SD card ready");
+#endif
+	init_time_diff = dev[0].init_time.total;
 	Control_RGB_LEDs(0, 1, 1); // Cyan: initialized OK
 	while (1) {
 //		for (; k<100; k++  )
 //		{
-//		idle_before = idle_counter;
+//		idle_before = CPU_Idle_Count;
 //		osDelay(2000);
-//		idle_after = idle_counter;
+//		idle_after = CPU_Idle_Count;
 //		time_diff = idle_after - idle_before;
 //		total = total + time_diff;
 //			//break;
@@ -93,9 +99,9 @@ init_after = idle_counter;
 //		}
 		//idle_before=idle_counter; 
 		//osDelay(2000);
-		idle_before = idle_counter;
+		idle_before = CPU_Idle_Count;
 		//osDelay(2000);
-		idle_after = idle_counter;
+		idle_after = CPU_Idle_Count;
 		
 		time_diff = idle_after - idle_before;
 		for (read_sector_count=0; read_sector_count < NUM_SECTORS_TO_READ; read_sector_count++) {
@@ -103,7 +109,7 @@ init_after = idle_counter;
 			for (i=0; i<SD_BLK_SIZE; i++)
 				buffer[i] = 0;
 			// perform SD card read
-			res = SD_Read(dev, (void *)buffer, sector_num, 0, 512);	
+			res = SD_Shared_Read(dev, (void *)buffer, sector_num, 0, 512);	
 			if (res != SD_OK) { // Was read was OK?
 				Error_Handler(); // Read error
 			} else {
@@ -118,7 +124,7 @@ init_after = idle_counter;
 		*(uint64_t *)(&buffer[0]) = 0xFEEDDC0D;
 		*(uint64_t *)(&buffer[508]) = 0xACE0FC0D;
 		// SD card write to sector_num
-		res = SD_Write(dev, (void *) buffer, sector_num);
+		res = SD_Shared_Write(dev, (void *) buffer, sector_num);
 		if (res != SD_OK) { // Was write completed OK?
 			Error_Handler(); // Write error
 		} 
@@ -127,7 +133,7 @@ init_after = idle_counter;
 		for (i=0; i<SD_BLK_SIZE; i++)
 			buffer[i] = 0;
 		// request SD card read to verify contents written correctly
-		res = SD_Read(dev, (void *)buffer, sector_num, 0, 512);	
+		res = SD_Shared_Read(dev, (void *)buffer, sector_num, 0, 512);	
 		if (res != SD_OK) { // Was verify read OK?
 			Error_Handler(); // Verify read error
 		} 
@@ -143,14 +149,30 @@ init_after = idle_counter;
 	
 
 int main(void) {
+#if USE_BOOT_PROF
+	Boot_Prof_Init();
+#endif
 	Init_Debug_Signals();
 	Init_RGB_LEDs();
 	Control_RGB_LEDs(1,1,0);	// Yellow - starting up
 
 	osKernelInitialize();
 	tick_freq = osKernelGetTickFreq();
-	tid_testSD = osThreadNew(Thread_Test_SD, NULL, NULL);
-	//tid_Makework = osThreadNew(Thread_Makework, NULL, NULL);
+	SD_Shared_Init();
+	SDS_Init();
+	CPU_Util_Init();
+#if USE_TICKLESS_IDLE
+	Tickless_Init();
+#endif
+#if USE_SD_BENCH
+	tid_testSD = osThreadNew(Thread_Bench_SD, NULL, &testSD_attr);
+#else
+	tid_testSD = osThreadNew(Thread_Test_SD, NULL, &testSD_attr);
+#endif
+	Load_Gen_Init();
+#if USE_BOOT_PROF
+	Boot_Kernel_Start();
+#endif
 	osKernelStart();
 	while(1)
 		;
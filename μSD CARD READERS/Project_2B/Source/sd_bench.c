@@ -0,0 +1,124 @@
+/*
+ * SD throughput and latency benchmark, runs in place of Thread_Test_SD.
+ * Phases: init, idle baseline (CPU_Util_Calibrate), reads, writes. Results in SD_Bench.
+ */
+
+#include <MKL25Z4.h>
+#include "sd_bench.h"
+#include "cmsis_os2.h"
+#include "cpu_util.h"
+#include "LEDs.h"
+#include "sd_shared.h"
+#include "perf_run.h"
+
+volatile SD_BENCH_T SD_Bench;
+
+static SD_DEV bench_dev[1];
+static uint8_t bench_buffer[SD_BENCH_BLOCKS][SD_BLK_SIZE];
+
+void SD_Bench_Sample(volatile SD_BENCH_STATS_T * s, uint32_t bytes, uint32_t us) {
+	uint32_t b;
+	
+	if ((s->Count == 0) || (us < s->Min_us))
+		s->Min_us = us;
+	if (us > s->Max_us)
+		s->Max_us = us;
+	s->Count++;
+	s->Bytes += bytes;
+	s->Total_us += us;
+	for (b = 0; (b < SD_BENCH_HIST_BINS - 1) && (us >> (b + 1)); b++)
+		;
+	s->Hist[b]++;
+}
+
+static void Bench_Stats_Finish(volatile SD_BENCH_STATS_T * s) {
+	if (s->Count)
+		s->Mean_us = s->Total_us / s->Count;
+	if (s->Total_us)
+		s->KBps = (uint32_t) (((uint64_t) s->Bytes * 1000000) / 1024 / s->Total_us);
+}
+
+void SD_Bench_Finish(void) {
+	Bench_Stats_Finish(&SD_Bench.Read);
+	Bench_Stats_Finish(&SD_Bench.Write);
+	if (SD_Bench.Baseline_Idle)
+		SD_Bench.Leftover_pm = (SD_Bench.Run_Idle * 1000) / SD_Bench.Baseline_Idle;
+	SD_Bench.Done = 1;
+}
+
+// Sector for next request of the phase
+static DWORD Bench_Sector(uint32_t n) {
+	static uint32_t seed = 12345;
+	
+	if (SD_BENCH_PATTERN == SD_BENCH_SEQUENTIAL)
+		return SD_BENCH_START + (n * SD_BENCH_BLOCKS) % SD_BENCH_SPAN;
+	seed = seed * 1103515245 + 12345; // LCG, same sequence every run
+	return SD_BENCH_START + ((seed >> 8) % (SD_BENCH_SPAN / SD_BENCH_BLOCKS)) * SD_BENCH_BLOCKS;
+}
+
+static int Bench_Is_Write(int phase_write) {
+	static uint32_t seed = 54321;
+	
+	if (SD_BENCH_PATTERN != SD_BENCH_MIXED)
+		return phase_write;
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 8) % 100) < SD_BENCH_WRITE_PCT;
+}
+
+// One request of SD_BENCH_BLOCKS sectors, returns latency in us
+static SDRESULTS Bench_Request(int is_write, DWORD sector, uint32_t * us) {
+	uint32_t start;
+	SDRESULTS res;
+	
+	start = osKernelGetSysTimerCount();
+	if (is_write)
+		res = SD_Shared_Write_Multi(bench_dev, bench_buffer, sector, SD_BENCH_BLOCKS);
+	else
+		res = SD_Shared_Read_Multi(bench_dev, bench_buffer, sector, SD_BENCH_BLOCKS);
+	*us = (osKernelGetSysTimerCount() - start)/(osKernelGetSysTimerFreq()/1000000);
+	return res;
+}
+
+void Thread_Bench_SD(void * arg) {
+	uint32_t n, us, start_tick, idle_start;
+	int phase_write, is_write;
+	SDRESULTS res;
+	
+	(void) arg;
+	CPU_Util_Calibrate(); // Card idle, nothing else running
+	SD_Bench.Baseline_Idle = CPU_Util_Idle_Reference() / CPU_UTIL_WINDOW_MS;
+	res = SD_Shared_Init_Card(bench_dev);
+	if (res == SD_OK) {
+		Control_RGB_LEDs(0, 1, 1); // Cyan: initialized OK
+		start_tick = osKernelGetTickCount();
+		idle_start = CPU_Idle_Count;
+		for (phase_write = 0; (phase_write < 2) && (res == SD_OK); phase_write++) {
+			for (n = 0; (n < SD_BENCH_REQUESTS) && (res == SD_OK); n++) {
+				is_write = Bench_Is_Write(phase_write);
+				if (is_write)
+					Control_RGB_LEDs(1, 0, 1); // Magenta: writing
+				else
+					Control_RGB_LEDs(0, 0, 1); // Blue: reading
+				res = Bench_Request(is_write, Bench_Sector(n), &us);
+				if (res == SD_OK)
+					SD_Bench_Sample(is_write ? &SD_Bench.Write : &SD_Bench.Read, 
+						SD_BENCH_BLOCKS * SD_BLK_SIZE, us);
+			}
+			if (SD_BENCH_PATTERN == SD_BENCH_MIXED)
+				break; // One phase covers both request types
+		}
+		SD_Bench.Elapsed_ms = (osKernelGetTickCount() - start_tick)*1000/osKernelGetTickFreq();
+		if (SD_Bench.Elapsed_ms)
+			SD_Bench.Run_Idle = (CPU_Idle_Count - idle_start) / SD_Bench.Elapsed_ms;
+	}
+	SD_Bench.Error = res;
+	SD_Bench_Finish();
+	if (res == SD_OK)
+		Control_RGB_LEDs(1, 1, 1); // White: benchmark finished
+	else
+		Control_RGB_LEDs(1, 0, 0);
+#if USE_PERF_RUN
+	Perf_Run_Report();
+#endif
+	osThreadExit();
+}
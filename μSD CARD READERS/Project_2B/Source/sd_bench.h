@@ -0,0 +1,50 @@
+#ifndef SD_BENCH_H
+#define SD_BENCH_H
+#include <integer.h>
+#include "sd_io.h"
+
+// Access patterns
+#define SD_BENCH_SEQUENTIAL (0)
+#define SD_BENCH_RANDOM     (1)
+#define SD_BENCH_MIXED      (2)   // Random sectors, SD_BENCH_WRITE_PCT of requests write
+
+// Benchmark configuration. Sectors from SD_BENCH_START to SD_BENCH_START+SD_BENCH_SPAN-1 are overwritten!
+#define SD_BENCH_PATTERN     SD_BENCH_SEQUENTIAL
+#define SD_BENCH_BLOCKS      (4)     // Sectors per request (SD_Shared_Read_Multi/_Write_Multi)
+#define SD_BENCH_REQUESTS    (256)   // Requests per phase
+#define SD_BENCH_WRITE_PCT   (30)
+#define SD_BENCH_START       (0x10000UL)
+#define SD_BENCH_SPAN        (0x1000UL)
+#define SD_BENCH_HIST_BINS   (16)    // Bin b counts latencies of 2^b..2^(b+1)-1 us
+
+typedef struct {
+	uint32_t Count;      // Requests
+	uint32_t Bytes;
+	uint32_t Total_us;   // Time spent in requests of this type
+	uint32_t Min_us, Mean_us, Max_us;
+	uint32_t KBps;       // Bytes/1024 per second of Total_us
+	uint32_t Hist[SD_BENCH_HIST_BINS];
+} SD_BENCH_STATS_T;
+
+// Read with debugger once Done is 1
+typedef struct {
+	SD_BENCH_STATS_T Read, Write;
+	uint32_t Elapsed_ms;     // Wall time of read and write phases
+	uint32_t Baseline_Idle;  // Idle thread passes per ms with card idle
+	uint32_t Run_Idle;       // Idle thread passes per ms during the phases
+	uint32_t Leftover_pm;    // Run_Idle/Baseline_Idle in 0.1% steps
+	SDRESULTS Error;
+	int Done;
+} SD_BENCH_T;
+
+extern volatile SD_BENCH_T SD_Bench;
+
+// Record one request of bytes taking us
+void SD_Bench_Sample(volatile SD_BENCH_STATS_T * s, uint32_t bytes, uint32_t us);
+// Compute means, throughput and leftover CPU from accumulated values
+void SD_Bench_Finish(void);
+
+// Runs once in place of Thread_Test_SD; must be the only thread using the card
+void Thread_Bench_SD(void * arg);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef SD_CONFIG_H
+#define SD_CONFIG_H
+
+/*
+ Build of the shared ulibSD driver (..\..\ulibSD) for this project: each
+ SD call blocks its RTX thread until done, the SPI1 interrupt moves the
+ 512 byte data blocks and the thread sleeps meanwhile. The SPI timer
+ runs on the kernel tick, LPTMR0 wakes the tickless idle (tickless.h).
+*/
+#define SD_IO_MODEL SD_IO_RTX_IRQ
+#define SPI_TIMER   SPI_TIMER_RTX
+#define SPI_DMA_CH  SPI_DMA_FIXED   // Only used by SD_IO_RTX_DMA
+#define SPI_IRQ_PRIO 2
+
+#define SD_IO_WRITE
+#define SD_IO_WRITE_PRE_ERASE   // Send ACMD23 before multi-block writes
+#define SD_IO_DEFERRED_BUSY     // Finish write when data is accepted, wait for busy before next command
+#define SD_IO_SPEED_STEP_DOWN   // Lower the SPI clock after a data token, reject or CRC error
+// #define SD_IO_CRC            // CMD59 on: send real CRC7/CRC16, check CRC16 of read blocks
+#define SD_IO_FAST_INIT         // Spec power-up delay, sleep with backoff between ACMD41 polls
+#define SD_IO_POWERUP_DELAY_MS  1       // Spec minimum is 1 ms
+#define SD_IO_BACKOFF_MAX_MS    16      // Longest sleep between ACMD41 polls
+#define SD_IO_INIT_TIME         // Phase durations of SD_Init in dev->init_time
+
+// #define SD_IO_DBG_COUNT
+
+#endif // SD_CONFIG_H
@@ -0,0 +1,102 @@
+#include "sd_server.h"
+#include "sd_shared.h"
+#include "rtx_os.h"
+
+osMessageQueueId_t SDS_Queue;
+
+static osRtxMessageQueue_t SDS_Queue_cb;
+static uint32_t SDS_Queue_mem[osRtxMessageQueueMemSize(SDS_QUEUE_LEN, sizeof(SDS_TD_T *))/4];
+const osMessageQueueAttr_t SDS_Queue_attr = {
+	.name = "SDS_Queue",
+	.cb_mem = &SDS_Queue_cb, .cb_size = sizeof(SDS_Queue_cb),
+	.mq_mem = SDS_Queue_mem, .mq_size = sizeof(SDS_Queue_mem)
+};
+
+static osRtxThread_t SDS_tcb;
+static uint64_t SDS_stk[SDS_STK_SZ/8];
+const osThreadAttr_t SDS_attr = {
+	.name = "SD_Server",
+	.cb_mem = &SDS_tcb, .cb_size = sizeof(SDS_tcb),
+	.stack_mem = SDS_stk, .stack_size = sizeof(SDS_stk),
+	.priority = SDS_THREAD_PRIO
+};
+
+static void Thread_SD_Server(void * arg) {
+	SDS_TD_T * t;
+	SDRESULTS res;
+
+	while (1) {
+		if (osMessageQueueGet(SDS_Queue, &t, NULL, osWaitForever) != osOK)
+			continue;
+		t->Status = STAT_BUSY;
+		switch (t->Request) {
+			case SDS_INIT:
+				res = SD_Shared_Init_Card(t->Device);
+				break;
+			case SDS_READ:
+				res = SD_Shared_Read(t->Device, t->Data, t->Sector, t->Ofs, t->Count);
+				break;
+			case SDS_WRITE:
+				res = SD_Shared_Write(t->Device, t->Data, t->Sector);
+				break;
+			case SDS_READ_MULTI:
+				res = SD_Shared_Read_Multi(t->Device, t->Data, t->Sector, t->Count);
+				break;
+			case SDS_WRITE_MULTI:
+				res = SD_Shared_Write_Multi(t->Device, t->Data, t->Sector, t->Count);
+				break;
+			case SDS_ERASE:
+				res = SD_Shared_Erase(t->Device, t->Sector, t->End_Sector);
+				break;
+			default:
+				res = SD_PARERR;
+				break;
+		}
+		t->ErrorCode = res;
+		t->Status = STAT_IDLE; // Before the flags, so the client sees it done when it wakes
+		if (t->Flags != 0)
+			osThreadFlagsSet(t->Thread, t->Flags);
+	}
+}
+
+void SDS_Init(void) {
+	SDS_Queue = osMessageQueueNew(SDS_QUEUE_LEN, sizeof(SDS_TD_T *), &SDS_Queue_attr);
+	osThreadNew(Thread_SD_Server, NULL, &SDS_attr);
+}
+
+static int SDS_Put(SDS_TD_T * t, uint8_t prio, uint32_t timeout) {
+	if (t->Status != STAT_IDLE)
+		return -1; // Still in flight
+	t->Thread = osThreadGetId();
+	t->Status = STAT_QUEUED;
+	if (osMessageQueuePut(SDS_Queue, &t, prio, timeout) != osOK) {
+		t->Status = STAT_IDLE;
+		return -1;
+	}
+	return 0;
+}
+
+int SDS_Submit(SDS_TD_T * t, uint32_t timeout) {
+	return SDS_Put(t, 0, timeout);
+}
+
+int SDS_Submit_Urgent(SDS_TD_T * t, uint32_t timeout) {
+	return SDS_Put(t, 1, timeout); // RTX takes higher message priorities first
+}
+
+SDRESULTS SDS_Wait(SDS_TD_T * t, uint32_t timeout) {
+	uint32_t start = osKernelGetTickCount(), waited;
+
+	while (t->Status != STAT_IDLE) {
+		waited = osKernelGetTickCount() - start;
+		if ((timeout != osWaitForever) && (waited >= timeout))
+			return SD_BUSY;
+		if (t->Flags != 0)
+			osThreadFlagsWait(t->Flags, osFlagsWaitAny, (timeout == osWaitForever) ? osWaitForever : timeout - waited);
+		else
+			osDelay(1);
+	}
+	if (t->Flags != 0)
+		osThreadFlagsClear(t->Flags); // Set if it finished before the wait
+	return t->ErrorCode;
+}
@@ -0,0 +1,64 @@
+#ifndef SD_SERVER_H
+#define SD_SERVER_H
+
+#include "cmsis_os2.h"
+#include "sd_io.h"
+
+/*
+ Asynchronous SD requests, the RTX counterpart of Project_2A's SD server.
+ A client fills in a transaction descriptor and submits it; the pointer
+ goes through SDS_Queue to Thread_SD_Server, which runs it with the
+ SD_Shared_* calls (so it takes turns with their direct callers) and then
+ sets the client's thread flags. The client keeps computing meanwhile and
+ collects the result with SDS_Wait, or checks SDS_Done.
+
+ 1. The client owns the SDS_TD_T (zeroed, or Status STAT_IDLE, before it
+    is first used) and its Data buffer; neither may be touched from
+    SDS_Submit until the transaction is done.
+ 2. It sets Request, Device, Data, Sector and, by request:
+    SDS_READ: Ofs and Count bytes within the sector (whole: 0, SD_BLK_SIZE),
+    SDS_READ_MULTI, SDS_WRITE_MULTI: Count sectors (Data holds Count*512 bytes),
+    SDS_ERASE: End_Sector.
+    Flags are the thread flags to set on completion, 0 for none.
+ 3. SDS_Submit records the calling thread and queues the descriptor, -1
+    if the queue stays full for timeout ticks.
+ 4. Status goes STAT_QUEUED, STAT_BUSY, then STAT_IDLE with ErrorCode set,
+    before the flags. Descriptors run in submission order, except that
+    SDS_Submit_Urgent puts one before every queued SDS_Submit.
+*/
+
+#define SDS_QUEUE_LEN (8)
+#define SDS_THREAD_PRIO (osPriorityAboveNormal) // Sleeps through data phases, command bytes are polled
+#define SDS_STK_SZ (256)       // As OS_STACK_SIZE
+#define SDS_FLAG_DONE (0x0001) // Suggested completion flag
+
+typedef enum {SDS_INIT, SDS_READ, SDS_WRITE, SDS_READ_MULTI, SDS_WRITE_MULTI, SDS_ERASE} SDS_REQ_T;
+typedef enum {STAT_IDLE, STAT_BUSY, STAT_QUEUED} SDS_STATUS_T;
+
+typedef struct { // SD Server Transaction Data
+	SDS_REQ_T Request;
+	SD_DEV * Device;
+	void * Data;
+	DWORD Sector;
+	WORD Ofs;            // SDS_READ: first byte in sector
+	WORD Count;          // SDS_READ: bytes, multi: sectors
+	DWORD End_Sector;    // SDS_ERASE: last sector
+	uint32_t Flags;      // Thread flags set when done
+	osThreadId_t Thread; // Submitting thread, set by SDS_Submit
+	volatile SDS_STATUS_T Status;
+	volatile SDRESULTS ErrorCode;
+} SDS_TD_T;
+
+extern osMessageQueueId_t SDS_Queue;
+
+void SDS_Init(void);  // After SD_Shared_Init, before clients run
+int SDS_Submit(SDS_TD_T * t, uint32_t timeout);        // 0, or -1 if not queued
+int SDS_Submit_Urgent(SDS_TD_T * t, uint32_t timeout); // Ahead of the others
+// Block until t is done or timeout ticks pass. ErrorCode, or SD_BUSY on timeout
+SDRESULTS SDS_Wait(SDS_TD_T * t, uint32_t timeout);
+
+static __inline int SDS_Done(const SDS_TD_T * t) {
+	return t->Status == STAT_IDLE;
+}
+
+#endif // SD_SERVER_H
@@ -0,0 +1,81 @@
+#include "sd_shared.h"
+#include "rtx_os.h"
+
+osMutexId_t SD_mutex;
+static osRtxMutex_t SD_mutex_cb;
+static SD_CTX SD_ctx;   // Driver state of the call holding SD_mutex
+
+const osMutexAttr_t SD_mutex_attr = {
+  "SD_mutex",      // human readable mutex name
+  osMutexPrioInherit,   // attr_bits
+  &SD_mutex_cb,         // memory for control block
+  sizeof(SD_mutex_cb)   // size of provided memory for control block
+};
+
+void SD_Shared_Init(void) {
+	SD_mutex = osMutexNew(&SD_mutex_attr);
+}
+
+SDRESULTS SD_Shared_Init_Card(SD_DEV *dev) {
+	SDRESULTS res;
+	
+	osMutexAcquire(SD_mutex, osWaitForever);
+	res = SD_Init(dev, &SD_ctx);
+	osMutexRelease(SD_mutex);
+	return res;
+}
+
+SDRESULTS SD_Shared_Read(SD_DEV *dev, void *dat, DWORD sector, WORD ofs, WORD cnt) {
+	SDRESULTS res;
+	
+	osMutexAcquire(SD_mutex, osWaitForever);
+	res = SD_Read(dev, &SD_ctx, dat, sector, ofs, cnt);
+	osMutexRelease(SD_mutex);
+	return res;
+}
+
+SDRESULTS SD_Shared_Write(SD_DEV *dev, void *dat, DWORD sector) {
+	SDRESULTS res;
+	
+	osMutexAcquire(SD_mutex, osWaitForever);
+	res = SD_Write(dev, &SD_ctx, dat, sector);
+	osMutexRelease(SD_mutex);
+	return res;
+}
+
+SDRESULTS SD_Shared_Read_Multi(SD_DEV *dev, void *dat, DWORD sector, WORD count) {
+	SDRESULTS res = SD_OK;
+	WORD n, chunk;
+	
+	// One multi-block transaction per mutex hold
+	for (n = 0; (n < count) && (res == SD_OK); n += chunk) {
+		chunk = (count - n < SD_SHARED_CHUNK) ? count - n : SD_SHARED_CHUNK;
+		osMutexAcquire(SD_mutex, osWaitForever);
+		res = SD_Read_Multi(dev, &SD_ctx, (BYTE *) dat + n*SD_BLK_SIZE, sector + n, chunk);
+		osMutexRelease(SD_mutex); // Waiting higher priority thread runs now
+	}
+	return res;
+}
+
+SDRESULTS SD_Shared_Write_Multi(SD_DEV *dev, void *dat, DWORD sector, WORD count) {
+	SDRESULTS res = SD_OK;
+	WORD n, chunk;
+	
+	// One multi-block transaction per mutex hold
+	for (n = 0; (n < count) && (res == SD_OK); n += chunk) {
+		chunk = (count - n < SD_SHARED_CHUNK) ? count - n : SD_SHARED_CHUNK;
+		osMutexAcquire(SD_mutex, osWaitForever);
+		res = SD_Write_Multi(dev, &SD_ctx, (BYTE *) dat + n*SD_BLK_SIZE, sector + n, chunk);
+		osMutexRelease(SD_mutex); // Waiting higher priority thread runs now
+	}
+	return res;
+}
+
+SDRESULTS SD_Shared_Erase(SD_DEV *dev, DWORD start, DWORD end) {
+	SDRESULTS res;
+	
+	osMutexAcquire(SD_mutex, osWaitForever);
+	res = SD_Erase(dev, &SD_ctx, start, end);
+	osMutexRelease(SD_mutex);
+	return res;
+}
@@ -0,0 +1,35 @@
+#ifndef SD_SHARED_H
+#define SD_SHARED_H
+
+#include "cmsis_os2.h"
+#include "sd_io.h"
+
+/*
+ Thread-safe access to the SD driver for any number of client threads.
+ Each call runs in the calling thread, under SD_mutex (priority inheritance),
+ so the card is served in thread priority order. Multi-sector calls release
+ the mutex every SD_SHARED_CHUNK sectors, letting a higher priority thread
+ in between instead of waiting for a long background transfer. Each chunk
+ is one CMD18/CMD25 transaction (with ACMD23 before a write), so larger
+ chunks cost less per sector but keep a waiting thread out longer: about
+ 0.45 ms per sector at a 12 MHz SPI clock, so roughly 4 ms plus the card's
+ access time for 8 sectors. A chunk of 1 turns every call into single
+ block CMD17/CMD24 requests.
+*/
+
+#ifndef SD_SHARED_CHUNK
+#define SD_SHARED_CHUNK (8)   // Sectors per mutex hold in multi-sector calls
+#endif
+
+extern osMutexId_t SD_mutex;
+
+void SD_Shared_Init(void);    // Call after osKernelInitialize, before clients run
+
+SDRESULTS SD_Shared_Init_Card(SD_DEV *dev);
+SDRESULTS SD_Shared_Read(SD_DEV *dev, void *dat, DWORD sector, WORD ofs, WORD cnt);
+SDRESULTS SD_Shared_Write(SD_DEV *dev, void *dat, DWORD sector);
+SDRESULTS SD_Shared_Read_Multi(SD_DEV *dev, void *dat, DWORD sector, WORD count);
+SDRESULTS SD_Shared_Write_Multi(SD_DEV *dev, void *dat, DWORD sector, WORD count);
+SDRESULTS SD_Shared_Erase(SD_DEV *dev, DWORD start, DWORD end);
+
+#endif // SD_SHARED_H
@@ -0,0 +1,115 @@
+#include <MKL25Z4.h>
+#include <cmsis_os2.h>
+#include <rtx_os.h>
+#include "tickless.h"
+#include "cpu_util.h"
+
+volatile TICKLESS_STATS_T Tickless_Stats;
+
+static uint8_t Tickless_On;
+static uint32_t Behind_us; // Real time the kernel hasn't been told about, under a tick
+static volatile uint8_t Fired; // LPTMR0 reached the compare, set by its ISR
+
+void Tickless_Init(void) {
+	SIM->SCGC5 |= SIM_SCGC5_LPTMR_MASK;
+	LPTMR0->CSR = 0;
+	// OSCERCLK/8: 1 us per count. Keep OSCERCLK running in Stop mode too
+	OSC0->CR |= OSC_CR_ERCLKEN_MASK | OSC_CR_EREFSTEN_MASK;
+	LPTMR0->PSR = LPTMR_PSR_PCS(3) | LPTMR_PSR_PRESCALE(2);
+	// Normal Stop: the AWIC wakes the core on the LPTMR0 interrupt. Its
+	// LLWU input is on too, in case STOPM is ever set to LLS
+	SMC->PMCTRL = (SMC->PMCTRL & ~SMC_PMCTRL_STOPM_MASK) | SMC_PMCTRL_STOPM(0);
+	LLWU->ME |= LLWU_ME_WUME0_MASK;
+	NVIC_SetPriority(LPTMR0_IRQn, 3);
+	NVIC_ClearPendingIRQ(LPTMR0_IRQn);
+	NVIC_EnableIRQ(LPTMR0_IRQn);
+	Tickless_On = 1;
+}
+
+// Only here to end the WFI, Tickless_Idle does the rest
+void LPTMR0_IRQHandler(void) {
+	LPTMR0->CSR |= LPTMR_CSR_TCF_MASK; // Write 1 to clear, TEN and TIE stay set
+	Fired = 1;
+}
+
+// Stop mode from PEE leaves the MCG in PBE: wait for the PLL, switch back to it
+static void Tickless_Restore_Clock(void) {
+	if ((MCG->S & MCG_S_CLKST_MASK) == MCG_S_CLKST(3))
+		return;
+	while (!(MCG->S & MCG_S_LOCK0_MASK))
+		;
+	MCG->C1 &= ~MCG_C1_CLKS_MASK;
+	while ((MCG->S & MCG_S_CLKST_MASK) != MCG_S_CLKST(3))
+		;
+}
+
+static uint32_t LPTMR_Count(void) {
+	LPTMR0->CNR = 0; // Write latches the counter for reading
+	return LPTMR0->CNR;
+}
+
+void Tickless_Idle(void) {
+	uint32_t ticks, done_us, sleep_us, slept_us, late_us, n;
+	int stop;
+
+	if (!Tickless_On)
+		return;
+	ticks = osKernelSuspend(); // SysTick is off from here
+	if (ticks < TICKLESS_MIN_TICKS) {
+		osKernelResume(0);
+		return;
+	}
+	if (ticks > TICKLESS_MAX_TICKS)
+		ticks = TICKLESS_MAX_TICKS;
+	// Part of the current tick already counted by SysTick, plus what the kernel is behind
+	done_us = (SysTick->LOAD - SysTick->VAL)/(SystemCoreClock/1000000) + Behind_us;
+	if (done_us >= 1000*ticks) { // Can't happen with ticks >= 2, but don't underflow
+		osKernelResume(0);
+		return;
+	}
+	sleep_us = 1000*ticks - done_us;
+
+	LPTMR0->CSR = 0;
+	LPTMR0->CMR = sleep_us - 1; // TCF sets on the count after CMR
+	Fired = 0;
+	LPTMR0->CSR = LPTMR_CSR_TIE_MASK | LPTMR_CSR_TEN_MASK;
+	stop = TICKLESS_STOP && TICKLESS_STOP_OK();
+	if (stop)
+		SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+	else
+		SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+
+	/* RTX defers a thread switch an ISR asks for while suspended to
+	kernel.pendSV, so its handlers run here without losing the wake-up. */
+	__disable_irq();
+	while (!Fired && !(LPTMR0->CSR & LPTMR_CSR_TCF_MASK) && !osRtxInfo.kernel.pendSV) {
+		__DSB();
+		__WFI(); // Any pending interrupt ends it, masked or not
+		if (stop)
+			Tickless_Restore_Clock();
+		__enable_irq();
+		__disable_irq();
+	}
+	if (Fired || (LPTMR0->CSR & LPTMR_CSR_TCF_MASK)) {
+		late_us = LPTMR_Count(); // Counter restarted at the compare
+		slept_us = sleep_us + late_us;
+		if (late_us > Tickless_Stats.Max_Late_us)
+			Tickless_Stats.Max_Late_us = late_us;
+	} else {
+		slept_us = LPTMR_Count();
+		Tickless_Stats.Early++;
+	}
+	LPTMR0->CSR = 0; // Clears TCF too
+	NVIC_ClearPendingIRQ(LPTMR0_IRQn); // Compare hit after the loop, the ISR needn't run
+	SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+	SysTick->VAL = 0; // Ticks restart from a boundary, the rest goes in Behind_us
+	__enable_irq();
+
+	slept_us += done_us;
+	n = slept_us/1000;
+	Behind_us = slept_us - 1000*n;
+	Tickless_Stats.Sleeps++;
+	Tickless_Stats.Slept_ms += n;
+	osKernelResume(n);
+	CPU_Util_Slept(slept_us - done_us);
+}
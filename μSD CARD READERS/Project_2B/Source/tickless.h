@@ -0,0 +1,47 @@
+#ifndef TICKLESS_H
+#define TICKLESS_H
+
+#include <stdint.h>
+#include "spi_io.h"
+
+/*
+ Tickless idle. When every thread is waiting, the idle thread suspends
+ the kernel (SysTick off), sets LPTMR0 to fire when the next delay or
+ timer is due, and sleeps. It wakes early if an interrupt readies a
+ thread, then hands the ticks slept to osKernelResume. The LPTMR0
+ interrupt ends a sleep nothing else cuts short. LPTMR0 counts
+ microseconds from the 8 MHz crystal (OSCERCLK/8), so at most
+ TICKLESS_MAX_TICKS per sleep. The part of a tick left over is carried
+ into the next sleep's wake time, so delays keep their phase.
+
+ This project sleeps in Stop mode unless an SPI1 data phase is under
+ way (it needs the bus clock); then in Wait mode. Stop turns the PLL off,
+ so the wake-up waits for it to lock again before the interrupt that
+ ended the sleep runs (Tickless_Stats.Max_Late_us). LPTMR0 belongs to
+ tickless idle, the SD driver times its waits on the kernel tick
+ (SPI_TIMER_RTX in sd_config.h).
+
+ Sleep time is credited to the CPU utilization meter as the idle passes
+ it replaced, and there is no sleep until the meter has an idle
+ reference (see cpu_util.h).
+*/
+
+#define USE_TICKLESS_IDLE (1)
+#define TICKLESS_STOP (1)         // 0: always Wait mode
+#define TICKLESS_STOP_OK() (!SPI_Block_Status()) // Stop allowed now, with TICKLESS_STOP
+#define TICKLESS_MIN_TICKS (2)    // Shorter waits spin, sleeping costs more than it saves
+#define TICKLESS_MAX_TICKS (65)   // 16 bit compare at 1 us
+
+typedef struct {
+	uint32_t Sleeps;
+	uint32_t Early;        // Woken by an interrupt that readied a thread
+	uint32_t Slept_ms;     // Total, like the ticks handed to the kernel
+	uint32_t Max_Late_us;  // Longest from the LPTMR deadline to resume
+} TICKLESS_STATS_T;
+
+extern volatile TICKLESS_STATS_T Tickless_Stats;
+
+void Tickless_Init(void);  // Before osKernelStart. Takes LPTMR0
+void Tickless_Idle(void);  // Idle thread only
+
+#endif // TICKLESS_H